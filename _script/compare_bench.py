@@ -0,0 +1,94 @@
+#!/usr/bin/env python3
+"""Compares two web_bench results and fails on regressions.
+
+Either file may hold Google Benchmark JSON (web_bench --benchmark_format=json)
+or the JSON lines printed by `web_bench load`.
+
+    _script/compare_bench.py baseline.json current.json [--threshold 0.10]
+
+Exits 1 when any benchmark got slower than the threshold allows, or is
+missing from the current run: a benchmark that stopped running would
+otherwise hide whatever regression it was there to catch.
+"""
+
+import argparse
+import json
+import sys
+
+
+def load(path):
+    """Returns {name: (value, higher_is_better)}."""
+    with open(path) as f:
+        text = f.read()
+
+    results = {}
+
+    try:
+        documents = [json.loads(text)]
+    except json.JSONDecodeError:
+        documents = [json.loads(line) for line in text.splitlines() if line.strip()]
+
+    for doc in documents:
+        if "benchmarks" in doc:
+            for bench in doc["benchmarks"]:
+                if bench.get("run_type", "iteration") != "iteration":
+                    continue
+                results[bench["name"]] = (bench["cpu_time"], False)
+        elif doc.get("benchmark") == "load":
+            name = "load{}/c{}/p{}{}".format(
+                doc["path"], doc["connections"], doc["pipeline"],
+                "" if doc["keep_alive"] else "/close")
+            results[name + " req/s"] = (doc["requests_per_second"], True)
+            results[name + " p99us"] = (doc["latency_us"]["p99"], False)
+
+    return results
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("baseline")
+    parser.add_argument("current")
+    parser.add_argument("--threshold", type=float, default=0.10,
+                        help="allowed relative slowdown (default 0.10)")
+    args = parser.parse_args()
+
+    baseline = load(args.baseline)
+    current = load(args.current)
+
+    regressions = 0
+
+    for name in sorted(baseline.keys() & current.keys()):
+        before, higher_is_better = baseline[name]
+        after, _ = current[name]
+
+        if before == 0:
+            continue
+
+        change = (after - before) / before
+        worse = -change if higher_is_better else change
+        status = "REGRESSION" if worse > args.threshold else "ok"
+
+        if worse > args.threshold:
+            regressions += 1
+
+        print("{:<48} {:>14.2f} {:>14.2f} {:>+8.1%}  {}".format(name, before, after, change, status))
+
+    missing = sorted(baseline.keys() - current.keys())
+
+    for name in missing:
+        print("{:<48} missing from {}".format(name, args.current))
+
+    if regressions:
+        print("{} regression(s) beyond {:.0%}".format(regressions, args.threshold))
+
+    if missing:
+        print("{} benchmark(s) missing from {}".format(len(missing), args.current))
+
+    if regressions or missing:
+        return 1
+
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,388 @@
+#include "load.hh"
+#include "quiet.hh"
+
+#include "web/server.hh"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include <strings.h>
+
+using namespace bench;
+
+namespace {
+    using Clock = std::chrono::steady_clock;
+
+    struct Control {
+        std::atomic<bool> recording = false;
+        std::atomic<bool> stopping = false;
+    };
+
+    // One per client thread, so recording needs no synchronization
+    struct Recorder {
+        std::vector<std::uint32_t> latencies;
+        std::uint64_t requests = 0;
+        std::uint64_t errors = 0;
+    };
+
+    // Sends `pipeline` requests at a time and waits for all of their
+    // responses before sending the next batch
+    class LoadConnection : public std::enable_shared_from_this<LoadConnection> {
+    public:
+        LoadConnection(IOContext& ioc, TcpEndpoint endpoint, const LoadOptions& options, const std::string& batch,
+                       Control& control, Recorder& recorder)
+            : _socket(ioc), _endpoint(endpoint), _options(options), _batch(batch),
+              _control(control), _recorder(recorder) { }
+
+        void start() { connect(); }
+
+    private:
+        void connect() {
+            auto self(shared_from_this());
+
+            boost::system::error_code ec;
+            _socket.close(ec);
+            _input.clear();
+
+            _socket.async_connect(_endpoint, [this, self](std::error_code ec) {
+                if(ec) {
+                    fail();
+                    return;
+                }
+
+                _socket.set_option(boost::asio::ip::tcp::no_delay(true));
+                send();
+            });
+        }
+
+        void send() {
+            if(_control.stopping) return;
+
+            auto self(shared_from_this());
+
+            _sent = Clock::now();
+            _outstanding = _options.pipeline;
+
+            boost::asio::async_write(_socket, boost::asio::buffer(_batch), [this, self](std::error_code ec, std::size_t) {
+                if(ec) {
+                    fail();
+                    return;
+                }
+
+                read();
+            });
+        }
+
+        void read() {
+            auto self(shared_from_this());
+
+            auto used = _input.size();
+            _input.resize(used + READ_SIZE);
+
+            _socket.async_read_some(boost::asio::buffer(_input.data() + used, READ_SIZE), [this, self, used](std::error_code ec, std::size_t length) {
+                _input.resize(used + length);
+
+                if(ec) {
+                    fail();
+                    return;
+                }
+
+                if(!consumeResponses()) {
+                    fail();
+                    return;
+                }
+
+                if(_outstanding > 0) {
+                    read();
+                }
+                else if(_options.keepAlive) {
+                    send();
+                }
+                else if(!_control.stopping) {
+                    connect();
+                }
+            });
+        }
+
+        // Removes complete responses from the input; false on garbage
+        bool consumeResponses() {
+            std::size_t offset = 0;
+            auto input = std::string_view(_input);
+
+            while(_outstanding > 0) {
+                auto headEnd = input.find("\r\n\r\n", offset);
+                if(headEnd == std::string_view::npos) break;
+
+                auto head = input.substr(offset, headEnd - offset);
+                if(head.size() < 12 || head.substr(0, 5) != "HTTP/") return false;
+
+                auto status = std::atoi(std::string(head.substr(9, 3)).c_str());
+                auto length = contentLength(head);
+
+                if(!length.has_value()) return false;
+
+                auto end = headEnd + 4 + *length;
+                if(end > input.size()) break;
+
+                offset = end;
+                --_outstanding;
+
+                record(status);
+            }
+
+            _input.erase(0, offset);
+            return true;
+        }
+
+        static std::optional<std::size_t> contentLength(std::string_view head) {
+            static constexpr std::string_view NAME = "\r\ncontent-length:";
+
+            for(std::size_t at = head.find("\r\n"); at != std::string_view::npos; at = head.find("\r\n", at + 2)) {
+                if(head.size() - at > NAME.size() && ::strncasecmp(head.data() + at, NAME.data(), NAME.size()) == 0) {
+                    return static_cast<std::size_t>(std::strtoull(head.data() + at + NAME.size(), nullptr, 10));
+                }
+            }
+
+            return std::nullopt;
+        }
+
+        void record(int status) {
+            if(!_control.recording || _control.stopping) return;
+
+            if(status >= 400) {
+                ++_recorder.errors;
+                return;
+            }
+
+            auto latency = std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - _sent).count();
+
+            ++_recorder.requests;
+            _recorder.latencies.push_back(static_cast<std::uint32_t>(latency));
+        }
+
+        void fail() {
+            if(_control.stopping) return;
+            if(_control.recording) ++_recorder.errors;
+
+            // Back off briefly instead of spinning on a refused connection
+            auto self(shared_from_this());
+            auto timer = std::make_shared<boost::asio::steady_timer>(_socket.get_executor(), std::chrono::milliseconds(10));
+
+            timer->async_wait([this, self, timer](std::error_code) { connect(); });
+        }
+
+        static constexpr std::size_t READ_SIZE = 64 * 1024;
+
+        TcpSocket _socket;
+        TcpEndpoint _endpoint;
+        const LoadOptions& _options;
+        const std::string& _batch;
+        Control& _control;
+        Recorder& _recorder;
+
+        std::string _input;
+        std::size_t _outstanding = 0;
+        Clock::time_point _sent;
+    };
+
+    std::uint64_t percentile(std::vector<std::uint32_t>& values, double fraction) {
+        if(values.empty()) return 0;
+
+        auto index = static_cast<std::size_t>(fraction * static_cast<double>(values.size() - 1));
+        std::nth_element(values.begin(), values.begin() + static_cast<std::ptrdiff_t>(index), values.end());
+
+        return values[index];
+    }
+
+    // Routes of the in-process server, in the spirit of the usual
+    // plaintext/JSON framework benchmarks
+    void addRoutes(web::http::HttpServer& server, const LoadOptions& options) {
+        using namespace web::http;
+
+        server.get("/plaintext", [](const HttpRequest&) {
+            return HttpResponse::text("Hello, World!", StatusCode::OK);
+        });
+
+        server.get("/json", [](const HttpRequest&) {
+            return HttpResponse::json([](JsonWriter& json) {
+                json.beginObject().field("message", "Hello, World!").endObject();
+            }, StatusCode::OK);
+        });
+
+        // The same response out of the response cache
+        server.get("/cached", [](const HttpRequest&) {
+            return HttpResponse::json("{\"message\":\"Hello, World!\"}", StatusCode::OK);
+        });
+
+        server.cache("/cached");
+
+        // /proxy/plaintext and the like, forwarded back to this same server
+        ProxyOptions upstream;
+        upstream.targets = { { options.host, options.port } };
+
+        server.proxy("/proxy", upstream, true);
+    }
+}
+
+LoadResult bench::runLoad(const LoadOptions& options) {
+    using namespace web::http;
+
+    QuietOutput quiet;
+
+    IOContext serverContext;
+    std::unique_ptr<HttpServer> server;
+    std::thread serverThread;
+
+    if(!options.external) {
+        HttpServerConfig config{ 1, 0, 0, options.host, options.port };
+        config.threads = options.serverThreads;
+
+        server = std::make_unique<HttpServer>(serverContext, config);
+        addRoutes(*server, options);
+        server->start();
+
+        serverThread = std::thread([&serverContext]() { serverContext.run(); });
+    }
+
+    std::ostringstream request;
+    request << "GET " << options.path << " HTTP/1.1\r\n"
+            << "Host: " << options.host << ":" << options.port << "\r\n"
+            << "User-Agent: web_bench\r\n"
+            << "Accept: */*\r\n"
+            << "Connection: " << (options.keepAlive ? "keep-alive" : "close") << "\r\n\r\n";
+
+    std::string batch;
+    for(std::size_t i = 0; i < options.pipeline; ++i) batch += request.str();
+
+    auto endpoint = TcpEndpoint(boost::asio::ip::make_address(options.host), options.port);
+
+    Control control;
+    std::vector<std::unique_ptr<IOContext>> contexts;
+    std::vector<Recorder> recorders(options.clientThreads);
+    std::vector<std::thread> threads;
+
+    for(std::size_t t = 0; t < options.clientThreads; ++t) {
+        auto& context = *contexts.emplace_back(std::make_unique<IOContext>(1));
+
+        for(std::size_t c = t; c < options.connections; c += options.clientThreads) {
+            std::make_shared<LoadConnection>(context, endpoint, options, batch, control, recorders[t])->start();
+        }
+    }
+
+    for(auto& context : contexts) {
+        threads.emplace_back([&context]() {
+            auto work = boost::asio::make_work_guard(*context);
+            context->run();
+        });
+    }
+
+    std::this_thread::sleep_for(options.warmup);
+
+    auto start = Clock::now();
+    control.recording = true;
+
+    std::this_thread::sleep_for(options.duration);
+
+    control.stopping = true;
+    auto elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+
+    for(auto& context : contexts) context->stop();
+    for(auto& thread : threads) thread.join();
+
+    // Connections hold on to the contexts until they are destroyed
+    contexts.clear();
+
+    if(server) {
+        // stop() hands the main loop's shutdown to its thread; stopping
+        // the context after that has run
+        server->stop();
+        boost::asio::post(serverContext, [&serverContext]() { serverContext.stop(); });
+        serverThread.join();
+    }
+
+    LoadResult result;
+    result.seconds = elapsed;
+
+    std::vector<std::uint32_t> latencies;
+
+    for(auto& recorder : recorders) {
+        result.requests += recorder.requests;
+        result.errors   += recorder.errors;
+        latencies.insert(latencies.end(), recorder.latencies.begin(), recorder.latencies.end());
+    }
+
+    result.p50 = percentile(latencies, 0.50);
+    result.p90 = percentile(latencies, 0.90);
+    result.p99 = percentile(latencies, 0.99);
+    result.max = latencies.empty() ? 0 : *std::max_element(latencies.begin(), latencies.end());
+
+    return result;
+}
+
+std::string bench::toJson(const LoadOptions& options, const LoadResult& result) {
+    auto rate = result.seconds > 0 ? static_cast<double>(result.requests) / result.seconds : 0.0;
+
+    char buffer[1024];
+    std::snprintf(buffer, sizeof(buffer),
+        "{\"benchmark\":\"load\",\"path\":\"%s\",\"connections\":%zu,\"pipeline\":%zu,\"keep_alive\":%s,"
+        "\"client_threads\":%zu,\"server_threads\":%zu,\"seconds\":%.3f,\"requests\":%llu,\"errors\":%llu,"
+        "\"requests_per_second\":%.1f,\"latency_us\":{\"p50\":%llu,\"p90\":%llu,\"p99\":%llu,\"max\":%llu}}",
+        options.path.c_str(), options.connections, options.pipeline, options.keepAlive ? "true" : "false",
+        options.clientThreads, options.external ? 0 : options.serverThreads, result.seconds,
+        static_cast<unsigned long long>(result.requests), static_cast<unsigned long long>(result.errors), rate,
+        static_cast<unsigned long long>(result.p50), static_cast<unsigned long long>(result.p90),
+        static_cast<unsigned long long>(result.p99), static_cast<unsigned long long>(result.max));
+
+    return buffer;
+}
+
+int bench::loadMain(int argc, char* argv[]) {
+    LoadOptions options;
+
+    for(int i = 1; i < argc; ++i) {
+        auto arg = std::string_view(argv[i]);
+        auto equals = arg.find('=');
+        auto name = arg.substr(0, equals);
+        auto value = (equals == std::string_view::npos) ? std::string() : std::string(arg.substr(equals + 1));
+
+        auto number = [&value]() { return static_cast<std::size_t>(std::stoul(value)); };
+
+        if(name == "--host")                { options.host = value; }
+        else if(name == "--port")           { options.port = static_cast<std::uint16_t>(number()); }
+        else if(name == "--path")           { options.path = value; }
+        else if(name == "--external")       { options.external = true; }
+        else if(name == "--server-threads") { options.serverThreads = number(); }
+        else if(name == "--connections")    { options.connections = number(); }
+        else if(name == "--pipeline")       { options.pipeline = std::max<std::size_t>(1, number()); }
+        else if(name == "--no-keepalive")   { options.keepAlive = false; }
+        else if(name == "--client-threads") { options.clientThreads = std::max<std::size_t>(1, number()); }
+        else if(name == "--warmup")         { options.warmup = std::chrono::seconds(number()); }
+        else if(name == "--duration")       { options.duration = std::chrono::seconds(number()); }
+        else {
+            std::cerr << "usage: web_bench load [--host=H] [--port=P] [--path=/plaintext] [--external]\n"
+                      << "                      [--server-threads=N] [--connections=N] [--pipeline=N]\n"
+                      << "                      [--no-keepalive] [--client-threads=N] [--warmup=S] [--duration=S]\n";
+            return 2;
+        }
+    }
+
+    // Without keep-alive every request needs its own connection
+    if(!options.keepAlive) options.pipeline = 1;
+
+    auto result = runLoad(options);
+    auto rate = result.seconds > 0 ? static_cast<double>(result.requests) / result.seconds : 0.0;
+
+    std::cerr << options.path << ": " << static_cast<std::uint64_t>(rate) << " req/s, "
+              << result.errors << " errors, latency p50 " << result.p50 << "us p99 " << result.p99 << "us" << std::endl;
+
+    std::cout << toJson(options, result) << std::endl;
+    return 0;
+}
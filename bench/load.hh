@@ -0,0 +1,45 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+namespace bench {
+    struct LoadOptions {
+        // Target; an in-process HttpServer is started on this port unless
+        // `external` is set
+        std::string host = "127.0.0.1";
+        std::uint16_t port = 18180;
+        std::string path = "/plaintext";
+        bool external = false;
+        std::size_t serverThreads = 1;
+
+        std::size_t connections = 64;
+        std::size_t pipeline = 1;          // requests in flight per connection
+        bool keepAlive = true;             // otherwise one request per connection
+        std::size_t clientThreads = 1;
+
+        std::chrono::seconds warmup{ 1 };
+        std::chrono::seconds duration{ 5 };
+    };
+
+    struct LoadResult {
+        std::uint64_t requests = 0;
+        std::uint64_t errors = 0;
+        double seconds = 0;
+
+        // Microseconds from sending a batch to each of its responses
+        std::uint64_t p50 = 0;
+        std::uint64_t p90 = 0;
+        std::uint64_t p99 = 0;
+        std::uint64_t max = 0;
+    };
+
+    LoadResult runLoad(const LoadOptions& options);
+
+    // One JSON object, for _script/compare_bench.py
+    std::string toJson(const LoadOptions& options, const LoadResult& result);
+
+    // `web_bench load [options]`; returns the process exit code
+    int loadMain(int argc, char* argv[]);
+}
@@ -0,0 +1,30 @@
+#include "load.hh"
+
+#include <iostream>
+#include <string_view>
+
+#ifdef MURLY_HAVE_BENCHMARK
+#include <benchmark/benchmark.h>
+#endif
+
+// web_bench load [options]     loopback load generator, JSON on stdout
+// web_bench [--benchmark_*]    microbenchmarks, e.g. --benchmark_format=json
+auto main(int argc, char* argv[]) -> int {
+    if(argc > 1 && std::string_view(argv[1]) == "load") {
+        return bench::loadMain(argc - 1, argv + 1);
+    }
+
+#ifdef MURLY_HAVE_BENCHMARK
+    benchmark::Initialize(&argc, argv);
+
+    if(benchmark::ReportUnrecognizedArguments(argc, argv)) return 1;
+
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+
+    return 0;
+#else
+    std::cerr << "web_bench was built without Google Benchmark; only `web_bench load` is available" << std::endl;
+    return 1;
+#endif
+}
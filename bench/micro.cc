@@ -0,0 +1,380 @@
+#ifdef MURLY_HAVE_BENCHMARK
+
+#include "quiet.hh"
+
+#include "web/admission.hh"
+#include "web/json.hh"
+#include "web/metrics.hh"
+#include "web/mime.hh"
+#include "web/multipart.hh"
+#include "web/ratelimit.hh"
+#include "web/request.hh"
+#include "web/response.hh"
+#include "web/server.hh"
+#include "web/session.hh"
+#include "web/utils.hh"
+
+#include <benchmark/benchmark.h>
+
+#include <string>
+#include <vector>
+
+using namespace web::http;
+
+namespace {
+    const std::string SIMPLE_REQUEST =
+        "GET /plaintext HTTP/1.1\r\n"
+        "Host: localhost:8080\r\n"
+        "Accept: text/plain\r\n"
+        "Connection: keep-alive\r\n\r\n";
+
+    // Header set of a typical browser navigation
+    const std::string BROWSER_REQUEST =
+        "GET /search/results?q=hello%20world&page=2&sort=date&lang=en HTTP/1.1\r\n"
+        "Host: www.example.com\r\n"
+        "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/120.0 Safari/537.36\r\n"
+        "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,image/avif,image/webp,*/*;q=0.8\r\n"
+        "Accept-Language: en-US,en;q=0.9\r\n"
+        "Accept-Encoding: gzip, deflate, br\r\n"
+        "Cookie: session=0123456789abcdef; theme=dark; consent=yes\r\n"
+        "Referer: https://www.example.com/search\r\n"
+        "Connection: keep-alive\r\n\r\n";
+
+    const std::string POST_REQUEST =
+        "POST /api/users HTTP/1.1\r\n"
+        "Host: localhost:8080\r\n"
+        "Content-Type: application/json\r\n"
+        "Content-Length: 50\r\n\r\n"
+        "{\"name\":\"Alice\",\"email\":\"alice@example.com\",\"x\":1}";
+
+    void parseRequest(benchmark::State& state, const std::string& raw) {
+        HttpRequest request;
+
+        for(auto _ : state) {
+            request.reset();
+            benchmark::DoNotOptimize(request.parse(raw));
+        }
+
+        state.SetBytesProcessed(static_cast<std::int64_t>(state.iterations() * raw.size()));
+    }
+
+    void BM_RequestParseSimple(benchmark::State& state)  { parseRequest(state, SIMPLE_REQUEST); }
+    void BM_RequestParseBrowser(benchmark::State& state) { parseRequest(state, BROWSER_REQUEST); }
+    void BM_RequestParsePost(benchmark::State& state)    { parseRequest(state, POST_REQUEST); }
+
+    // Five lookups on a freshly parsed request, as a search handler would
+    void BM_QueryParams(benchmark::State& state) {
+        HttpRequest request;
+
+        for(auto _ : state) {
+            request.reset();
+            request.parse(BROWSER_REQUEST);
+
+            for(auto name : { "q", "page", "sort", "lang", "missing" }) {
+                benchmark::DoNotOptimize(request.queryParam(name));
+            }
+        }
+    }
+
+    HttpResponse sampleResponse(std::size_t bodySize) {
+        auto response = HttpResponse::text(std::string(bodySize, 'x'), StatusCode::OK);
+
+        response.header("Cache-Control", "no-cache");
+        response.header("X-Request-Id", "5f2b9c1e-0a4d-4e8b-9a51-3c7d2e6f8b10");
+
+        return response;
+    }
+
+    void BM_ResponseToString(benchmark::State& state) {
+        auto response = sampleResponse(static_cast<std::size_t>(state.range(0)));
+
+        for(auto _ : state) {
+            benchmark::DoNotOptimize(response.toString());
+        }
+    }
+
+    void BM_ResponseWriteHead(benchmark::State& state) {
+        auto response = sampleResponse(13);
+        std::string out;
+
+        for(auto _ : state) {
+            out.clear();
+            response.writeHead(out);
+            benchmark::DoNotOptimize(out.data());
+        }
+    }
+
+    // Every third byte escaped, which is heavier than most real URLs
+    void BM_UrlDecode(benchmark::State& state) {
+        std::string encoded;
+
+        while(encoded.size() < static_cast<std::size_t>(state.range(0))) {
+            encoded += "ab%20c+d";
+        }
+
+        for(auto _ : state) {
+            benchmark::DoNotOptimize(web::http::utils::urlDecode(encoded));
+        }
+
+        state.SetBytesProcessed(static_cast<std::int64_t>(state.iterations() * encoded.size()));
+    }
+
+    void BM_UrlDecodePlain(benchmark::State& state) {
+        std::string plain(static_cast<std::size_t>(state.range(0)), 'a');
+
+        for(auto _ : state) {
+            benchmark::DoNotOptimize(web::http::utils::urlDecode(plain));
+        }
+
+        state.SetBytesProcessed(static_cast<std::int64_t>(state.iterations() * plain.size()));
+    }
+
+    // A path with a few characters to escape
+    void BM_UrlEncode(benchmark::State& state) {
+        std::string plain;
+
+        while(plain.size() < static_cast<std::size_t>(state.range(0))) {
+            plain += "search results/page";
+        }
+
+        for(auto _ : state) {
+            benchmark::DoNotOptimize(web::http::utils::urlEncode(plain));
+        }
+
+        state.SetBytesProcessed(static_cast<std::int64_t>(state.iterations() * plain.size()));
+    }
+
+    void BM_MimeType(benchmark::State& state) {
+        static const std::string_view FILES[] = { "index.html", "app.JS", "logo.png", "font.woff2", "notes.unknown" };
+
+        for(auto _ : state) {
+            for(auto file : FILES) benchmark::DoNotOptimize(mimeType(file));
+        }
+    }
+
+    void BM_ContentTypeParse(benchmark::State& state) {
+        for(auto _ : state) {
+            benchmark::DoNotOptimize(parseContentType("multipart/form-data; charset=utf-8; boundary=\"----WebKitFormBoundary7MA4YWxk\""));
+        }
+    }
+
+    // A list of N user records, as an API response would carry them
+    void writeUsers(JsonWriter& json, int count) {
+        json.beginObject().field("total", count).key("users").beginArray();
+
+        for(int i = 0; i < count; ++i) {
+            json.beginObject()
+                .field("id", i)
+                .field("name", "User \"" + std::to_string(i) + "\"")
+                .field("email", "user" + std::to_string(i) + "@example.com")
+                .field("score", i * 0.5)
+                .field("active", i % 2 == 0)
+                .key("tags").beginArray().value("alpha").value("beta").endArray()
+                .endObject();
+        }
+
+        json.endArray().endObject();
+    }
+
+    void BM_JsonWrite(benchmark::State& state) {
+        auto count = static_cast<int>(state.range(0));
+        std::string body;
+
+        for(auto _ : state) {
+            body.clear();
+
+            JsonWriter json(body);
+            writeUsers(json, count);
+            benchmark::DoNotOptimize(body.data());
+        }
+
+        state.SetBytesProcessed(static_cast<std::int64_t>(state.iterations() * body.size()));
+    }
+
+    // Parse plus reading every field, the way a handler would
+    void BM_JsonParse(benchmark::State& state) {
+        std::string body;
+        JsonWriter json(body);
+        writeUsers(json, static_cast<int>(state.range(0)));
+
+        JsonDocument document;
+
+        for(auto _ : state) {
+            document.parse(body);
+
+            std::int64_t sum = 0;
+            for(auto [key, user] : document.root()["users"]) {
+                sum += user["id"].asInt().value_or(0);
+                sum += static_cast<std::int64_t>(user["name"].asString()->size());
+                sum += user["active"].asBool().value_or(false);
+            }
+
+            benchmark::DoNotOptimize(sum);
+        }
+
+        state.SetBytesProcessed(static_cast<std::int64_t>(state.iterations() * body.size()));
+    }
+
+    // A file part of N KB fed in 16KB reads, as a body stream delivers it
+    void BM_MultipartParse(benchmark::State& state) {
+        const std::string boundary = "----MurlyBoundary7MA4YWxkTrZu0gW";
+
+        std::string body = "--" + boundary + "\r\n"
+            "Content-Disposition: form-data; name=\"upload\"; filename=\"data.bin\"\r\n"
+            "Content-Type: application/octet-stream\r\n\r\n";
+
+        for(std::int64_t i = 0; i < state.range(0) * 1024; ++i) {
+            body.push_back(static_cast<char>("\r\n-abcdefgh"[i % 12]));
+        }
+
+        body += "\r\n--" + boundary + "--\r\n";
+
+        for(auto _ : state) {
+            MultipartParser parser(boundary);
+            std::string_view input(body);
+            std::size_t size = 0;
+
+            while(!input.empty() && !parser.done()) {
+                auto piece = input.substr(0, 16 * 1024);
+                std::size_t consumed = 0;
+                std::string_view data;
+
+                while(!piece.empty()) {
+                    auto event = parser.parse(piece, consumed, data);
+                    piece.remove_prefix(consumed);
+                    input.remove_prefix(consumed);
+
+                    if(event == MultipartParser::Event::DATA) size += data.size();
+                }
+            }
+
+            benchmark::DoNotOptimize(size);
+        }
+
+        state.SetBytesProcessed(static_cast<std::int64_t>(state.iterations() * body.size()));
+    }
+
+    // Lookup of a session by the id in a request's cookie, among N live ones
+    void BM_SessionFind(benchmark::State& state) {
+        SessionStore sessions;
+        std::vector<std::string> ids;
+
+        for(std::int64_t i = 0; i < state.range(0); ++i) {
+            ids.push_back(sessions.create({ { "user", "user" + std::to_string(i) } }));
+        }
+
+        std::size_t next = 0;
+
+        for(auto _ : state) {
+            auto session = sessions.find(ids[next]);
+            benchmark::DoNotOptimize(session);
+
+            if(++next == ids.size()) next = 0;
+        }
+    }
+
+    // The rate limiter's decision and its headers, for one client
+    void BM_RateLimit(benchmark::State& state) {
+        RateLimitOptions options;
+        options.rate = 1e9;
+        options.burst = 1000000;
+
+        RateLimiter limiter(options);
+
+        HttpRequest request("GET /api/items HTTP/1.1\r\nHost: localhost\r\n\r\n");
+        request.remoteAddress(boost::asio::ip::make_address("192.0.2.1"));
+
+        for(auto _ : state) {
+            HttpResponse response(StatusCode::OK);
+            response.contentType("text/plain");
+
+            limiter.before(request, response);
+            limiter.after(request, response);
+            benchmark::DoNotOptimize(response);
+        }
+    }
+
+    // Admission of a request that finds a free slot, and its leaving
+    void BM_Admission(benchmark::State& state) {
+        AdmissionController admission;
+
+        for(auto _ : state) {
+            auto result = admission.enter(Priority::NORMAL, AdmissionController::Clock::duration::zero());
+            benchmark::DoNotOptimize(result);
+            admission.leave();
+        }
+    }
+
+    // The per-request cost of timing: three timestamps and a record into
+    // each phase's histogram
+    void BM_RequestMetrics(benchmark::State& state) {
+        LoopMetrics metrics(16);
+        std::uint64_t route = 0;
+
+        for(auto _ : state) {
+            auto received = Ticks::now();
+            auto dispatched = Ticks::now();
+            auto responded = Ticks::now();
+
+            std::array<std::uint64_t, REQUEST_PHASES> nanos = {
+                Ticks::nanos(dispatched - received),
+                Ticks::nanos(responded - dispatched),
+                Ticks::nanos(responded - received) + 40000,
+                Ticks::nanos(responded - received) + 90000
+            };
+
+            metrics.record(route++ % 16, 200, nanos);
+        }
+    }
+
+    // Middleware plus route lookup for the last of N registered routes,
+    // without any socket I/O
+    void BM_Routing(benchmark::State& state) {
+        bench::QuietOutput quiet;
+
+        IOContext ioc;
+        HttpServerConfig config{ 1, 0, 0, "127.0.0.1", 0 };
+        config.workerThreads = 1;
+        config.compression = false;
+
+        HttpServer server(ioc, config);
+        auto routes = static_cast<int>(state.range(0));
+
+        for(int i = 0; i < routes; ++i) {
+            server.get("/api/v1/resource" + std::to_string(i), [](const HttpRequest&) {
+                return HttpResponse::text("ok", StatusCode::OK);
+            });
+        }
+
+        auto raw = "GET /api/v1/resource" + std::to_string(routes - 1) + " HTTP/1.1\r\nHost: localhost\r\n\r\n";
+
+        HttpRequest request;
+        request.parse(raw);
+
+        for(auto _ : state) {
+            benchmark::DoNotOptimize(server.process(request));
+        }
+    }
+}
+
+BENCHMARK(BM_RequestParseSimple);
+BENCHMARK(BM_RequestParseBrowser);
+BENCHMARK(BM_RequestParsePost);
+BENCHMARK(BM_QueryParams);
+BENCHMARK(BM_ResponseToString)->Arg(13)->Arg(4096);
+BENCHMARK(BM_ResponseWriteHead);
+BENCHMARK(BM_UrlDecode)->Arg(16)->Arg(256)->Arg(4096);
+BENCHMARK(BM_UrlDecodePlain)->Arg(16)->Arg(256)->Arg(4096);
+BENCHMARK(BM_UrlEncode)->Arg(16)->Arg(256)->Arg(4096);
+BENCHMARK(BM_MimeType);
+BENCHMARK(BM_ContentTypeParse);
+BENCHMARK(BM_JsonWrite)->Arg(1)->Arg(100);
+BENCHMARK(BM_JsonParse)->Arg(1)->Arg(100);
+BENCHMARK(BM_MultipartParse)->Arg(64)->Arg(1024);
+BENCHMARK(BM_SessionFind)->Arg(1000)->Arg(100000);
+BENCHMARK(BM_RateLimit);
+BENCHMARK(BM_Admission);
+BENCHMARK(BM_RequestMetrics);
+BENCHMARK(BM_Routing)->Arg(1)->Arg(16)->Arg(128);
+
+#endif
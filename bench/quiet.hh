@@ -0,0 +1,27 @@
+#pragma once
+
+#include <iostream>
+
+namespace bench {
+    // Silences std::cout and std::cerr while in scope; the server logs
+    // every request and every connection reset
+    class QuietOutput {
+    public:
+        QuietOutput() : _out(std::cout.rdstate()), _err(std::cerr.rdstate()) {
+            std::cout.setstate(std::ios::badbit);
+            std::cerr.setstate(std::ios::badbit);
+        }
+
+        ~QuietOutput() {
+            std::cout.clear(_out);
+            std::cerr.clear(_err);
+        }
+
+        QuietOutput(const QuietOutput&) = delete;
+        QuietOutput& operator=(const QuietOutput&) = delete;
+
+    private:
+        std::ios::iostate _out;
+        std::ios::iostate _err;
+    };
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include "util/type.hh"
+#include "chat/message.hh"
+#include "chat/room.hh"
+#include "web/request.hh"
+#include "web/response.hh"
+
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <optional>
+#include <set>
+#include <string>
+#include <string_view>
+
+namespace chat {
+    // Relays a Room to browsers as Server-Sent Events (text/event-stream).
+    //
+    // The bridge joins the room as one participant and encodes each message
+    // into an event frame once; every subscriber is sent the same frame.
+    // Subscribers are streaming HTTP responses, possibly on other event
+    // loops than the room's, each with a queue bounded like a native
+    // Session's: one that falls MAX_PENDING_MSGS behind is cut off, and the
+    // browser reconnects with Last-Event-ID to catch up from recent history.
+    class EventBridge
+        : public ParticipantImpl,
+        public std::enable_shared_from_this<EventBridge> {
+    public:
+        using Executor = boost::asio::any_io_executor;
+        using Frame    = std::shared_ptr<const std::string>;
+
+        // Idle subscribers get a comment line this often, so proxies keep
+        // the response open and dead clients are noticed
+        static constexpr std::chrono::seconds HEARTBEAT{ 15 };
+
+        // `executor` is the one the room's sessions run on
+        EventBridge(Room& room, Executor executor);
+
+        void start();
+
+        // Ends every subscription; call before stopping the HTTP server
+        void stop();
+
+        void deliver(const Message& msg) override;
+
+        // Handler for a GET route, e.g.
+        //     server.get("/events", [bridge](const HttpRequest& r) { return bridge->subscribe(r); });
+        web::http::HttpResponse subscribe(const web::http::HttpRequest& request);
+
+    private:
+        struct Subscriber;
+
+        static Frame encode(std::uint64_t id, std::string_view body);
+
+        boost::asio::awaitable<void> stream(std::optional<std::uint64_t> lastEventId, web::http::BodyWriter& writer);
+
+        // Room executor only
+        void add(std::shared_ptr<Subscriber> subscriber, std::optional<std::uint64_t> lastEventId);
+
+        Room& _room;
+        Executor _executor;
+
+        std::set<std::shared_ptr<Subscriber>> _subscribers;
+        std::deque<std::pair<std::uint64_t, Frame>> _recentFrames;
+        std::uint64_t _nextId = 1;
+    };
+}
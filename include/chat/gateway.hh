@@ -0,0 +1,52 @@
+#pragma once
+
+#include "util/type.hh"
+#include "chat/message.hh"
+#include "chat/room.hh"
+#include "web/request.hh"
+#include "web/websocket.hh"
+
+#include <deque>
+#include <memory>
+#include <set>
+
+namespace chat {
+    // Lets browsers chat in a Room over WebSocket, next to native sessions.
+    //
+    // The gateway joins the room as one participant. Each room message is
+    // encoded into a WebSocket frame once and the same frame is queued on
+    // every socket; what a socket receives is delivered to the room like a
+    // native Session's message. Sockets may run on other event loops than
+    // the room's, and share the native backpressure limit.
+    class WebSocketGateway
+        : public ParticipantImpl,
+        public std::enable_shared_from_this<WebSocketGateway> {
+    public:
+        using Executor = boost::asio::any_io_executor;
+        using Socket   = std::shared_ptr<web::http::WebSocket>;
+
+        // `executor` is the one the room's sessions run on
+        WebSocketGateway(Room& room, Executor executor);
+
+        void start();
+
+        // Closes every socket; call before stopping the HTTP server
+        void stop();
+
+        void deliver(const Message& msg) override;
+
+        // Handler for HttpServer::websocket(), e.g.
+        //     server.websocket("/chat", [gateway](auto socket, const auto& r) { gateway->accept(socket, r); });
+        void accept(Socket socket, const web::http::HttpRequest& request);
+
+    private:
+        // Room executor only
+        void add(Socket socket);
+
+        Room& _room;
+        Executor _executor;
+
+        std::set<Socket> _sockets;
+        std::deque<web::http::WebSocket::Frame> _recentFrames;
+    };
+}
@@ -9,6 +9,10 @@
 namespace chat {
     class ParticipantImpl {
     public:
+        // A participant this many messages behind is disconnected rather
+        // than buffered for without bound
+        static constexpr std::size_t MAX_PENDING_MSGS = 1024;
+
         virtual ~ParticipantImpl() = default;
         virtual void deliver(const Message& msg) = 0;
     };
@@ -17,12 +21,13 @@ namespace chat {
 
     class Room {
     public:
+        static constexpr std::size_t MAX_RECENT_MSGS = 100;
+
         void join(Participant participant);
         void leave(Participant participant);
         void deliver(const Message& msg);
     
     private:
-        static constexpr std::size_t MAX_RECENT_MSGS = 100;
         std::set<Participant> _participants;
         std::deque<Message> _recentMessages;
     };
@@ -15,6 +15,8 @@ namespace chat {
             const TcpEndpoint& endpoint
         );
 
+        Room& room() { return _room; }
+
     private:
         void accept();
 
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <utility>
+
 #include "boost/asio.hpp"
 
 using byte = unsigned char;
@@ -0,0 +1,139 @@
+#pragma once
+
+#include "util/type.hh"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+namespace web::http {
+    // How a route fares when the server sheds load
+    enum class Priority {
+        CRITICAL,   // never queued or shed, e.g. health checks
+        NORMAL,
+        LOW         // served after NORMAL, and the first to go
+    };
+
+    struct AdmissionOptions {
+        // Requests past admission at once, over every loop; later ones
+        // queue for a slot, and beyond maxQueued are refused outright
+        std::size_t maxInFlight = 256;
+        std::size_t maxQueued = 1024;
+
+        // CoDel: a queue whose shortest delay stays above `target` for a
+        // whole `interval` is standing, not a burst, and requests are shed
+        // until it drains. The delay counts both the wait for a slot and the
+        // lag of the loop the request arrived on.
+        std::chrono::milliseconds target{ 5 };
+        std::chrono::milliseconds interval{ 100 };
+
+        // Queued requests are shed after this long whatever the state
+        std::chrono::milliseconds maxWait{ 1000 };
+
+        // While overloaded, stop accepting connections and leave them in the
+        // kernel's backlog. Health checks that connect afresh wait too.
+        bool pauseAccepting = false;
+
+        // Sent with the 503 of a shed request
+        std::chrono::seconds retryAfter{ 1 };
+    };
+
+    // Admission control in front of the handlers: a limit on requests in
+    // flight with a queue behind it, drained by CoDel. Normally the queue is
+    // FIFO; once it is standing, waiters past twice the target (LOW ones
+    // past the target) are shed, the newest are served first so they still
+    // meet their deadline, and new arrivals that already waited as long in
+    // their loop are refused. Shared by every loop.
+    class AdmissionController {
+    public:
+        using Clock = std::chrono::steady_clock;
+
+        enum class Admission {
+            ADMITTED,
+            QUEUE,      // wait() for a slot
+            SHED
+        };
+
+        struct Stats {
+            std::uint64_t admitted;
+            std::uint64_t queued;
+            std::uint64_t shed;
+            std::size_t   inFlight;
+            std::size_t   waiting;
+            bool          overloaded;
+        };
+
+        explicit AdmissionController(AdmissionOptions options = {});
+
+        AdmissionController(const AdmissionController&) = delete;
+        AdmissionController& operator=(const AdmissionController&) = delete;
+
+        // Without waiting; `delay` is what the request has already spent
+        // queued elsewhere, its loop's lag. Every request but a CRITICAL
+        // one admitted here or by wait() has to leave().
+        Admission enter(Priority priority, Clock::duration delay);
+
+        // Resumes with ADMITTED once a slot is handed over, or SHED
+        boost::asio::awaitable<Admission> wait(Priority priority);
+
+        void leave();
+
+        // Sheds waiters past maxWait, and ends the CoDel interval once it
+        // is over; call it a few times per interval
+        void roll();
+
+        // Sheds every waiter, for shutdown
+        void shed();
+
+        // A standing queue was seen in the last interval
+        bool overloaded() const { return _overloaded.load(std::memory_order_relaxed); }
+
+        Stats stats() const;
+        const AdmissionOptions& options() const { return _options; }
+
+    private:
+        using Resume = std::function<void(Admission)>;
+
+        struct Waiter {
+            Clock::time_point queued;
+            Resume resume;
+        };
+
+        using Queue = std::deque<Waiter>;
+
+        static constexpr std::int64_t NO_SAMPLE = INT64_MAX;
+
+        void sample(Clock::duration delay);
+
+        // With the lock held: hands free slots to waiters, shedding the
+        // stale ones on the way
+        void dispatch(std::vector<Resume>& admit, std::vector<Resume>& shed);
+
+        // With the lock held: moves waiters queued before `cutoff` from the
+        // front of `queue` to `shed`
+        void dropOlder(Queue& queue, Clock::time_point cutoff, std::vector<Resume>& shed);
+
+        AdmissionOptions _options;
+        std::size_t _maxInFlight;
+
+        std::atomic<std::size_t> _inFlight = 0;
+        std::atomic<std::size_t> _waiting = 0;
+
+        // The shortest delay seen this interval, in nanoseconds
+        std::atomic<std::int64_t> _minDelay = NO_SAMPLE;
+        std::atomic<bool> _overloaded = false;
+        Clock::time_point _intervalEnd;
+
+        mutable std::mutex _mutex;
+        Queue _normal;
+        Queue _low;
+
+        std::atomic<std::uint64_t> _admitted = 0;
+        std::atomic<std::uint64_t> _queued = 0;
+        std::atomic<std::uint64_t> _shed = 0;
+    };
+}
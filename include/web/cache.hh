@@ -0,0 +1,114 @@
+#pragma once
+
+#include "util/type.hh"
+#include "web/response.hh"
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace web::http {
+    // Opt-in caching of one GET route's responses, see HttpServer::cache().
+    // The key is the path plus the values of the listed query parameters
+    // and request headers, and the negotiated content coding.
+    struct CachePolicy {
+        std::chrono::milliseconds ttl{ 1000 };
+        std::vector<std::string> queryParams;
+        std::vector<std::string> headers;
+    };
+
+    // Fully serialized responses of cached routes, shared by every event
+    // loop. Only one request produces a missing entry; requests for the same
+    // key meanwhile wait for it instead of running the handler too. Expired
+    // entries are dropped on lookup and the least recently used ones to stay
+    // within the byte budget.
+    class ResponseCache {
+    public:
+        using Clock = std::chrono::steady_clock;
+        using Entry = std::shared_ptr<const SerializedResponse>;
+
+        struct Stats {
+            std::uint64_t hits;
+            std::uint64_t misses;       // requests that ran the handler to fill an entry
+            std::uint64_t coalesced;    // requests that waited for another one's fill
+            std::uint64_t evictions;
+            std::size_t   entries;
+            std::size_t   bytes;
+        };
+
+        // Held by the request filling a miss. Whoever waits on the key is
+        // woken by complete(), or empty-handed if the fill is dropped.
+        class Fill {
+        public:
+            Fill(ResponseCache& cache, std::string key) : _cache(cache), _key(std::move(key)) { }
+            ~Fill() { if(!_done) complete(nullptr, {}); }
+
+            Fill(const Fill&) = delete;
+            Fill& operator=(const Fill&) = delete;
+
+            // `entry` may be null when the response was not cacheable
+            void complete(Entry entry, std::chrono::milliseconds ttl);
+
+        private:
+            ResponseCache& _cache;
+            std::string _key;
+            bool _done = false;
+        };
+
+        struct Lookup {
+            Entry entry;                    // a fresh hit
+            std::shared_ptr<Fill> fill;     // a miss this request has to fill
+            bool pending = false;           // a miss someone else is filling; wait()
+        };
+
+        explicit ResponseCache(std::size_t budget) : _budget(budget) { }
+
+        Lookup lookup(const std::string& key);
+
+        // Resumes on the caller's executor with the filled entry, or null
+        // when the fill produced nothing to store
+        boost::asio::awaitable<Entry> wait(const std::string& key);
+
+        // Statuses HTTP allows to be reused, no cookies, no private data;
+        // bodies must be in memory
+        static bool cacheable(const HttpResponse& response);
+
+        // Head and body, leaving out the Connection header
+        static Entry serialize(const HttpResponse& response);
+
+        Stats stats() const;
+
+    private:
+        struct Slot {
+            std::string key;
+            Entry entry;
+            Clock::time_point expires;
+        };
+
+        using Waiter = std::function<void(Entry)>;
+
+        void store(const std::string& key, Entry entry, std::chrono::milliseconds ttl);
+        std::size_t cost(const Slot& slot) const { return slot.key.size() + slot.entry->bytes.size(); }
+
+        const std::size_t _budget;
+        std::size_t _size = 0;
+
+        mutable std::mutex _mutex;
+        std::list<Slot> _slots;     // most recently used first
+        std::unordered_map<std::string, std::list<Slot>::iterator> _index;
+
+        // Keys being filled, with the requests waiting for them
+        std::unordered_map<std::string, std::vector<Waiter>> _pending;
+
+        std::uint64_t _hits = 0;
+        std::uint64_t _misses = 0;
+        std::uint64_t _coalesced = 0;
+        std::uint64_t _evictions = 0;
+    };
+}
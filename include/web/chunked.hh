@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstdint>
+#include <string_view>
+
+namespace web::http {
+    // Incremental decoder for Transfer-Encoding: chunked. Input may be split
+    // anywhere, including inside a size line or the CRLF after a chunk, and
+    // payload is handed back as views into the caller's buffer so nothing is
+    // copied while decoding.
+    class ChunkedDecoder {
+    public:
+        // Consumes framing from `input` up to and including the next run of
+        // payload, which is returned; `consumed` is set to the bytes used.
+        // An empty result with consumed == input.size() means more input is needed.
+        std::string_view decode(std::string_view input, std::size_t& consumed);
+
+        bool done() const   { return _state == State::DONE; }
+        bool failed() const { return _state == State::FAILED; }
+
+        void reset();
+
+    private:
+        enum class State {
+            SIZE,
+            EXTENSION,
+            SIZE_LF,
+            DATA,
+            DATA_CR,
+            DATA_LF,
+            TRAILER,
+            TRAILER_LINE,
+            TRAILER_LF,
+            DONE,
+            FAILED
+        };
+
+        // Trailer fields are skipped, but not without bound
+        static constexpr std::size_t MAX_TRAILER = 8 * 1024;
+
+        State _state = State::SIZE;
+        std::uint64_t _remaining = 0;
+        std::size_t _digits = 0;
+        std::size_t _trailer = 0;
+    };
+}
@@ -0,0 +1,109 @@
+#pragma once
+
+#include "web/response.hh"
+
+#include <cstddef>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+
+struct z_stream_s;
+
+namespace web::http {
+    enum class ContentCoding {
+        IDENTITY,
+        GZIP,
+        DEFLATE
+    };
+
+    std::string_view codingName(ContentCoding coding);
+
+    // Picks the best coding the client accepts, honouring q-values; gzip
+    // wins ties since every client that sends Accept-Encoding decodes it
+    ContentCoding negotiateCoding(std::string_view acceptEncoding);
+
+    // Text-like media types worth compressing (images, video and archives
+    // are already compressed). Parameters such as charset are ignored.
+    bool isCompressible(std::string_view contentType);
+
+    // Incremental zlib compressor producing a gzip or zlib ("deflate") stream
+    class Deflater {
+    public:
+        enum class Flush {
+            NONE,
+            SYNC,   // emit everything so far, so the client can decode it now
+            FINISH
+        };
+
+        Deflater(ContentCoding coding, int level);
+        ~Deflater();
+
+        Deflater(const Deflater&) = delete;
+        Deflater& operator=(const Deflater&) = delete;
+
+        // Compresses `input` and appends whatever zlib emits to `out`
+        void write(std::string_view input, std::string& out, Flush flush = Flush::NONE);
+
+        static std::string compress(std::string_view input, ContentCoding coding, int level);
+
+    private:
+        std::unique_ptr<z_stream_s> _stream;
+    };
+
+    // Compresses a streamed body on its way to another writer. Output is
+    // handed on in blocks, so memory stays bounded however long the body is.
+    class CompressingWriter : public BodyWriter {
+    public:
+        CompressingWriter(BodyWriter& out, ContentCoding coding, int level)
+            : _out(out), _deflater(coding, level) { }
+
+        boost::asio::awaitable<void> write(std::string_view data) override;
+        boost::asio::awaitable<void> flush() override;
+
+        // Ends the compressed stream; the producer must not write afterwards
+        boost::asio::awaitable<void> finish();
+
+    private:
+        static constexpr std::size_t BLOCK = 16 * 1024;
+
+        BodyWriter& _out;
+        Deflater _deflater;
+        std::string _buffer;
+    };
+
+    // Compressed representations of static files, shared by every event
+    // loop. Entries are keyed by path, coding and validator, so a changed
+    // file is never served stale, and the least recently used entries are
+    // dropped to stay within the byte budget. A missing entry is filled by
+    // one request at a time: claim() it, then fill() it.
+    class CompressionCache {
+    public:
+        explicit CompressionCache(std::size_t budget) : _budget(budget) { }
+
+        std::shared_ptr<const std::string> get(const std::string& key);
+        void put(const std::string& key, std::shared_ptr<const std::string> data);
+
+        // False while another request is filling `key`
+        bool claim(const std::string& key);
+
+        // Ends the claim, storing `data` unless it is null
+        void fill(const std::string& key, std::shared_ptr<const std::string> data);
+
+        std::size_t budget() const { return _budget; }
+
+    private:
+        using Entry = std::pair<std::string, std::shared_ptr<const std::string>>;
+
+        const std::size_t _budget;
+        std::size_t _size = 0;
+
+        std::mutex _mutex;
+        std::list<Entry> _entries;  // most recently used first
+        std::unordered_map<std::string, std::list<Entry>::iterator> _index;
+        std::unordered_set<std::string> _filling;
+    };
+}
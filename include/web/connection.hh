@@ -0,0 +1,78 @@
+#pragma once
+
+#include "util/type.hh"
+#include "web/metrics.hh"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <unordered_set>
+
+namespace web::http {
+    // A client connection in whatever protocol it speaks; the server only
+    // needs to be able to close it on stop(), or when its deadline passes
+    class Connection {
+    public:
+        using Clock = std::chrono::steady_clock;
+
+        virtual ~Connection() = default;
+        virtual void close() = 0;
+
+        // Called by the loop's sweep once the deadline has passed
+        virtual void timeout() { close(); }
+
+        Clock::time_point deadline() const          { return _deadline; }
+        void deadline(Clock::time_point deadline)   { _deadline = deadline; }
+        void clearDeadline()                        { _deadline = Clock::time_point::max(); }
+
+    private:
+        Clock::time_point _deadline = Clock::time_point::max();
+    };
+
+    // Why connections ended early, per loop. Written only by the loop's own
+    // thread; atomic so the totals can be read from anywhere.
+    struct ConnectionCounters {
+        std::atomic<std::uint64_t> accepted = 0;
+        std::atomic<std::uint64_t> closedByPeer = 0;
+        std::atomic<std::uint64_t> idleTimeouts = 0;        // keep-alive wait expired
+        std::atomic<std::uint64_t> headerTimeouts = 0;      // 408, head too slow
+        std::atomic<std::uint64_t> bodyTimeouts = 0;        // 408, body too slow
+        std::atomic<std::uint64_t> writeTimeouts = 0;       // client stopped reading
+        std::atomic<std::uint64_t> headersTooLarge = 0;     // 431
+        std::atomic<std::uint64_t> urisTooLong = 0;         // 414
+        std::atomic<std::uint64_t> bodiesTooLarge = 0;      // 413
+        std::atomic<std::uint64_t> malformed = 0;           // 400/501
+    };
+
+    // Counters have a single writer, so no locked add is needed
+    inline void increment(std::atomic<std::uint64_t>& counter) {
+        counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+
+    // One event loop: an acceptor sharing the port with the other loops and
+    // the connections it accepted. Only touched from its own thread.
+    struct EventLoop {
+        explicit EventLoop(IOContext& ioc) : ioc(ioc), acceptor(ioc), sweeper(ioc), prober(ioc) { }
+
+        IOContext& ioc;
+        TcpAcceptor acceptor;
+        std::unordered_set<Connection*> connections;
+
+        // Deadlines are checked once a second against this coarse clock,
+        // which is what connections should base their deadlines on
+        boost::asio::steady_timer sweeper;
+        Connection::Clock::time_point now = Connection::Clock::now();
+
+        // With admission control, a timer due every CoDel target; how late
+        // it last fired is how long ready work currently waits on this loop
+        boost::asio::steady_timer prober;
+        Connection::Clock::duration lag{};
+        bool acceptPaused = false;
+
+        ConnectionCounters counters;
+
+        // Request latencies, when the server has metrics turned on
+        std::unique_ptr<LoopMetrics> metrics;
+    };
+}
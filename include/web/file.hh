@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstdint>
+#include <ctime>
+#include <string>
+
+namespace web::http {
+    // Read-only descriptor on a file served from disk. A response holds it
+    // through a shared_ptr so the connection can send it with sendfile(2)
+    // after the handler has returned.
+    class File {
+    public:
+        explicit File(const std::string& path);
+        ~File();
+
+        File(const File&) = delete;
+        File& operator=(const File&) = delete;
+
+        int fd() const                  { return _fd; }
+        const std::string& path() const { return _path; }
+
+        std::uint64_t size() const          { return _size; }
+        std::time_t   lastModified() const  { return _lastModified; }
+
+        // Strong validator derived from size and modification time
+        std::string etag() const;
+
+        // Whole contents, for files small enough to hold in memory
+        std::string read() const;
+
+    private:
+        int _fd = -1;
+        std::string _path;
+
+        std::uint64_t _size = 0;
+        std::time_t _lastModified = 0;
+    };
+}
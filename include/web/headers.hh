@@ -0,0 +1,164 @@
+#pragma once
+
+#include <boost/container/small_vector.hpp>
+
+#include <array>
+#include <cstdint>
+#include <iterator>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+
+namespace web::http {
+    // Well-known headers, resolved once when a header is added so lookups
+    // by Field are a direct index instead of a name comparison
+    enum class Field : std::uint8_t {
+        ACCEPT,
+        ACCEPT_ENCODING,
+        ACCEPT_RANGES,
+        AUTHORIZATION,
+        CACHE_CONTROL,
+        CONNECTION,
+        CONTENT_ENCODING,
+        CONTENT_LENGTH,
+        CONTENT_RANGE,
+        CONTENT_TYPE,
+        COOKIE,
+        DATE,
+        ETAG,
+        EXPECT,
+        HOST,
+        IF_MODIFIED_SINCE,
+        IF_NONE_MATCH,
+        IF_RANGE,
+        LAST_MODIFIED,
+        LOCATION,
+        RANGE,
+        SERVER,
+        SET_COOKIE,
+        TRANSFER_ENCODING,
+        UPGRADE,
+        USER_AGENT,
+        VARY,
+        UNKNOWN
+    };
+
+    constexpr std::size_t FIELD_COUNT = static_cast<std::size_t>(Field::UNKNOWN);
+
+    std::string_view fieldName(Field field);
+    Field            fieldFromName(std::string_view name);
+
+    // ASCII case-insensitive comparison, header names are never localized
+    bool iequals(std::string_view a, std::string_view b);
+
+    // Without the spaces and tabs around it (optional whitespace, RFC 9110 5.6.3)
+    std::string_view trim(std::string_view value);
+
+    // Calls visit() with every item of a comma-separated list, trimmed;
+    // empty items are passed on too
+    template<typename Visit>
+    void forEachToken(std::string_view list, Visit&& visit) {
+        for(;;) {
+            auto comma = list.find(',');
+            visit(trim(list.substr(0, comma)));
+
+            if(comma == std::string_view::npos) break;
+            list.remove_prefix(comma + 1);
+        }
+    }
+
+    // Whether a list such as Connection or Transfer-Encoding has `token`, ignoring case
+    bool hasToken(std::string_view list, std::string_view token);
+
+    // Flat header list. Names and values share one byte arena and the entry
+    // table lives inline for typical messages, so parsing a request costs a
+    // single allocation and lookups never allocate.
+    class HttpHeaders {
+    public:
+        using value_type = std::pair<std::string_view, std::string_view>;
+
+        class const_iterator;
+
+        // Appends, keeping earlier values (Set-Cookie may repeat)
+        void add(std::string_view name, std::string_view value);
+
+        // Replaces the first value with this name, or appends
+        void set(std::string_view name, std::string_view value);
+        void set(Field field, std::string_view value);
+
+        void remove(std::string_view name);
+        void clear();
+
+        std::optional<std::string_view> get(std::string_view name) const;
+        std::optional<std::string_view> get(Field field) const;
+
+        bool contains(std::string_view name) const  { return get(name).has_value(); }
+        bool contains(Field field) const            { return _index[static_cast<std::size_t>(field)] != 0; }
+
+        std::size_t size() const    { return _entries.size(); }
+        bool empty() const          { return _entries.empty(); }
+
+        const_iterator begin() const;
+        const_iterator end() const;
+
+    private:
+        struct Entry {
+            std::uint32_t nameOffset;
+            std::uint32_t nameLength;
+            std::uint32_t valueOffset;
+            std::uint32_t valueLength;
+            Field field;
+        };
+
+        std::string_view name(const Entry& entry) const {
+            return std::string_view(_arena).substr(entry.nameOffset, entry.nameLength);
+        }
+
+        std::string_view value(const Entry& entry) const {
+            return std::string_view(_arena).substr(entry.valueOffset, entry.valueLength);
+        }
+
+        const Entry* find(std::string_view name) const;
+        std::uint32_t store(std::string_view bytes);
+        void reindex();
+
+        std::string _arena;
+        boost::container::small_vector<Entry, 16> _entries;
+
+        // 1-based position of the first entry for each well-known field
+        std::array<std::uint16_t, FIELD_COUNT> _index{};
+
+        friend class const_iterator;
+
+    public:
+        class const_iterator {
+        public:
+            using iterator_category = std::forward_iterator_tag;
+            using value_type        = HttpHeaders::value_type;
+            using difference_type   = std::ptrdiff_t;
+            using pointer           = void;
+            using reference         = value_type;
+
+            const_iterator(const HttpHeaders* headers, std::size_t position)
+                : _headers(headers), _position(position) { }
+
+            value_type operator*() const {
+                const auto& entry = _headers->_entries[_position];
+                return { _headers->name(entry), _headers->value(entry) };
+            }
+
+            const_iterator& operator++() { ++_position; return *this; }
+
+            bool operator==(const const_iterator& other) const { return _position == other._position; }
+            bool operator!=(const const_iterator& other) const { return _position != other._position; }
+
+        private:
+            const HttpHeaders* _headers;
+            std::size_t _position;
+        };
+    };
+
+    inline HttpHeaders::const_iterator HttpHeaders::begin() const { return const_iterator(this, 0); }
+    inline HttpHeaders::const_iterator HttpHeaders::end() const   { return const_iterator(this, _entries.size()); }
+}
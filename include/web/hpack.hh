@@ -0,0 +1,89 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// HPACK header compression for HTTP/2 (RFC 7541)
+namespace web::http::hpack {
+    // A compression error; always fatal to the HTTP/2 connection, since
+    // the two sides' tables can no longer be trusted to agree
+    class DecodeError : public std::runtime_error {
+    public:
+        using std::runtime_error::runtime_error;
+    };
+
+    struct HeaderField {
+        std::string name;
+        std::string value;
+    };
+
+    bool huffmanDecode(std::string_view input, std::string& out);
+    void huffmanEncode(std::string_view input, std::string& out);
+    std::size_t huffmanLength(std::string_view input);
+
+    // Entries added by the peer (for decoding) or by us (for encoding);
+    // newest first, evicted from the back to stay within the size limit
+    class DynamicTable {
+    public:
+        explicit DynamicTable(std::size_t maxSize) : _maxSize(maxSize) { }
+
+        void add(std::string name, std::string value);
+        void resize(std::size_t maxSize);
+
+        const HeaderField& at(std::size_t index) const { return _entries[index]; }
+        std::size_t count() const   { return _entries.size(); }
+        std::size_t maxSize() const { return _maxSize; }
+
+        // Per-entry overhead the RFC charges on top of the bytes
+        static constexpr std::size_t ENTRY_OVERHEAD = 32;
+
+    private:
+        void evict(std::size_t room);
+
+        std::deque<HeaderField> _entries;
+        std::size_t _size = 0;
+        std::size_t _maxSize;
+    };
+
+    class Decoder {
+    public:
+        // `maxTableSize` is what our SETTINGS_HEADER_TABLE_SIZE allows the peer
+        explicit Decoder(std::size_t maxTableSize = 4096)
+            : _table(maxTableSize), _limit(maxTableSize) { }
+
+        // Decodes a complete header block, appending the fields to `out`.
+        // Returns false once the list passes `maxListSize` (name + value +
+        // 32 per field); the rest is still decoded to keep the table in sync.
+        bool decode(std::string_view block, std::vector<HeaderField>& out, std::size_t maxListSize);
+
+    private:
+        HeaderField lookup(std::uint64_t index) const;
+        std::string readString(std::string_view& input);
+
+        DynamicTable _table;
+        std::size_t _limit;
+    };
+
+    class Encoder {
+    public:
+        explicit Encoder(std::size_t maxTableSize = 4096) : _table(maxTableSize) { }
+
+        // Follows the peer's SETTINGS_HEADER_TABLE_SIZE; the change is
+        // announced at the start of the next header block
+        void setMaxTableSize(std::size_t maxSize);
+
+        // `name` must already be lowercase. Values that change on every
+        // response (lengths, validators) or are secret should not be indexed.
+        void encode(std::string_view name, std::string_view value, std::string& out, bool index = true);
+
+    private:
+        void writeString(std::string_view value, std::string& out);
+
+        DynamicTable _table;
+        bool _sizeChanged = false;
+    };
+}
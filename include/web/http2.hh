@@ -0,0 +1,130 @@
+#pragma once
+
+#include "util/type.hh"
+#include "web/connection.hh"
+#include "web/hpack.hh"
+#include "web/request.hh"
+#include "web/response.hh"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+namespace web::http {
+    class HttpServer;
+
+    // What an HTTP/2 client sends before its first frame
+    constexpr std::string_view HTTP2_PREFACE = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+
+    // HTTP/2 over cleartext TCP (h2c with prior knowledge, RFC 9113).
+    //
+    // Each stream is a request/response exchange dispatched through the same
+    // router, middleware and handlers as HTTP/1.1, so many requests run
+    // concurrently on one connection. Frames from every stream are gathered
+    // into one output buffer and written together. Response bodies respect
+    // the peer's flow-control windows; a stream that runs out of window
+    // parks until a WINDOW_UPDATE arrives.
+    //
+    // A stream still counts against the concurrency limit after a reset
+    // until its handler has finished, and one that stops sending its head
+    // or body is answered 408 on its own deadline rather than holding the
+    // connection open.
+    class Http2Connection : public Connection, public std::enable_shared_from_this<Http2Connection> {
+    public:
+        // `received` holds whatever was read off the socket already,
+        // starting with the preface
+        Http2Connection(TcpSocket socket, HttpServer& server, EventLoop& loop, std::string received);
+        ~Http2Connection();
+
+        void start();
+        void close() override;
+        void timeout() override;
+
+    private:
+        struct Stream;
+        class StreamReader;
+        class StreamWriter;
+
+        boost::asio::awaitable<void> readFrames();
+        void handleFrame(std::uint8_t type, std::uint8_t flags, std::uint32_t streamId, std::string_view payload);
+
+        void onData(std::uint8_t flags, std::uint32_t streamId, std::string_view payload);
+        void onHeaders(std::uint8_t flags, std::uint32_t streamId, std::string_view payload);
+        void onContinuation(std::uint8_t flags, std::uint32_t streamId, std::string_view payload);
+        void onSettings(std::uint8_t flags, std::uint32_t streamId, std::string_view payload);
+        void onWindowUpdate(std::uint32_t streamId, std::string_view payload);
+        void onResetStream(std::uint32_t streamId, std::string_view payload);
+
+        void openStream(std::uint32_t streamId, std::string_view block, bool endStream);
+        void endOfBody(std::shared_ptr<Stream> stream);
+        void dispatch(std::shared_ptr<Stream> stream);
+        boost::asio::awaitable<void> handle(std::shared_ptr<Stream> stream);
+        boost::asio::awaitable<void> sendResponse(Stream& stream);
+        void encodeHeaders(const HttpResponse& response, std::string& block);
+
+        // Answers without involving the router, e.g. 413 for an oversized body
+        void refuse(std::shared_ptr<Stream> stream, StatusCode status);
+
+        void resetStream(std::uint32_t streamId, std::uint32_t code);
+        void closeStream(std::uint32_t streamId);
+
+        // Closes once a GOAWAY has gone out, or the peer's has been honoured
+        void closeIfDone();
+
+        // Arms the idle deadline while no stream is open, otherwise the
+        // earliest header or body deadline
+        void watchDeadlines();
+
+        // Parks the calling coroutine until wake() (or close())
+        boost::asio::awaitable<void> park(Stream& stream);
+        void wake(Stream& stream);
+        void wakeAll();
+
+        void writeFrame(std::uint8_t type, std::uint8_t flags, std::uint32_t streamId, std::string_view payload);
+        void writeHeaders(std::uint32_t streamId, std::string_view block, bool endStream);
+        void writeWindowUpdate(std::uint32_t streamId, std::uint32_t increment);
+        void goAway(std::uint32_t code);
+        void send();
+
+        TcpSocket _socket;
+        HttpServer& _server;
+        EventLoop& _loop;
+        boost::asio::ip::address _remoteAddress;
+
+        std::string _input;
+
+        // Frames queued by every stream, and the batch being written
+        std::string _output;
+        std::string _sending;
+        bool _writing = false;
+        bool _sendScheduled = false;
+
+        hpack::Decoder _decoder;
+        hpack::Encoder _encoder;
+        std::string _headerBlock;
+        std::string _lowercase;
+
+        std::unordered_map<std::uint32_t, std::shared_ptr<Stream>> _streams;
+        std::uint32_t _lastStreamId = 0;
+
+        // Reset streams whose handler is still running
+        std::uint32_t _orphans = 0;
+
+        // HEADERS without END_HEADERS: only CONTINUATION for this stream may follow
+        std::uint32_t _continuationStream = 0;
+        bool _continuationEndStream = false;
+        Clock::time_point _headersDeadline;
+
+        // The peer's settings, and our send window for the whole connection
+        std::uint32_t _peerMaxFrameSize = 16384;
+        std::int64_t _peerInitialWindow = 65535;
+        std::int64_t _sendWindow = 65535;
+
+        bool _prefaceReceived = false;
+        bool _goingAway = false;        // we sent GOAWAY: no new streams, close once flushed
+        bool _peerGoingAway = false;    // the peer did: close once the open streams are done
+        bool _closed = false;
+    };
+}
@@ -0,0 +1,250 @@
+#pragma once
+
+#include "util/type.hh"
+
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace web::http {
+    class BodyWriter;
+
+    // Serializes JSON straight onto the end of a string, typically the
+    // response body, with no intermediate tree. Commas are placed by the
+    // writer; nesting is the caller's business.
+    //
+    //   JsonWriter json(body);
+    //   json.beginObject().field("id", 42).key("tags").beginArray().value("a").endArray().endObject();
+    class JsonWriter {
+    public:
+        explicit JsonWriter(std::string& out) : _out(out) { }
+
+        JsonWriter& beginObject();
+        JsonWriter& endObject();
+        JsonWriter& beginArray();
+        JsonWriter& endArray();
+
+        JsonWriter& key(std::string_view name);
+
+        JsonWriter& value(std::string_view text);
+        JsonWriter& value(const char* text)     { return value(std::string_view(text)); }
+        JsonWriter& value(const std::string& text) { return value(std::string_view(text)); }
+        JsonWriter& value(bool flag);
+        JsonWriter& value(std::nullptr_t);
+        JsonWriter& value(double number);   // NaN and infinities become null
+
+        template<typename T, typename = std::enable_if_t<std::is_integral_v<T> && !std::is_same_v<T, bool>>>
+        JsonWriter& value(T number) {
+            if constexpr(std::is_signed_v<T>) return integer(static_cast<std::int64_t>(number));
+            else return unsignedInteger(static_cast<std::uint64_t>(number));
+        }
+
+        template<typename T>
+        JsonWriter& field(std::string_view name, T&& v) {
+            key(name);
+            return value(std::forward<T>(v));
+        }
+
+        // An already serialized value, inserted as is
+        JsonWriter& raw(std::string_view json);
+
+        // Object and array nesting still open
+        std::size_t depth() const { return _depth; }
+
+        std::string& buffer() { return _out; }
+
+    private:
+        JsonWriter& integer(std::int64_t number);
+        JsonWriter& unsignedInteger(std::uint64_t number);
+
+        void separate() {
+            if(_comma) _out.push_back(',');
+            _comma = true;
+        }
+
+        std::string& _out;
+        std::size_t _depth = 0;
+        bool _comma = false;    // the next value or key follows a sibling
+    };
+
+    // A JsonWriter for a streamed response body. Text collects in a buffer
+    // that sync() hands to the BodyWriter once it has grown past `chunk`
+    // bytes, so a large document is never held in memory whole and the
+    // producer waits on the client only every so often.
+    //
+    //   response.stream([rows](BodyWriter& body) -> boost::asio::awaitable<void> {
+    //       JsonStream json(body);
+    //       json->beginArray();
+    //       for(const auto& row : *rows) { json->value(row); co_await json.sync(); }
+    //       json->endArray();
+    //       co_await json.finish();
+    //   });
+    class JsonStream {
+    public:
+        explicit JsonStream(BodyWriter& body, std::size_t chunk = 16 * 1024)
+            : _body(body), _chunk(chunk), _writer(_buffer) { _buffer.reserve(chunk + chunk / 4); }
+
+        JsonWriter& operator*()  { return _writer; }
+        JsonWriter* operator->() { return &_writer; }
+
+        boost::asio::awaitable<void> sync();
+        boost::asio::awaitable<void> finish();
+
+    private:
+        BodyWriter& _body;
+        std::size_t _chunk;
+        std::string _buffer;
+        JsonWriter _writer;
+    };
+
+    enum class JsonType : std::uint8_t {
+        NONE,   // a missing member or index, or a document that failed to parse
+        NUL,
+        BOOLEAN,
+        NUMBER,
+        STRING,
+        ARRAY,
+        OBJECT
+    };
+
+    class JsonDocument;
+
+    // A position in a JsonDocument's tape; cheap to copy, valid while the
+    // document is. Lookups of missing members give a NONE value rather than
+    // throwing, so paths can be chained: doc.root()["user"]["id"].asInt()
+    class JsonValue {
+    public:
+        JsonValue() = default;
+
+        JsonType type() const;
+        bool exists() const     { return type() != JsonType::NONE; }
+        bool isNull() const     { return type() == JsonType::NUL; }
+        bool isBool() const     { return type() == JsonType::BOOLEAN; }
+        bool isNumber() const   { return type() == JsonType::NUMBER; }
+        bool isString() const   { return type() == JsonType::STRING; }
+        bool isArray() const    { return type() == JsonType::ARRAY; }
+        bool isObject() const   { return type() == JsonType::OBJECT; }
+
+        explicit operator bool() const { return exists(); }
+
+        // Numbers are converted on access, from their text in the source
+        std::optional<bool>             asBool() const;
+        std::optional<std::int64_t>     asInt() const;
+        std::optional<std::uint64_t>    asUint() const;
+        std::optional<double>           asDouble() const;
+        std::optional<std::string_view> asString() const;
+
+        // The number's source text, e.g. to keep full precision
+        std::string_view numberText() const;
+
+        // Elements of an array, members of an object
+        std::size_t size() const;
+
+        JsonValue operator[](std::string_view name) const;     // first member with this name
+        JsonValue operator[](std::size_t index) const;
+        JsonValue operator[](int index) const { return (*this)[static_cast<std::size_t>(index)]; }
+
+        // Walks an array's elements, or an object's members as (key, value)
+        class Iterator {
+        public:
+            using iterator_category = std::forward_iterator_tag;
+            using value_type        = std::pair<std::string_view, JsonValue>;
+            using difference_type   = std::ptrdiff_t;
+            using pointer           = void;
+            using reference         = value_type;
+
+            Iterator() = default;
+
+            value_type operator*() const;
+            Iterator& operator++();
+            Iterator operator++(int) { auto copy = *this; ++*this; return copy; }
+
+            bool operator==(const Iterator& other) const { return _index == other._index; }
+            bool operator!=(const Iterator& other) const { return _index != other._index; }
+
+        private:
+            friend class JsonValue;
+            Iterator(const JsonDocument* document, std::uint32_t index, bool members)
+                : _document(document), _index(index), _members(members) { }
+
+            const JsonDocument* _document = nullptr;
+            std::uint32_t _index = 0;
+            bool _members = false;
+        };
+
+        Iterator begin() const;
+        Iterator end() const;
+
+    private:
+        friend class JsonDocument;
+        JsonValue(const JsonDocument* document, std::uint32_t index) : _document(document), _index(index) { }
+
+        const JsonDocument* _document = nullptr;
+        std::uint32_t _index = 0;
+    };
+
+    // A parsed JSON text as a flat tape of fixed-size nodes, built in one
+    // pass over the input with no allocation per value. Strings and numbers
+    // stay in the source text, which must outlive the document; only strings
+    // with escapes are decoded, into one shared arena. Containers record
+    // where they end, so skipping a subtree is a single jump.
+    class JsonDocument {
+    public:
+        JsonDocument() = default;
+        explicit JsonDocument(std::string_view text) { parse(text); }
+
+        // Replaces the document; false on malformed input, see error()
+        bool parse(std::string_view text);
+
+        bool ok() const                 { return _error.empty() && !_tape.empty(); }
+        explicit operator bool() const  { return ok(); }
+
+        // What was wrong and where, empty after a successful parse
+        const std::string& error() const { return _error; }
+
+        JsonValue root() const { return ok() ? JsonValue(this, 0) : JsonValue(); }
+
+        // Nesting deeper than this is refused rather than risked
+        static constexpr std::size_t MAX_DEPTH = 512;
+
+    private:
+        friend class JsonValue;
+
+        struct Node {
+            JsonType type;
+            bool escaped;           // string lives in the arena, not the source; a boolean's value
+            std::uint32_t a;        // scalars: offset; containers: index past the last descendant
+            std::uint32_t b;        // scalars: length; containers: element or member count
+        };
+
+        std::string_view text(const Node& node) const {
+            return node.escaped ? std::string_view(_arena).substr(node.a, node.b) : _text.substr(node.a, node.b);
+        }
+
+        std::uint32_t next(std::uint32_t index) const {
+            const auto& node = _tape[index];
+            return (node.type == JsonType::ARRAY || node.type == JsonType::OBJECT) ? node.a : index + 1;
+        }
+
+        // Each takes the position of the token and returns the position after
+        // it, or null once reject() has recorded why it is malformed
+        const char* parseString(const char* p, const char* end);
+        const char* parseNumber(const char* p, const char* end);
+        const char* parseLiteral(const char* p, const char* end, std::string_view word, JsonType type, bool flag);
+        static const char* skipSpace(const char* p, const char* end);
+
+        std::uint32_t offset(const char* at) const { return static_cast<std::uint32_t>(at - _text.data()); }
+        bool fail(std::string_view what, std::size_t offset);
+        const char* reject(std::string_view what, const char* at) { fail(what, offset(at)); return nullptr; }
+
+        std::string_view _text;
+        std::vector<Node> _tape;
+        std::string _arena;
+        std::string _error;
+    };
+}
@@ -0,0 +1,158 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace web::http {
+    // Timestamps for timing requests: the CPU's time stamp counter where it
+    // runs at a constant rate, steady_clock otherwise. Ticks only mean
+    // something as differences, converted with nanos().
+    class Ticks {
+    public:
+        static std::uint64_t now();
+        static std::uint64_t nanos(std::uint64_t ticks);
+
+        // "tsc" or "steady_clock"; the first call calibrates the counter
+        // against steady_clock, which takes about 10ms
+        static const char* source();
+    };
+
+    // Latency histogram in the manner of HdrHistogram: buckets are linear
+    // within each power of two, 64 of them, so any recorded value is known
+    // to within 1.6%, from 1ns up to about a minute; longer ones land in
+    // the last bucket. One thread records, any thread may read.
+    class LatencyHistogram {
+    public:
+        static constexpr unsigned SUB_BUCKET_BITS = 7;
+        static constexpr unsigned MAX_BITS = 36;
+        static constexpr std::size_t SUB_BUCKETS = std::size_t(1) << SUB_BUCKET_BITS;
+        static constexpr std::size_t HALF = SUB_BUCKETS / 2;
+        static constexpr std::size_t BUCKETS = SUB_BUCKETS + (MAX_BITS - SUB_BUCKET_BITS) * HALF;
+
+        // Counts of one or more histograms added up, for reading
+        struct Snapshot {
+            std::array<std::uint64_t, BUCKETS> counts{};
+            std::uint64_t total = 0;
+            std::uint64_t sum = 0;
+            std::uint64_t max = 0;
+
+            void add(const LatencyHistogram& histogram);
+
+            // The value at or below which a `quantile` of the recorded ones lie
+            std::uint64_t percentile(double quantile) const;
+            double mean() const { return total == 0 ? 0.0 : static_cast<double>(sum) / static_cast<double>(total); }
+        };
+
+        void record(std::uint64_t value);
+
+        static std::size_t bucketOf(std::uint64_t value);
+
+        // The largest value that lands in `bucket`
+        static std::uint64_t highestIn(std::size_t bucket);
+
+    private:
+        std::array<std::atomic<std::uint64_t>, BUCKETS> _counts{};
+        std::atomic<std::uint64_t> _total = 0;
+        std::atomic<std::uint64_t> _sum = 0;
+        std::atomic<std::uint64_t> _max = 0;
+    };
+
+    // Where a request's time went, from the first byte of its head
+    enum class RequestPhase {
+        PARSE,      // until the head, and a buffered body, have arrived
+        HANDLER,    // admission, middleware and the handler
+        WRITE,      // until the last byte of the response is handed to the socket
+        TOTAL
+    };
+
+    constexpr std::size_t REQUEST_PHASES = 4;
+
+    // Stamped by the connection as a request goes along
+    struct RequestTiming {
+        std::uint64_t received = 0;
+        std::uint64_t dispatched = 0;
+        std::uint64_t responded = 0;
+    };
+
+    struct MetricsOptions {
+        // GET routes serving the histograms as JSON, and the traces below
+        // it at /traces; empty for none
+        std::string debugPath = "/debug/metrics";
+
+        // Requests taking at least traceThreshold in total are traced, one
+        // in traceSampling of them, into a ring of the last traceCapacity.
+        // A capacity of 0 turns tracing off.
+        std::chrono::milliseconds traceThreshold{ 100 };
+        std::uint32_t traceSampling = 1;
+        std::size_t traceCapacity = 128;
+    };
+
+    // One slow request, as it went
+    struct RequestTrace {
+        std::chrono::system_clock::time_point finished;
+        std::string method;
+        std::string target;     // the request URI, cut at 256 bytes
+        std::string route;
+        std::string client;
+        std::string version;
+        int status = 0;
+        std::array<std::uint64_t, REQUEST_PHASES> nanos{};
+    };
+
+    // Histograms of one event loop by route and status, each with one per
+    // phase. Only the loop's thread records; adding a status it has not
+    // seen before is the only step that takes the lock readers take.
+    class LoopMetrics {
+    public:
+        using Phases = std::array<LatencyHistogram, REQUEST_PHASES>;
+
+        // Routes are numbered from 0; `routes` is one past the highest
+        explicit LoopMetrics(std::size_t routes) : _routes(routes) { }
+
+        void record(std::size_t route, int status, const std::array<std::uint64_t, REQUEST_PHASES>& nanos);
+
+        // Calls visit(route, status, phases) for everything recorded so far
+        template<typename F>
+        void visit(F&& visit) const {
+            std::lock_guard<std::mutex> lock(_mutex);
+
+            for(std::size_t route = 0; route < _routes.size(); ++route) {
+                for(const auto& entry : _routes[route]) visit(route, entry.status, *entry.phases);
+            }
+        }
+
+        // Whether this slow request is the one in `sampling` to trace
+        bool sample(std::uint32_t sampling) { return sampling != 0 && _slow++ % sampling == 0; }
+
+    private:
+        struct Entry {
+            int status;
+            std::unique_ptr<Phases> phases;
+        };
+
+        mutable std::mutex _mutex;
+        std::vector<std::vector<Entry>> _routes;
+        std::uint64_t _slow = 0;
+    };
+
+    // The last few traces of every loop together, newest first when read
+    class TraceRing {
+    public:
+        explicit TraceRing(std::size_t capacity) : _traces(capacity) { }
+
+        void push(RequestTrace trace);
+        std::vector<RequestTrace> snapshot() const;
+
+    private:
+        mutable std::mutex _mutex;
+        std::vector<RequestTrace> _traces;
+        std::size_t _next = 0;
+        std::size_t _size = 0;
+    };
+}
@@ -0,0 +1,191 @@
+#pragma once
+
+#include "web/request.hh"
+#include "web/response.hh"
+
+#include <concepts>
+#include <memory>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace web::http {
+    enum class Next {
+        CONTINUE,
+        STOP        // skip routing and the remaining layers, send the response as is
+    };
+
+    // A middleware is any type with one or both of
+    //
+    //     Next before(HttpRequest& request, HttpResponse& response);
+    //     void after(const HttpRequest& request, HttpResponse& response);
+    //
+    // before() runs in registration order ahead of routing, after() runs in
+    // reverse order on the final response, for every layer whose before()
+    // ran. A layer that stops fills in `response` itself. Layers are shared
+    // by every connection (and every I/O thread), so they must not keep
+    // per-request state in members.
+    template<typename T>
+    concept HasBefore = requires(T& layer, HttpRequest& request, HttpResponse& response) {
+        { layer.before(request, response) } -> std::same_as<Next>;
+    };
+
+    template<typename T>
+    concept HasAfter = requires(T& layer, const HttpRequest& request, HttpResponse& response) {
+        layer.after(request, response);
+    };
+
+    template<typename T>
+    concept MiddlewareLayer = HasBefore<T> || HasAfter<T>;
+
+    // Adapts a plain `Next(HttpRequest&, HttpResponse&)` callable
+    template<typename F>
+    struct BeforeLayer {
+        F fn;
+        Next before(HttpRequest& request, HttpResponse& response) { return fn(request, response); }
+    };
+
+    // Statically composed layers. A chain is one stage of the server
+    // pipeline, and the calls to its layers are resolved at compile time and
+    // inlined, so e.g. auth + CORS + logging cost one indirect call in total.
+    template<MiddlewareLayer... Layers>
+    class Chain {
+    public:
+        static constexpr std::size_t WIDTH = sizeof...(Layers);
+
+        explicit Chain(Layers... layers) : _layers(std::move(layers)...) { }
+
+        // Returns how many layers were entered and whether the last one stopped
+        std::pair<std::size_t, Next> enter(HttpRequest& request, HttpResponse& response) {
+            return enter(request, response, std::index_sequence_for<Layers...>{});
+        }
+
+        // Runs after() on the first `entered` layers, innermost first
+        void leave(std::size_t entered, const HttpRequest& request, HttpResponse& response) {
+            leave(entered, request, response, std::index_sequence_for<Layers...>{});
+        }
+
+        static constexpr bool hasAfter() { return (HasAfter<Layers> || ...); }
+
+    private:
+        template<std::size_t... I>
+        std::pair<std::size_t, Next> enter(HttpRequest& request, HttpResponse& response, std::index_sequence<I...>) {
+            std::size_t entered = 0;
+            Next next = Next::CONTINUE;
+
+            auto step = [&](auto& layer) {
+                ++entered;
+                next = callBefore(layer, request, response);
+                return next == Next::CONTINUE;
+            };
+
+            // && folds left to right and short-circuits on the first STOP
+            static_cast<void>((step(std::get<I>(_layers)) && ...));
+
+            return { entered, next };
+        }
+
+        template<std::size_t... I>
+        void leave(std::size_t entered, const HttpRequest& request, HttpResponse& response, std::index_sequence<I...>) {
+            constexpr auto LAST = sizeof...(I) - 1;
+            ((LAST - I < entered ? callAfter(std::get<LAST - I>(_layers), request, response) : void()), ...);
+        }
+
+        template<typename T>
+        static Next callBefore(T& layer, HttpRequest& request, HttpResponse& response) {
+            if constexpr (HasBefore<T>) { return layer.before(request, response); }
+            else                        { return Next::CONTINUE; }
+        }
+
+        template<typename T>
+        static void callAfter(T& layer, const HttpRequest& request, HttpResponse& response) {
+            if constexpr (HasAfter<T>) { layer.after(request, response); }
+        }
+
+        std::tuple<Layers...> _layers;
+    };
+
+    template<MiddlewareLayer... Layers>
+    Chain<std::decay_t<Layers>...> chain(Layers&&... layers) {
+        return Chain<std::decay_t<Layers>...>(std::forward<Layers>(layers)...);
+    }
+
+    template<typename T>
+    struct IsChain : std::false_type { };
+
+    template<typename... Layers>
+    struct IsChain<Chain<Layers...>> : std::true_type { };
+
+    // Runtime list of registered stages, flattened as each one is added, so
+    // the pipeline runs the same before start() (HttpServer::process()) as
+    // after it. Each stage is a Chain reached through a plain function pointer;
+    // running the pipeline performs no allocation.
+    class Pipeline {
+    public:
+        template<typename M>
+        void add(M&& middleware) {
+            using Layer = std::decay_t<M>;
+
+            if constexpr (IsChain<Layer>::value) {
+                addChain(std::make_shared<Layer>(std::forward<M>(middleware)));
+            }
+            else if constexpr (MiddlewareLayer<Layer>) {
+                addChain(std::make_shared<Chain<Layer>>(std::forward<M>(middleware)));
+            }
+            else {
+                static_assert(std::is_invocable_r_v<Next, Layer&, HttpRequest&, HttpResponse&>,
+                    "middleware needs before()/after() members or to be callable as Next(HttpRequest&, HttpResponse&)");
+                addChain(std::make_shared<Chain<BeforeLayer<Layer>>>(BeforeLayer<Layer>{ std::forward<M>(middleware) }));
+            }
+        }
+
+        bool empty() const { return _stages.empty(); }
+
+        // Returns the number of layers entered, to be handed to after()
+        std::pair<std::size_t, Next> before(HttpRequest& request, HttpResponse& response) const;
+        void after(std::size_t entered, const HttpRequest& request, HttpResponse& response) const;
+
+    private:
+        struct Stage {
+            void* chain;
+            std::size_t offset;
+            std::size_t width;
+
+            std::pair<std::size_t, Next> (*enter)(void*, HttpRequest&, HttpResponse&);
+            void (*leave)(void*, std::size_t, const HttpRequest&, HttpResponse&);
+        };
+
+        template<typename C>
+        void addChain(std::shared_ptr<C> chain) {
+            Stage stage;
+            stage.chain  = chain.get();
+            stage.offset = 0;
+            stage.width  = C::WIDTH;
+            stage.enter  = [](void* self, HttpRequest& request, HttpResponse& response) {
+                return static_cast<C*>(self)->enter(request, response);
+            };
+            stage.leave  = nullptr;
+
+            if constexpr (C::hasAfter()) {
+                stage.leave = [](void* self, std::size_t entered, const HttpRequest& request, HttpResponse& response) {
+                    static_cast<C*>(self)->leave(entered, request, response);
+                };
+            }
+
+            _owners.push_back(std::move(chain));
+            _stages.push_back(stage);
+
+            compose();
+        }
+
+        // Lays the stages out for dispatch
+        void compose();
+
+        std::vector<std::shared_ptr<void>> _owners;
+        std::vector<Stage> _stages;
+
+        // Stages that have after() hooks, innermost first
+        std::vector<Stage> _afterStages;
+    };
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstdint>
+#include <string_view>
+
+namespace web::http {
+    // Media type for a file name's extension, ASCII case-insensitive, or
+    // application/octet-stream. Served from a table with a perfect hash
+    // built at compile time, so a lookup neither allocates nor probes.
+    std::string_view mimeType(std::string_view filename);
+
+    // Media types the server acts on; everything else is OTHER
+    enum class MediaType : std::uint8_t {
+        NONE,               // no Content-Type at all
+        JSON,               // application/json and +json suffixes
+        FORM,               // application/x-www-form-urlencoded
+        MULTIPART_FORM,     // multipart/form-data
+        MULTIPART_OTHER,    // any other multipart/*
+        TEXT,               // text/plain
+        HTML,
+        XML,                // application/xml, text/xml and +xml suffixes
+        EVENT_STREAM,
+        OCTET_STREAM,
+        OTHER
+    };
+
+    // A Content-Type value split once into its kind and the parameters the
+    // server uses. Views point into the header value.
+    struct ContentType {
+        MediaType kind = MediaType::NONE;
+        std::string_view type;      // "type/subtype" as sent, without parameters
+        std::string_view charset;
+        std::string_view boundary;  // unquoted
+
+        bool is(MediaType other) const { return kind == other; }
+        bool isMultipart() const { return kind == MediaType::MULTIPART_FORM || kind == MediaType::MULTIPART_OTHER; }
+    };
+
+    ContentType parseContentType(std::string_view value);
+}
@@ -0,0 +1,148 @@
+#pragma once
+
+#include "util/type.hh"
+#include "web/headers.hh"
+#include "web/request.hh"
+#include "web/worker.hh"
+
+#include <array>
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace web::http {
+    // Incremental multipart/* parser. Input may be split anywhere, including
+    // inside a delimiter or a part's headers. Like ChunkedDecoder it works
+    // on the caller's bytes and returns one event at a time, so the caller
+    // can wait (write to disk, say) between them. The delimiter is found with
+    // Boyer-Moore-Horspool, which skips most of a part body without looking
+    // at each byte.
+    class MultipartParser {
+    public:
+        enum class Event {
+            NEED_MORE,  // all input used, nothing completed
+            HEADERS,    // a part begins, see headers(), name() and filename()
+            DATA,       // a piece of the current part's body
+            PART_END,
+            DONE,       // the close delimiter; anything after it is ignored
+            FAILED
+        };
+
+        explicit MultipartParser(std::string_view boundary, std::size_t maxHeaderSize = 8 * 1024);
+
+        // Consumes input up to and including the next event; `consumed` is
+        // set to the bytes used. DATA's `data` points into `input` or into
+        // the parser and stays valid until the next call. NEED_MORE always
+        // uses all of the input.
+        Event parse(std::string_view input, std::size_t& consumed, std::string_view& data);
+
+        bool done() const   { return _state == State::DONE; }
+        bool failed() const { return _state == State::FAILED; }
+
+        // The current part's headers, and its Content-Disposition parameters
+        const HttpHeaders& headers() const              { return _headers; }
+        const std::string& name() const                 { return _name; }
+        const std::optional<std::string>& filename() const { return _filename; }
+
+    private:
+        enum class State {
+            PREAMBLE,       // before the first delimiter, discarded
+            DELIMITER_END,  // after a delimiter: "--", or padding up to CRLF
+            CLOSE,          // the second '-' of the close delimiter
+            DELIMITER_LF,
+            HEADERS,
+            BODY,
+            DONE,
+            FAILED
+        };
+
+        // Finds the delimiter in `input`, or the start of a partial one at its end
+        std::size_t search(std::string_view input, bool& partial) const;
+        bool parseHeaders();
+
+        std::string _delimiter;                 // CRLF "--" boundary
+        std::array<std::uint8_t, 256> _skip;    // BMH shift per last byte of the window
+        std::size_t _maxHeaderSize;
+
+        State _state = State::PREAMBLE;
+
+        // A tail of the last input that may begin a delimiter, held back
+        // until the next input shows whether it does
+        std::string _lookbehind;
+        std::string _released;      // a lookbehind that turned out to be data
+
+        std::string _head;
+        HttpHeaders _headers;
+        std::string _name;
+        std::optional<std::string> _filename;
+    };
+
+    struct MultipartLimits {
+        std::size_t maxParts = 1000;
+        std::size_t maxFieldSize = 64 * 1024;           // one in-memory field
+        std::size_t maxFieldsSize = 1024 * 1024;        // all of them together
+        std::uint64_t maxFileSize = UINT64_MAX;         // one file part
+        std::size_t maxHeaderSize = 8 * 1024;           // one part's headers
+
+        // File parts go to temp files here (the system temp directory when
+        // empty), written whenever this many bytes have been buffered
+        std::filesystem::path tempDirectory;
+        std::size_t writeBuffer = 64 * 1024;
+
+        // When set, file writes run on the pool instead of the event loop
+        WorkerPool* workers = nullptr;
+    };
+
+    struct MultipartField {
+        std::string name;
+        std::string value;
+        std::string contentType;
+    };
+
+    // An uploaded file, already on disk. The temp file is removed with the
+    // form unless it has been saved somewhere else first.
+    struct MultipartFile {
+        std::string name;           // the form field
+        std::string filename;       // as sent by the client; never use it as a path unchecked
+        std::string contentType;
+        std::filesystem::path path;
+        std::uint64_t size = 0;
+    };
+
+    // A multipart/form-data request body, read from the request's body
+    // stream: fields in memory, files straight to temp files, so memory use
+    // stays bounded by the limits and write buffer whatever the upload size.
+    // Register the route with BodyMode::STREAMING, and raise the server's
+    // maxBodySize for large uploads. A buffered body is parsed the same way.
+    // Malformed bodies throw MalformedBody, exceeded limits BodyTooLarge.
+    class MultipartForm {
+    public:
+        MultipartForm() = default;
+        ~MultipartForm();
+
+        MultipartForm(MultipartForm&& other) noexcept = default;
+        MultipartForm& operator=(MultipartForm&& other) noexcept;
+
+        static boost::asio::awaitable<MultipartForm> read(const HttpRequest& request, MultipartLimits limits = {});
+
+        const std::vector<MultipartField>& fields() const   { return _fields; }
+        const std::vector<MultipartFile>& files() const     { return _files; }
+
+        std::optional<std::string_view> field(std::string_view name) const;    // first with this name
+        const MultipartFile* file(std::string_view name) const;
+
+        // Moves the file's temp file to `destination`, copying across file
+        // systems; the form no longer removes it. False if that failed.
+        bool save(const MultipartFile& file, const std::filesystem::path& destination);
+
+    private:
+        void removeFiles();
+
+        std::vector<MultipartField> _fields;
+        std::vector<MultipartFile> _files;
+        std::vector<std::filesystem::path> _temporary;     // still ours to remove
+    };
+}
@@ -0,0 +1,116 @@
+#pragma once
+
+#include "util/type.hh"
+#include "web/request.hh"
+#include "web/response.hh"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace web::http {
+    class UpstreamConnection;
+
+    struct UpstreamTarget {
+        std::string host;
+        std::uint16_t port;
+    };
+
+    struct ProxyOptions {
+        std::vector<UpstreamTarget> targets;
+
+        // Send the client's Host on instead of the target's host:port
+        bool preserveHost = false;
+
+        // Kept-alive connections parked per target on each event loop, and
+        // how long one may sit there before it is no longer trusted
+        std::size_t maxIdlePerTarget = 32;
+        std::chrono::seconds idleTimeout{ 30 };
+
+        std::chrono::milliseconds connectTimeout{ 2000 };
+        std::chrono::milliseconds responseTimeout{ 30000 };    // request sent until the response head
+        std::chrono::milliseconds bodyTimeout{ 30000 };        // each read or write of a body
+
+        // A target failing this many times in a row (refused, timed out,
+        // broken framing or a 502/503/504) is left out for ejectionTime
+        std::size_t ejectAfter = 5;
+        std::chrono::milliseconds ejectionTime{ 10000 };
+    };
+
+    // Forwards requests to a set of HTTP/1.1 upstreams, see HttpServer::proxy().
+    // Each request goes to the target with the fewest requests in flight.
+    // Connections are pooled per event loop and reused while the upstream
+    // keeps them alive. Bodies are relayed as they arrive in both directions,
+    // so the client's speed throttles the upstream and the other way round.
+    // Failures before the response head answer 502, timeouts 504.
+    // Must be owned by a shared_ptr; responses in flight hold on to it.
+    class ReverseProxy : public std::enable_shared_from_this<ReverseProxy> {
+    public:
+        using Clock = std::chrono::steady_clock;
+
+        struct TargetStats {
+            std::string   address;
+            std::uint64_t requests;
+            std::uint64_t failures;
+            std::int64_t  outstanding;
+            bool          ejected;
+        };
+
+        explicit ReverseProxy(ProxyOptions options);
+        ~ReverseProxy();
+
+        ReverseProxy(const ReverseProxy&) = delete;
+        ReverseProxy& operator=(const ReverseProxy&) = delete;
+
+        // Must run on the event loop of the request's connection
+        boost::asio::awaitable<HttpResponse> forward(const HttpRequest& request);
+        boost::asio::awaitable<HttpResponse> forward(const HttpRequest& request, std::string uri);
+
+        const ProxyOptions& options() const { return _options; }
+        std::vector<TargetStats> stats() const;
+
+    private:
+        struct Target {
+            std::string host;
+            std::string port;
+            std::string address;    // host:port, for Host and the logs
+
+            std::atomic<std::int64_t>  outstanding = 0;
+            std::atomic<std::uint64_t> requests = 0;
+            std::atomic<std::uint64_t> failures = 0;
+            std::atomic<std::uint32_t> consecutiveFailures = 0;
+            std::atomic<Clock::rep>    ejectedUntil = 0;
+        };
+
+        // One event loop's parked connections, by target; only that loop touches it
+        struct Pool {
+            std::vector<std::vector<std::shared_ptr<UpstreamConnection>>> idle;
+        };
+
+        struct Lease;
+
+        Pool& pool(const boost::asio::any_io_executor& executor);
+        std::size_t pick();
+        void report(std::size_t target, bool success);
+        void release(Lease& lease);
+
+        boost::asio::awaitable<std::shared_ptr<UpstreamConnection>> acquire(Pool& pool, std::size_t target);
+        boost::asio::awaitable<HttpResponse> exchange(std::shared_ptr<Lease> lease, const HttpRequest& request, const std::string& uri);
+        static boost::asio::awaitable<void> relay(std::shared_ptr<Lease> lease, BodyWriter& writer);
+
+        ProxyOptions _options;
+        std::vector<std::unique_ptr<Target>> _targets;
+        std::atomic<std::size_t> _next = 0;
+
+        // Distinguishes this proxy in each thread's memo of its pool
+        const std::uint64_t _id;
+
+        std::mutex _poolsMutex;
+        std::unordered_map<const void*, std::unique_ptr<Pool>> _pools;
+    };
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include "web/middleware.hh"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+namespace web::http {
+    enum class RateLimitKey {
+        CLIENT_ADDRESS,     // the connection's peer
+        PATH,               // the request path, whoever asks
+        HEADER              // a header's value, e.g. an API key; the client address without one
+    };
+
+    struct RateLimitOptions {
+        // Sustained requests per second, and how many may come at once
+        double rate = 10.0;
+        std::uint32_t burst = 20;
+
+        RateLimitKey key = RateLimitKey::CLIENT_ADDRESS;
+        std::string header;
+
+        // Only requests whose path starts with this are limited
+        std::string prefix;
+
+        // Per-key state lives in a fixed table, rounded up to a power of two.
+        // Keys that land in the same slot share one allowance, so with many
+        // more active keys than slots the limit errs on the strict side.
+        std::size_t slots = 64 * 1024;
+
+        // RateLimit-Limit, -Remaining and -Reset on every limited response,
+        // not only on 429s; never on responses of cached routes
+        bool headers = true;
+    };
+
+    // Middleware allowing each key a rate with GCRA, the generic cell rate
+    // algorithm: a token bucket kept as the time at which it will be full
+    // again. That is one word per key, updated with compare-and-swap, so
+    // every I/O thread shares the table without a lock. Refused requests
+    // get 429 with Retry-After. Copies share their state.
+    //
+    //   RateLimitOptions options;
+    //   options.rate   = 5;
+    //   options.burst  = 10;
+    //   options.prefix = "/api/";
+    //
+    //   server.use(RateLimiter(options));
+    class RateLimiter {
+    public:
+        explicit RateLimiter(RateLimitOptions options = {});
+
+        Next before(HttpRequest& request, HttpResponse& response);
+        void after(const HttpRequest& request, HttpResponse& response);
+
+        const RateLimitOptions& options() const;
+
+        // Requests refused so far
+        std::uint64_t limited() const;
+
+    private:
+        struct State;
+        std::shared_ptr<State> _state;
+    };
+}
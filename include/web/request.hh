@@ -1,8 +1,19 @@
 #pragma once
 
+#include "util/type.hh"
+#include "web/headers.hh"
+#include "web/json.hh"
+#include "web/mime.hh"
+
+#include <boost/container/small_vector.hpp>
+
+#include <cstdint>
+#include <stdexcept>
 #include <string>
+#include <string_view>
 #include <unordered_map>
 #include <optional>
+#include <vector>
 
 namespace web::http {
     enum class Method {
@@ -26,14 +37,51 @@ namespace web::http {
         UNKNOWN
     };
 
+    // Thrown by a BodyReader once the body exceeds the server's limit
+    class BodyTooLarge : public std::runtime_error {
+    public:
+        BodyTooLarge() : std::runtime_error("request body is too large") { }
+    };
+
+    // Thrown by a BodyReader on broken chunked framing or a truncated body
+    class MalformedBody : public std::runtime_error {
+    public:
+        using std::runtime_error::runtime_error;
+    };
+
+    // Source for a request body that is consumed as it arrives. read()
+    // returns the next piece, valid until the following read(), and an empty
+    // view once the body is complete.
+    class BodyReader {
+    public:
+        virtual ~BodyReader() = default;
+
+        virtual boost::asio::awaitable<std::string_view> read() = 0;
+
+        // True once read() has returned the end of the body
+        virtual bool finished() const = 0;
+
+        // Collects the rest of the body
+        boost::asio::awaitable<std::string> readAll();
+    };
+
     class HttpRequest {
     public:
+        // Decoded name and value, in order of appearance; names may repeat
+        using QueryParam  = std::pair<std::string_view, std::string_view>;
+        using QueryParams = boost::container::small_vector<QueryParam, 8>;
+
         HttpRequest() = default;
         explicit HttpRequest(const std::string& rawRequest);
 
-        bool parse(const std::string& buffer);
+        bool parse(std::string_view buffer);
         bool isComplete() const;
 
+        // For transports that deliver the head already split into fields (HTTP/2)
+        void beginHead(std::string_view method, std::string_view uri, Version version);
+        void addHeader(std::string_view name, std::string_view value) { _headers.add(name, value); _contentType.value.reset(); }
+        bool endHead();
+
         Method method() const { return _method; }
 
         const std::string& uri()    const { return _uri; }
@@ -42,18 +90,53 @@ namespace web::http {
         
         Version version() const { return _version; }
 
-        const std::unordered_map<std::string, std::string>& headers() const { return _headers; }
+        const HttpHeaders& headers() const { return _headers; }
         const std::string& body() const { return _body; }
+        void body(std::string body)     { _body = std::move(body); _json.value.reset(); }
+
+        // Set only for streaming routes, whose body has not been read yet
+        BodyReader* bodyReader() const          { return _bodyReader; }
+        void bodyReader(BodyReader* reader)     { _bodyReader = reader; }
+
+        // The peer's address, set by the connection; parse() and reset() keep it
+        const boost::asio::ip::address& remoteAddress() const   { return _remoteAddress; }
+        void remoteAddress(const boost::asio::ip::address& address) { _remoteAddress = address; }
+
+        // Views stay valid until the request is parsed again or reset
+        std::optional<std::string_view> getHeader(std::string_view name) const { return _headers.get(name); }
+        std::optional<std::string_view> getHeader(Field field) const            { return _headers.get(field); }
+        bool hasHeader(std::string_view name) const                             { return _headers.contains(name); }
+        bool hasHeader(Field field) const                                       { return _headers.contains(field); }
+
+        // Resolved once when the head is parsed
+        std::size_t contentLength() const   { return _contentLength.value_or(0); }
+        bool        hasContentLength() const { return _contentLength.has_value(); }
+        bool        keepAlive() const       { return _keepAlive; }
+        bool        isChunked() const       { return _chunked; }
+
+        // The head broke the framing rules and must be answered with 400
+        bool        malformed() const       { return _malformed; }
 
-        std::optional<std::string>  getHeader(const std::string& name) const;
-        bool                        hasHeader(const std::string& name) const;
-        std::size_t                 contentLength() const;
+        // Content-Type split into kind, charset and boundary on first use
+        const ContentType& contentType() const;
+
+        // The body parsed as JSON on first use, whatever the Content-Type;
+        // check ok() before reading it. Values point into the body.
+        const JsonDocument& json() const;
+
+        // The query is split and percent-decoded on first access, once per
+        // request. Views stay valid until the request is parsed again, reset
+        // or copied.
+        const QueryParams&              queryParams() const;
+        std::optional<std::string_view> queryParam(std::string_view name) const;    // first value
+        std::vector<std::string_view>   queryParamAll(std::string_view name) const;
 
         std::optional<std::string>                   getQueryParam(const std::string& name) const;
         std::unordered_map<std::string, std::string> getQueryParams() const;
 
         std::string methodToString() const;
         std::string versionToString() const;
+        static std::string methodToString(Method method);
         std::string toString() const;
 
         void reset();
@@ -64,20 +147,50 @@ namespace web::http {
         std::string _query;
 
         Version _version = Version::UNKNOWN;
-        std::unordered_map<std::string, std::string> _headers;
+        HttpHeaders _headers;
         std::string _body;
+        BodyReader* _bodyReader = nullptr;
+        boost::asio::ip::address _remoteAddress;
+
+        std::optional<std::uint64_t> _contentLength;
+        bool _keepAlive = false;
+        bool _chunked = false;
+        bool _malformed = false;
 
         bool _isComplete = false;
 
+        // Something derived from the request's own bytes on first use. A
+        // copy starts empty rather than pointing into the original.
+        template<typename T>
+        struct Derived {
+            Derived() = default;
+            Derived(const Derived&) { }
+            Derived& operator=(const Derived&) { value.reset(); return *this; }
+
+            std::optional<T> value;
+        };
+
+        // Values without escapes point into _query, decoded ones into the
+        // arena, which is reserved up front so it never moves
+        struct ParsedQuery {
+            std::string arena;
+            QueryParams params;
+        };
+
+        mutable Derived<ParsedQuery> _parsedQuery;
+        mutable Derived<ContentType> _contentType;
+        mutable Derived<JsonDocument> _json;
+
         Method      stringToMethod(const std::string& method) const;
         Version     stringToVersion(const std::string& version) const;
         
         std::string toLowerCase(const std::string& str) const;
         std::string toUpperCase(const std::string& str) const;
 
-        void parseRequestLine(const std::string& line);
-        void parseHeaderLine(const std::string& line);
+        void parseRequestLine(std::string_view line);
+        void parseHeaderLine(std::string_view line);
         void parseUri(const std::string& uri);
-        void parseQuery(const std::string& query);
+        void parseQuery() const;
+        void resolveHeaders();
     };
 }
\ No newline at end of file
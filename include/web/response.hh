@@ -1,7 +1,17 @@
 #pragma once
 
+#include "util/type.hh"
+#include "web/file.hh"
+#include "web/headers.hh"
+#include "web/json.hh"
+
+#include <cstdint>
+#include <functional>
+#include <memory>
 #include <string>
+#include <string_view>
 #include <unordered_map>
+#include <vector>
 #include <optional>
 #include <sstream>
 #include <ctime>
@@ -45,7 +55,9 @@ namespace web::http {
         EXPECTATION_FAILED  = 417,
         IM_A_TEAPOT        = 418,
         UNPROCESSABLE_ENTITY = 422,
+        UPGRADE_REQUIRED    = 426,
         TOO_MANY_REQUESTS   = 429,
+        REQUEST_HEADER_FIELDS_TOO_LARGE = 431,
         // 5xx Server Error
         INTERNAL_SERVER_ERROR= 500,
         NOT_IMPLEMENTED      = 501,
@@ -55,26 +67,125 @@ namespace web::http {
         HTTP_VERSION_NOT_SUPPORTED = 505
     };
 
+    // Part of a file-backed body: `data` is written from memory, then
+    // `length` bytes of the file starting at `offset` go out with sendfile(2)
+    struct BodySegment {
+        std::string     data;
+        std::uint64_t   offset = 0;
+        std::uint64_t   length = 0;
+    };
+
+    // Sink for a streamed body. write() completes once the transport has
+    // taken the bytes, which is what throttles a producer to the speed of
+    // the client; small writes are coalesced into a bounded window.
+    class BodyWriter {
+    public:
+        virtual ~BodyWriter() = default;
+
+        virtual boost::asio::awaitable<void> write(std::string_view data) = 0;
+
+        // Pushes buffered bytes (and the head, if not sent yet) to the client now
+        virtual boost::asio::awaitable<void> flush() = 0;
+    };
+
+    using BodyProducer = std::function<boost::asio::awaitable<void>(BodyWriter&)>;
+
+    // A complete HTTP/1.1 message, head and body, without a Connection
+    // header; see ResponseCache
+    struct SerializedResponse {
+        std::string bytes;
+        std::size_t headLength = 0;
+        StatusCode status = StatusCode::OK;
+    };
+
     class HttpResponse {
     public:
+        // Sent as the Server header unless a handler sets its own
+        static constexpr std::string_view SERVER_NAME = "HTTP-Lib/1.0";
+
         HttpResponse() = default;
-        explicit HttpResponse(StatusCode code, const std::string& body = "");
+        explicit HttpResponse(StatusCode code, std::string body = "");
 
-        void setDefaultHeaders();
-        
         std::string statusCodeToString(StatusCode code) const;
-        std::string getCurrentTimestamp() const;
+
+        // Precomputed "HTTP/1.1 <code> <reason>\r\n" for 100-599; the
+        // reason is left empty for codes without one
+        static std::string_view statusLine(StatusCode code);
 
         HttpResponse& status(StatusCode code);
-        HttpResponse& body(const std::string& body);
+        HttpResponse& body(std::string body);
+
+        // Moves the in-memory body out, e.g. to re-encode it
+        std::string takeBody() { return std::move(_body); }
         HttpResponse& header(const std::string& name, const std::string& value);
-        HttpResponse& contentType(const std::string& type);
+
+        // Appends without replacing an earlier value, for headers that repeat
+        HttpResponse& addHeader(std::string_view name, std::string_view value);
+        HttpResponse& contentType(std::string_view type);
         HttpResponse& cookie(
             const std::string& name, const std::string& value, 
             const std::string& path = "/", int maxAge = -1
         );
+        HttpResponse& keepAlive(bool keepAlive);
+
+        // File-backed bodies are never loaded into memory
+        HttpResponse& file(std::shared_ptr<File> file);
+        HttpResponse& file(std::shared_ptr<File> file, std::vector<BodySegment> segments);
+
+        // Streamed bodies are produced while they are sent. Without a known
+        // length they go out with Transfer-Encoding: chunked (or, for
+        // HTTP/1.0 peers, delimited by closing the connection)
+        HttpResponse& stream(BodyProducer producer);
+        HttpResponse& stream(BodyProducer producer, std::uint64_t length);
+        HttpResponse& chunked(bool chunked);
+
+        // Sent as these exact bytes instead of being serialized again
+        HttpResponse& serialized(std::shared_ptr<const SerializedResponse> serialized);
+
+        // Marks a response the server may store and replay to other
+        // clients; after() layers leave out anything about this one
+        HttpResponse& shared(bool shared) { _shared = shared; return *this; }
+
+        StatusCode                          statusCode() const  { return _statusCode; }
+        const std::string&                  body() const        { return _body; }
+        const std::shared_ptr<File>&        file() const        { return _file; }
+        const std::vector<BodySegment>&     segments() const    { return _segments; }
+
+        const BodyProducer&                 producer() const    { return _producer; }
+        bool                                isStreaming() const { return static_cast<bool>(_producer); }
+        std::optional<std::uint64_t>        streamLength() const { return _streamLength; }
+        bool                                chunked() const     { return _chunked; }
+        bool                                shared() const      { return _shared; }
+        const std::shared_ptr<const SerializedResponse>& serialized() const { return _serialized; }
+
+        std::uint64_t contentLength() const;
+        bool keepAlive() const { return _keepAlive; }
 
-        std::string getHeader(const std::string& name) const;
+        // 1xx, 204 and 304 never carry a body, whatever was set
+        bool allowsBody() const {
+            auto code = static_cast<int>(_statusCode);
+            return code >= 200 && code != 204 && code != 304;
+        }
+
+        // Whether a Content-Length header set on the response is sent in
+        // place of the measured length: only when there is no body to
+        // measure, as for a proxied HEAD or 304 that reports the length of
+        // the representation. Otherwise the header is dropped.
+        bool keepsContentLength() const {
+            auto code = static_cast<int>(_statusCode);
+            return code >= 200 && code != 204 && _body.empty() && !_file && !isStreaming() &&
+                   _headers.contains(Field::CONTENT_LENGTH);
+        }
+
+        const HttpHeaders& headers() const { return _headers; }
+        std::string_view getHeader(std::string_view name) const;
+
+        // Appends the status line and headers to `out`; the body is written
+        // separately so it never has to be copied next to the headers.
+        // Without `connection`, the Connection header is left to the caller.
+        void writeHead(std::string& out, bool connection = true) const;
+
+        std::string head() const;
         std::string toString() const;
 
         //Helper methods for common responses
@@ -118,16 +229,44 @@ namespace web::http {
             return HttpResponse(StatusCode::NOT_IMPLEMENTED, message);
         }
 
+        static HttpResponse payloadTooLarge(const std::string& message) {
+            return HttpResponse(StatusCode::PAYLOAD_TOO_LARGE, message);
+        }
+
+        static HttpResponse requestTimeout(const std::string& message) {
+            return HttpResponse(StatusCode::REQUEST_TIMEOUT, message);
+        }
+
+        static HttpResponse tooManyRequests(const std::string& message) {
+            return HttpResponse(StatusCode::TOO_MANY_REQUESTS, message);
+        }
+
         static HttpResponse serviceUnavailable(const std::string& message) {
             return HttpResponse(StatusCode::SERVICE_UNAVAILABLE, message);
         }
 
+        static HttpResponse badGateway(const std::string& message) {
+            return HttpResponse(StatusCode::BAD_GATEWAY, message);
+        }
+
+        static HttpResponse gatewayTimeout(const std::string& message) {
+            return HttpResponse(StatusCode::GATEWAY_TIMEOUT, message);
+        }
+
+        static HttpResponse rangeNotSatisfiable(std::uint64_t size) {
+            return HttpResponse(StatusCode::RANGE_NOT_SATISFIABLE)
+                .header("Content-Range", "bytes */" + std::to_string(size));
+        }
+
 
         // Content type helpers
         static HttpResponse json(const std::string& json, StatusCode status) {
             return HttpResponse(status, json).contentType("application/json");
         }
 
+        // Serialized by `build` straight into the body, no string in between
+        static HttpResponse json(const std::function<void(JsonWriter&)>& build, StatusCode status);
+
         static HttpResponse html(const std::string& html, StatusCode status) {
             return HttpResponse(status, html).contentType("text/html; charset=utf-8");
         }
@@ -140,8 +279,19 @@ namespace web::http {
             return HttpResponse(status).header("Location", location);
         }
     private:
-        StatusCode _statusCode;
+        StatusCode _statusCode = StatusCode::OK;
         std::string _body;
-        std::unordered_map<std::string, std::string> _headers;
+        bool _keepAlive = false;
+        HttpHeaders _headers;
+
+        std::shared_ptr<File> _file;
+        std::vector<BodySegment> _segments;
+
+        BodyProducer _producer;
+        std::optional<std::uint64_t> _streamLength;
+        bool _chunked = false;
+
+        std::shared_ptr<const SerializedResponse> _serialized;
+        bool _shared = false;
     };
 }
\ No newline at end of file
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstddef>
+#include <string_view>
+
+namespace web::http::scan {
+    // Byte-scanning kernels for the hot text paths: URL coding and header
+    // parsing. Each is picked once at startup, AVX2 or SSE2 when the CPU
+    // has them, a scalar loop otherwise. All return `length` (or npos for
+    // findCrlf) when nothing matches.
+
+    // First byte equal to `a` or `b`
+    std::size_t findEither(const char* data, std::size_t length, char a, char b);
+
+    // First byte outside the URL unreserved set [A-Za-z0-9-._~]
+    std::size_t findReserved(const char* data, std::size_t length);
+
+    // First "\r\n", and first "\r\n\r\n" (the end of a message head)
+    std::size_t findCrlf(std::string_view data);
+    std::size_t findHeadEnd(std::string_view data);
+
+    // "avx2", "sse2" or "scalar", for logs and benchmarks
+    std::string_view kernel();
+
+    inline std::size_t findEither(std::string_view data, char a, char b) {
+        return findEither(data.data(), data.size(), a, b);
+    }
+
+    inline std::size_t findReserved(std::string_view data) {
+        return findReserved(data.data(), data.size());
+    }
+}
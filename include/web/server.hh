@@ -1,14 +1,46 @@
 #pragma once
 
 #include "util/type.hh"
+#include "web/admission.hh"
+#include "web/cache.hh"
+#include "web/compression.hh"
+#include "web/connection.hh"
+#include "web/json.hh"
+#include "web/metrics.hh"
+#include "web/middleware.hh"
+#include "web/proxy.hh"
+#include "web/ratelimit.hh"
 #include "web/request.hh"
 #include "web/response.hh"
+#include "web/session.hh"
+#include "web/websocket.hh"
+#include "web/worker.hh"
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <optional>
+#include <thread>
+#include <vector>
 
 namespace web::http {
     class HttpConnection;
+    class Http1BodyReader;
+
+    using RouteHandler      = std::function<HttpResponse(const HttpRequest&)>;
 
-    using RouteHandler  = std::function<HttpResponse(const HttpRequest&)>;
-    using Middleware    = std::function<void(HttpRequest&, HttpResponse&, std::function<void()>)>;
+    // Runs as a coroutine on the connection's loop. Anything blocking belongs
+    // on the server's worker pool: co_await server.workers().run(...)
+    using AsyncRouteHandler = std::function<boost::asio::awaitable<HttpResponse>(const HttpRequest&)>;
+
+    // Called once the 101 response is out; set the socket's handlers here,
+    // the server starts it afterwards
+    using WebSocketHandler  = std::function<void(std::shared_ptr<WebSocket>, const HttpRequest&)>;
+
+    enum class BodyMode {
+        BUFFERED,   // the body is read in full before the handler runs
+        STREAMING   // the handler consumes it through request.bodyReader()
+    };
 
     struct HttpServerConfig {
         const int VERSION_MAJOR;
@@ -23,12 +55,85 @@ namespace web::http {
 
         const std::string host;
         std::uint16_t port;
+
+        // Event loops; each extra loop runs on its own thread with its own
+        // SO_REUSEPORT acceptor, the first one is the IOContext given to HttpServer
+        std::size_t threads = 1;
+        bool pinThreads = true;
+
+        // CPU pool for offloaded handler work; 0 threads means one per core
+        std::size_t workerThreads = 0;
+        std::size_t workerQueueCapacity = 1024;
+
+        // Larger request bodies are refused with 413, before they are read
+        // when the Content-Length announces them
+        std::uint64_t maxBodySize = 8 * 1024 * 1024;
+
+        // gzip/deflate negotiated from Accept-Encoding, for compressible
+        // content types at least compressionMinSize bytes long
+        bool compression = true;
+        std::size_t compressionMinSize = 1024;
+        int compressionLevel = 6;
+
+        // Memory for compressed copies of static files; larger files are
+        // sent as is unless a precompressed .gz sits next to them
+        std::size_t compressionCacheSize = 32 * 1024 * 1024;
+
+        // Memory for serialized responses of routes opted in with cache()
+        std::size_t responseCacheSize = 16 * 1024 * 1024;
+
+        // HTTP/2 over cleartext TCP for clients that open with the
+        // connection preface (prior knowledge), on the same port as HTTP/1.1
+        bool http2 = true;
+        std::uint32_t http2MaxConcurrentStreams = 128;
+
+        // Receive window advertised for each stream's request body
+        std::uint32_t http2WindowSize = 1024 * 1024;
+
+        // Deadlines, checked by a once-a-second sweep of each loop, so they
+        // are accurate to about a second. The head is timed from its first
+        // byte; a buffered body as a whole, a streamed one per read.
+        std::chrono::seconds headerTimeout{ 10 };
+        std::chrono::seconds bodyTimeout{ 60 };
+        std::chrono::seconds idleTimeout{ 60 };
+
+        // How long a client may take to accept each write of a response, or
+        // of WebSocket frames; a large file on a slow link that keeps
+        // moving is fine, a client that stops reading is dropped
+        std::chrono::seconds writeTimeout{ 30 };
+
+        // A WebSocket peer silent this long is pinged, and dropped if the
+        // same time passes again without a frame from it; 0 turns it off
+        std::chrono::seconds webSocketPingInterval{ 30 };
+
+        // Request line plus headers (431 beyond), and the request line alone (414)
+        std::size_t maxHeaderSize = 16 * 1024;
+        std::size_t maxUriLength = 8 * 1024;
+
+        // A line on stdout per connection and per request. Each one flushes
+        // under the stream's lock, shared by every loop; metrics() is the
+        // cheap way to see requests.
+        bool accessLog = false;
+    };
+
+    // Totals of every loop's ConnectionCounters
+    struct ConnectionStats {
+        std::uint64_t accepted;
+        std::uint64_t closedByPeer;
+        std::uint64_t idleTimeouts;
+        std::uint64_t headerTimeouts;
+        std::uint64_t bodyTimeouts;
+        std::uint64_t writeTimeouts;
+        std::uint64_t headersTooLarge;
+        std::uint64_t urisTooLong;
+        std::uint64_t bodiesTooLarge;
+        std::uint64_t malformed;
     };
 
     class HttpServer {
     public:
         HttpServer(IOContext& ioc, const HttpServerConfig& config);
-        ~HttpServer() = default;
+        ~HttpServer();
 
         HttpServer& get(const std::string& path, RouteHandler handler);
         HttpServer& post(const std::string& path, RouteHandler handler);
@@ -36,54 +141,233 @@ namespace web::http {
         HttpServer& del(const std::string& path, RouteHandler handler);
         HttpServer& route(Method method, const std::string& path, RouteHandler handler);
 
-        // middleware support
-        HttpServer& use(Middleware middleware);
+        // Streaming routes run as soon as the head has arrived; their
+        // middleware sees the request before the body does
+        HttpServer& get(const std::string& path, AsyncRouteHandler handler);
+        HttpServer& post(const std::string& path, AsyncRouteHandler handler, BodyMode mode = BodyMode::BUFFERED);
+        HttpServer& put(const std::string& path, AsyncRouteHandler handler, BodyMode mode = BodyMode::BUFFERED);
+        HttpServer& del(const std::string& path, AsyncRouteHandler handler);
+        HttpServer& route(Method method, const std::string& path, AsyncRouteHandler handler, BodyMode mode = BodyMode::BUFFERED);
+
+        // WebSocket endpoint; other requests to `path` get 426 Upgrade Required
+        HttpServer& websocket(const std::string& path, WebSocketHandler handler);
+
+        // Caches the GET route's responses under `policy`; register the route
+        // first. Hits are sent as stored bytes over HTTP/1.x, after the
+        // before() hooks but skipping the handler, the after() hooks and
+        // compression, whose effects are already in those bytes. HTTP/2
+        // requests always run the handler.
+        HttpServer& cache(const std::string& path, CachePolicy policy = {});
+
+        // Forwards every request under `prefix`, whatever its method, to the
+        // proxy's upstreams, bodies streamed both ways. Exact routes take
+        // precedence. With stripPrefix the upstream sees the path below it.
+        HttpServer& proxy(const std::string& prefix, ProxyOptions options, bool stripPrefix = false);
+        HttpServer& proxy(const std::string& prefix, std::shared_ptr<ReverseProxy> upstream, bool stripPrefix = false);
+
+        // Expires the store's sessions once a second on the first loop, and
+        // saves its snapshot, if it has a path, when the server stops
+        HttpServer& sessions(std::shared_ptr<SessionStore> store);
+
+        // Admission control: requests past the limits wait or are shed with
+        // 503 before the middleware runs, see web/admission.hh. Off unless set.
+        HttpServer& admission(AdmissionOptions options);
+
+        // Sets the priority of every route registered at `path`, e.g.
+        // CRITICAL for health checks; routes are NORMAL otherwise
+        HttpServer& priority(const std::string& path, Priority priority);
+
+        // Latency histograms of every route by status, split into phases,
+        // and traces of slow requests; served as JSON at options.debugPath,
+        // so call it before registering other routes under that path
+        HttpServer& metrics(MetricsOptions options = {});
+
+        // middleware support, see web/middleware.hh; must be called before start()
+        template<typename M>
+        HttpServer& use(M&& middleware) {
+            _pipeline.add(std::forward<M>(middleware));
+            return *this;
+        }
 
         // static file serving
         HttpServer& serveStatic(const std::string& urlPath, const std::string& filePath);
         
         void start();
+
+        // May be called from any thread; each loop closes its own
+        // connections, and worker loops are joined before it returns
         void stop();
 
+        // Runs a request through the middleware and router the way a
+        // connection would, without any I/O. Async routes are not run and
+        // answer 501. Meant for tests and benchmarks.
+        HttpResponse process(HttpRequest& request);
+
         const HttpServerConfig& config() const { return _config; }
+        WorkerPool& workers() { return *_workerPool; }
+        ConnectionStats connectionStats() const;
+        ResponseCache::Stats responseCacheStats() const { return _responseCache.stats(); }
+        SessionStore* sessions() const { return _sessions.get(); }
+        AdmissionController* admission() const { return _admission.get(); }
+
+        // What the debug routes serve, slowest route first by total p99, in
+        // microseconds; empty objects with metrics off
+        void writeMetrics(JsonWriter& json) const;
+        void writeTraces(JsonWriter& json) const;
+
+        static constexpr std::size_t NO_ROUTE = SIZE_MAX;
+
+        // One request's way through begin(), respond() and end()
+        struct Exchange {
+            std::size_t entered = 0;                    // middleware layers to leave
+            const CachePolicy* cachePolicy = nullptr;
+            std::string cacheKey;
+            std::shared_ptr<ResponseCache::Fill> fill;  // this request fills a cache miss
+            bool waitForFill = false;                   // another one does
+            bool cached = false;                        // the response is a cache hit
+            bool admitted = false;                      // holds an admission slot
+            std::size_t route = NO_ROUTE;               // index into the route table
+        };
+
     private:
-        void accept();
-        HttpResponse handleRequest(const HttpRequest& request);
+        struct LoopThread {
+            std::unique_ptr<IOContext> ioc;
+            std::unique_ptr<EventLoop> loop;
+            std::thread thread;
+        };
 
         struct Route {
             Method method;
             std::string path;
             RouteHandler handler;
+            AsyncRouteHandler asyncHandler;
+            BodyMode bodyMode = BodyMode::BUFFERED;
+            WebSocketHandler socketHandler = nullptr;
+            std::shared_ptr<const CachePolicy> cachePolicy = nullptr;
+            Priority priority = Priority::NORMAL;
+            bool prefix = false;    // matches `path` and below, any method
         };
 
+        void listen(TcpAcceptor& acceptor);
+        void accept(EventLoop& loop);
+
+        // Times out the loop's connections whose deadline has passed
+        void sweep(EventLoop& loop);
+
+        // Measures the loop's lag every CoDel target, drives the controller
+        // from the first loop, and resumes accepting once the overload is over
+        void probe(EventLoop& loop);
+        HttpServer& addRoute(Route route);
+
+        // Admission control ahead of begin(), when it is enabled. A request
+        // that has to QUEUE gets its answer from queue(); a SHED one has its
+        // 503 in `response` and goes straight on to end().
+        AdmissionController::Admission admit(const HttpRequest& request, HttpResponse& response, Exchange& exchange, const EventLoop& loop);
+        boost::asio::awaitable<AdmissionController::Admission> queue(const HttpRequest& request, HttpResponse& response, Exchange& exchange);
+        void shed(HttpResponse& response) const;
+
+        // Request processing shared by every transport. begin() runs the
+        // before() hooks and synchronous routing; when it returns a route,
+        // that route's async handler still has to be awaited via respond().
+        // end() runs the after() hooks on the final response.
+        const Route* begin(HttpRequest& request, HttpResponse& response, Exchange& exchange);
+        boost::asio::awaitable<void> respond(const Route& route, const HttpRequest& request, HttpResponse& response, Exchange& exchange);
+        void end(Exchange& exchange, const HttpRequest& request, HttpResponse& response);
+
+        const Route* findRoute(const HttpRequest& request) const;
+        std::size_t routeIndex(const Route* route) const { return route ? static_cast<std::size_t>(route - _routes.data()) : NO_ROUTE; }
+        std::string routeLabel(std::size_t index) const;
+
+        // Adds a request that has been answered to its loop's histograms,
+        // and to the traces if it was slow
+        void record(EventLoop& loop, const HttpRequest& request, const Exchange& exchange, StatusCode status, const RequestTiming& timing);
+        HttpResponse dispatch(const HttpRequest& request, const Route* route);
+        bool lookupCache(const Route& route, const HttpRequest& request, HttpResponse& response, Exchange& exchange);
+        std::string cacheKey(const CachePolicy& policy, const HttpRequest& request) const;
+        HttpResponse serveFile(const HttpRequest& request, const std::string& path);
+        std::optional<HttpResponse> serveCompressedFile(const HttpRequest& request, const std::string& path, std::shared_ptr<File> file);
+
+        void compress(const HttpRequest& request, HttpResponse& response);
+
         IOContext& _ioc;
-        TcpAcceptor _acceptor;
+        EventLoop _mainLoop;
         HttpServerConfig _config;
-    
+
+        // Loops beyond the first, created by start()
+        std::vector<LoopThread> _loopThreads;
+
+        std::unique_ptr<WorkerPool> _workerPool;
+
+        // Read-only once the server is running, shared by every loop
         std::vector<Route> _routes;
-        std::vector<Middleware> _middlewares;
+        Pipeline _pipeline;
         std::unordered_map<std::string, std::string> _staticDirectories;
 
-        bool _isRunning = false;
+        CompressionCache _compressionCache;
+        ResponseCache _responseCache;
+        std::shared_ptr<SessionStore> _sessions;
+        std::unique_ptr<AdmissionController> _admission;
+        std::optional<MetricsOptions> _metrics;
+        std::unique_ptr<TraceRing> _traces;
+
+        std::atomic<bool> _isRunning = false;
         friend class HttpConnection;
+        friend class Http2Connection;
     };
 
-    class HttpConnection : public std::enable_shared_from_this<HttpConnection> {
+    class HttpConnection : public Connection, public std::enable_shared_from_this<HttpConnection> {
     public:
-        HttpConnection(TcpSocket socket, HttpServer& server);
-        ~HttpConnection() = default;
+        HttpConnection(TcpSocket socket, HttpServer& server, EventLoop& loop);
+        ~HttpConnection();
 
         void start();
+        void close() override;
+        void timeout() override;
     private:
+        // What the connection is waiting for, which decides what a timeout means
+        enum class Phase {
+            IDLE,       // the next request, on a kept-alive connection
+            HEAD,       // the rest of a request head
+            BODY,       // a request body
+            RESPONDING, // the handler
+            WRITE       // the client reading the response
+        };
+
         void read();
+        void readHead(std::size_t length);
+        bool checkHeadLimits(std::string_view head);
+        void readBody();
+        void reject(HttpResponse response);
         void processRequest();
-        void write(const HttpResponse& response);
+        void serveRequest();
+        void finishRequest();
+        void upgrade();
+        void write(HttpResponse response);
+        void writeSerialized();
+        boost::asio::awaitable<void> streamBody();
+        void writeSegment(std::size_t index);
+        void sendFile(std::size_t index, std::uint64_t offset, std::uint64_t remaining);
+        void complete();
+
+        // Each write the client has to take in gets writeTimeout
+        void armWrite() { deadline(_loop.now + _server.config().writeTimeout); }
 
         TcpSocket _socket;
         HttpServer& _server;
+        EventLoop& _loop;
         boost::asio::streambuf _buffer;
+        std::unique_ptr<Http1BodyReader> _bodyReader;
 
         HttpRequest _request;
+        HttpResponse _response;
+        HttpServer::Exchange _exchange;
+        RequestTiming _timing;
         std::string _responseData;
+
+        Phase _phase = Phase::HEAD;
+        bool _timedOut = false;
+
+        // How much of the buffer has been searched for the end of the head
+        std::size_t _scanned = 0;
     };
 }
\ No newline at end of file
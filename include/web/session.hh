@@ -0,0 +1,189 @@
+#pragma once
+
+#include "web/request.hh"
+#include "web/response.hh"
+
+#include <boost/intrusive/list.hpp>
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+namespace web::http {
+    struct SessionOptions {
+        // Independently locked parts of the store, rounded up to a power of two
+        std::size_t shards = 16;
+
+        // Idle time after which a session is gone; every lookup restarts it
+        std::chrono::seconds ttl{ 30 * 60 };
+
+        // Approximate bytes of all sessions together; beyond it the least
+        // recently used ones are dropped
+        std::size_t budget = 64 * 1024 * 1024;
+
+        std::string cookieName = "murly_session";
+        std::string cookiePath = "/";
+        std::string sameSite = "Lax";
+        bool secure = false;
+
+        // Loaded when the store is created and saved when a server using it
+        // stops, so sessions survive a restart; empty for none
+        std::filesystem::path snapshotPath;
+    };
+
+    // A session's attributes. Stored sessions are never changed in place:
+    // update() swaps in a modified copy, so a lookup hands out a reference
+    // that stays valid and consistent without holding any lock.
+    using SessionData = std::unordered_map<std::string, std::string>;
+    using Session = std::shared_ptr<const SessionData>;
+
+    // Server-side sessions in memory, keyed by a random 128-bit id sent as
+    // a cookie. The id picks a shard and is its own hash, so a lookup is a
+    // parse of the cookie, one short lock and a map probe. Expiry runs on a
+    // timing wheel advanced by expire(), once a second when the store is
+    // given to HttpServer::sessions(); lookups never return an expired one
+    // whenever the wheel last ran.
+    //
+    //   auto sessions = std::make_shared<SessionStore>();
+    //   server.sessions(sessions);
+    //   ...
+    //   if(auto session = sessions->find(request)) user = session->at("user");
+    //   sessions->attach(response, sessions->create({ { "user", name } }));
+    class SessionStore {
+    public:
+        struct Stats {
+            std::uint64_t hits;
+            std::uint64_t misses;
+            std::uint64_t expired;
+            std::uint64_t evictions;    // dropped for the budget
+            std::size_t   sessions;
+            std::size_t   bytes;
+        };
+
+        explicit SessionStore(SessionOptions options = {});
+
+        SessionStore(const SessionStore&) = delete;
+        SessionStore& operator=(const SessionStore&) = delete;
+
+        // Returns the new session's id
+        std::string create(SessionData data = {});
+
+        // Null for unknown, malformed and expired ids
+        Session find(std::string_view id);
+
+        // Runs `change` on a copy of the session and stores the result.
+        // It runs under the shard's lock, so keep it short. False if the
+        // session is gone.
+        bool update(std::string_view id, const std::function<void(SessionData&)>& change);
+
+        bool erase(std::string_view id);
+
+        // Moves the session to a fresh id, e.g. on login, so an id handed
+        // out before cannot be used to ride along; empty if it is gone
+        std::string rotate(std::string_view id);
+
+        // The session named by the request's cookie
+        std::optional<std::string_view> sessionId(const HttpRequest& request) const;
+        Session find(const HttpRequest& request);
+
+        // Sets or clears the session cookie on a response
+        void attach(HttpResponse& response, std::string_view id) const;
+        void detach(HttpResponse& response) const;
+
+        // Advances the timing wheel to now and drops expired sessions;
+        // returns how many
+        std::size_t expire();
+
+        // Writes every live session with its remaining time, replacing
+        // `path` atomically. The format is for the same build on the same
+        // machine, not for exchange.
+        bool save(const std::filesystem::path& path) const;
+
+        // Adds the sessions of a snapshot that have not expired; returns how many
+        std::size_t load(const std::filesystem::path& path);
+
+        Stats stats() const;
+        const SessionOptions& options() const { return _options; }
+
+    private:
+        struct Key {
+            std::uint64_t high;
+            std::uint64_t low;
+
+            bool operator==(const Key& other) const { return high == other.high && low == other.low; }
+        };
+
+        // Ids are random, so any 64 bits of one are as good as a hash
+        struct KeyHash {
+            std::size_t operator()(const Key& key) const { return static_cast<std::size_t>(key.low); }
+        };
+
+        using Hook = boost::intrusive::list_member_hook<boost::intrusive::link_mode<boost::intrusive::auto_unlink>>;
+
+        // Linked into its shard's LRU list and into the wheel slot of its
+        // deadline; both unlink themselves when the entry is destroyed
+        struct Entry {
+            Key key{};
+            Session data;
+            std::size_t cost = 0;
+            std::uint32_t expires = 0;  // tick at which it is gone
+            Hook recency;
+            Hook schedule;
+        };
+
+        template<Hook Entry::* Member>
+        using List = boost::intrusive::list<
+            Entry,
+            boost::intrusive::member_hook<Entry, Hook, Member>,
+            boost::intrusive::constant_time_size<false>
+        >;
+
+        // One tick per second; a slot holds the entries due at every tick
+        // congruent to it, those due rounds later are passed over until then
+        static constexpr std::size_t WHEEL_SLOTS = 256;
+
+        struct Shard {
+            mutable std::mutex mutex;
+            std::unordered_map<Key, Entry, KeyHash> entries;
+            List<&Entry::recency> recency;      // most recently used first
+            std::array<List<&Entry::schedule>, WHEEL_SLOTS> wheel;
+            std::uint32_t swept = 0;            // the last tick expire() has handled
+            std::size_t bytes = 0;
+
+            std::uint64_t hits = 0;
+            std::uint64_t misses = 0;
+            std::uint64_t expired = 0;
+            std::uint64_t evictions = 0;
+        };
+
+        static bool parseId(std::string_view id, Key& key);
+        static std::string formatId(const Key& key);
+        static Key randomKey();
+        static std::size_t cost(const SessionData& data);
+
+        Shard& shardOf(const Key& key) { return _shards[key.high & _mask]; }
+        std::uint32_t now() const;      // the current tick
+
+        // With the shard locked: the live entry for `key`, or null after
+        // dropping an expired one
+        Entry* lookup(Shard& shard, const Key& key, std::uint32_t tick);
+        void insert(Shard& shard, const Key& key, Session data, std::uint32_t expires);
+        void touch(Shard& shard, Entry& entry, std::uint32_t tick);
+        void evict(Shard& shard, const Entry& keep);
+
+        SessionOptions _options;
+        std::uint32_t _ttl;             // in ticks
+        std::size_t _shardBudget;
+        std::size_t _mask;
+        std::unique_ptr<Shard[]> _shards;
+        std::int64_t _epoch;            // monotonic seconds at construction
+    };
+}
@@ -1,28 +1,59 @@
 #pragma once
 
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
 #include <unordered_map>
+#include <vector>
 #include <sstream>
 #include <iomanip>
 #include <cctype>
+#include <ctime>
 #include <algorithm>
 
 namespace web::http::utils {
     std::string urlEncode(const std::string& url);
     std::string urlDecode(const std::string& url);
+
+    // Appends the decoded form of `url` to `out`, which grows by at most
+    // url.size() bytes
+    void urlDecode(std::string_view url, std::string& out);
     
-    // MIME type detection
+    // MIME type detection; prefer web::http::mimeType(), which does not allocate
     std::string getMimeType(const std::string& filename);
     
     // HTTP date formatting
     std::string formatHttpDate(std::time_t time);
     std::time_t parseHttpDate(const std::string& dateStr);
+
+    // Current time as an HTTP date, reformatted at most once per second per thread
+    std::string_view currentHttpDate();
     
     // Header parsing utilities
     std::unordered_map<std::string, std::string> parseQueryString(const std::string& query);
     std::unordered_map<std::string, std::string> parseCookies(const std::string& cookieHeader);
+
+    // One cookie's value, the first if the name repeats, without building a map
+    std::optional<std::string_view> findCookie(std::string_view cookieHeader, std::string_view name);
+
+    // Byte ranges (RFC 7233)
+    struct ByteRange {
+        std::uint64_t offset;
+        std::uint64_t length;
+    };
+
+    enum class RangeStatus {
+        NONE,           // no usable Range header, serve the whole representation
+        SATISFIABLE,
+        UNSATISFIABLE
+    };
+
+    RangeStatus parseRange(const std::string& rangeHeader, std::uint64_t size, std::vector<ByteRange>& ranges);
     
-    // Content type helpers
-    bool isJsonContentType(const std::string& contentType);
-    bool isFormContentType(const std::string& contentType);
-    bool isMultipartContentType(const std::string& contentType);
+    // Content type helpers; a request's own type is parsed once, see
+    // HttpRequest::contentType()
+    bool isJsonContentType(std::string_view contentType);
+    bool isFormContentType(std::string_view contentType);
+    bool isMultipartContentType(std::string_view contentType);
 }
\ No newline at end of file
@@ -0,0 +1,134 @@
+#pragma once
+
+#include "util/type.hh"
+#include "web/connection.hh"
+#include "web/request.hh"
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace web::http {
+    // WebSocket connections (RFC 6455), taken over from an HttpConnection
+    // once the 101 Switching Protocols response has gone out.
+    //
+    // Incoming frames are unmasked in place in the read buffer, and a
+    // message that arrives in a single frame is handed to onMessage as a
+    // view into that buffer. Outgoing frames are encoded up front, so a
+    // broadcast encodes a message once and queues the same frame on every
+    // socket.
+    class WebSocket : public Connection, public std::enable_shared_from_this<WebSocket> {
+    public:
+        enum class Opcode : std::uint8_t {
+            CONTINUATION = 0x0,
+            TEXT         = 0x1,
+            BINARY       = 0x2,
+            CLOSE        = 0x8,
+            PING         = 0x9,
+            PONG         = 0xa
+        };
+
+        // Close status codes used by the server
+        static constexpr std::uint16_t NORMAL_CLOSURE   = 1000;
+        static constexpr std::uint16_t GOING_AWAY       = 1001;
+        static constexpr std::uint16_t PROTOCOL_ERROR   = 1002;
+        static constexpr std::uint16_t INVALID_DATA     = 1007;
+        static constexpr std::uint16_t MESSAGE_TOO_BIG  = 1009;
+
+        // A peer this many frames behind is disconnected
+        static constexpr std::size_t MAX_PENDING_FRAMES = 1024;
+
+        using Frame          = std::shared_ptr<const std::string>;
+        using MessageHandler = std::function<void(Opcode opcode, std::string_view payload)>;
+        using CloseHandler   = std::function<void()>;
+
+        // `received` is whatever followed the upgrade request on the socket
+        WebSocket(TcpSocket socket, EventLoop& loop, std::string received);
+        ~WebSocket();
+
+        // Set before start(); called on the socket's executor
+        void onMessage(MessageHandler handler) { _onMessage = std::move(handler); }
+        void onClose(CloseHandler handler)     { _onClose = std::move(handler); }
+
+        // Messages larger than this are refused with MESSAGE_TOO_BIG
+        void maxMessageSize(std::size_t size) { _maxMessageSize = size; }
+
+        // A peer silent for `ping` is pinged, and dropped if `ping` passes
+        // again without a frame; one that takes longer than `write` to accept
+        // a write is dropped too. Zero turns either off. Set before start().
+        void timeouts(std::chrono::seconds ping, std::chrono::seconds write) { _pingInterval = ping; _writeTimeout = write; }
+
+        void start();
+
+        // Must be called on executor(); frames from encode() can be shared
+        // between any number of sockets
+        void send(Frame frame);
+        void send(Opcode opcode, std::string_view payload);
+
+        // Starts the closing handshake
+        void close(std::uint16_t code, std::string_view reason);
+
+        // Drops the connection without a handshake
+        void close() override;
+
+        // Pings a silent peer, or drops one that did not answer or read
+        void timeout() override;
+
+        boost::asio::any_io_executor executor() { return _socket.get_executor(); }
+
+        // Builds a complete unmasked server frame
+        static Frame encode(Opcode opcode, std::string_view payload);
+
+        // Sec-WebSocket-Accept for a client's Sec-WebSocket-Key
+        static std::string acceptKey(std::string_view key);
+
+        // Whether `request` is a well-formed upgrade to WebSocket
+        static bool isUpgrade(const HttpRequest& request);
+
+        // XORs `data` with the 4-byte masking key, whose first byte applies
+        // to data[0]. Vectorized; done in place.
+        static void unmask(char* data, std::size_t length, std::array<std::uint8_t, 4> key);
+
+    private:
+        boost::asio::awaitable<void> readFrames();
+
+        // Returns false once the connection should stop reading
+        bool handleFrame(bool fin, Opcode opcode, std::string_view payload);
+        void fail(std::uint16_t code, std::string_view reason);
+        void write();
+
+        // The deadline that applies now: the write in flight, else the
+        // peer's silence
+        void armDeadline();
+
+        TcpSocket _socket;
+        EventLoop& _loop;
+
+        std::string _input;
+
+        // Fragments of the message being reassembled
+        std::string _message;
+        Opcode _messageOpcode = Opcode::CONTINUATION;
+        std::size_t _maxMessageSize = 16 * 1024 * 1024;
+
+        std::deque<Frame> _pending;
+        std::vector<Frame> _writing;
+        std::vector<boost::asio::const_buffer> _buffers;
+
+        MessageHandler _onMessage;
+        CloseHandler _onClose;
+
+        std::chrono::seconds _pingInterval{ 0 };
+        std::chrono::seconds _writeTimeout{ 0 };
+        bool _pingSent = false;
+
+        bool _closeSent = false;
+        bool _closed = false;
+    };
+}
@@ -0,0 +1,192 @@
+#pragma once
+
+#include "util/type.hh"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <thread>
+#include <tuple>
+#include <type_traits>
+#include <vector>
+
+namespace web::http {
+    // Bounded pool of CPU threads for work that must not run on an I/O loop
+    // (disk, compression, heavy serialization). A coroutine hops onto a
+    // worker with `co_await pool.run(fn)` and is resumed on its own executor
+    // with the result.
+    class WorkerPool {
+    public:
+        // Thrown into the awaiting coroutine when the queue is full
+        class Overloaded : public std::runtime_error {
+        public:
+            Overloaded() : std::runtime_error("worker queue is full") { }
+        };
+
+        struct Stats {
+            std::size_t     threads;
+            std::size_t     capacity;
+            std::size_t     depth;          // queued, not yet picked up
+            std::size_t     maxDepth;       // high-water mark of depth
+            std::size_t     active;         // running right now
+            std::uint64_t   submitted;
+            std::uint64_t   completed;
+            std::uint64_t   rejected;
+        };
+
+        WorkerPool(std::size_t threads, std::size_t capacity);
+        ~WorkerPool();
+
+        WorkerPool(const WorkerPool&) = delete;
+        WorkerPool& operator=(const WorkerPool&) = delete;
+
+        template<typename F>
+        boost::asio::awaitable<std::invoke_result_t<F&>> run(F fn);
+
+        // Queues `fn` without anyone waiting for it, e.g. to fill a cache;
+        // false when the queue is full. Exceptions from it are dropped.
+        template<typename F>
+        bool submit(F fn);
+
+        // Finishes the queued work and joins the threads; later run() calls
+        // are rejected with Overloaded
+        void shutdown();
+
+        Stats stats() const;
+
+    private:
+        struct Task {
+            virtual ~Task() = default;
+            virtual void run() = 0;
+        };
+
+        // Runs `fn` on a worker, then posts the completion back to the
+        // awaiting coroutine's executor
+        template<typename F, typename Executor, typename Handler>
+        struct Job : Task {
+            using Result = std::invoke_result_t<F&>;
+
+            Job(F fn, Executor executor, Handler handler)
+                : fn(std::move(fn)), executor(std::move(executor)), handler(std::move(handler)) { }
+
+            void run() override {
+                std::exception_ptr error;
+
+                if constexpr (std::is_void_v<Result>) {
+                    try { fn(); }
+                    catch(...) { error = std::current_exception(); }
+
+                    complete(error);
+                }
+                else {
+                    std::optional<Result> result;
+
+                    try { result.emplace(fn()); }
+                    catch(...) { error = std::current_exception(); }
+
+                    complete(error, std::move(result));
+                }
+            }
+
+            void reject() {
+                if constexpr (std::is_void_v<Result>) { complete(std::make_exception_ptr(Overloaded())); }
+                else { complete(std::make_exception_ptr(Overloaded()), std::optional<Result>()); }
+            }
+
+            template<typename... Args>
+            void complete(Args&&... args) {
+                auto values = std::make_tuple(std::forward<Args>(args)...);
+
+                boost::asio::post(executor, [handler = std::move(handler), values = std::move(values)]() mutable {
+                    std::apply([&](auto&... value) { std::move(handler)(std::move(value)...); }, values);
+                });
+            }
+
+            F fn;
+            Executor executor;
+            Handler handler;
+        };
+
+        template<typename F>
+        struct Detached : Task {
+            explicit Detached(F fn) : fn(std::move(fn)) { }
+
+            void run() override {
+                try { fn(); }
+                catch(...) { }
+            }
+
+            F fn;
+        };
+
+        // Takes ownership only when there is room in the queue
+        bool enqueue(std::unique_ptr<Task>& task);
+        void work();
+
+        const std::size_t _capacity;
+
+        mutable std::mutex _mutex;
+        std::condition_variable _ready;
+        std::deque<std::unique_ptr<Task>> _queue;
+        bool _stopping = false;
+
+        std::vector<std::thread> _threads;
+
+        std::size_t _maxDepth = 0;
+        std::atomic<std::size_t> _active = 0;
+        std::atomic<std::uint64_t> _submitted = 0;
+        std::atomic<std::uint64_t> _completed = 0;
+        std::atomic<std::uint64_t> _rejected = 0;
+    };
+
+    template<typename F>
+    boost::asio::awaitable<std::invoke_result_t<F&>> WorkerPool::run(F fn) {
+        using Result = std::invoke_result_t<F&>;
+        using Signature = std::conditional_t<
+            std::is_void_v<Result>,
+            void(std::exception_ptr),
+            void(std::exception_ptr, std::optional<Result>)
+        >;
+
+        auto executor = co_await boost::asio::this_coro::executor;
+
+        auto initiate = [this, executor, fn = std::move(fn)](auto handler) mutable {
+            using Handler = decltype(handler);
+            using JobType = Job<F, decltype(executor), Handler>;
+
+            auto job  = std::make_unique<JobType>(std::move(fn), executor, std::move(handler));
+            auto raw  = job.get();
+            auto task = std::unique_ptr<Task>(std::move(job));
+
+            if(!enqueue(task)) {
+                raw->reject();
+            }
+        };
+
+        if constexpr (std::is_void_v<Result>) {
+            co_await boost::asio::async_initiate<const boost::asio::use_awaitable_t<>&, Signature>(
+                std::move(initiate), boost::asio::use_awaitable
+            );
+        }
+        else {
+            auto result = co_await boost::asio::async_initiate<const boost::asio::use_awaitable_t<>&, Signature>(
+                std::move(initiate), boost::asio::use_awaitable
+            );
+
+            co_return std::move(*result);
+        }
+    }
+
+    template<typename F>
+    bool WorkerPool::submit(F fn) {
+        auto task = std::unique_ptr<Task>(std::make_unique<Detached<F>>(std::move(fn)));
+
+        return enqueue(task);
+    }
+}
@@ -0,0 +1,194 @@
+#include "chat/events.hh"
+
+#include <charconv>
+#include <iostream>
+#include <vector>
+
+using namespace chat;
+using namespace web::http;
+
+// Lives on the executor of the connection streaming to it
+struct EventBridge::Subscriber {
+    explicit Subscriber(Executor executor) : executor(executor), timer(executor) { }
+
+    void push(Frame frame) {
+        if(dropped) return;
+
+        if(pending.size() >= MAX_PENDING_MSGS) {
+            dropped = true;
+            pending.clear();
+        }
+        else {
+            pending.push_back(std::move(frame));
+        }
+
+        timer.cancel();
+    }
+
+    void drop() {
+        dropped = true;
+        timer.cancel();
+    }
+
+    Executor executor;
+    boost::asio::steady_timer timer;
+    std::deque<Frame> pending;
+    bool dropped = false;
+};
+
+EventBridge::EventBridge(Room& room, Executor executor)
+    : _room(room), _executor(std::move(executor)) {
+}
+
+void EventBridge::start() {
+    auto self(shared_from_this());
+
+    boost::asio::dispatch(_executor, [this, self]() {
+        _room.join(self);
+    });
+}
+
+void EventBridge::stop() {
+    auto self(shared_from_this());
+
+    boost::asio::dispatch(_executor, [this, self]() {
+        _room.leave(self);
+
+        for(const auto& subscriber : _subscribers) {
+            boost::asio::dispatch(subscriber->executor, [subscriber]() { subscriber->drop(); });
+        }
+
+        _subscribers.clear();
+    });
+}
+
+void EventBridge::deliver(const Message& msg) {
+    auto id    = _nextId++;
+    auto frame = encode(id, std::string_view(msg.body(), msg.bodyLength()));
+
+    _recentFrames.emplace_back(id, frame);
+
+    while(_recentFrames.size() > Room::MAX_RECENT_MSGS) {
+        _recentFrames.pop_front();
+    }
+
+    for(const auto& subscriber : _subscribers) {
+        boost::asio::dispatch(subscriber->executor, [subscriber, frame]() { subscriber->push(frame); });
+    }
+}
+
+HttpResponse EventBridge::subscribe(const HttpRequest& request) {
+    // A reconnecting EventSource says where it left off
+    std::optional<std::uint64_t> lastEventId;
+
+    if(auto header = request.getHeader("last-event-id")) {
+        std::uint64_t id = 0;
+        auto result = std::from_chars(header->data(), header->data() + header->size(), id);
+
+        if(result.ec == std::errc()) lastEventId = id;
+    }
+
+    auto self(shared_from_this());
+
+    HttpResponse response(StatusCode::OK);
+    response.contentType("text/event-stream")
+            .header("Cache-Control", "no-cache")
+            .stream([self, lastEventId](BodyWriter& writer) {
+                return self->stream(lastEventId, writer);
+            });
+
+    return response;
+}
+
+EventBridge::Frame EventBridge::encode(std::uint64_t id, std::string_view body) {
+    auto frame = std::make_shared<std::string>();
+    frame->reserve(body.size() + 32);
+
+    frame->append("id: ").append(std::to_string(id)).append("\n");
+
+    // A line break inside the message continues it on another data line
+    while(true) {
+        auto end  = body.find_first_of("\r\n");
+        auto line = body.substr(0, end);
+
+        frame->append("data: ").append(line).append("\n");
+
+        if(end == std::string_view::npos) break;
+
+        body.remove_prefix(end + ((body.substr(end, 2) == "\r\n") ? 2 : 1));
+    }
+
+    frame->append("\n");
+    return frame;
+}
+
+void EventBridge::add(std::shared_ptr<Subscriber> subscriber, std::optional<std::uint64_t> lastEventId) {
+    // Catch the subscriber up the way Room::join does for a native session
+    std::vector<Frame> backlog;
+
+    for(const auto& [id, frame] : _recentFrames) {
+        if(!lastEventId || id > *lastEventId) backlog.push_back(frame);
+    }
+
+    if(!backlog.empty()) {
+        boost::asio::dispatch(subscriber->executor, [subscriber, backlog = std::move(backlog)]() {
+            for(const auto& frame : backlog) subscriber->push(frame);
+        });
+    }
+
+    _subscribers.insert(std::move(subscriber));
+}
+
+boost::asio::awaitable<void> EventBridge::stream(std::optional<std::uint64_t> lastEventId, BodyWriter& writer) {
+    auto self(shared_from_this());
+    auto subscriber = std::make_shared<Subscriber>(co_await boost::asio::this_coro::executor);
+
+    boost::asio::post(_executor, [self, subscriber, lastEventId]() {
+        self->add(subscriber, lastEventId);
+    });
+
+    // However the stream ends, unsubscribe on the room's executor
+    struct Unsubscribe {
+        ~Unsubscribe() {
+            subscriber->dropped = true;
+
+            boost::asio::post(self->_executor, [self = self, subscriber = subscriber]() {
+                self->_subscribers.erase(subscriber);
+            });
+        }
+
+        std::shared_ptr<EventBridge> self;
+        std::shared_ptr<Subscriber> subscriber;
+    } unsubscribe{ self, subscriber };
+
+    co_await writer.write("retry: 3000\n\n");
+    co_await writer.flush();
+
+    while(!subscriber->dropped) {
+        if(subscriber->pending.empty()) {
+            boost::system::error_code ec;
+
+            subscriber->timer.expires_after(HEARTBEAT);
+            co_await subscriber->timer.async_wait(boost::asio::redirect_error(boost::asio::use_awaitable, ec));
+
+            if(!ec) {
+                co_await writer.write(":\n\n");
+                co_await writer.flush();
+            }
+
+            continue;
+        }
+
+        // Everything queued goes out in one flush
+        while(!subscriber->pending.empty()) {
+            auto frame = std::move(subscriber->pending.front());
+            subscriber->pending.pop_front();
+
+            co_await writer.write(*frame);
+        }
+
+        co_await writer.flush();
+    }
+
+    std::cout<<"Event stream ended: subscriber fell behind or the bridge stopped."<<std::endl;
+}
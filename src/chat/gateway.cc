@@ -0,0 +1,94 @@
+#include "chat/gateway.hh"
+
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+using namespace chat;
+using web::http::WebSocket;
+
+static_assert(WebSocket::MAX_PENDING_FRAMES == ParticipantImpl::MAX_PENDING_MSGS,
+    "browsers and native sessions should be cut off at the same backlog");
+
+WebSocketGateway::WebSocketGateway(Room& room, Executor executor)
+    : _room(room), _executor(std::move(executor)) {
+}
+
+void WebSocketGateway::start() {
+    auto self(shared_from_this());
+
+    boost::asio::dispatch(_executor, [this, self]() {
+        _room.join(self);
+    });
+}
+
+void WebSocketGateway::stop() {
+    auto self(shared_from_this());
+
+    boost::asio::dispatch(_executor, [this, self]() {
+        _room.leave(self);
+
+        for(const auto& socket : _sockets) {
+            boost::asio::dispatch(socket->executor(), [socket]() {
+                socket->close(WebSocket::GOING_AWAY, "server shutting down");
+            });
+        }
+
+        _sockets.clear();
+    });
+}
+
+void WebSocketGateway::deliver(const Message& msg) {
+    auto frame = WebSocket::encode(WebSocket::Opcode::TEXT, std::string_view(msg.body(), msg.bodyLength()));
+
+    _recentFrames.push_back(frame);
+
+    while(_recentFrames.size() > Room::MAX_RECENT_MSGS) {
+        _recentFrames.pop_front();
+    }
+
+    for(const auto& socket : _sockets) {
+        boost::asio::dispatch(socket->executor(), [socket, frame]() { socket->send(frame); });
+    }
+}
+
+void WebSocketGateway::accept(Socket socket, const web::http::HttpRequest& /*request*/) {
+    auto self(shared_from_this());
+    std::weak_ptr<WebSocket> weak = socket;
+
+    // A chat message has to fit in one native Message
+    socket->maxMessageSize(Message::MAX_BODY_LENGTH);
+
+    socket->onMessage([this, self](WebSocket::Opcode, std::string_view payload) {
+        auto msg = Message();
+        msg.bodyLength(payload.size());
+
+        std::memcpy(msg.body(), payload.data(), msg.bodyLength());
+        msg.encodeHeader();
+
+        boost::asio::post(_executor, [this, self, msg]() { _room.deliver(msg); });
+    });
+
+    socket->onClose([this, self, weak]() {
+        if(auto socket = weak.lock()) {
+            boost::asio::post(_executor, [this, self, socket]() { _sockets.erase(socket); });
+        }
+    });
+
+    boost::asio::post(_executor, [this, self, socket]() { add(socket); });
+}
+
+void WebSocketGateway::add(Socket socket) {
+    std::cout<<"A WebSocket has joined the room."<<std::endl;
+
+    // Catch the socket up the way Room::join does for a native session
+    std::vector<WebSocket::Frame> backlog(_recentFrames.begin(), _recentFrames.end());
+
+    if(!backlog.empty()) {
+        boost::asio::dispatch(socket->executor(), [socket, backlog = std::move(backlog)]() {
+            for(const auto& frame : backlog) socket->send(frame);
+        });
+    }
+
+    _sockets.insert(std::move(socket));
+}
@@ -19,6 +19,18 @@ void Session::start() {
 }
 
 void Session::deliver(const Message& msg) {
+    if(!_socket.is_open()) return;
+
+    if(_writeMsgs.size() >= MAX_PENDING_MSGS) {
+        // Too slow to keep up. Closing fails the pending read, which leaves
+        // the room; leaving here would disturb the room's delivery loop.
+        std::cout<<" Disconnect from client. Too many messages pending."<<std::endl;
+
+        boost::system::error_code ec;
+        _socket.close(ec);
+        return;
+    }
+
     bool writeInProgress = !_writeMsgs.empty();
 
     _writeMsgs.push_back(msg);
@@ -0,0 +1,222 @@
+#include "web/admission.hh"
+
+#include <algorithm>
+
+using namespace web::http;
+
+AdmissionController::AdmissionController(AdmissionOptions options)
+    : _options(std::move(options)),
+      _maxInFlight(std::max<std::size_t>(_options.maxInFlight, 1)),
+      _intervalEnd(Clock::now() + _options.interval) {
+}
+
+AdmissionController::Admission AdmissionController::enter(Priority priority, Clock::duration delay) {
+    if(priority == Priority::CRITICAL) {
+        _admitted.fetch_add(1, std::memory_order_relaxed);
+        return Admission::ADMITTED;
+    }
+
+    if(overloaded()) {
+        auto limit = (priority == Priority::LOW) ? _options.target : _options.target * 2;
+
+        if(delay > limit) {
+            sample(delay);
+            _shed.fetch_add(1, std::memory_order_relaxed);
+            return Admission::SHED;
+        }
+    }
+
+    // Nobody waiting: take a slot unless they are all in use. Queued
+    // requests are sampled when they leave the queue instead.
+    if(_waiting.load() == 0) {
+        if(_inFlight.fetch_add(1) < _maxInFlight) {
+            sample(delay);
+            _admitted.fetch_add(1, std::memory_order_relaxed);
+            return Admission::ADMITTED;
+        }
+
+        // Handing it back may let in someone who queued meanwhile
+        leave();
+    }
+
+    return Admission::QUEUE;
+}
+
+boost::asio::awaitable<AdmissionController::Admission> AdmissionController::wait(Priority priority) {
+    auto executor = co_await boost::asio::this_coro::executor;
+
+    auto initiate = [this, executor, priority](auto handler) {
+        using Handler = decltype(handler);
+
+        // use_awaitable handlers are move-only; waiters are copied around
+        auto shared = std::make_shared<Handler>(std::move(handler));
+        auto resume = [executor, shared](Admission admission) {
+            boost::asio::post(executor, [shared, admission]() mutable {
+                std::move(*shared)(admission);
+            });
+        };
+
+        std::unique_lock<std::mutex> lock(_mutex);
+
+        // Counted before looking at the slots, so that a leave() racing
+        // with this either frees a slot seen here or sees the waiter
+        _waiting.fetch_add(1);
+
+        if(_normal.empty() && _low.empty() && _inFlight.load() < _maxInFlight) {
+            _waiting.fetch_sub(1);
+            _inFlight.fetch_add(1);
+            _admitted.fetch_add(1, std::memory_order_relaxed);
+
+            lock.unlock();
+            resume(Admission::ADMITTED);
+            return;
+        }
+
+        if(_normal.size() + _low.size() >= _options.maxQueued) {
+            _waiting.fetch_sub(1);
+            _shed.fetch_add(1, std::memory_order_relaxed);
+
+            lock.unlock();
+            resume(Admission::SHED);
+            return;
+        }
+
+        auto& queue = (priority == Priority::LOW) ? _low : _normal;
+        queue.push_back({ Clock::now(), std::move(resume) });
+
+        _queued.fetch_add(1, std::memory_order_relaxed);
+    };
+
+    co_return co_await boost::asio::async_initiate<const boost::asio::use_awaitable_t<>&, void(Admission)>(
+        std::move(initiate), boost::asio::use_awaitable
+    );
+}
+
+void AdmissionController::leave() {
+    _inFlight.fetch_sub(1);
+
+    if(_waiting.load() == 0) return;
+
+    std::vector<Resume> admit;
+    std::vector<Resume> shed;
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        dispatch(admit, shed);
+    }
+
+    for(auto& resume : shed)  resume(Admission::SHED);
+    for(auto& resume : admit) resume(Admission::ADMITTED);
+}
+
+void AdmissionController::dispatch(std::vector<Resume>& admit, std::vector<Resume>& shed) {
+    auto now = Clock::now();
+    bool standing = overloaded();
+
+    if(standing) {
+        dropOlder(_normal, now - _options.target * 2, shed);
+        dropOlder(_low, now - _options.target, shed);
+    }
+
+    while(_inFlight.load() < _maxInFlight) {
+        auto queue = !_normal.empty() ? &_normal : !_low.empty() ? &_low : nullptr;
+        if(queue == nullptr) break;
+
+        // Newest first while the queue stands: they can still be served in
+        // time, where the oldest would only be served late
+        auto& waiter = standing ? queue->back() : queue->front();
+
+        sample(now - waiter.queued);
+        admit.push_back(std::move(waiter.resume));
+
+        if(standing) { queue->pop_back(); }
+        else         { queue->pop_front(); }
+
+        _waiting.fetch_sub(1);
+        _inFlight.fetch_add(1);
+        _admitted.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+void AdmissionController::dropOlder(Queue& queue, Clock::time_point cutoff, std::vector<Resume>& shed) {
+    while(!queue.empty() && queue.front().queued < cutoff) {
+        shed.push_back(std::move(queue.front().resume));
+        queue.pop_front();
+
+        _waiting.fetch_sub(1);
+        _shed.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+void AdmissionController::sample(Clock::duration delay) {
+    auto nanos = std::chrono::duration_cast<std::chrono::nanoseconds>(delay).count();
+    auto current = _minDelay.load(std::memory_order_relaxed);
+
+    while(nanos < current && !_minDelay.compare_exchange_weak(current, nanos, std::memory_order_relaxed)) { }
+}
+
+void AdmissionController::roll() {
+    std::vector<Resume> admit;
+    std::vector<Resume> shed;
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        auto now = Clock::now();
+
+        dropOlder(_normal, now - _options.maxWait, shed);
+        dropOlder(_low, now - _options.maxWait, shed);
+
+        if(now >= _intervalEnd) {
+            _intervalEnd = now + _options.interval;
+
+            // A queue that nothing left during the interval is standing all the same
+            for(auto queue : { &_normal, &_low }) {
+                if(!queue->empty()) sample(now - queue->front().queued);
+            }
+
+            auto minimum = _minDelay.exchange(NO_SAMPLE, std::memory_order_relaxed);
+            auto target = std::chrono::duration_cast<std::chrono::nanoseconds>(_options.target).count();
+
+            // An interval without requests says nothing either way
+            _overloaded.store(minimum != NO_SAMPLE && minimum > target, std::memory_order_relaxed);
+
+            // Applies the new state to those waiting already
+            dispatch(admit, shed);
+        }
+    }
+
+    for(auto& resume : shed)  resume(Admission::SHED);
+    for(auto& resume : admit) resume(Admission::ADMITTED);
+}
+
+void AdmissionController::shed() {
+    std::vector<Resume> shed;
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        for(auto queue : { &_normal, &_low }) {
+            for(auto& waiter : *queue) shed.push_back(std::move(waiter.resume));
+
+            _waiting.fetch_sub(queue->size());
+            _shed.fetch_add(queue->size(), std::memory_order_relaxed);
+            queue->clear();
+        }
+    }
+
+    for(auto& resume : shed) resume(Admission::SHED);
+}
+
+AdmissionController::Stats AdmissionController::stats() const {
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    return Stats{
+        _admitted.load(std::memory_order_relaxed),
+        _queued.load(std::memory_order_relaxed),
+        _shed.load(std::memory_order_relaxed),
+        _inFlight.load(std::memory_order_relaxed),
+        _normal.size() + _low.size(),
+        overloaded()
+    };
+}
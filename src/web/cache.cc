@@ -0,0 +1,182 @@
+#include "web/cache.hh"
+#include "web/headers.hh"
+
+using namespace web::http;
+
+namespace {
+    bool hasDirective(std::string_view value, std::string_view directive) {
+        bool found = false;
+
+        forEachToken(value, [&found, directive](std::string_view item) {
+            found = found || iequals(item.substr(0, item.find('=')), directive);
+        });
+
+        return found;
+    }
+}
+
+// ============================================================================
+// ResponseCache Implementation
+// ============================================================================
+
+ResponseCache::Lookup ResponseCache::lookup(const std::string& key) {
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    if(auto it = _index.find(key); it != _index.end()) {
+        auto slot = it->second;
+
+        if(slot->expires > Clock::now()) {
+            ++_hits;
+            _slots.splice(_slots.begin(), _slots, slot);
+
+            return { slot->entry, nullptr, false };
+        }
+
+        _size -= cost(*slot);
+        _slots.erase(slot);
+        _index.erase(it);
+    }
+
+    if(_pending.count(key) != 0) {
+        ++_coalesced;
+        return { nullptr, nullptr, true };
+    }
+
+    ++_misses;
+    _pending.emplace(key, std::vector<Waiter>());
+
+    return { nullptr, std::make_shared<Fill>(*this, key), false };
+}
+
+boost::asio::awaitable<ResponseCache::Entry> ResponseCache::wait(const std::string& key) {
+    auto executor = co_await boost::asio::this_coro::executor;
+
+    auto initiate = [this, executor, key](auto handler) {
+        using Handler = decltype(handler);
+
+        // use_awaitable handlers are move-only; waiters are copied around
+        auto shared = std::make_shared<Handler>(std::move(handler));
+        auto resume = [executor, shared](Entry entry) {
+            boost::asio::post(executor, [shared, entry = std::move(entry)]() mutable {
+                std::move(*shared)(std::move(entry));
+            });
+        };
+
+        std::unique_lock<std::mutex> lock(_mutex);
+
+        if(auto pending = _pending.find(key); pending != _pending.end()) {
+            pending->second.push_back(std::move(resume));
+            return;
+        }
+
+        // The fill finished between lookup() and now
+        Entry entry;
+
+        if(auto it = _index.find(key); it != _index.end() && it->second->expires > Clock::now()) {
+            entry = it->second->entry;
+        }
+
+        lock.unlock();
+        resume(std::move(entry));
+    };
+
+    co_return co_await boost::asio::async_initiate<const boost::asio::use_awaitable_t<>&, void(Entry)>(
+        std::move(initiate), boost::asio::use_awaitable
+    );
+}
+
+void ResponseCache::Fill::complete(Entry entry, std::chrono::milliseconds ttl) {
+    if(_done) return;
+    _done = true;
+
+    std::vector<Waiter> waiters;
+
+    {
+        std::lock_guard<std::mutex> lock(_cache._mutex);
+
+        if(auto pending = _cache._pending.find(_key); pending != _cache._pending.end()) {
+            waiters = std::move(pending->second);
+            _cache._pending.erase(pending);
+        }
+
+        if(entry && ttl.count() > 0) _cache.store(_key, entry, ttl);
+    }
+
+    for(auto& waiter : waiters) waiter(entry);
+}
+
+void ResponseCache::store(const std::string& key, Entry entry, std::chrono::milliseconds ttl) {
+    if(auto it = _index.find(key); it != _index.end()) {
+        _size -= cost(*it->second);
+        _slots.erase(it->second);
+        _index.erase(it);
+    }
+
+    Slot slot{ key, std::move(entry), Clock::now() + ttl };
+    if(cost(slot) > _budget) return;
+
+    _size += cost(slot);
+    _slots.push_front(std::move(slot));
+    _index[key] = _slots.begin();
+
+    while(_size > _budget && !_slots.empty()) {
+        auto& victim = _slots.back();
+
+        _size -= cost(victim);
+        _index.erase(victim.key);
+        _slots.pop_back();
+
+        ++_evictions;
+    }
+}
+
+bool ResponseCache::cacheable(const HttpResponse& response) {
+    if(response.isStreaming() || response.file()) return false;
+    if(response.headers().contains(Field::SET_COOKIE)) return false;
+
+    // The connection adds its own when it sends the stored bytes
+    if(response.headers().contains(Field::CONNECTION)) return false;
+
+    if(auto control = response.headers().get(Field::CACHE_CONTROL)) {
+        if(hasDirective(*control, "no-store") || hasDirective(*control, "private") || hasDirective(*control, "no-cache")) {
+            return false;
+        }
+    }
+
+    // Heuristically cacheable statuses (RFC 9111, section 4.2.2), less 206
+    switch(response.statusCode()) {
+        case StatusCode::OK:
+        case StatusCode::NO_CONTENT:
+        case StatusCode::MULTIPLE_CHOICES:
+        case StatusCode::MOVED_PERMANENTLY:
+        case StatusCode::PERMANENT_REDIRECT:
+        case StatusCode::NOT_FOUND:
+        case StatusCode::METHOD_NOT_ALLOWED:
+        case StatusCode::GONE:
+        case StatusCode::URI_TOO_LONG:
+        case StatusCode::NOT_IMPLEMENTED:
+            return true;
+
+        default:
+            return false;
+    }
+}
+
+ResponseCache::Entry ResponseCache::serialize(const HttpResponse& response) {
+    auto serialized = std::make_shared<SerializedResponse>();
+
+    serialized->bytes.reserve(256 + response.body().size());
+    response.writeHead(serialized->bytes, false);
+
+    serialized->headLength = serialized->bytes.size();
+    serialized->bytes.append(response.body());
+    serialized->status = response.statusCode();
+
+    return serialized;
+}
+
+ResponseCache::Stats ResponseCache::stats() const {
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    return { _hits, _misses, _coalesced, _evictions, _slots.size(), _size };
+}
@@ -0,0 +1,116 @@
+#include "web/chunked.hh"
+
+#include <algorithm>
+
+using namespace web::http;
+
+std::string_view ChunkedDecoder::decode(std::string_view input, std::size_t& consumed) {
+    std::size_t position = 0;
+
+    auto fail = [&]() {
+        _state = State::FAILED;
+        consumed = position;
+        return std::string_view();
+    };
+
+    while(position < input.size()) {
+        auto c = input[position];
+
+        switch(_state) {
+            case State::SIZE: {
+                int digit = -1;
+
+                if(c >= '0' && c <= '9')        digit = c - '0';
+                else if(c >= 'a' && c <= 'f')   digit = c - 'a' + 10;
+                else if(c >= 'A' && c <= 'F')   digit = c - 'A' + 10;
+
+                if(digit >= 0) {
+                    // 15 hex digits is far beyond any sane chunk and cannot overflow
+                    if(++_digits > 15) return fail();
+                    _remaining = (_remaining << 4) | static_cast<std::uint64_t>(digit);
+                }
+                else if(_digits == 0)               { return fail(); }
+                else if(c == ';' || c == ' ' || c == '\t') { _state = State::EXTENSION; }
+                else if(c == '\r')                  { _state = State::SIZE_LF; }
+                else                                { return fail(); }
+
+                ++position;
+                break;
+            }
+
+            case State::EXTENSION:
+                // Chunk extensions carry nothing we act on
+                if(c == '\r') _state = State::SIZE_LF;
+                ++position;
+                break;
+
+            case State::SIZE_LF:
+                if(c != '\n') return fail();
+
+                _state = (_remaining == 0) ? State::TRAILER : State::DATA;
+                ++position;
+                break;
+
+            case State::DATA: {
+                auto length = static_cast<std::size_t>(
+                    std::min<std::uint64_t>(_remaining, input.size() - position)
+                );
+
+                auto payload = input.substr(position, length);
+                _remaining -= length;
+
+                if(_remaining == 0) _state = State::DATA_CR;
+
+                consumed = position + length;
+                return payload;
+            }
+
+            case State::DATA_CR:
+                if(c != '\r') return fail();
+                _state = State::DATA_LF;
+                ++position;
+                break;
+
+            case State::DATA_LF:
+                if(c != '\n') return fail();
+                _state = State::SIZE;
+                _digits = 0;
+                ++position;
+                break;
+
+            case State::TRAILER:
+                _state = (c == '\r') ? State::TRAILER_LF : State::TRAILER_LINE;
+                ++position;
+                if(++_trailer > MAX_TRAILER) return fail();
+                break;
+
+            case State::TRAILER_LINE:
+                if(c == '\n') _state = State::TRAILER;
+                ++position;
+                if(++_trailer > MAX_TRAILER) return fail();
+                break;
+
+            case State::TRAILER_LF:
+                if(c != '\n') return fail();
+                _state = State::DONE;
+                ++position;
+                consumed = position;
+                return std::string_view();
+
+            case State::DONE:
+            case State::FAILED:
+                consumed = position;
+                return std::string_view();
+        }
+    }
+
+    consumed = position;
+    return std::string_view();
+}
+
+void ChunkedDecoder::reset() {
+    _state = State::SIZE;
+    _remaining = 0;
+    _digits = 0;
+    _trailer = 0;
+}
@@ -0,0 +1,245 @@
+#include "web/compression.hh"
+#include "web/headers.hh"
+
+#include <stdexcept>
+
+#include <zlib.h>
+
+using namespace web::http;
+
+namespace {
+    // q-value in thousandths, so "q=0.5" compares without floating point
+    int parseQuality(std::string_view parameters) {
+        while(!parameters.empty()) {
+            auto semicolon = parameters.find(';');
+            auto parameter = trim(parameters.substr(0, semicolon));
+
+            if(parameter.size() >= 2 && (parameter[0] == 'q' || parameter[0] == 'Q') && parameter[1] == '=') {
+                auto value = parameter.substr(2);
+                if(value.empty() || (value[0] != '0' && value[0] != '1')) return 0;
+
+                int quality = (value[0] - '0') * 1000;
+                int scale = 100;
+
+                if(value.size() > 1 && value[1] == '.') {
+                    for(std::size_t i = 2; i < value.size() && i < 5; ++i) {
+                        if(value[i] < '0' || value[i] > '9') return 0;
+                        quality += (value[i] - '0') * scale;
+                        scale /= 10;
+                    }
+                }
+
+                return std::min(quality, 1000);
+            }
+
+            if(semicolon == std::string_view::npos) break;
+            parameters.remove_prefix(semicolon + 1);
+        }
+
+        return 1000;
+    }
+}
+
+std::string_view web::http::codingName(ContentCoding coding) {
+    switch(coding) {
+        case ContentCoding::GZIP:       return "gzip";
+        case ContentCoding::DEFLATE:    return "deflate";
+        default:                        return "identity";
+    }
+}
+
+ContentCoding web::http::negotiateCoding(std::string_view acceptEncoding) {
+    int gzip = -1, deflate = -1, wildcard = -1;
+
+    while(!acceptEncoding.empty()) {
+        auto comma = acceptEncoding.find(',');
+        auto item  = trim(acceptEncoding.substr(0, comma));
+
+        auto semicolon = item.find(';');
+        auto name      = trim(item.substr(0, semicolon));
+        auto quality   = (semicolon == std::string_view::npos) ? 1000 : parseQuality(item.substr(semicolon + 1));
+
+        if(iequals(name, "gzip") || iequals(name, "x-gzip"))   gzip = quality;
+        else if(iequals(name, "deflate"))                       deflate = quality;
+        else if(name == "*")                                    wildcard = quality;
+
+        if(comma == std::string_view::npos) break;
+        acceptEncoding.remove_prefix(comma + 1);
+    }
+
+    // Codings not named explicitly fall back to the wildcard
+    if(gzip < 0)    gzip = wildcard;
+    if(deflate < 0) deflate = wildcard;
+
+    if(gzip > 0 && gzip >= deflate) return ContentCoding::GZIP;
+    if(deflate > 0)                 return ContentCoding::DEFLATE;
+
+    return ContentCoding::IDENTITY;
+}
+
+bool web::http::isCompressible(std::string_view contentType) {
+    auto type = trim(contentType.substr(0, contentType.find(';')));
+
+    if(type.size() > 5 && iequals(type.substr(0, 5), "text/")) return true;
+
+    // Structured syntax suffixes, e.g. application/problem+json
+    if(type.size() > 5 && iequals(type.substr(type.size() - 5), "+json")) return true;
+    if(type.size() > 4 && iequals(type.substr(type.size() - 4), "+xml"))  return true;
+
+    static constexpr std::string_view ALLOWED[] = {
+        "application/json",
+        "application/javascript",
+        "application/xml",
+        "application/wasm",
+        "application/x-www-form-urlencoded",
+        "font/ttf",
+        "image/x-icon"
+    };
+
+    for(auto allowed : ALLOWED) {
+        if(iequals(type, allowed)) return true;
+    }
+
+    return false;
+}
+
+// ============================================================================
+// Deflater Implementation
+// ============================================================================
+
+Deflater::Deflater(ContentCoding coding, int level) : _stream(std::make_unique<z_stream>()) {
+    // 15 bits of window; +16 selects the gzip wrapper instead of zlib's
+    auto windowBits = (coding == ContentCoding::GZIP) ? 15 + 16 : 15;
+
+    if(deflateInit2(_stream.get(), level, Z_DEFLATED, windowBits, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        throw std::runtime_error("deflateInit2 failed");
+    }
+}
+
+Deflater::~Deflater() {
+    deflateEnd(_stream.get());
+}
+
+void Deflater::write(std::string_view input, std::string& out, Flush flush) {
+    constexpr std::size_t STEP = 16 * 1024;
+
+    auto mode = (flush == Flush::FINISH) ? Z_FINISH : (flush == Flush::SYNC) ? Z_SYNC_FLUSH : Z_NO_FLUSH;
+
+    _stream->next_in  = reinterpret_cast<Bytef*>(const_cast<char*>(input.data()));
+    _stream->avail_in = static_cast<uInt>(input.size());
+
+    // Keep going while zlib fills the output entirely, it may have more
+    do {
+        auto used = out.size();
+        out.resize(used + STEP);
+
+        _stream->next_out  = reinterpret_cast<Bytef*>(out.data() + used);
+        _stream->avail_out = static_cast<uInt>(STEP);
+
+        auto result = deflate(_stream.get(), mode);
+
+        if(result == Z_STREAM_ERROR) {
+            out.resize(used);
+            throw std::runtime_error("deflate failed");
+        }
+
+        out.resize(used + STEP - _stream->avail_out);
+    } while(_stream->avail_out == 0);
+}
+
+std::string Deflater::compress(std::string_view input, ContentCoding coding, int level) {
+    std::string out;
+    out.reserve(input.size() / 4 + 64);
+
+    Deflater deflater(coding, level);
+    deflater.write(input, out, Flush::FINISH);
+
+    return out;
+}
+
+// ============================================================================
+// CompressingWriter Implementation
+// ============================================================================
+
+boost::asio::awaitable<void> CompressingWriter::write(std::string_view data) {
+    // Fed in slices so a large write doesn't compress into one large buffer
+    while(!data.empty()) {
+        auto slice = data.substr(0, BLOCK * 4);
+        data.remove_prefix(slice.size());
+
+        _deflater.write(slice, _buffer);
+
+        if(_buffer.size() >= BLOCK) {
+            co_await _out.write(_buffer);
+            _buffer.clear();
+        }
+    }
+}
+
+boost::asio::awaitable<void> CompressingWriter::flush() {
+    _deflater.write({}, _buffer, Deflater::Flush::SYNC);
+
+    co_await _out.write(_buffer);
+    _buffer.clear();
+
+    co_await _out.flush();
+}
+
+boost::asio::awaitable<void> CompressingWriter::finish() {
+    _deflater.write({}, _buffer, Deflater::Flush::FINISH);
+
+    co_await _out.write(_buffer);
+    _buffer.clear();
+}
+
+// ============================================================================
+// CompressionCache Implementation
+// ============================================================================
+
+std::shared_ptr<const std::string> CompressionCache::get(const std::string& key) {
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    auto it = _index.find(key);
+    if(it == _index.end()) return nullptr;
+
+    _entries.splice(_entries.begin(), _entries, it->second);
+    return it->second->second;
+}
+
+void CompressionCache::put(const std::string& key, std::shared_ptr<const std::string> data) {
+    if(data->size() > _budget) return;
+
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    if(auto it = _index.find(key); it != _index.end()) {
+        _size -= it->second->second->size();
+        _entries.erase(it->second);
+        _index.erase(it);
+    }
+
+    _size += data->size();
+    _entries.emplace_front(key, std::move(data));
+    _index[key] = _entries.begin();
+
+    while(_size > _budget && !_entries.empty()) {
+        auto& victim = _entries.back();
+
+        _size -= victim.second->size();
+        _index.erase(victim.first);
+        _entries.pop_back();
+    }
+}
+
+bool CompressionCache::claim(const std::string& key) {
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    return _filling.insert(key).second;
+}
+
+void CompressionCache::fill(const std::string& key, std::shared_ptr<const std::string> data) {
+    // Stored before the claim ends, so no one compresses the file again meanwhile
+    if(data != nullptr) put(key, std::move(data));
+
+    std::lock_guard<std::mutex> lock(_mutex);
+    _filling.erase(key);
+}
@@ -0,0 +1,63 @@
+#include "web/file.hh"
+
+#include <cerrno>
+#include <sstream>
+#include <system_error>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace web::http;
+
+File::File(const std::string& path) : _path(path) {
+    _fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+
+    if(_fd < 0) {
+        throw std::system_error(errno, std::generic_category(), "open " + path);
+    }
+
+    struct stat st{};
+
+    if(::fstat(_fd, &st) < 0) {
+        auto err = errno;
+        ::close(_fd);
+        throw std::system_error(err, std::generic_category(), "fstat " + path);
+    }
+
+    _size = static_cast<std::uint64_t>(st.st_size);
+    _lastModified = st.st_mtime;
+}
+
+File::~File() {
+    if(_fd >= 0) ::close(_fd);
+}
+
+std::string File::read() const {
+    std::string contents(_size, '\0');
+    std::uint64_t offset = 0;
+
+    while(offset < _size) {
+        auto count = ::pread(_fd, contents.data() + offset, _size - offset, static_cast<off_t>(offset));
+
+        if(count < 0) {
+            if(errno == EINTR) continue;
+            throw std::system_error(errno, std::generic_category(), "read " + _path);
+        }
+
+        // Truncated underneath us
+        if(count == 0) break;
+
+        offset += static_cast<std::uint64_t>(count);
+    }
+
+    contents.resize(offset);
+    return contents;
+}
+
+std::string File::etag() const {
+    std::ostringstream oss;
+    oss << '"' << std::hex << _size << '-' << static_cast<std::uint64_t>(_lastModified) << '"';
+
+    return oss.str();
+}
@@ -0,0 +1,224 @@
+#include "web/headers.hh"
+
+#include <algorithm>
+
+using namespace web::http;
+
+namespace {
+    constexpr std::array<std::string_view, FIELD_COUNT> FIELD_NAMES = {
+        "Accept",
+        "Accept-Encoding",
+        "Accept-Ranges",
+        "Authorization",
+        "Cache-Control",
+        "Connection",
+        "Content-Encoding",
+        "Content-Length",
+        "Content-Range",
+        "Content-Type",
+        "Cookie",
+        "Date",
+        "ETag",
+        "Expect",
+        "Host",
+        "If-Modified-Since",
+        "If-None-Match",
+        "If-Range",
+        "Last-Modified",
+        "Location",
+        "Range",
+        "Server",
+        "Set-Cookie",
+        "Transfer-Encoding",
+        "Upgrade",
+        "User-Agent",
+        "Vary"
+    };
+
+    constexpr std::size_t MAX_FIELD_NAME = [] {
+        std::size_t longest = 0;
+        for(auto name : FIELD_NAMES) longest = std::max(longest, name.size());
+        return longest;
+    }();
+
+    // Field indices grouped by name length, and where each length's group
+    // starts, so a lookup only compares names that could match
+    struct FieldsByLength {
+        std::array<std::uint8_t, FIELD_COUNT> order{};
+        std::array<std::uint8_t, MAX_FIELD_NAME + 2> start{};
+    };
+
+    constexpr FieldsByLength FIELDS_BY_LENGTH = [] {
+        FieldsByLength table{};
+        std::size_t next = 0;
+
+        for(std::size_t length = 0; length <= MAX_FIELD_NAME; ++length) {
+            table.start[length] = static_cast<std::uint8_t>(next);
+
+            for(std::size_t i = 0; i < FIELD_NAMES.size(); ++i) {
+                if(FIELD_NAMES[i].size() == length) table.order[next++] = static_cast<std::uint8_t>(i);
+            }
+        }
+
+        table.start[MAX_FIELD_NAME + 1] = static_cast<std::uint8_t>(next);
+        return table;
+    }();
+
+    constexpr std::array<unsigned char, 256> LOWER_TABLE = [] {
+        std::array<unsigned char, 256> table{};
+
+        for(std::size_t i = 0; i < table.size(); ++i) {
+            table[i] = static_cast<unsigned char>((i >= 'A' && i <= 'Z') ? i + ('a' - 'A') : i);
+        }
+
+        return table;
+    }();
+}
+
+std::string_view web::http::fieldName(Field field) {
+    auto index = static_cast<std::size_t>(field);
+    return index < FIELD_NAMES.size() ? FIELD_NAMES[index] : std::string_view();
+}
+
+Field web::http::fieldFromName(std::string_view name) {
+    if(name.size() > MAX_FIELD_NAME) return Field::UNKNOWN;
+
+    auto first = FIELDS_BY_LENGTH.start[name.size()];
+    auto last  = FIELDS_BY_LENGTH.start[name.size() + 1];
+
+    for(auto i = first; i < last; ++i) {
+        auto index = FIELDS_BY_LENGTH.order[i];
+        if(iequals(FIELD_NAMES[index], name)) return static_cast<Field>(index);
+    }
+
+    return Field::UNKNOWN;
+}
+
+bool web::http::iequals(std::string_view a, std::string_view b) {
+    if(a.size() != b.size()) return false;
+
+    for(std::size_t i = 0; i < a.size(); ++i) {
+        if(LOWER_TABLE[static_cast<unsigned char>(a[i])] != LOWER_TABLE[static_cast<unsigned char>(b[i])]) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+std::string_view web::http::trim(std::string_view value) {
+    auto first = value.find_first_not_of(" \t");
+    if(first == std::string_view::npos) return std::string_view();
+
+    auto last = value.find_last_not_of(" \t");
+    return value.substr(first, last - first + 1);
+}
+
+bool web::http::hasToken(std::string_view list, std::string_view token) {
+    bool found = false;
+    forEachToken(list, [&found, token](std::string_view item) { found = found || iequals(item, token); });
+
+    return found;
+}
+
+void HttpHeaders::add(std::string_view name, std::string_view value) {
+    auto field = fieldFromName(name);
+
+    Entry entry;
+    entry.nameOffset  = store(name);
+    entry.nameLength  = static_cast<std::uint32_t>(name.size());
+    entry.valueOffset = store(value);
+    entry.valueLength = static_cast<std::uint32_t>(value.size());
+    entry.field       = field;
+
+    _entries.push_back(entry);
+
+    if(field != Field::UNKNOWN && _index[static_cast<std::size_t>(field)] == 0) {
+        _index[static_cast<std::size_t>(field)] = static_cast<std::uint16_t>(_entries.size());
+    }
+}
+
+void HttpHeaders::set(std::string_view name, std::string_view value) {
+    auto entry = const_cast<Entry*>(find(name));
+
+    if(entry == nullptr) {
+        add(name, value);
+        return;
+    }
+
+    // The old bytes stay in the arena until clear(); replacing is rare
+    entry->valueOffset = store(value);
+    entry->valueLength = static_cast<std::uint32_t>(value.size());
+}
+
+void HttpHeaders::set(Field field, std::string_view value) {
+    set(fieldName(field), value);
+}
+
+void HttpHeaders::remove(std::string_view name) {
+    auto removed = std::remove_if(_entries.begin(), _entries.end(), [&](const Entry& entry) {
+        return iequals(this->name(entry), name);
+    });
+
+    if(removed == _entries.end()) return;
+
+    _entries.erase(removed, _entries.end());
+    reindex();
+}
+
+void HttpHeaders::clear() {
+    _arena.clear();
+    _entries.clear();
+    _index.fill(0);
+}
+
+std::optional<std::string_view> HttpHeaders::get(std::string_view name) const {
+    auto entry = find(name);
+    return entry != nullptr ? std::make_optional(value(*entry)) : std::nullopt;
+}
+
+std::optional<std::string_view> HttpHeaders::get(Field field) const {
+    auto position = _index[static_cast<std::size_t>(field)];
+    return position != 0 ? std::make_optional(value(_entries[position - 1])) : std::nullopt;
+}
+
+const HttpHeaders::Entry* HttpHeaders::find(std::string_view name) const {
+    auto field = fieldFromName(name);
+
+    if(field != Field::UNKNOWN) {
+        auto position = _index[static_cast<std::size_t>(field)];
+        return position != 0 ? &_entries[position - 1] : nullptr;
+    }
+
+    for(const auto& entry : _entries) {
+        if(entry.nameLength == name.size() && iequals(this->name(entry), name)) {
+            return &entry;
+        }
+    }
+
+    return nullptr;
+}
+
+std::uint32_t HttpHeaders::store(std::string_view bytes) {
+    if(_arena.empty()) {
+        // Sized for a typical request head so parsing rarely regrows
+        _arena.reserve(512);
+    }
+
+    auto offset = static_cast<std::uint32_t>(_arena.size());
+    _arena.append(bytes);
+
+    return offset;
+}
+
+void HttpHeaders::reindex() {
+    _index.fill(0);
+
+    for(std::size_t i = 0; i < _entries.size(); ++i) {
+        auto field = _entries[i].field;
+
+        if(field != Field::UNKNOWN && _index[static_cast<std::size_t>(field)] == 0) {
+            _index[static_cast<std::size_t>(field)] = static_cast<std::uint16_t>(i + 1);
+        }
+    }
+}
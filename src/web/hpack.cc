@@ -0,0 +1,503 @@
+#include "web/hpack.hh"
+
+#include <algorithm>
+#include <array>
+#include <memory>
+#include <unordered_map>
+#include <utility>
+
+using namespace web::http::hpack;
+
+namespace {
+    // RFC 7541 Appendix A
+    constexpr std::pair<std::string_view, std::string_view> STATIC_TABLE[] = {
+        { ":authority", "" },
+        { ":method", "GET" },
+        { ":method", "POST" },
+        { ":path", "/" },
+        { ":path", "/index.html" },
+        { ":scheme", "http" },
+        { ":scheme", "https" },
+        { ":status", "200" },
+        { ":status", "204" },
+        { ":status", "206" },
+        { ":status", "304" },
+        { ":status", "400" },
+        { ":status", "404" },
+        { ":status", "500" },
+        { "accept-charset", "" },
+        { "accept-encoding", "gzip, deflate" },
+        { "accept-language", "" },
+        { "accept-ranges", "" },
+        { "accept", "" },
+        { "access-control-allow-origin", "" },
+        { "age", "" },
+        { "allow", "" },
+        { "authorization", "" },
+        { "cache-control", "" },
+        { "content-disposition", "" },
+        { "content-encoding", "" },
+        { "content-language", "" },
+        { "content-length", "" },
+        { "content-location", "" },
+        { "content-range", "" },
+        { "content-type", "" },
+        { "cookie", "" },
+        { "date", "" },
+        { "etag", "" },
+        { "expect", "" },
+        { "expires", "" },
+        { "from", "" },
+        { "host", "" },
+        { "if-match", "" },
+        { "if-modified-since", "" },
+        { "if-none-match", "" },
+        { "if-range", "" },
+        { "if-unmodified-since", "" },
+        { "last-modified", "" },
+        { "link", "" },
+        { "location", "" },
+        { "max-forwards", "" },
+        { "proxy-authenticate", "" },
+        { "proxy-authorization", "" },
+        { "range", "" },
+        { "referer", "" },
+        { "refresh", "" },
+        { "retry-after", "" },
+        { "server", "" },
+        { "set-cookie", "" },
+        { "strict-transport-security", "" },
+        { "transfer-encoding", "" },
+        { "user-agent", "" },
+        { "vary", "" },
+        { "via", "" },
+        { "www-authenticate", "" },
+    };
+
+    // RFC 7541 Appendix B; EOS (256) is 30 one bits and only ever appears as padding
+    constexpr std::uint32_t HUFFMAN_CODES[256] = {
+        0x1ff8, 0x7fffd8, 0xfffffe2, 0xfffffe3, 0xfffffe4, 0xfffffe5, 0xfffffe6, 0xfffffe7,
+        0xfffffe8, 0xffffea, 0x3ffffffc, 0xfffffe9, 0xfffffea, 0x3ffffffd, 0xfffffeb, 0xfffffec,
+        0xfffffed, 0xfffffee, 0xfffffef, 0xffffff0, 0xffffff1, 0xffffff2, 0x3ffffffe, 0xffffff3,
+        0xffffff4, 0xffffff5, 0xffffff6, 0xffffff7, 0xffffff8, 0xffffff9, 0xffffffa, 0xffffffb,
+        0x14, 0x3f8, 0x3f9, 0xffa, 0x1ff9, 0x15, 0xf8, 0x7fa,
+        0x3fa, 0x3fb, 0xf9, 0x7fb, 0xfa, 0x16, 0x17, 0x18,
+        0x0, 0x1, 0x2, 0x19, 0x1a, 0x1b, 0x1c, 0x1d,
+        0x1e, 0x1f, 0x5c, 0xfb, 0x7ffc, 0x20, 0xffb, 0x3fc,
+        0x1ffa, 0x21, 0x5d, 0x5e, 0x5f, 0x60, 0x61, 0x62,
+        0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69, 0x6a,
+        0x6b, 0x6c, 0x6d, 0x6e, 0x6f, 0x70, 0x71, 0x72,
+        0xfc, 0x73, 0xfd, 0x1ffb, 0x7fff0, 0x1ffc, 0x3ffc, 0x22,
+        0x7ffd, 0x3, 0x23, 0x4, 0x24, 0x5, 0x25, 0x26,
+        0x27, 0x6, 0x74, 0x75, 0x28, 0x29, 0x2a, 0x7,
+        0x2b, 0x76, 0x2c, 0x8, 0x9, 0x2d, 0x77, 0x78,
+        0x79, 0x7a, 0x7b, 0x7ffe, 0x7fc, 0x3ffd, 0x1ffd, 0xffffffc,
+        0xfffe6, 0x3fffd2, 0xfffe7, 0xfffe8, 0x3fffd3, 0x3fffd4, 0x3fffd5, 0x7fffd9,
+        0x3fffd6, 0x7fffda, 0x7fffdb, 0x7fffdc, 0x7fffdd, 0x7fffde, 0xffffeb, 0x7fffdf,
+        0xffffec, 0xffffed, 0x3fffd7, 0x7fffe0, 0xffffee, 0x7fffe1, 0x7fffe2, 0x7fffe3,
+        0x7fffe4, 0x1fffdc, 0x3fffd8, 0x7fffe5, 0x3fffd9, 0x7fffe6, 0x7fffe7, 0xffffef,
+        0x3fffda, 0x1fffdd, 0xfffe9, 0x3fffdb, 0x3fffdc, 0x7fffe8, 0x7fffe9, 0x1fffde,
+        0x7fffea, 0x3fffdd, 0x3fffde, 0xfffff0, 0x1fffdf, 0x3fffdf, 0x7fffeb, 0x7fffec,
+        0x1fffe0, 0x1fffe1, 0x3fffe0, 0x1fffe2, 0x7fffed, 0x3fffe1, 0x7fffee, 0x7fffef,
+        0xfffea, 0x3fffe2, 0x3fffe3, 0x3fffe4, 0x7ffff0, 0x3fffe5, 0x3fffe6, 0x7ffff1,
+        0x3ffffe0, 0x3ffffe1, 0xfffeb, 0x7fff1, 0x3fffe7, 0x7ffff2, 0x3fffe8, 0x1ffffec,
+        0x3ffffe2, 0x3ffffe3, 0x3ffffe4, 0x7ffffde, 0x7ffffdf, 0x3ffffe5, 0xfffff1, 0x1ffffed,
+        0x7fff2, 0x1fffe3, 0x3ffffe6, 0x7ffffe0, 0x7ffffe1, 0x3ffffe7, 0x7ffffe2, 0xfffff2,
+        0x1fffe4, 0x1fffe5, 0x3ffffe8, 0x3ffffe9, 0xffffffd, 0x7ffffe3, 0x7ffffe4, 0x7ffffe5,
+        0xfffec, 0xfffff3, 0xfffed, 0x1fffe6, 0x3fffe9, 0x1fffe7, 0x1fffe8, 0x7ffff3,
+        0x3fffea, 0x3fffeb, 0x1ffffee, 0x1ffffef, 0xfffff4, 0xfffff5, 0x3ffffea, 0x7ffff4,
+        0x3ffffeb, 0x7ffffe6, 0x3ffffec, 0x3ffffed, 0x7ffffe7, 0x7ffffe8, 0x7ffffe9, 0x7ffffea,
+        0x7ffffeb, 0xffffffe, 0x7ffffec, 0x7ffffed, 0x7ffffee, 0x7ffffef, 0x7fffff0, 0x3ffffee,
+    };
+
+    constexpr std::uint8_t HUFFMAN_LENGTHS[256] = {
+        13, 23, 28, 28, 28, 28, 28, 28, 28, 24, 30, 28, 28, 30, 28, 28,
+        28, 28, 28, 28, 28, 28, 30, 28, 28, 28, 28, 28, 28, 28, 28, 28,
+        6, 10, 10, 12, 13, 6, 8, 11, 10, 10, 8, 11, 8, 6, 6, 6,
+        5, 5, 5, 6, 6, 6, 6, 6, 6, 6, 7, 8, 15, 6, 12, 10,
+        13, 6, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+        7, 7, 7, 7, 7, 7, 7, 7, 8, 7, 8, 13, 19, 13, 14, 6,
+        15, 5, 6, 5, 6, 5, 6, 6, 6, 5, 7, 7, 6, 6, 6, 5,
+        6, 7, 6, 5, 5, 6, 7, 7, 7, 7, 7, 15, 11, 14, 13, 28,
+        20, 22, 20, 20, 22, 22, 22, 23, 22, 23, 23, 23, 23, 23, 24, 23,
+        24, 24, 22, 23, 24, 23, 23, 23, 23, 21, 22, 23, 22, 23, 23, 24,
+        22, 21, 20, 22, 22, 23, 23, 21, 23, 22, 22, 24, 21, 22, 23, 23,
+        21, 21, 22, 21, 23, 22, 23, 23, 20, 22, 22, 22, 23, 22, 22, 23,
+        26, 26, 20, 19, 22, 23, 22, 25, 26, 26, 26, 27, 27, 26, 24, 25,
+        19, 21, 26, 27, 27, 26, 27, 24, 21, 21, 26, 26, 28, 27, 27, 27,
+        20, 24, 20, 21, 22, 21, 21, 23, 22, 22, 25, 25, 24, 24, 26, 23,
+        26, 27, 26, 26, 27, 27, 27, 27, 27, 28, 27, 27, 27, 27, 27, 26,
+    };
+
+    constexpr std::size_t STATIC_COUNT = std::size(STATIC_TABLE);
+
+    // Same-named static entries are adjacent, so the first index of a name
+    // is enough to find every value stored with it
+    std::size_t staticNameIndex(std::string_view name) {
+        static const auto index = [] {
+            std::unordered_map<std::string_view, std::size_t> map;
+
+            for(std::size_t i = STATIC_COUNT; i-- > 0;) {
+                map[STATIC_TABLE[i].first] = i + 1;
+            }
+
+            return map;
+        }();
+
+        auto it = index.find(name);
+        return (it != index.end()) ? it->second : 0;
+    }
+
+    void writeInteger(std::uint64_t value, int prefixBits, std::uint8_t flags, std::string& out) {
+        auto max = (std::uint64_t(1) << prefixBits) - 1;
+
+        if(value < max) {
+            out.push_back(static_cast<char>(flags | value));
+            return;
+        }
+
+        out.push_back(static_cast<char>(flags | max));
+        value -= max;
+
+        while(value >= 128) {
+            out.push_back(static_cast<char>((value & 0x7f) | 0x80));
+            value >>= 7;
+        }
+
+        out.push_back(static_cast<char>(value));
+    }
+
+    std::uint64_t readInteger(std::string_view& input, int prefixBits) {
+        if(input.empty()) throw DecodeError("truncated integer");
+
+        auto max   = (std::uint64_t(1) << prefixBits) - 1;
+        auto value = static_cast<std::uint8_t>(input[0]) & max;
+        input.remove_prefix(1);
+
+        if(value < max) return value;
+
+        for(int shift = 0;; shift += 7) {
+            if(input.empty()) throw DecodeError("truncated integer");
+            if(shift > 56)    throw DecodeError("integer overflow");
+
+            auto byte = static_cast<std::uint8_t>(input[0]);
+            input.remove_prefix(1);
+
+            value += static_cast<std::uint64_t>(byte & 0x7f) << shift;
+            if((byte & 0x80) == 0) return value;
+        }
+    }
+
+    // Huffman decoding walks the code tree four bits at a time: for every
+    // internal node and nibble the table holds the node reached and the
+    // symbol completed on the way, if any (codes are at least 5 bits long,
+    // so there is never more than one)
+    struct HuffmanDecoder {
+        struct Transition {
+            std::uint16_t next;
+            std::int16_t symbol;    // -1: none
+            bool fail;
+        };
+
+        static constexpr std::size_t MAX_NODES = 2 * 257;
+
+        std::array<std::array<std::int16_t, 2>, MAX_NODES> children{};
+        std::array<std::int16_t, MAX_NODES> symbols{};
+        std::array<bool, MAX_NODES> accepting{};
+        std::array<std::array<Transition, 16>, MAX_NODES> transitions{};
+        std::size_t nodes = 1;
+
+        HuffmanDecoder() {
+            symbols.fill(-1);
+
+            for(int symbol = 0; symbol <= 256; ++symbol) {
+                auto code   = (symbol == 256) ? 0x3fffffffu : HUFFMAN_CODES[symbol];
+                auto length = (symbol == 256) ? 30 : HUFFMAN_LENGTHS[symbol];
+                std::size_t node = 0;
+
+                for(int bit = length - 1; bit >= 0; --bit) {
+                    auto branch = (code >> bit) & 1;
+
+                    if(children[node][branch] == 0) {
+                        children[node][branch] = static_cast<std::int16_t>(nodes++);
+                    }
+
+                    node = static_cast<std::size_t>(children[node][branch]);
+                }
+
+                symbols[node] = static_cast<std::int16_t>(symbol);
+            }
+
+            // Padding is a prefix of EOS (all ones) shorter than a byte
+            for(std::size_t node = 0, depth = 0; depth < 8; ++depth) {
+                accepting[node] = true;
+                node = static_cast<std::size_t>(children[node][1]);
+            }
+
+            for(std::size_t node = 0; node < nodes; ++node) {
+                if(symbols[node] >= 0) continue;
+
+                for(unsigned nibble = 0; nibble < 16; ++nibble) {
+                    Transition transition{ 0, -1, false };
+                    auto current = node;
+
+                    for(int bit = 3; bit >= 0; --bit) {
+                        current = static_cast<std::size_t>(children[current][(nibble >> bit) & 1]);
+
+                        if(symbols[current] >= 0) {
+                            if(symbols[current] == 256) { transition.fail = true; break; }
+
+                            transition.symbol = symbols[current];
+                            current = 0;
+                        }
+                    }
+
+                    transition.next = static_cast<std::uint16_t>(current);
+                    transitions[node][nibble] = transition;
+                }
+            }
+        }
+
+        bool decode(std::string_view input, std::string& out) const {
+            std::size_t state = 0;
+
+            auto step = [&](unsigned nibble) {
+                const auto& transition = transitions[state][nibble];
+                if(transition.fail) return false;
+
+                if(transition.symbol >= 0) out.push_back(static_cast<char>(transition.symbol));
+                state = transition.next;
+
+                return true;
+            };
+
+            for(auto c : input) {
+                auto byte = static_cast<std::uint8_t>(c);
+                if(!step(byte >> 4) || !step(byte & 0x0f)) return false;
+            }
+
+            return accepting[state];
+        }
+    };
+}
+
+bool web::http::hpack::huffmanDecode(std::string_view input, std::string& out) {
+    static const auto decoder = std::make_unique<HuffmanDecoder>();
+    return decoder->decode(input, out);
+}
+
+void web::http::hpack::huffmanEncode(std::string_view input, std::string& out) {
+    std::uint64_t bits = 0;
+    int count = 0;
+
+    for(auto c : input) {
+        auto symbol = static_cast<std::uint8_t>(c);
+
+        bits   = (bits << HUFFMAN_LENGTHS[symbol]) | HUFFMAN_CODES[symbol];
+        count += HUFFMAN_LENGTHS[symbol];
+
+        while(count >= 8) {
+            count -= 8;
+            out.push_back(static_cast<char>(bits >> count));
+        }
+
+        bits &= (std::uint64_t(1) << count) - 1;
+    }
+
+    // Pad with the most significant bits of EOS
+    if(count > 0) {
+        auto padding = 8 - count;
+        out.push_back(static_cast<char>((bits << padding) | ((1u << padding) - 1)));
+    }
+}
+
+std::size_t web::http::hpack::huffmanLength(std::string_view input) {
+    std::size_t bits = 0;
+
+    for(auto c : input) {
+        bits += HUFFMAN_LENGTHS[static_cast<std::uint8_t>(c)];
+    }
+
+    return (bits + 7) / 8;
+}
+
+// ============================================================================
+// DynamicTable Implementation
+// ============================================================================
+
+void DynamicTable::add(std::string name, std::string value) {
+    auto size = name.size() + value.size() + ENTRY_OVERHEAD;
+
+    // An entry larger than the whole table empties it and is not stored
+    if(size > _maxSize) {
+        _entries.clear();
+        _size = 0;
+        return;
+    }
+
+    evict(size);
+
+    _entries.push_front({ std::move(name), std::move(value) });
+    _size += size;
+}
+
+void DynamicTable::resize(std::size_t maxSize) {
+    _maxSize = maxSize;
+    evict(0);
+}
+
+void DynamicTable::evict(std::size_t room) {
+    while(!_entries.empty() && _size + room > _maxSize) {
+        const auto& last = _entries.back();
+
+        _size -= last.name.size() + last.value.size() + ENTRY_OVERHEAD;
+        _entries.pop_back();
+    }
+}
+
+// ============================================================================
+// Decoder Implementation
+// ============================================================================
+
+bool Decoder::decode(std::string_view block, std::vector<HeaderField>& out, std::size_t maxListSize) {
+    std::size_t listSize = 0;
+    bool fields = false;
+
+    while(!block.empty()) {
+        auto first = static_cast<std::uint8_t>(block[0]);
+        HeaderField field;
+
+        if(first & 0x80) {
+            // Indexed field
+            field = lookup(readInteger(block, 7));
+        }
+        else if((first & 0xe0) == 0x20) {
+            // Dynamic table size update, only allowed ahead of any field
+            auto size = readInteger(block, 5);
+
+            if(fields || size > _limit) throw DecodeError("invalid table size update");
+
+            _table.resize(size);
+            continue;
+        }
+        else {
+            // Literal, with incremental indexing (01), without (0000) or never indexed (0001)
+            bool indexing = (first & 0x40) != 0;
+            auto index    = readInteger(block, indexing ? 6 : 4);
+
+            field.name  = (index != 0) ? lookup(index).name : readString(block);
+            field.value = readString(block);
+
+            if(indexing) _table.add(field.name, field.value);
+        }
+
+        fields = true;
+        listSize += field.name.size() + field.value.size() + DynamicTable::ENTRY_OVERHEAD;
+
+        // Keep decoding so the table stays in sync, but stop collecting
+        if(listSize <= maxListSize) out.push_back(std::move(field));
+    }
+
+    return listSize <= maxListSize;
+}
+
+HeaderField Decoder::lookup(std::uint64_t index) const {
+    if(index == 0) throw DecodeError("index 0");
+
+    if(index <= STATIC_COUNT) {
+        const auto& [name, value] = STATIC_TABLE[index - 1];
+        return { std::string(name), std::string(value) };
+    }
+
+    index -= STATIC_COUNT + 1;
+    if(index >= _table.count()) throw DecodeError("index out of range");
+
+    return _table.at(index);
+}
+
+std::string Decoder::readString(std::string_view& input) {
+    if(input.empty()) throw DecodeError("truncated string");
+
+    bool huffman = (static_cast<std::uint8_t>(input[0]) & 0x80) != 0;
+    auto length  = readInteger(input, 7);
+
+    if(length > input.size()) throw DecodeError("truncated string");
+
+    auto raw = input.substr(0, length);
+    input.remove_prefix(length);
+
+    if(!huffman) return std::string(raw);
+
+    std::string decoded;
+    decoded.reserve(raw.size() * 8 / 5);
+
+    if(!huffmanDecode(raw, decoded)) throw DecodeError("invalid Huffman string");
+
+    return decoded;
+}
+
+// ============================================================================
+// Encoder Implementation
+// ============================================================================
+
+void Encoder::setMaxTableSize(std::size_t maxSize) {
+    // We never use more than the default, however much the peer allows
+    auto size = std::min<std::size_t>(maxSize, 4096);
+
+    if(size != _table.maxSize()) {
+        _table.resize(size);
+        _sizeChanged = true;
+    }
+}
+
+void Encoder::encode(std::string_view name, std::string_view value, std::string& out, bool index) {
+    if(_sizeChanged) {
+        writeInteger(_table.maxSize(), 5, 0x20, out);
+        _sizeChanged = false;
+    }
+
+    std::size_t nameIndex = staticNameIndex(name);
+
+    for(auto i = nameIndex; i != 0 && i <= STATIC_COUNT && STATIC_TABLE[i - 1].first == name; ++i) {
+        if(STATIC_TABLE[i - 1].second == value) {
+            writeInteger(i, 7, 0x80, out);
+            return;
+        }
+    }
+
+    for(std::size_t i = 0; i < _table.count(); ++i) {
+        const auto& entry = _table.at(i);
+        if(entry.name != name) continue;
+
+        if(entry.value == value) {
+            writeInteger(STATIC_COUNT + 1 + i, 7, 0x80, out);
+            return;
+        }
+
+        if(nameIndex == 0) nameIndex = STATIC_COUNT + 1 + i;
+    }
+
+    if(index) {
+        writeInteger(nameIndex, 6, 0x40, out);
+        _table.add(std::string(name), std::string(value));
+    }
+    else {
+        writeInteger(nameIndex, 4, 0x00, out);
+    }
+
+    if(nameIndex == 0) writeString(name, out);
+    writeString(value, out);
+}
+
+void Encoder::writeString(std::string_view value, std::string& out) {
+    auto length = huffmanLength(value);
+
+    if(length < value.size()) {
+        writeInteger(length, 7, 0x80, out);
+        huffmanEncode(value, out);
+    }
+    else {
+        writeInteger(value.size(), 7, 0x00, out);
+        out.append(value);
+    }
+}
@@ -0,0 +1,1119 @@
+#include "web/http2.hh"
+#include "web/server.hh"
+#include "web/utils.hh"
+
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <charconv>
+#include <deque>
+#include <iostream>
+#include <stdexcept>
+
+#include <unistd.h>
+
+using namespace web::http;
+
+namespace {
+    namespace frame {
+        constexpr std::uint8_t DATA          = 0x0;
+        constexpr std::uint8_t HEADERS       = 0x1;
+        constexpr std::uint8_t PRIORITY      = 0x2;
+        constexpr std::uint8_t RST_STREAM    = 0x3;
+        constexpr std::uint8_t SETTINGS      = 0x4;
+        constexpr std::uint8_t PUSH_PROMISE  = 0x5;
+        constexpr std::uint8_t PING          = 0x6;
+        constexpr std::uint8_t GOAWAY        = 0x7;
+        constexpr std::uint8_t WINDOW_UPDATE = 0x8;
+        constexpr std::uint8_t CONTINUATION  = 0x9;
+    }
+
+    namespace flag {
+        constexpr std::uint8_t END_STREAM  = 0x1;
+        constexpr std::uint8_t ACK         = 0x1;
+        constexpr std::uint8_t END_HEADERS = 0x4;
+        constexpr std::uint8_t PADDED      = 0x8;
+        constexpr std::uint8_t PRIORITY    = 0x20;
+    }
+
+    namespace error {
+        constexpr std::uint32_t NO_ERROR           = 0x0;
+        constexpr std::uint32_t PROTOCOL_ERROR     = 0x1;
+        constexpr std::uint32_t INTERNAL_ERROR     = 0x2;
+        constexpr std::uint32_t FLOW_CONTROL_ERROR = 0x3;
+        constexpr std::uint32_t STREAM_CLOSED      = 0x5;
+        constexpr std::uint32_t FRAME_SIZE_ERROR   = 0x6;
+        constexpr std::uint32_t REFUSED_STREAM     = 0x7;
+        constexpr std::uint32_t COMPRESSION_ERROR  = 0x9;
+        constexpr std::uint32_t ENHANCE_YOUR_CALM  = 0xb;
+    }
+
+    namespace setting {
+        constexpr std::uint16_t HEADER_TABLE_SIZE      = 0x1;
+        constexpr std::uint16_t ENABLE_PUSH            = 0x2;
+        constexpr std::uint16_t MAX_CONCURRENT_STREAMS = 0x3;
+        constexpr std::uint16_t INITIAL_WINDOW_SIZE    = 0x4;
+        constexpr std::uint16_t MAX_FRAME_SIZE         = 0x5;
+        constexpr std::uint16_t MAX_HEADER_LIST_SIZE   = 0x6;
+    }
+
+    constexpr std::size_t FRAME_HEADER_SIZE = 9;
+
+    // We never raise SETTINGS_MAX_FRAME_SIZE above the default
+    constexpr std::size_t MAX_FRAME_SIZE = 16384;
+
+    constexpr std::size_t MAX_HEADER_LIST  = 64 * 1024;
+    constexpr std::size_t MAX_HEADER_BLOCK = 256 * 1024;
+
+    constexpr std::int64_t MAX_WINDOW = 0x7fffffff;
+    constexpr std::int64_t DEFAULT_WINDOW = 65535;
+
+    // Receive window for the connection as a whole, opened right after the preface
+    constexpr std::uint32_t CONNECTION_WINDOW = 16 * 1024 * 1024;
+
+    // Streams stop producing DATA while this much output is waiting for the socket
+    constexpr std::size_t OUTPUT_LIMIT = 256 * 1024;
+
+    // Fatal protocol violation: GOAWAY with this code, then close
+    struct ConnectionError {
+        std::uint32_t code;
+        const char* reason;
+    };
+
+    std::uint32_t readUint32(std::string_view bytes) {
+        return (static_cast<std::uint32_t>(static_cast<std::uint8_t>(bytes[0])) << 24) |
+               (static_cast<std::uint32_t>(static_cast<std::uint8_t>(bytes[1])) << 16) |
+               (static_cast<std::uint32_t>(static_cast<std::uint8_t>(bytes[2])) << 8)  |
+                static_cast<std::uint32_t>(static_cast<std::uint8_t>(bytes[3]));
+    }
+
+    void appendUint32(std::string& out, std::uint32_t value) {
+        out.push_back(static_cast<char>(value >> 24));
+        out.push_back(static_cast<char>(value >> 16));
+        out.push_back(static_cast<char>(value >> 8));
+        out.push_back(static_cast<char>(value));
+    }
+
+    void appendSetting(std::string& out, std::uint16_t id, std::uint32_t value) {
+        out.push_back(static_cast<char>(id >> 8));
+        out.push_back(static_cast<char>(id));
+        appendUint32(out, value);
+    }
+
+    std::string_view unpad(std::uint8_t flags, std::string_view payload) {
+        if(!(flags & flag::PADDED)) return payload;
+
+        if(payload.empty()) throw ConnectionError{ error::PROTOCOL_ERROR, "missing pad length" };
+
+        auto padding = static_cast<std::uint8_t>(payload[0]);
+        payload.remove_prefix(1);
+
+        if(padding > payload.size()) throw ConnectionError{ error::PROTOCOL_ERROR, "padding exceeds payload" };
+
+        return payload.substr(0, payload.size() - padding);
+    }
+
+    // Meaningful only to a single HTTP/1.1 hop, forbidden in HTTP/2
+    bool isConnectionSpecific(std::string_view name) {
+        return name == "connection" || name == "keep-alive" || name == "proxy-connection" ||
+               name == "transfer-encoding" || name == "upgrade";
+    }
+
+    // Values that differ on nearly every response would only churn the HPACK table
+    bool isVolatile(std::string_view name) {
+        return name == "content-length" || name == "content-range" || name == "etag" ||
+               name == "last-modified" || name == "set-cookie";
+    }
+}
+
+// ============================================================================
+// Stream
+// ============================================================================
+
+struct Http2Connection::Stream {
+    Stream(std::uint32_t id, std::int64_t sendWindow, const TcpSocket::executor_type& executor)
+        : id(id), sendWindow(sendWindow), timer(executor) { }
+
+    std::uint32_t id;
+
+    HttpRequest request;
+    HttpResponse response;
+    HttpServer::Exchange exchange;
+    RequestTiming timing;
+
+    std::int64_t sendWindow;
+
+    // A coroutine waiting for window, output room or request data parks here
+    boost::asio::steady_timer timer;
+
+    // Request body: collected for buffered routes, queued for streaming ones
+    bool streaming = false;
+    std::string body;
+    std::deque<std::string> chunks;
+    std::uint64_t received = 0;
+    std::uint64_t credited = 0;     // receive window granted for the body so far
+    std::unique_ptr<StreamReader> reader;
+
+    // While the body is awaited: as a whole when buffered, per read when streamed
+    Connection::Clock::time_point deadline = Connection::Clock::time_point::max();
+
+    bool remoteClosed = false;  // END_STREAM received
+    bool dispatched = false;
+    bool refused = false;
+    bool tooLarge = false;
+    bool timedOut = false;
+    bool reset = false;
+    bool done = false;          // the handler has finished
+};
+
+// Hands a streaming route the DATA frames of its stream as they arrive. The
+// stream's receive window is only credited once a piece has been consumed,
+// so a slow handler throttles the client instead of buffering its upload.
+class Http2Connection::StreamReader : public web::http::BodyReader {
+public:
+    StreamReader(Http2Connection& connection, Stream& stream) : _connection(connection), _stream(stream) { }
+
+    bool finished() const override { return _finished; }
+
+    boost::asio::awaitable<std::string_view> read() override {
+        if(!_current.empty() && !_stream.remoteClosed && !_stream.reset) {
+            _connection.writeWindowUpdate(_stream.id, static_cast<std::uint32_t>(_current.size()));
+        }
+
+        _current.clear();
+
+        auto waiting = [this]() {
+            return _stream.chunks.empty() && !_stream.remoteClosed && !_stream.reset &&
+                   !_stream.tooLarge && !_stream.timedOut && !_connection._closed;
+        };
+
+        if(waiting()) {
+            _stream.deadline = _connection._loop.now + _connection._server.config().bodyTimeout;
+            _connection.deadline(std::min(_connection.deadline(), _stream.deadline));
+        }
+
+        while(waiting()) {
+            co_await _connection.park(_stream);
+        }
+
+        _stream.deadline = Connection::Clock::time_point::max();
+
+        if(_stream.tooLarge) throw BodyTooLarge();
+        if(_stream.timedOut) throw MalformedBody("request body timed out");
+        if(_stream.reset || _connection._closed) throw MalformedBody("stream was reset");
+
+        if(_stream.chunks.empty()) {
+            _finished = true;
+            co_return std::string_view();
+        }
+
+        _current = std::move(_stream.chunks.front());
+        _stream.chunks.pop_front();
+
+        co_return std::string_view(_current);
+    }
+
+private:
+    Http2Connection& _connection;
+    Stream& _stream;
+    std::string _current;
+    bool _finished = false;
+};
+
+// Cuts a response body into DATA frames no larger than the peer accepts,
+// waiting whenever the stream or connection window is exhausted
+class Http2Connection::StreamWriter : public web::http::BodyWriter {
+public:
+    StreamWriter(Http2Connection& connection, Stream& stream) : _connection(connection), _stream(stream) { }
+
+    boost::asio::awaitable<void> write(std::string_view data) override {
+        while(!data.empty()) {
+            while(!_connection._closed && !_stream.reset &&
+                  (_stream.sendWindow <= 0 || _connection._sendWindow <= 0 || _connection._output.size() >= OUTPUT_LIMIT)) {
+                co_await _connection.park(_stream);
+            }
+
+            if(_connection._closed || _stream.reset) throw std::runtime_error("stream closed by peer");
+
+            auto length = std::min<std::size_t>({
+                data.size(),
+                static_cast<std::size_t>(_stream.sendWindow),
+                static_cast<std::size_t>(_connection._sendWindow),
+                _connection._peerMaxFrameSize
+            });
+
+            _connection.writeFrame(frame::DATA, 0, _stream.id, data.substr(0, length));
+
+            _stream.sendWindow      -= static_cast<std::int64_t>(length);
+            _connection._sendWindow -= static_cast<std::int64_t>(length);
+            data.remove_prefix(length);
+        }
+    }
+
+    // Frames leave as soon as the loop comes round, there is nothing to push
+    boost::asio::awaitable<void> flush() override {
+        co_return;
+    }
+
+    void finish() {
+        if(!_connection._closed && !_stream.reset) {
+            _connection.writeFrame(frame::DATA, flag::END_STREAM, _stream.id, std::string_view());
+        }
+    }
+
+private:
+    Http2Connection& _connection;
+    Stream& _stream;
+};
+
+// ============================================================================
+// Http2Connection Implementation
+// ============================================================================
+
+Http2Connection::Http2Connection(TcpSocket socket, HttpServer& server, EventLoop& loop, std::string received)
+    : _socket(std::move(socket)), _server(server), _loop(loop), _input(std::move(received)) {
+    boost::system::error_code ec;
+    auto remote = _socket.remote_endpoint(ec);
+    if(!ec) _remoteAddress = remote.address();
+}
+
+Http2Connection::~Http2Connection() {
+    _loop.connections.erase(this);
+}
+
+void Http2Connection::start() {
+    _loop.connections.insert(this);
+
+    const auto& config = _server.config();
+
+    std::string settings;
+    appendSetting(settings, setting::ENABLE_PUSH, 0);
+    appendSetting(settings, setting::MAX_CONCURRENT_STREAMS, config.http2MaxConcurrentStreams);
+    appendSetting(settings, setting::INITIAL_WINDOW_SIZE, config.http2WindowSize);
+    appendSetting(settings, setting::MAX_HEADER_LIST_SIZE, MAX_HEADER_LIST);
+
+    writeFrame(frame::SETTINGS, 0, 0, settings);
+
+    // The connection window starts at 64 KiB whatever the settings say
+    writeWindowUpdate(0, CONNECTION_WINDOW - DEFAULT_WINDOW);
+
+    watchDeadlines();
+
+    auto self(shared_from_this());
+
+    boost::asio::co_spawn(
+        _socket.get_executor(),
+        [this, self]() { return readFrames(); },
+        [this, self](std::exception_ptr error) {
+            try {
+                if(error) std::rethrow_exception(error);
+            }
+            catch(const ConnectionError& e) {
+                std::cerr << "HTTP/2 error: " << e.reason << std::endl;
+                goAway(e.code);
+                return;
+            }
+            catch(const std::exception&) {
+                // The peer went away
+            }
+
+            close();
+        }
+    );
+}
+
+void Http2Connection::close() {
+    if(_closed) return;
+    _closed = true;
+
+    boost::system::error_code ec;
+    _socket.shutdown(TcpSocket::shutdown_both, ec);
+    _socket.close(ec);
+
+    wakeAll();
+}
+
+void Http2Connection::timeout() {
+    // Idle, or a GOAWAY that never got out
+    if(_goingAway || (_streams.empty() && _continuationStream == 0)) {
+        if(!_goingAway) increment(_loop.counters.idleTimeouts);
+
+        close();
+        return;
+    }
+
+    // Nothing else may arrive until the header block is finished
+    if(_continuationStream != 0 && _headersDeadline <= _loop.now) {
+        increment(_loop.counters.headerTimeouts);
+
+        goAway(error::NO_ERROR);
+        deadline(_loop.now + _server.config().writeTimeout);
+        return;
+    }
+
+    // Deadlines only move later without rearming, so some may not be due yet
+    std::vector<std::shared_ptr<Stream>> expired;
+
+    for(auto& [id, stream] : _streams) {
+        if(stream->deadline <= _loop.now) expired.push_back(stream);
+    }
+
+    for(auto& stream : expired) {
+        increment(_loop.counters.bodyTimeouts);
+        stream->deadline = Clock::time_point::max();
+
+        if(stream->dispatched) {
+            // A streaming handler's read fails
+            stream->timedOut = true;
+            wake(*stream);
+        }
+        else {
+            refuse(stream, StatusCode::REQUEST_TIMEOUT);
+        }
+    }
+
+    watchDeadlines();
+}
+
+boost::asio::awaitable<void> Http2Connection::readFrames() {
+    std::array<char, 64 * 1024> buffer;
+
+    while(!_closed) {
+        std::size_t offset = 0;
+
+        if(!_prefaceReceived && _input.size() >= HTTP2_PREFACE.size()) {
+            if(std::string_view(_input).substr(0, HTTP2_PREFACE.size()) != HTTP2_PREFACE) {
+                throw ConnectionError{ error::PROTOCOL_ERROR, "invalid connection preface" };
+            }
+
+            offset = HTTP2_PREFACE.size();
+            _prefaceReceived = true;
+        }
+
+        while(_prefaceReceived && !_closed && _input.size() - offset >= FRAME_HEADER_SIZE) {
+            auto header = std::string_view(_input).substr(offset, FRAME_HEADER_SIZE);
+            auto length = readUint32(header) >> 8;
+
+            if(length > MAX_FRAME_SIZE) throw ConnectionError{ error::FRAME_SIZE_ERROR, "frame too large" };
+            if(_input.size() - offset < FRAME_HEADER_SIZE + length) break;
+
+            auto type     = static_cast<std::uint8_t>(header[3]);
+            auto flags    = static_cast<std::uint8_t>(header[4]);
+            auto streamId = readUint32(header.substr(5)) & 0x7fffffff;
+            auto payload  = std::string_view(_input).substr(offset + FRAME_HEADER_SIZE, length);
+
+            handleFrame(type, flags, streamId, payload);
+            offset += FRAME_HEADER_SIZE + length;
+        }
+
+        _input.erase(0, offset);
+
+        if(_closed) break;
+
+        auto length = co_await _socket.async_read_some(boost::asio::buffer(buffer), boost::asio::use_awaitable);
+        _input.append(buffer.data(), length);
+    }
+}
+
+void Http2Connection::handleFrame(std::uint8_t type, std::uint8_t flags, std::uint32_t streamId, std::string_view payload) {
+    if(_continuationStream != 0 && type != frame::CONTINUATION) {
+        throw ConnectionError{ error::PROTOCOL_ERROR, "expected CONTINUATION" };
+    }
+
+    switch(type) {
+        case frame::DATA:           onData(flags, streamId, payload); break;
+        case frame::HEADERS:        onHeaders(flags, streamId, payload); break;
+        case frame::CONTINUATION:   onContinuation(flags, streamId, payload); break;
+        case frame::SETTINGS:       onSettings(flags, streamId, payload); break;
+        case frame::WINDOW_UPDATE:  onWindowUpdate(streamId, payload); break;
+        case frame::RST_STREAM:     onResetStream(streamId, payload); break;
+
+        case frame::PRIORITY:
+            // Advisory, and every stream is served as soon as it is ready anyway
+            if(streamId == 0) throw ConnectionError{ error::PROTOCOL_ERROR, "PRIORITY on stream 0" };
+            break;
+
+        case frame::PUSH_PROMISE:
+            throw ConnectionError{ error::PROTOCOL_ERROR, "PUSH_PROMISE from a client" };
+
+        case frame::PING:
+            if(streamId != 0)           throw ConnectionError{ error::PROTOCOL_ERROR, "PING on a stream" };
+            if(payload.size() != 8)     throw ConnectionError{ error::FRAME_SIZE_ERROR, "bad PING size" };
+
+            if(!(flags & flag::ACK)) writeFrame(frame::PING, flag::ACK, 0, payload);
+            break;
+
+        case frame::GOAWAY:
+            if(streamId != 0) throw ConnectionError{ error::PROTOCOL_ERROR, "GOAWAY on a stream" };
+
+            _peerGoingAway = true;
+            closeIfDone();
+            break;
+
+        default:
+            // Unknown frame types are ignored
+            break;
+    }
+}
+
+void Http2Connection::onData(std::uint8_t flags, std::uint32_t streamId, std::string_view payload) {
+    if(streamId == 0) throw ConnectionError{ error::PROTOCOL_ERROR, "DATA on stream 0" };
+
+    // Flow control counts the whole payload, padding included. The
+    // connection window is credited straight away; per-stream windows are
+    // what bound each request body.
+    auto length = static_cast<std::uint32_t>(payload.size());
+    auto data   = unpad(flags, payload);
+
+    if(length > 0) writeWindowUpdate(0, length);
+
+    auto it = _streams.find(streamId);
+
+    if(it == _streams.end()) {
+        if(streamId > _lastStreamId) throw ConnectionError{ error::PROTOCOL_ERROR, "DATA on idle stream" };
+        return;
+    }
+
+    auto stream = it->second;
+
+    if(stream->remoteClosed) {
+        resetStream(streamId, error::STREAM_CLOSED);
+        return;
+    }
+
+    if(!stream->refused && !stream->tooLarge) {
+        stream->received += data.size();
+
+        if(stream->received > _server.config().maxBodySize) {
+            if(stream->streaming) {
+                stream->tooLarge = true;
+                wake(*stream);
+            }
+            else {
+                refuse(stream, StatusCode::PAYLOAD_TOO_LARGE);
+            }
+        }
+        else if(stream->streaming) {
+            if(!data.empty()) stream->chunks.emplace_back(data);
+            if(length > data.size()) writeWindowUpdate(streamId, static_cast<std::uint32_t>(length - data.size()));
+
+            wake(*stream);
+        }
+        else {
+            stream->body.append(data);
+
+            // The body is only handed over once complete, so the window is
+            // topped up just as far as the rest of it can still need: what
+            // its Content-Length declares, else a window at a time up to
+            // maxBodySize. Padding is returned.
+            const auto& request = stream->request;
+            const auto& config  = _server.config();
+
+            std::uint64_t limit   = request.hasContentLength() ? request.contentLength() : config.maxBodySize;
+            std::uint64_t window  = request.hasContentLength() ? MAX_WINDOW : config.http2WindowSize;
+            std::uint64_t needed  = std::min<std::uint64_t>(limit > stream->received ? limit - stream->received : 0, window);
+            std::uint64_t open    = stream->credited > stream->received ? stream->credited - stream->received : 0;
+            std::uint64_t topUp   = needed > open ? needed - open : 0;
+            std::uint64_t padding = length - data.size();
+
+            if(topUp + padding > 0) writeWindowUpdate(streamId, static_cast<std::uint32_t>(topUp + padding));
+            stream->credited += topUp;
+        }
+    }
+
+    if(flags & flag::END_STREAM) {
+        stream->remoteClosed = true;
+        endOfBody(stream);
+    }
+}
+
+void Http2Connection::onHeaders(std::uint8_t flags, std::uint32_t streamId, std::string_view payload) {
+    if(streamId == 0 || streamId % 2 == 0) {
+        throw ConnectionError{ error::PROTOCOL_ERROR, "HEADERS on an invalid stream" };
+    }
+
+    auto block = unpad(flags, payload);
+
+    if(flags & flag::PRIORITY) {
+        if(block.size() < 5) throw ConnectionError{ error::FRAME_SIZE_ERROR, "truncated priority" };
+        block.remove_prefix(5);
+    }
+
+    _headerBlock.assign(block);
+
+    if(!(flags & flag::END_HEADERS)) {
+        _continuationStream = streamId;
+        _continuationEndStream = (flags & flag::END_STREAM) != 0;
+        _headersDeadline = _loop.now + _server.config().headerTimeout;
+
+        watchDeadlines();
+        return;
+    }
+
+    openStream(streamId, _headerBlock, (flags & flag::END_STREAM) != 0);
+}
+
+void Http2Connection::onContinuation(std::uint8_t flags, std::uint32_t streamId, std::string_view payload) {
+    if(streamId == 0 || streamId != _continuationStream) {
+        throw ConnectionError{ error::PROTOCOL_ERROR, "unexpected CONTINUATION" };
+    }
+
+    _headerBlock.append(payload);
+
+    if(_headerBlock.size() > MAX_HEADER_BLOCK) {
+        throw ConnectionError{ error::ENHANCE_YOUR_CALM, "header block too large" };
+    }
+
+    if(flags & flag::END_HEADERS) {
+        _continuationStream = 0;
+        watchDeadlines();
+
+        openStream(streamId, _headerBlock, _continuationEndStream);
+    }
+}
+
+void Http2Connection::onSettings(std::uint8_t flags, std::uint32_t streamId, std::string_view payload) {
+    if(streamId != 0) throw ConnectionError{ error::PROTOCOL_ERROR, "SETTINGS on a stream" };
+
+    if(flags & flag::ACK) {
+        if(!payload.empty()) throw ConnectionError{ error::FRAME_SIZE_ERROR, "SETTINGS ack with payload" };
+        return;
+    }
+
+    if(payload.size() % 6 != 0) throw ConnectionError{ error::FRAME_SIZE_ERROR, "bad SETTINGS size" };
+
+    for(; !payload.empty(); payload.remove_prefix(6)) {
+        auto id    = static_cast<std::uint16_t>((static_cast<std::uint8_t>(payload[0]) << 8) | static_cast<std::uint8_t>(payload[1]));
+        auto value = readUint32(payload.substr(2));
+
+        switch(id) {
+            case setting::HEADER_TABLE_SIZE:
+                _encoder.setMaxTableSize(value);
+                break;
+
+            case setting::ENABLE_PUSH:
+                if(value > 1) throw ConnectionError{ error::PROTOCOL_ERROR, "bad ENABLE_PUSH" };
+                break;
+
+            case setting::INITIAL_WINDOW_SIZE: {
+                if(value > MAX_WINDOW) throw ConnectionError{ error::FLOW_CONTROL_ERROR, "window too large" };
+
+                // Applies retroactively to every open stream
+                auto delta = static_cast<std::int64_t>(value) - _peerInitialWindow;
+                _peerInitialWindow = value;
+
+                for(auto& [id, stream] : _streams) {
+                    stream->sendWindow += delta;
+                }
+
+                wakeAll();
+                break;
+            }
+
+            case setting::MAX_FRAME_SIZE:
+                if(value < 16384 || value > 16777215) throw ConnectionError{ error::PROTOCOL_ERROR, "bad MAX_FRAME_SIZE" };
+                _peerMaxFrameSize = value;
+                break;
+
+            default:
+                // MAX_CONCURRENT_STREAMS limits pushes, which we never send
+                break;
+        }
+    }
+
+    writeFrame(frame::SETTINGS, flag::ACK, 0, std::string_view());
+}
+
+void Http2Connection::onWindowUpdate(std::uint32_t streamId, std::string_view payload) {
+    if(payload.size() != 4) throw ConnectionError{ error::FRAME_SIZE_ERROR, "bad WINDOW_UPDATE size" };
+
+    auto increment = readUint32(payload) & 0x7fffffff;
+
+    if(streamId == 0) {
+        if(increment == 0) throw ConnectionError{ error::PROTOCOL_ERROR, "zero window increment" };
+
+        _sendWindow += increment;
+        if(_sendWindow > MAX_WINDOW) throw ConnectionError{ error::FLOW_CONTROL_ERROR, "window overflow" };
+
+        wakeAll();
+        return;
+    }
+
+    auto it = _streams.find(streamId);
+    if(it == _streams.end()) return;
+
+    if(increment == 0) {
+        resetStream(streamId, error::PROTOCOL_ERROR);
+        return;
+    }
+
+    it->second->sendWindow += increment;
+
+    if(it->second->sendWindow > MAX_WINDOW) {
+        resetStream(streamId, error::FLOW_CONTROL_ERROR);
+        return;
+    }
+
+    wake(*it->second);
+}
+
+void Http2Connection::onResetStream(std::uint32_t streamId, std::string_view payload) {
+    if(streamId == 0)           throw ConnectionError{ error::PROTOCOL_ERROR, "RST_STREAM on stream 0" };
+    if(payload.size() != 4)     throw ConnectionError{ error::FRAME_SIZE_ERROR, "bad RST_STREAM size" };
+    if(streamId > _lastStreamId) throw ConnectionError{ error::PROTOCOL_ERROR, "RST_STREAM on idle stream" };
+
+    auto it = _streams.find(streamId);
+    if(it == _streams.end()) return;
+
+    // Whatever is still running for the stream unwinds when it next waits,
+    // and counts against the limit until then
+    it->second->reset = true;
+    if(it->second->dispatched && !it->second->done) ++_orphans;
+    wake(*it->second);
+
+    _streams.erase(it);
+    watchDeadlines();
+    closeIfDone();
+}
+
+void Http2Connection::openStream(std::uint32_t streamId, std::string_view block, bool endStream) {
+    std::vector<hpack::HeaderField> fields;
+    bool fits = false;
+
+    // The block has to be decoded even if the stream is refused, to keep
+    // the HPACK table in step with the peer's
+    try {
+        fits = _decoder.decode(block, fields, MAX_HEADER_LIST);
+    }
+    catch(const hpack::DecodeError&) {
+        throw ConnectionError{ error::COMPRESSION_ERROR, "malformed header block" };
+    }
+
+    if(auto it = _streams.find(streamId); it != _streams.end()) {
+        // Trailers end the body; their fields are not used
+        auto stream = it->second;
+
+        if(!endStream || stream->remoteClosed) {
+            resetStream(streamId, error::PROTOCOL_ERROR);
+            return;
+        }
+
+        stream->remoteClosed = true;
+        endOfBody(stream);
+        return;
+    }
+
+    if(streamId <= _lastStreamId) throw ConnectionError{ error::PROTOCOL_ERROR, "stream id reused" };
+    _lastStreamId = streamId;
+
+    const auto& config = _server.config();
+
+    // Reset streams count as well: resetting each one right after opening
+    // it must not start handlers beyond the limit
+    if(_goingAway || _streams.size() + _orphans >= config.http2MaxConcurrentStreams) {
+        resetStream(streamId, error::REFUSED_STREAM);
+        return;
+    }
+
+    auto stream = std::make_shared<Stream>(streamId, _peerInitialWindow, _socket.get_executor());
+    stream->remoteClosed = endStream;
+    stream->credited = config.http2WindowSize;
+    if(_loop.metrics) stream->timing.received = Ticks::now();
+    _streams.emplace(streamId, stream);
+
+    // A streaming route's reader sets its own, per read
+    if(!endStream) stream->deadline = _loop.now + config.bodyTimeout;
+    watchDeadlines();
+
+    std::string_view method, path, authority;
+    bool valid = fits, pseudo = true;
+
+    for(const auto& field : fields) {
+        if(!field.name.empty() && field.name[0] == ':') {
+            // Pseudo-headers come first
+            if(!pseudo) valid = false;
+
+            if(field.name == ":method")         method = field.value;
+            else if(field.name == ":path")      path = field.value;
+            else if(field.name == ":authority") authority = field.value;
+            else if(field.name != ":scheme")    valid = false;
+        }
+        else {
+            pseudo = false;
+
+            if(isConnectionSpecific(field.name)) valid = false;
+        }
+    }
+
+    if(!valid || method.empty() || path.empty()) {
+        refuse(stream, StatusCode::BAD_REQUEST);
+        return;
+    }
+
+    auto& request = stream->request;
+    request.beginHead(method, path, Version::HTTP_2_0);
+    request.remoteAddress(_remoteAddress);
+
+    std::string cookie;
+
+    for(const auto& field : fields) {
+        if(field.name[0] == ':') continue;
+
+        // Cookies may arrive split into one field per pair
+        if(field.name == "cookie") {
+            if(!cookie.empty()) cookie += "; ";
+            cookie += field.value;
+            continue;
+        }
+
+        request.addHeader(field.name, field.value);
+    }
+
+    if(!cookie.empty()) request.addHeader("cookie", cookie);
+    if(!authority.empty() && !request.hasHeader(Field::HOST)) request.addHeader("host", authority);
+
+    if(!request.endHead()) {
+        refuse(stream, request.malformed() ? StatusCode::BAD_REQUEST : StatusCode::NOT_IMPLEMENTED);
+        return;
+    }
+
+    if(request.contentLength() > config.maxBodySize) {
+        refuse(stream, StatusCode::PAYLOAD_TOO_LARGE);
+        return;
+    }
+
+    auto route = _server.findRoute(request);
+
+    if(route != nullptr && route->bodyMode == BodyMode::STREAMING) {
+        stream->streaming = true;
+        stream->reader = std::make_unique<StreamReader>(*this, *stream);
+        stream->deadline = Connection::Clock::time_point::max();
+
+        request.bodyReader(stream->reader.get());
+        dispatch(stream);
+        return;
+    }
+
+    if(endStream) dispatch(stream);
+}
+
+void Http2Connection::endOfBody(std::shared_ptr<Stream> stream) {
+    if(stream->streaming) {
+        wake(*stream);
+        return;
+    }
+
+    if(!stream->dispatched) {
+        stream->request.body(std::move(stream->body));
+        dispatch(stream);
+    }
+}
+
+void Http2Connection::refuse(std::shared_ptr<Stream> stream, StatusCode status) {
+    stream->refused = true;
+    stream->response = HttpResponse(status, HttpResponse().statusCodeToString(status));
+
+    if(!stream->dispatched) dispatch(stream);
+}
+
+void Http2Connection::dispatch(std::shared_ptr<Stream> stream) {
+    stream->dispatched = true;
+    if(!stream->streaming) stream->deadline = Connection::Clock::time_point::max();
+
+    auto self(shared_from_this());
+
+    boost::asio::co_spawn(
+        _socket.get_executor(),
+        [this, self, stream]() { return handle(stream); },
+        [this, self, stream](std::exception_ptr error) {
+            stream->done = true;
+
+            if(stream->reset) {
+                --_orphans;
+                return;
+            }
+
+            if(_closed) return;
+
+            if(error) {
+                resetStream(stream->id, error::INTERNAL_ERROR);
+                return;
+            }
+
+            // Responding before the whole request arrived: tell the client to stop sending
+            if(stream->remoteClosed) { closeStream(stream->id); }
+            else                     { resetStream(stream->id, error::NO_ERROR); }
+        }
+    );
+}
+
+boost::asio::awaitable<void> Http2Connection::handle(std::shared_ptr<Stream> stream) {
+    if(!stream->refused) {
+        auto& request  = stream->request;
+        auto& response = stream->response;
+
+        if(_loop.metrics) stream->timing.dispatched = Ticks::now();
+
+        auto admission = _server.admit(request, response, stream->exchange, _loop);
+
+        if(admission == AdmissionController::Admission::QUEUE) {
+            admission = co_await _server.queue(request, response, stream->exchange);
+        }
+
+        if(admission == AdmissionController::Admission::ADMITTED) {
+            auto route = _server.begin(request, response, stream->exchange);
+
+            if(route != nullptr) {
+                co_await _server.respond(*route, request, response, stream->exchange);
+            }
+        }
+
+        _server.end(stream->exchange, request, response);
+
+        if(_loop.metrics) stream->timing.responded = Ticks::now();
+    }
+
+    co_await sendResponse(*stream);
+
+    if(!stream->refused && !stream->reset && !_closed) {
+        _server.record(_loop, stream->request, stream->exchange, stream->response.statusCode(), stream->timing);
+    }
+}
+
+boost::asio::awaitable<void> Http2Connection::sendResponse(Stream& stream) {
+    if(_closed || stream.reset) co_return;
+
+    const auto& response = stream.response;
+
+    bool hasBody = stream.request.method() != Method::HEAD && response.allowsBody() &&
+                   (response.isStreaming() || response.file() || !response.body().empty());
+
+    std::string block;
+    encodeHeaders(response, block);
+    writeHeaders(stream.id, block, !hasBody);
+
+    if(!hasBody) co_return;
+
+    StreamWriter writer(*this, stream);
+
+    if(response.isStreaming()) {
+        co_await response.producer()(writer);
+    }
+    else if(response.file()) {
+        // DATA frames carry copies, so the file is read rather than sendfile'd
+        std::string chunk;
+
+        for(const auto& segment : response.segments()) {
+            co_await writer.write(segment.data);
+
+            auto offset    = segment.offset;
+            auto remaining = segment.length;
+
+            while(remaining > 0) {
+                chunk.resize(static_cast<std::size_t>(std::min<std::uint64_t>(remaining, 64 * 1024)));
+
+                auto count = ::pread(response.file()->fd(), chunk.data(), chunk.size(), static_cast<off_t>(offset));
+                if(count <= 0) throw std::runtime_error("read failed on " + response.file()->path());
+
+                co_await writer.write(std::string_view(chunk.data(), static_cast<std::size_t>(count)));
+
+                offset    += static_cast<std::uint64_t>(count);
+                remaining -= static_cast<std::uint64_t>(count);
+            }
+        }
+    }
+    else {
+        co_await writer.write(response.body());
+    }
+
+    writer.finish();
+}
+
+void Http2Connection::encodeHeaders(const HttpResponse& response, std::string& block) {
+    std::array<char, 24> number;
+
+    auto format = [&number](std::uint64_t value) {
+        auto result = std::to_chars(number.data(), number.data() + number.size(), value);
+        return std::string_view(number.data(), static_cast<std::size_t>(result.ptr - number.data()));
+    };
+
+    _encoder.encode(":status", format(static_cast<std::uint64_t>(response.statusCode())), block);
+
+    auto keepLength = response.keepsContentLength();
+
+    for(const auto& [name, value] : response.headers()) {
+        // Field names are lowercase on the wire in HTTP/2
+        _lowercase.assign(name);
+        std::transform(_lowercase.begin(), _lowercase.end(), _lowercase.begin(), [](unsigned char c) {
+            return static_cast<char>(std::tolower(c));
+        });
+
+        if(isConnectionSpecific(_lowercase)) continue;
+        if(!keepLength && _lowercase == "content-length") continue;
+
+        _encoder.encode(_lowercase, value, block, !isVolatile(_lowercase));
+    }
+
+    const auto& headers = response.headers();
+
+    if(!headers.contains(Field::SERVER)) _encoder.encode("server", HttpResponse::SERVER_NAME, block);
+    if(!headers.contains(Field::DATE))   _encoder.encode("date", utils::currentHttpDate(), block);
+
+    if(response.allowsBody() && !keepLength && (!response.isStreaming() || response.streamLength().has_value())) {
+        _encoder.encode("content-length", format(response.contentLength()), block, false);
+    }
+}
+
+void Http2Connection::resetStream(std::uint32_t streamId, std::uint32_t code) {
+    std::string payload;
+    appendUint32(payload, code);
+
+    writeFrame(frame::RST_STREAM, 0, streamId, payload);
+
+    if(auto it = _streams.find(streamId); it != _streams.end()) {
+        it->second->reset = true;
+        if(it->second->dispatched && !it->second->done) ++_orphans;
+        wake(*it->second);
+
+        _streams.erase(it);
+        watchDeadlines();
+    }
+
+    closeIfDone();
+}
+
+void Http2Connection::closeStream(std::uint32_t streamId) {
+    _streams.erase(streamId);
+    watchDeadlines();
+    closeIfDone();
+}
+
+void Http2Connection::watchDeadlines() {
+    if(_streams.empty() && _continuationStream == 0) {
+        deadline(_loop.now + _server.config().idleTimeout);
+        return;
+    }
+
+    auto next = (_continuationStream != 0) ? _headersDeadline : Clock::time_point::max();
+
+    for(auto& [id, stream] : _streams) {
+        next = std::min(next, stream->deadline);
+    }
+
+    deadline(next);
+}
+
+void Http2Connection::closeIfDone() {
+    if(_closed) return;
+
+    bool done = _goingAway || (_peerGoingAway && _streams.empty());
+
+    if(done && !_writing && !_sendScheduled && _output.empty()) {
+        close();
+    }
+}
+
+boost::asio::awaitable<void> Http2Connection::park(Stream& stream) {
+    boost::system::error_code ec;
+
+    stream.timer.expires_at(boost::asio::steady_timer::time_point::max());
+    co_await stream.timer.async_wait(boost::asio::redirect_error(boost::asio::use_awaitable, ec));
+}
+
+void Http2Connection::wake(Stream& stream) {
+    stream.timer.cancel();
+}
+
+void Http2Connection::wakeAll() {
+    for(auto& [id, stream] : _streams) {
+        stream->timer.cancel();
+    }
+}
+
+void Http2Connection::writeFrame(std::uint8_t type, std::uint8_t flags, std::uint32_t streamId, std::string_view payload) {
+    if(_closed) return;
+
+    auto length = static_cast<std::uint32_t>(payload.size());
+
+    _output.push_back(static_cast<char>(length >> 16));
+    _output.push_back(static_cast<char>(length >> 8));
+    _output.push_back(static_cast<char>(length));
+    _output.push_back(static_cast<char>(type));
+    _output.push_back(static_cast<char>(flags));
+    appendUint32(_output, streamId & 0x7fffffff);
+    _output.append(payload);
+
+    send();
+}
+
+void Http2Connection::writeHeaders(std::uint32_t streamId, std::string_view block, bool endStream) {
+    // A header block larger than a frame continues in CONTINUATION frames,
+    // which must follow without any other frame in between
+    auto first = block.substr(0, _peerMaxFrameSize);
+    block.remove_prefix(first.size());
+
+    std::uint8_t flags = (endStream ? flag::END_STREAM : 0) | (block.empty() ? flag::END_HEADERS : 0);
+    writeFrame(frame::HEADERS, flags, streamId, first);
+
+    while(!block.empty()) {
+        auto next = block.substr(0, _peerMaxFrameSize);
+        block.remove_prefix(next.size());
+
+        writeFrame(frame::CONTINUATION, block.empty() ? flag::END_HEADERS : 0, streamId, next);
+    }
+}
+
+void Http2Connection::writeWindowUpdate(std::uint32_t streamId, std::uint32_t increment) {
+    std::string payload;
+    appendUint32(payload, increment & 0x7fffffff);
+
+    writeFrame(frame::WINDOW_UPDATE, 0, streamId, payload);
+}
+
+void Http2Connection::goAway(std::uint32_t code) {
+    std::string payload;
+    appendUint32(payload, _lastStreamId);
+    appendUint32(payload, code);
+
+    writeFrame(frame::GOAWAY, 0, 0, payload);
+    _goingAway = true;
+}
+
+void Http2Connection::send() {
+    if(_sendScheduled || _writing || _closed) return;
+    _sendScheduled = true;
+
+    auto self(shared_from_this());
+
+    // Deferred to the end of this turn of the loop, so frames queued by
+    // every stream that was ready go out in a single write
+    boost::asio::post(_socket.get_executor(), [this, self]() {
+        _sendScheduled = false;
+
+        if(_writing || _closed) return;
+
+        if(_output.empty()) {
+            closeIfDone();
+            return;
+        }
+
+        std::swap(_output, _sending);
+        _writing = true;
+
+        boost::asio::async_write(_socket, boost::asio::buffer(_sending), [this, self](std::error_code ec, std::size_t) {
+            _writing = false;
+            _sending.clear();
+
+            if(ec) {
+                close();
+                return;
+            }
+
+            // Streams held back by OUTPUT_LIMIT can go on
+            wakeAll();
+
+            if(_output.empty()) { closeIfDone(); }
+            else                { send(); }
+        });
+    });
+}
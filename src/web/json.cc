@@ -0,0 +1,580 @@
+#include "web/json.hh"
+#include "web/response.hh"
+#include "web/scan.hh"
+
+#include <boost/container/small_vector.hpp>
+
+#include <algorithm>
+#include <array>
+#include <charconv>
+#include <cmath>
+#include <limits>
+
+using namespace web::http;
+
+namespace {
+    constexpr char HEX[] = "0123456789abcdef";
+
+    bool needsEscape(unsigned char c) {
+        return c < 0x20 || c == '"' || c == '\\';
+    }
+
+    bool isDigit(char c) {
+        return c >= '0' && c <= '9';
+    }
+
+    int hexValue(char c) {
+        if(c >= '0' && c <= '9') return c - '0';
+        if(c >= 'a' && c <= 'f') return c - 'a' + 10;
+        if(c >= 'A' && c <= 'F') return c - 'A' + 10;
+        return -1;
+    }
+
+    // The four hex digits of a \u escape, or -1
+    std::int32_t readHex(const char* at, const char* end) {
+        if(end - at < 4) return -1;
+
+        std::int32_t code = 0;
+        for(int i = 0; i < 4; ++i) {
+            auto digit = hexValue(at[i]);
+            if(digit < 0) return -1;
+            code = code * 16 + digit;
+        }
+
+        return code;
+    }
+
+    constexpr auto npos = std::string_view::npos;
+
+    // Length of the plain run of a string body: up to the closing quote or
+    // the next escape, or npos at a raw control character. Most strings are
+    // short, so the first bytes are checked in place and only longer ones
+    // go to the vector kernel.
+    std::size_t stringRun(const char* data, const char* end) {
+        static constexpr std::size_t PEEK = 16;
+
+        auto length = static_cast<std::size_t>(end - data);
+        auto peek = std::min(length, PEEK);
+
+        for(std::size_t i = 0; i < peek; ++i) {
+            auto c = static_cast<unsigned char>(data[i]);
+            if(c == '"' || c == '\\') return i;
+            if(c < 0x20) return npos;
+        }
+
+        if(peek == length) return length;
+
+        auto run = peek + scan::findEither(data + peek, length - peek, '"', '\\');
+
+        bool control = false;
+        for(std::size_t i = peek; i < run; ++i) control |= static_cast<unsigned char>(data[i]) < 0x20;
+
+        return control ? npos : run;
+    }
+
+    void appendUtf8(std::string& out, std::uint32_t code) {
+        if(code < 0x80) {
+            out.push_back(static_cast<char>(code));
+        }
+        else if(code < 0x800) {
+            out.push_back(static_cast<char>(0xC0 | (code >> 6)));
+            out.push_back(static_cast<char>(0x80 | (code & 0x3F)));
+        }
+        else if(code < 0x10000) {
+            out.push_back(static_cast<char>(0xE0 | (code >> 12)));
+            out.push_back(static_cast<char>(0x80 | ((code >> 6) & 0x3F)));
+            out.push_back(static_cast<char>(0x80 | (code & 0x3F)));
+        }
+        else {
+            out.push_back(static_cast<char>(0xF0 | (code >> 18)));
+            out.push_back(static_cast<char>(0x80 | ((code >> 12) & 0x3F)));
+            out.push_back(static_cast<char>(0x80 | ((code >> 6) & 0x3F)));
+            out.push_back(static_cast<char>(0x80 | (code & 0x3F)));
+        }
+    }
+}
+
+// ============================================================================
+// JsonWriter Implementation
+// ============================================================================
+
+JsonWriter& JsonWriter::beginObject() {
+    separate();
+    _out.push_back('{');
+    _comma = false;
+    ++_depth;
+    return *this;
+}
+
+JsonWriter& JsonWriter::endObject() {
+    _out.push_back('}');
+    _comma = true;
+    --_depth;
+    return *this;
+}
+
+JsonWriter& JsonWriter::beginArray() {
+    separate();
+    _out.push_back('[');
+    _comma = false;
+    ++_depth;
+    return *this;
+}
+
+JsonWriter& JsonWriter::endArray() {
+    _out.push_back(']');
+    _comma = true;
+    --_depth;
+    return *this;
+}
+
+JsonWriter& JsonWriter::key(std::string_view name) {
+    value(name);
+    _out.push_back(':');
+
+    // The member's value follows without a comma
+    _comma = false;
+    return *this;
+}
+
+JsonWriter& JsonWriter::value(std::string_view text) {
+    separate();
+    _out.push_back('"');
+
+    // Runs that need no escaping are appended whole
+    std::size_t start = 0;
+
+    for(std::size_t i = 0; i < text.size(); ++i) {
+        auto c = static_cast<unsigned char>(text[i]);
+        if(!needsEscape(c)) continue;
+
+        _out.append(text.data() + start, i - start);
+        start = i + 1;
+
+        switch(c) {
+            case '"':  _out.append("\\\""); break;
+            case '\\': _out.append("\\\\"); break;
+            case '\b': _out.append("\\b");  break;
+            case '\f': _out.append("\\f");  break;
+            case '\n': _out.append("\\n");  break;
+            case '\r': _out.append("\\r");  break;
+            case '\t': _out.append("\\t");  break;
+            default: {
+                char escape[] = { '\\', 'u', '0', '0', HEX[c >> 4], HEX[c & 0xF] };
+                _out.append(escape, sizeof(escape));
+            }
+        }
+    }
+
+    _out.append(text.data() + start, text.size() - start);
+    _out.push_back('"');
+    return *this;
+}
+
+JsonWriter& JsonWriter::value(bool flag) {
+    separate();
+    _out.append(flag ? "true" : "false");
+    return *this;
+}
+
+JsonWriter& JsonWriter::value(std::nullptr_t) {
+    separate();
+    _out.append("null");
+    return *this;
+}
+
+JsonWriter& JsonWriter::value(double number) {
+    if(!std::isfinite(number)) return value(nullptr);
+
+    separate();
+
+    // Shortest text that reads back as the same double
+    std::array<char, 32> text;
+    auto result = std::to_chars(text.data(), text.data() + text.size(), number);
+    _out.append(text.data(), result.ptr - text.data());
+    return *this;
+}
+
+JsonWriter& JsonWriter::integer(std::int64_t number) {
+    separate();
+
+    std::array<char, 24> text;
+    auto result = std::to_chars(text.data(), text.data() + text.size(), number);
+    _out.append(text.data(), result.ptr - text.data());
+    return *this;
+}
+
+JsonWriter& JsonWriter::unsignedInteger(std::uint64_t number) {
+    separate();
+
+    std::array<char, 24> text;
+    auto result = std::to_chars(text.data(), text.data() + text.size(), number);
+    _out.append(text.data(), result.ptr - text.data());
+    return *this;
+}
+
+JsonWriter& JsonWriter::raw(std::string_view json) {
+    separate();
+    _out.append(json);
+    return *this;
+}
+
+// ============================================================================
+// JsonStream Implementation
+// ============================================================================
+
+boost::asio::awaitable<void> JsonStream::sync() {
+    if(_buffer.size() < _chunk) co_return;
+
+    co_await _body.write(_buffer);
+    _buffer.clear();
+}
+
+boost::asio::awaitable<void> JsonStream::finish() {
+    if(!_buffer.empty()) co_await _body.write(_buffer);
+    _buffer.clear();
+}
+
+// ============================================================================
+// JsonDocument Implementation
+// ============================================================================
+
+bool JsonDocument::fail(std::string_view what, std::size_t offset) {
+    _tape.clear();
+    _error.assign(what).append(" at offset ").append(std::to_string(offset));
+    return false;
+}
+
+bool JsonDocument::parse(std::string_view text) {
+    _text = text;
+    _tape.clear();
+    _arena.clear();
+    _error.clear();
+
+    if(text.size() > std::numeric_limits<std::uint32_t>::max()) return fail("document is too large", 0);
+
+    // Roughly one node per few bytes of typical payloads; the tape grows
+    // if that is short, but most documents never reallocate it
+    _tape.reserve(text.size() / 6 + 4);
+
+    const char* end = text.data() + text.size();
+    const char* p   = text.data();
+
+    // Containers not closed yet, by tape index
+    boost::container::small_vector<std::uint32_t, 32> open;
+
+    // Object members start with a key and its colon
+    auto parseKey = [&]() -> bool {
+        p = skipSpace(p, end);
+        if(p == end || *p != '"') return fail("expected a member name", offset(p));
+        if(!(p = parseString(p, end))) return false;
+
+        ++_tape[open.back()].b;
+
+        p = skipSpace(p, end);
+        if(p == end || *p != ':') return fail("expected ':'", offset(p));
+        ++p;
+        return true;
+    };
+
+    bool expectValue = true;
+
+    while(true) {
+        p = skipSpace(p, end);
+
+        if(expectValue) {
+            if(p == end) return fail("unexpected end of input", offset(p));
+
+            if(!open.empty() && _tape[open.back()].type == JsonType::ARRAY) ++_tape[open.back()].b;
+
+            switch(*p) {
+                case '{':
+                case '[': {
+                    if(open.size() >= MAX_DEPTH) return fail("nesting is too deep", offset(p));
+
+                    auto type = (*p == '{') ? JsonType::OBJECT : JsonType::ARRAY;
+                    open.push_back(static_cast<std::uint32_t>(_tape.size()));
+                    _tape.push_back({type, false, 0, 0});
+
+                    p = skipSpace(p + 1, end);
+                    if(p < end && *p == (type == JsonType::OBJECT ? '}' : ']')) {
+                        // Empty; closed below
+                        break;
+                    }
+
+                    if(type == JsonType::OBJECT && !parseKey()) return false;
+                    continue;
+                }
+                case '"':
+                    p = parseString(p, end);
+                    break;
+                case 't':
+                    p = parseLiteral(p, end, "true", JsonType::BOOLEAN, true);
+                    break;
+                case 'f':
+                    p = parseLiteral(p, end, "false", JsonType::BOOLEAN, false);
+                    break;
+                case 'n':
+                    p = parseLiteral(p, end, "null", JsonType::NUL, false);
+                    break;
+                default:
+                    p = parseNumber(p, end);
+            }
+
+            if(!p) return false;
+
+            expectValue = false;
+            p = skipSpace(p, end);
+        }
+
+        if(open.empty()) {
+            if(p != end) return fail("trailing characters", offset(p));
+            return true;
+        }
+
+        if(p == end) return fail("unexpected end of input", offset(p));
+
+        auto& parent = _tape[open.back()];
+
+        if(*p == ',') {
+            ++p;
+            if(parent.type == JsonType::OBJECT && !parseKey()) return false;
+            expectValue = true;
+        }
+        else if(*p == (parent.type == JsonType::OBJECT ? '}' : ']')) {
+            ++p;
+            parent.a = static_cast<std::uint32_t>(_tape.size());
+            open.pop_back();
+        }
+        else {
+            return fail("expected ',' or the end of the container", offset(p));
+        }
+    }
+}
+
+const char* JsonDocument::skipSpace(const char* p, const char* end) {
+    while(p < end && (*p == ' ' || *p == '\n' || *p == '\r' || *p == '\t')) ++p;
+    return p;
+}
+
+const char* JsonDocument::parseString(const char* p, const char* end) {
+    auto start = ++p;
+
+    auto run = stringRun(p, end);
+    if(run == npos) return reject("control character in string", p);
+    if(run == static_cast<std::size_t>(end - p)) return reject("unterminated string", start - 1);
+
+    // The common case: no escapes, the node points into the source
+    if(p[run] == '"') {
+        _tape.push_back({JsonType::STRING, false, offset(start), static_cast<std::uint32_t>(run)});
+        return p + run + 1;
+    }
+
+    auto arenaStart = _arena.size();
+
+    while(true) {
+        _arena.append(p, run);
+        p += run;
+
+        if(p == end) return reject("unterminated string", start - 1);
+        if(*p == '"') break;
+
+        // An escape
+        if(end - p < 2) return reject("unterminated string", start - 1);
+
+        switch(p[1]) {
+            case '"':  _arena.push_back('"');  p += 2; break;
+            case '\\': _arena.push_back('\\'); p += 2; break;
+            case '/':  _arena.push_back('/');  p += 2; break;
+            case 'b':  _arena.push_back('\b'); p += 2; break;
+            case 'f':  _arena.push_back('\f'); p += 2; break;
+            case 'n':  _arena.push_back('\n'); p += 2; break;
+            case 'r':  _arena.push_back('\r'); p += 2; break;
+            case 't':  _arena.push_back('\t'); p += 2; break;
+            case 'u': {
+                auto code = readHex(p + 2, end);
+                if(code < 0) return reject("malformed \\u escape", p);
+                p += 6;
+
+                // A UTF-16 surrogate pair is one code point
+                if(code >= 0xD800 && code <= 0xDBFF) {
+                    auto low = (end - p >= 6 && p[0] == '\\' && p[1] == 'u') ? readHex(p + 2, end) : -1;
+                    if(low < 0xDC00 || low > 0xDFFF) return reject("unpaired surrogate", p);
+
+                    code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+                    p += 6;
+                }
+                else if(code >= 0xDC00 && code <= 0xDFFF) {
+                    return reject("unpaired surrogate", p - 6);
+                }
+
+                appendUtf8(_arena, static_cast<std::uint32_t>(code));
+                break;
+            }
+            default:
+                return reject("invalid escape", p);
+        }
+
+        run = stringRun(p, end);
+        if(run == npos) return reject("control character in string", p);
+    }
+
+    _tape.push_back({JsonType::STRING, true, static_cast<std::uint32_t>(arenaStart), static_cast<std::uint32_t>(_arena.size() - arenaStart)});
+    return p + 1;
+}
+
+const char* JsonDocument::parseNumber(const char* p, const char* end) {
+    auto start = p;
+
+    if(*p == '-') ++p;
+
+    if(p < end && *p == '0') {
+        ++p;
+    }
+    else if(p < end && isDigit(*p)) {
+        while(p < end && isDigit(*p)) ++p;
+    }
+    else {
+        return reject(start == p ? "unexpected character" : "malformed number", start);
+    }
+
+    if(p < end && *p == '.') {
+        ++p;
+        if(p == end || !isDigit(*p)) return reject("malformed number", start);
+        while(p < end && isDigit(*p)) ++p;
+    }
+
+    if(p < end && (*p == 'e' || *p == 'E')) {
+        ++p;
+        if(p < end && (*p == '+' || *p == '-')) ++p;
+        if(p == end || !isDigit(*p)) return reject("malformed number", start);
+        while(p < end && isDigit(*p)) ++p;
+    }
+
+    _tape.push_back({JsonType::NUMBER, false, offset(start), static_cast<std::uint32_t>(p - start)});
+    return p;
+}
+
+const char* JsonDocument::parseLiteral(const char* p, const char* end, std::string_view word, JsonType type, bool flag) {
+    if(static_cast<std::size_t>(end - p) < word.size() || std::string_view(p, word.size()) != word) {
+        return reject("unexpected character", p);
+    }
+
+    _tape.push_back({type, flag, 0, 0});
+    return p + word.size();
+}
+
+// ============================================================================
+// JsonValue Implementation
+// ============================================================================
+
+JsonType JsonValue::type() const {
+    return _document ? _document->_tape[_index].type : JsonType::NONE;
+}
+
+std::optional<bool> JsonValue::asBool() const {
+    if(!isBool()) return std::nullopt;
+    return _document->_tape[_index].escaped;
+}
+
+std::string_view JsonValue::numberText() const {
+    if(!isNumber()) return std::string_view();
+    return _document->text(_document->_tape[_index]);
+}
+
+std::optional<std::int64_t> JsonValue::asInt() const {
+    auto text = numberText();
+    if(text.empty()) return std::nullopt;
+
+    std::int64_t number = 0;
+    auto result = std::from_chars(text.data(), text.data() + text.size(), number);
+    if(result.ec == std::errc() && result.ptr == text.data() + text.size()) return number;
+
+    // 1.0 or 1e3 still name an integer
+    auto real = asDouble();
+    if(real && std::trunc(*real) == *real && std::abs(*real) < 9.2e18) return static_cast<std::int64_t>(*real);
+
+    return std::nullopt;
+}
+
+std::optional<std::uint64_t> JsonValue::asUint() const {
+    auto text = numberText();
+    if(text.empty() || text[0] == '-') return std::nullopt;
+
+    std::uint64_t number = 0;
+    auto result = std::from_chars(text.data(), text.data() + text.size(), number);
+    if(result.ec == std::errc() && result.ptr == text.data() + text.size()) return number;
+
+    auto real = asDouble();
+    if(real && std::trunc(*real) == *real && *real < 1.8e19) return static_cast<std::uint64_t>(*real);
+
+    return std::nullopt;
+}
+
+std::optional<double> JsonValue::asDouble() const {
+    auto text = numberText();
+    if(text.empty()) return std::nullopt;
+
+    double number = 0;
+    auto result = std::from_chars(text.data(), text.data() + text.size(), number);
+    if(result.ec != std::errc()) return std::nullopt;
+
+    return number;
+}
+
+std::optional<std::string_view> JsonValue::asString() const {
+    if(!isString()) return std::nullopt;
+    return _document->text(_document->_tape[_index]);
+}
+
+std::size_t JsonValue::size() const {
+    if(!isArray() && !isObject()) return 0;
+    return _document->_tape[_index].b;
+}
+
+JsonValue JsonValue::operator[](std::string_view name) const {
+    if(!isObject()) return JsonValue();
+
+    const auto& tape = _document->_tape;
+    auto end = tape[_index].a;
+
+    // Members are a key node followed by their value
+    for(auto i = _index + 1; i < end; i = _document->next(i + 1)) {
+        if(_document->text(tape[i]) == name) return JsonValue(_document, i + 1);
+    }
+
+    return JsonValue();
+}
+
+JsonValue JsonValue::operator[](std::size_t index) const {
+    if(!isArray() || index >= size()) return JsonValue();
+
+    // Elements are found by skipping their predecessors' subtrees
+    auto i = _index + 1;
+    for(std::size_t n = 0; n < index; ++n) i = _document->next(i);
+
+    return JsonValue(_document, i);
+}
+
+JsonValue::Iterator JsonValue::begin() const {
+    if(!isArray() && !isObject()) return Iterator();
+    return Iterator(_document, _index + 1, isObject());
+}
+
+JsonValue::Iterator JsonValue::end() const {
+    if(!isArray() && !isObject()) return Iterator();
+    return Iterator(_document, _document->_tape[_index].a, isObject());
+}
+
+JsonValue::Iterator::value_type JsonValue::Iterator::operator*() const {
+    if(_members) {
+        return { _document->text(_document->_tape[_index]), JsonValue(_document, _index + 1) };
+    }
+
+    return { std::string_view(), JsonValue(_document, _index) };
+}
+
+JsonValue::Iterator& JsonValue::Iterator::operator++() {
+    _index = _members ? _document->next(_index + 1) : _document->next(_index);
+    return *this;
+}
@@ -0,0 +1,185 @@
+#include "web/metrics.hh"
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define MURLY_TSC_X86 1
+#include <cpuid.h>
+#include <x86intrin.h>
+#endif
+
+using namespace web::http;
+
+namespace {
+    using SteadyClock = std::chrono::steady_clock;
+
+    struct Source {
+        bool tsc;
+        double nanosPerTick;
+    };
+
+    std::uint64_t steadyNanos() {
+        return static_cast<std::uint64_t>(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(SteadyClock::now().time_since_epoch()).count()
+        );
+    }
+
+    Source select() {
+#if defined(MURLY_TSC_X86)
+        // An invariant TSC ticks at the same rate in every power state and
+        // on every core; anything else is no clock
+        unsigned eax = 0, ebx = 0, ecx = 0, edx = 0;
+
+        if(__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx) && (edx & (1u << 8))) {
+            auto start = SteadyClock::now();
+            auto ticks = __rdtsc();
+
+            while(SteadyClock::now() - start < std::chrono::milliseconds(10)) { }
+
+            auto elapsed = std::chrono::duration<double, std::nano>(SteadyClock::now() - start).count();
+            ticks = __rdtsc() - ticks;
+
+            if(ticks > 0) return { true, elapsed / static_cast<double>(ticks) };
+        }
+#endif
+
+        return { false, 1.0 };
+    }
+
+    // Chosen and calibrated on first use
+    const Source& counter() {
+        static const Source selected = select();
+        return selected;
+    }
+}
+
+std::uint64_t Ticks::now() {
+#if defined(MURLY_TSC_X86)
+    if(counter().tsc) return __rdtsc();
+#endif
+
+    return steadyNanos();
+}
+
+std::uint64_t Ticks::nanos(std::uint64_t ticks) {
+    const auto& selected = counter();
+    if(!selected.tsc) return ticks;
+
+    return static_cast<std::uint64_t>(static_cast<double>(ticks) * selected.nanosPerTick);
+}
+
+const char* Ticks::source() {
+    return counter().tsc ? "tsc" : "steady_clock";
+}
+
+// ============================================================================
+// LatencyHistogram Implementation
+// ============================================================================
+
+std::size_t LatencyHistogram::bucketOf(std::uint64_t value) {
+    if(value < SUB_BUCKETS) return static_cast<std::size_t>(value);
+
+    // Values of the same bit width share a shift; their top seven bits,
+    // of which the first is always set, pick one of 64 buckets
+    auto shift = static_cast<unsigned>(std::bit_width(value)) - SUB_BUCKET_BITS;
+    if(shift > MAX_BITS - SUB_BUCKET_BITS) return BUCKETS - 1;
+
+    return SUB_BUCKETS + (shift - 1) * HALF + static_cast<std::size_t>((value >> shift) - HALF);
+}
+
+std::uint64_t LatencyHistogram::highestIn(std::size_t bucket) {
+    if(bucket < SUB_BUCKETS) return bucket;
+
+    auto shift = static_cast<unsigned>((bucket - SUB_BUCKETS) / HALF) + 1;
+    auto sub = static_cast<std::uint64_t>((bucket - SUB_BUCKETS) % HALF + HALF);
+
+    return ((sub + 1) << shift) - 1;
+}
+
+// Single writer: plain loads and stores, no locked read-modify-write
+void LatencyHistogram::record(std::uint64_t value) {
+    auto& count = _counts[bucketOf(value)];
+    count.store(count.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+
+    _total.store(_total.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    _sum.store(_sum.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+
+    if(value > _max.load(std::memory_order_relaxed)) _max.store(value, std::memory_order_relaxed);
+}
+
+void LatencyHistogram::Snapshot::add(const LatencyHistogram& histogram) {
+    for(std::size_t i = 0; i < BUCKETS; ++i) {
+        counts[i] += histogram._counts[i].load(std::memory_order_relaxed);
+    }
+
+    total += histogram._total.load(std::memory_order_relaxed);
+    sum   += histogram._sum.load(std::memory_order_relaxed);
+    max    = std::max(max, histogram._max.load(std::memory_order_relaxed));
+}
+
+std::uint64_t LatencyHistogram::Snapshot::percentile(double quantile) const {
+    if(total == 0) return 0;
+
+    // Counts are read bucket by bucket while the loop records, so they may
+    // add up to a little more or less than `total`
+    auto rank = static_cast<std::uint64_t>(std::ceil(std::clamp(quantile, 0.0, 1.0) * static_cast<double>(total)));
+    rank = std::max<std::uint64_t>(rank, 1);
+
+    std::uint64_t seen = 0;
+
+    for(std::size_t i = 0; i < BUCKETS; ++i) {
+        seen += counts[i];
+        if(seen >= rank) return std::min(highestIn(i), max);
+    }
+
+    return max;
+}
+
+// ============================================================================
+// LoopMetrics Implementation
+// ============================================================================
+
+void LoopMetrics::record(std::size_t route, int status, const std::array<std::uint64_t, REQUEST_PHASES>& nanos) {
+    auto& entries = _routes[std::min(route, _routes.size() - 1)];
+
+    auto it = std::find_if(entries.begin(), entries.end(), [status](const Entry& entry) { return entry.status == status; });
+
+    if(it == entries.end()) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        entries.push_back({ status, std::make_unique<Phases>() });
+        it = entries.end() - 1;
+    }
+
+    for(std::size_t phase = 0; phase < REQUEST_PHASES; ++phase) {
+        (*it->phases)[phase].record(nanos[phase]);
+    }
+}
+
+// ============================================================================
+// TraceRing Implementation
+// ============================================================================
+
+void TraceRing::push(RequestTrace trace) {
+    if(_traces.empty()) return;
+
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    _traces[_next] = std::move(trace);
+    _next = (_next + 1) % _traces.size();
+    _size = std::min(_size + 1, _traces.size());
+}
+
+std::vector<RequestTrace> TraceRing::snapshot() const {
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    std::vector<RequestTrace> traces;
+    traces.reserve(_size);
+
+    for(std::size_t i = 1; i <= _size; ++i) {
+        traces.push_back(_traces[(_next + _traces.size() - i) % _traces.size()]);
+    }
+
+    return traces;
+}
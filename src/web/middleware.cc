@@ -0,0 +1,43 @@
+#include "web/middleware.hh"
+
+#include <algorithm>
+
+using namespace web::http;
+
+void Pipeline::compose() {
+    std::size_t offset = 0;
+
+    for(auto& stage : _stages) {
+        stage.offset = offset;
+        offset += stage.width;
+    }
+
+    // Only stages with after() hooks are visited on the way out
+    _afterStages.clear();
+    std::copy_if(_stages.rbegin(), _stages.rend(), std::back_inserter(_afterStages), [](const Stage& stage) {
+        return stage.leave != nullptr;
+    });
+}
+
+std::pair<std::size_t, Next> Pipeline::before(HttpRequest& request, HttpResponse& response) const {
+    std::size_t entered = 0;
+
+    for(const auto& stage : _stages) {
+        auto [count, next] = stage.enter(stage.chain, request, response);
+        entered += count;
+
+        if(next == Next::STOP) {
+            return { entered, Next::STOP };
+        }
+    }
+
+    return { entered, Next::CONTINUE };
+}
+
+void Pipeline::after(std::size_t entered, const HttpRequest& request, HttpResponse& response) const {
+    for(const auto& stage : _afterStages) {
+        if(entered <= stage.offset) continue;
+
+        stage.leave(stage.chain, std::min(entered - stage.offset, stage.width), request, response);
+    }
+}
@@ -0,0 +1,226 @@
+#include "web/mime.hh"
+#include "web/headers.hh"
+
+#include <array>
+#include <cstddef>
+
+using namespace web::http;
+
+namespace {
+    constexpr std::string_view OCTET_STREAM = "application/octet-stream";
+
+    struct MimeEntry {
+        std::string_view extension;
+        std::string_view type;
+    };
+
+    constexpr MimeEntry MIME_TYPES[] = {
+        // Text
+        { "txt",   "text/plain" },
+        { "html",  "text/html" },
+        { "htm",   "text/html" },
+        { "css",   "text/css" },
+        { "js",    "application/javascript" },
+        { "mjs",   "application/javascript" },
+        { "json",  "application/json" },
+        { "xml",   "application/xml" },
+        { "csv",   "text/csv" },
+
+        // Images
+        { "png",   "image/png" },
+        { "jpg",   "image/jpeg" },
+        { "jpeg",  "image/jpeg" },
+        { "gif",   "image/gif" },
+        { "svg",   "image/svg+xml" },
+        { "webp",  "image/webp" },
+        { "avif",  "image/avif" },
+        { "ico",   "image/x-icon" },
+
+        // Audio/Video
+        { "mp3",   "audio/mpeg" },
+        { "wav",   "audio/wav" },
+        { "mp4",   "video/mp4" },
+        { "webm",  "video/webm" },
+        { "ogg",   "audio/ogg" },
+
+        // Documents
+        { "pdf",   "application/pdf" },
+        { "doc",   "application/msword" },
+        { "docx",  "application/vnd.openxmlformats-officedocument.wordprocessingml.document" },
+        { "xls",   "application/vnd.ms-excel" },
+        { "xlsx",  "application/vnd.openxmlformats-officedocument.spreadsheetml.sheet" },
+
+        // Archives
+        { "zip",   "application/zip" },
+        { "tar",   "application/x-tar" },
+        { "gz",    "application/gzip" },
+        { "rar",   "application/x-rar-compressed" },
+
+        // Fonts and code
+        { "ttf",   "font/ttf" },
+        { "otf",   "font/otf" },
+        { "woff",  "font/woff" },
+        { "woff2", "font/woff2" },
+        { "wasm",  "application/wasm" }
+    };
+
+    constexpr std::size_t MIME_COUNT = std::size(MIME_TYPES);
+
+    // An extension of up to 7 bytes, lowercased, packed into one word with
+    // its length in the top byte; longer ones are never in the table
+    constexpr std::size_t MAX_EXTENSION = 7;
+
+    constexpr std::uint64_t packExtension(std::string_view extension) {
+        std::uint64_t key = static_cast<std::uint64_t>(extension.size()) << 56;
+
+        for(std::size_t i = 0; i < extension.size(); ++i) {
+            auto c = static_cast<unsigned char>(extension[i]);
+            if(c >= 'A' && c <= 'Z') c |= 0x20;
+
+            key |= static_cast<std::uint64_t>(c) << (8 * i);
+        }
+
+        return key;
+    }
+
+    // Multiplicative hashing into 128 slots; the multiplier is searched
+    // for at compile time until no two extensions share a slot
+    constexpr unsigned SLOT_BITS = 7;
+    constexpr std::size_t SLOT_COUNT = std::size_t(1) << SLOT_BITS;
+
+    constexpr std::size_t slotOf(std::uint64_t key, std::uint64_t multiplier) {
+        return static_cast<std::size_t>((key * multiplier) >> (64 - SLOT_BITS));
+    }
+
+    struct MimeTable {
+        std::uint64_t multiplier = 0;
+        std::array<std::uint8_t, SLOT_COUNT> slots{};       // entry index + 1, 0 when empty
+        std::array<std::uint64_t, MIME_COUNT> keys{};
+    };
+
+    constexpr MimeTable buildMimeTable() {
+        std::uint64_t candidate = 0x9e3779b97f4a7c15ull;
+
+        for(;;) {
+            MimeTable table;
+            table.multiplier = candidate | 1;
+
+            bool perfect = true;
+
+            for(std::size_t i = 0; i < MIME_COUNT && perfect; ++i) {
+                table.keys[i] = packExtension(MIME_TYPES[i].extension);
+
+                auto& slot = table.slots[slotOf(table.keys[i], table.multiplier)];
+                perfect = (slot == 0);
+                slot = static_cast<std::uint8_t>(i + 1);
+            }
+
+            if(perfect) return table;
+
+            candidate = candidate * 6364136223846793005ull + 1442695040888963407ull;
+        }
+    }
+
+    constexpr MimeTable MIME_TABLE = buildMimeTable();
+
+    constexpr bool extensionsFit() {
+        for(const auto& entry : MIME_TYPES) {
+            if(entry.extension.empty() || entry.extension.size() > MAX_EXTENSION) return false;
+        }
+
+        return MIME_COUNT < 255;
+    }
+
+    static_assert(extensionsFit(), "extensions must be 1-7 bytes and fit the slot index");
+
+    bool endsWith(std::string_view value, std::string_view suffix) {
+        return value.size() > suffix.size() && iequals(value.substr(value.size() - suffix.size()), suffix);
+    }
+
+    MediaType classify(std::string_view type) {
+        struct Known {
+            std::string_view type;
+            MediaType kind;
+        };
+
+        static constexpr Known KNOWN[] = {
+            { "application/json",                   MediaType::JSON },
+            { "application/x-www-form-urlencoded",  MediaType::FORM },
+            { "multipart/form-data",                MediaType::MULTIPART_FORM },
+            { "text/plain",                         MediaType::TEXT },
+            { "text/html",                          MediaType::HTML },
+            { "application/xml",                    MediaType::XML },
+            { "text/xml",                           MediaType::XML },
+            { "text/event-stream",                  MediaType::EVENT_STREAM },
+            { "application/octet-stream",           MediaType::OCTET_STREAM }
+        };
+
+        for(const auto& known : KNOWN) {
+            if(iequals(type, known.type)) return known.kind;
+        }
+
+        // Structured syntax suffixes, e.g. application/problem+json
+        if(endsWith(type, "+json")) return MediaType::JSON;
+        if(endsWith(type, "+xml"))  return MediaType::XML;
+
+        if(type.size() > 10 && iequals(type.substr(0, 10), "multipart/")) return MediaType::MULTIPART_OTHER;
+
+        return MediaType::OTHER;
+    }
+}
+
+std::string_view web::http::mimeType(std::string_view filename) {
+    auto dot = filename.find_last_of("./");
+    if(dot == std::string_view::npos || filename[dot] != '.') return OCTET_STREAM;
+
+    auto extension = filename.substr(dot + 1);
+    if(extension.empty() || extension.size() > MAX_EXTENSION) return OCTET_STREAM;
+
+    auto key = packExtension(extension);
+    auto index = MIME_TABLE.slots[slotOf(key, MIME_TABLE.multiplier)];
+
+    if(index == 0 || MIME_TABLE.keys[index - 1] != key) return OCTET_STREAM;
+
+    return MIME_TYPES[index - 1].type;
+}
+
+ContentType web::http::parseContentType(std::string_view value) {
+    ContentType result;
+
+    auto semicolon = value.find(';');
+    result.type = trim(value.substr(0, semicolon));
+
+    if(result.type.empty()) return result;
+
+    result.kind = classify(result.type);
+
+    // Parameters: ; name=value or ; name="quoted value"
+    while(semicolon != std::string_view::npos) {
+        value.remove_prefix(semicolon + 1);
+        semicolon = value.find(';');
+
+        auto parameter = trim(value.substr(0, semicolon));
+        auto equals = parameter.find('=');
+
+        if(equals == std::string_view::npos) continue;
+
+        auto name = trim(parameter.substr(0, equals));
+        auto argument = trim(parameter.substr(equals + 1));
+
+        if(argument.size() >= 2 && argument.front() == '"') {
+            // A quoted boundary may contain ';', so resume after the closing quote
+            auto start = static_cast<std::size_t>(argument.data() - value.data());
+            auto close = value.find('"', start + 1);
+
+            if(close == std::string_view::npos) break;
+
+            argument = value.substr(start + 1, close - start - 1);
+            semicolon = value.find(';', close);
+        }
+
+        if(iequals(name, "charset"))        result.charset = argument;
+        else if(iequals(name, "boundary"))  result.boundary = argument;
+    }
+
+    return result;
+}
@@ -0,0 +1,524 @@
+#include "web/multipart.hh"
+#include "web/headers.hh"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <system_error>
+
+#include <unistd.h>
+
+using namespace web::http;
+
+namespace {
+    // RFC 2046 allows 1 to 70 characters; anything longer is not worth the risk
+    constexpr std::size_t MAX_BOUNDARY = 70;
+
+    // form-data; name="field"; filename="photo.jpg"
+    // Browsers percent-encode quotes in names rather than escaping them, so
+    // a quoted value simply runs to the next quote. filename* is not used
+    // by form submissions (RFC 7578) and is ignored.
+    void parseDisposition(std::string_view value, std::string& name, std::optional<std::string>& filename) {
+        auto semicolon = value.find(';');
+
+        while(semicolon != std::string_view::npos) {
+            value.remove_prefix(semicolon + 1);
+
+            auto equals = value.find('=');
+            if(equals == std::string_view::npos) break;
+
+            semicolon = value.find(';');
+            if(semicolon < equals) continue;
+
+            auto key = trim(value.substr(0, equals));
+            auto argument = value.substr(equals + 1);
+            argument.remove_prefix(std::min(argument.find_first_not_of(" \t"), argument.size()));
+
+            if(!argument.empty() && argument.front() == '"') {
+                auto close = argument.find('"', 1);
+                auto start = static_cast<std::size_t>(argument.data() - value.data());
+
+                semicolon = (close == std::string_view::npos) ? close : value.find(';', start + close);
+                argument = argument.substr(1, close == std::string_view::npos ? close : close - 1);
+            }
+            else {
+                argument = trim(argument.substr(0, argument.find(';')));
+            }
+
+            if(iequals(key, "name"))            name.assign(argument);
+            else if(iequals(key, "filename"))   filename.emplace(argument);
+        }
+    }
+
+    void writeAll(int fd, std::string_view data) {
+        while(!data.empty()) {
+            auto written = ::write(fd, data.data(), data.size());
+
+            if(written < 0) {
+                if(errno == EINTR) continue;
+                throw std::system_error(errno, std::generic_category(), "writing an upload");
+            }
+
+            data.remove_prefix(static_cast<std::size_t>(written));
+        }
+    }
+
+    // The file part being written; its descriptor is closed however reading ends
+    struct Upload {
+        int fd = -1;
+        std::string buffer;
+
+        ~Upload() { close(); }
+
+        void close() {
+            if(fd >= 0) ::close(fd);
+            fd = -1;
+        }
+    };
+
+    boost::asio::awaitable<void> write(const Upload& upload, std::string_view data, const MultipartLimits& limits) {
+        if(limits.workers) {
+            co_await limits.workers->run([fd = upload.fd, data]() { writeAll(fd, data); });
+        }
+        else {
+            writeAll(upload.fd, data);
+        }
+    }
+
+    int createTempFile(const std::filesystem::path& directory, std::filesystem::path& path) {
+        auto pattern = (directory / "murly-upload-XXXXXX").string();
+        auto fd = ::mkstemp(pattern.data());
+
+        if(fd < 0) throw std::system_error(errno, std::generic_category(), "creating a temp file for an upload");
+
+        path = pattern;
+        return fd;
+    }
+}
+
+// ============================================================================
+// MultipartParser Implementation
+// ============================================================================
+
+MultipartParser::MultipartParser(std::string_view boundary, std::size_t maxHeaderSize)
+    : _delimiter("\r\n--"), _maxHeaderSize(maxHeaderSize) {
+
+    // The search relies on '\r' appearing only at the start of the delimiter
+    if(boundary.empty() || boundary.size() > MAX_BOUNDARY || boundary.find_first_of("\r\n") != std::string_view::npos) {
+        _state = State::FAILED;
+        return;
+    }
+
+    _delimiter.append(boundary);
+
+    auto length = _delimiter.size();
+    _skip.fill(static_cast<std::uint8_t>(length));
+
+    for(std::size_t i = 0; i + 1 < length; ++i) {
+        _skip[static_cast<unsigned char>(_delimiter[i])] = static_cast<std::uint8_t>(length - 1 - i);
+    }
+
+    // The first delimiter may open the body, with no CRLF before it
+    _lookbehind = "\r\n";
+}
+
+std::size_t MultipartParser::search(std::string_view input, bool& partial) const {
+    const auto* text = input.data();
+    const auto* pattern = _delimiter.data();
+    auto length = _delimiter.size();
+    auto last = static_cast<unsigned char>(pattern[length - 1]);
+
+    partial = false;
+
+    std::size_t i = 0;
+    while(i + length <= input.size()) {
+        auto c = static_cast<unsigned char>(text[i + length - 1]);
+
+        if(c == last && std::memcmp(text + i, pattern, length - 1) == 0) return i;
+
+        i += _skip[c];
+    }
+
+    // No whole delimiter, but one may begin in what is left
+    for(auto at = input.find('\r', i); at != std::string_view::npos; at = input.find('\r', at + 1)) {
+        if(_delimiter.compare(0, input.size() - at, input.substr(at)) == 0) {
+            partial = true;
+            return at;
+        }
+    }
+
+    return std::string_view::npos;
+}
+
+bool MultipartParser::parseHeaders() {
+    _headers.clear();
+    _name.clear();
+    _filename.reset();
+
+    // _head holds the CRLF ending the delimiter line, then lines ending in CRLF
+    auto block = std::string_view(_head).substr(2);
+
+    while(!block.empty()) {
+        auto end = block.find("\r\n");
+        auto line = block.substr(0, end);
+        block.remove_prefix(end + 2);
+
+        auto colon = line.find(':');
+        if(colon == std::string_view::npos || colon == 0) return false;
+
+        _headers.add(trim(line.substr(0, colon)), trim(line.substr(colon + 1)));
+    }
+
+    if(auto disposition = _headers.get("Content-Disposition")) {
+        parseDisposition(*disposition, _name, _filename);
+    }
+
+    return true;
+}
+
+MultipartParser::Event MultipartParser::parse(std::string_view input, std::size_t& consumed, std::string_view& data) {
+    std::size_t position = 0;
+    consumed = 0;
+
+    if(_state == State::FAILED) return Event::FAILED;
+
+    if(_state == State::DONE) {
+        consumed = input.size();
+        return Event::DONE;
+    }
+
+    auto fail = [&]() {
+        _state = State::FAILED;
+        consumed = position;
+        return Event::FAILED;
+    };
+
+    while(position < input.size()) {
+        auto c = input[position];
+
+        switch(_state) {
+            case State::PREAMBLE:
+            case State::BODY: {
+                auto body = (_state == State::BODY);
+                auto rest = input.substr(position);
+
+                if(!_lookbehind.empty()) {
+                    auto expected = std::string_view(_delimiter).substr(_lookbehind.size());
+                    auto length = std::min(expected.size(), rest.size());
+
+                    if(rest.compare(0, length, expected.substr(0, length)) == 0) {
+                        if(length < expected.size()) {
+                            _lookbehind.append(rest);
+                            position = input.size();
+                            break;
+                        }
+
+                        _lookbehind.clear();
+                        position += length;
+                        _state = State::DELIMITER_END;
+
+                        if(body) {
+                            consumed = position;
+                            return Event::PART_END;
+                        }
+                        break;
+                    }
+
+                    // Not a delimiter after all. Its prefix holds a '\r' only
+                    // at the start, so none can begin inside it either.
+                    if(body) {
+                        _released.swap(_lookbehind);
+                        _lookbehind.clear();
+                        data = _released;
+                        consumed = position;
+                        return Event::DATA;
+                    }
+
+                    _lookbehind.clear();
+                    break;
+                }
+
+                bool partial = false;
+                auto found = search(rest, partial);
+
+                if(found == std::string_view::npos || partial) {
+                    if(partial) _lookbehind.assign(rest.substr(found));
+                    position = input.size();
+
+                    auto length = partial ? found : rest.size();
+                    if(body && length > 0) {
+                        data = rest.substr(0, length);
+                        consumed = position;
+                        return Event::DATA;
+                    }
+                    break;
+                }
+
+                if(body && found > 0) {
+                    data = rest.substr(0, found);
+                    consumed = position + found;
+                    return Event::DATA;
+                }
+
+                position += found + _delimiter.size();
+                _state = State::DELIMITER_END;
+
+                if(body) {
+                    consumed = position;
+                    return Event::PART_END;
+                }
+                break;
+            }
+
+            case State::DELIMITER_END:
+                // "--" closes the body; otherwise optional padding, then CRLF
+                if(c == '-')                        _state = State::CLOSE;
+                else if(c == '\r')                  _state = State::DELIMITER_LF;
+                else if(c != ' ' && c != '\t')      return fail();
+
+                ++position;
+                break;
+
+            case State::CLOSE:
+                if(c != '-') return fail();
+
+                // The epilogue is of no interest
+                _state = State::DONE;
+                consumed = input.size();
+                return Event::DONE;
+
+            case State::DELIMITER_LF:
+                if(c != '\n') return fail();
+
+                _head.assign("\r\n");
+                _state = State::HEADERS;
+                ++position;
+                break;
+
+            case State::HEADERS: {
+                auto old = _head.size();
+                _head.append(input.substr(position, _maxHeaderSize + 4 - old));
+
+                // _head begins with the delimiter line's CRLF, so a part
+                // without headers ends the block at once
+                auto end = _head.find("\r\n\r\n", old >= 3 ? old - 3 : 0);
+
+                if(end == std::string::npos) {
+                    if(_head.size() >= _maxHeaderSize + 4) return fail();
+
+                    position = input.size();
+                    break;
+                }
+
+                position += end + 4 - old;
+                _head.resize(end + 2);
+
+                if(!parseHeaders()) return fail();
+
+                _state = State::BODY;
+                consumed = position;
+                return Event::HEADERS;
+            }
+
+            case State::DONE:
+            case State::FAILED:
+                break;
+        }
+    }
+
+    consumed = position;
+    return Event::NEED_MORE;
+}
+
+// ============================================================================
+// MultipartForm Implementation
+// ============================================================================
+
+MultipartForm::~MultipartForm() {
+    removeFiles();
+}
+
+MultipartForm& MultipartForm::operator=(MultipartForm&& other) noexcept {
+    if(this != &other) {
+        removeFiles();
+
+        _fields = std::move(other._fields);
+        _files = std::move(other._files);
+        _temporary = std::move(other._temporary);
+        other._temporary.clear();
+    }
+
+    return *this;
+}
+
+void MultipartForm::removeFiles() {
+    for(const auto& path : _temporary) {
+        std::error_code error;
+        std::filesystem::remove(path, error);
+    }
+
+    _temporary.clear();
+}
+
+boost::asio::awaitable<MultipartForm> MultipartForm::read(const HttpRequest& request, MultipartLimits limits) {
+    const auto& type = request.contentType();
+
+    if(!type.is(MediaType::MULTIPART_FORM) || type.boundary.empty()) {
+        throw MalformedBody("expected a multipart/form-data body with a boundary");
+    }
+
+    enum class Part { NONE, FIELD, FILE };
+
+    MultipartParser parser(type.boundary, limits.maxHeaderSize);
+    MultipartForm form;
+    Upload upload;
+
+    auto current = Part::NONE;
+    std::size_t parts = 0;
+    std::size_t fieldsSize = 0;
+
+    auto directory = limits.tempDirectory.empty() ? std::filesystem::temp_directory_path() : limits.tempDirectory;
+    auto writeBuffer = std::max<std::size_t>(limits.writeBuffer, 1);
+
+    auto* reader = request.bodyReader();
+    auto piece = reader ? co_await reader->read() : std::string_view(request.body());
+
+    while(!piece.empty() && !parser.done()) {
+        std::size_t consumed = 0;
+        std::string_view data;
+
+        auto event = parser.parse(piece, consumed, data);
+        piece.remove_prefix(consumed);
+
+        switch(event) {
+            case MultipartParser::Event::HEADERS: {
+                if(++parts > limits.maxParts) throw BodyTooLarge();
+
+                auto contentType = std::string(parser.headers().get(Field::CONTENT_TYPE).value_or(""));
+
+                if(parser.filename()) {
+                    MultipartFile file{ parser.name(), *parser.filename(), std::move(contentType), {}, 0 };
+                    upload.fd = createTempFile(directory, file.path);
+
+                    form._temporary.push_back(file.path);
+                    form._files.push_back(std::move(file));
+                    current = Part::FILE;
+                }
+                else {
+                    form._fields.push_back({ parser.name(), {}, std::move(contentType) });
+                    current = Part::FIELD;
+                }
+                break;
+            }
+
+            case MultipartParser::Event::DATA:
+                if(current == Part::FIELD) {
+                    auto& value = form._fields.back().value;
+                    fieldsSize += data.size();
+
+                    if(value.size() + data.size() > limits.maxFieldSize || fieldsSize > limits.maxFieldsSize) {
+                        throw BodyTooLarge();
+                    }
+
+                    value.append(data);
+                }
+                else if(current == Part::FILE) {
+                    auto& file = form._files.back();
+                    file.size += data.size();
+
+                    if(file.size > limits.maxFileSize) throw BodyTooLarge();
+
+                    // Large pieces go to disk as they are; small ones are
+                    // gathered so the file is not written a few bytes at a time
+                    if(upload.buffer.empty() && data.size() >= writeBuffer) {
+                        co_await write(upload, data, limits);
+                    }
+                    else {
+                        upload.buffer.append(data);
+
+                        if(upload.buffer.size() >= writeBuffer) {
+                            co_await write(upload, upload.buffer, limits);
+                            upload.buffer.clear();
+                        }
+                    }
+                }
+                break;
+
+            case MultipartParser::Event::PART_END:
+                if(current == Part::FILE) {
+                    if(!upload.buffer.empty()) {
+                        co_await write(upload, upload.buffer, limits);
+                        upload.buffer.clear();
+                    }
+
+                    upload.close();
+                }
+
+                current = Part::NONE;
+                break;
+
+            case MultipartParser::Event::FAILED:
+                throw MalformedBody("malformed multipart body");
+
+            case MultipartParser::Event::NEED_MORE:
+            case MultipartParser::Event::DONE:
+                break;
+        }
+
+        if(piece.empty() && reader && !parser.done()) piece = co_await reader->read();
+    }
+
+    if(!parser.done()) throw MalformedBody("multipart body ends before its close delimiter");
+
+    // Read past the epilogue so the connection can be kept alive
+    if(reader) {
+        while(!reader->finished() && !(co_await reader->read()).empty()) { }
+    }
+
+    co_return form;
+}
+
+std::optional<std::string_view> MultipartForm::field(std::string_view name) const {
+    for(const auto& field : _fields) {
+        if(field.name == name) return std::string_view(field.value);
+    }
+
+    return std::nullopt;
+}
+
+const MultipartFile* MultipartForm::file(std::string_view name) const {
+    for(const auto& file : _files) {
+        if(file.name == name) return &file;
+    }
+
+    return nullptr;
+}
+
+bool MultipartForm::save(const MultipartFile& file, const std::filesystem::path& destination) {
+    if(_files.empty() || &file < _files.data() || &file >= _files.data() + _files.size()) return false;
+
+    auto& entry = _files[static_cast<std::size_t>(&file - _files.data())];
+    auto owned = std::find(_temporary.begin(), _temporary.end(), entry.path);
+
+    if(owned == _temporary.end()) return false;
+
+    std::error_code error;
+    std::filesystem::rename(entry.path, destination, error);
+
+    if(!error) {
+        _temporary.erase(owned);
+        entry.path = destination;
+        return true;
+    }
+
+    if(error != std::errc::cross_device_link) return false;
+
+    // Another file system: copy, and leave the temp file to be removed with the form
+    error.clear();
+    std::filesystem::copy_file(entry.path, destination, std::filesystem::copy_options::overwrite_existing, error);
+
+    if(error) return false;
+
+    entry.path = destination;
+    return true;
+}
@@ -0,0 +1,700 @@
+#include "web/proxy.hh"
+#include "web/chunked.hh"
+#include "web/headers.hh"
+#include "web/scan.hh"
+
+#include <boost/container/small_vector.hpp>
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <charconv>
+#include <iostream>
+
+#include <sys/socket.h>
+
+using namespace web::http;
+
+namespace {
+    constexpr std::size_t READ_SIZE = 16 * 1024;
+    constexpr std::size_t MAX_HEAD  = 64 * 1024;
+
+    // Bodies of a known length up to this size are read in full before
+    // answering, which hands the upstream connection back right away
+    constexpr std::uint64_t SMALL_BODY = 16 * 1024;
+
+    std::atomic<std::uint64_t> nextProxyId = 1;
+
+    // Anything that went wrong talking to an upstream
+    class UpstreamError : public std::runtime_error {
+    public:
+        explicit UpstreamError(const std::string& message, bool timeout = false)
+            : std::runtime_error(message), timeout(timeout) { }
+
+        bool timeout;
+        bool retryable = false;  // nothing was lost, the request may be sent again
+    };
+
+    // Headers about one connection, never forwarded: the fixed ones and
+    // whatever that message's Connection header lists
+    bool isHopByHop(std::string_view name, std::string_view connection) {
+        static constexpr std::string_view NAMES[] = {
+            "connection", "keep-alive", "proxy-connection", "proxy-authenticate",
+            "proxy-authorization", "te", "trailer", "transfer-encoding", "upgrade"
+        };
+
+        for(auto hop : NAMES) {
+            if(iequals(name, hop)) return true;
+        }
+
+        return hasToken(connection, name);
+    }
+
+    bool isIdempotent(Method method) {
+        switch(method) {
+            case Method::GET:
+            case Method::HEAD:
+            case Method::PUT:
+            case Method::DELETE:
+            case Method::OPTIONS:
+            case Method::TRACE:
+                return true;
+            default:
+                return false;
+        }
+    }
+}
+
+// ============================================================================
+// UpstreamConnection Implementation
+// ============================================================================
+
+// One HTTP/1.1 connection to a target. Every operation is timed: when the
+// timer wins, the socket is closed, which fails the operation and makes sure
+// the connection is never reused.
+class web::http::UpstreamConnection : public std::enable_shared_from_this<UpstreamConnection> {
+public:
+    explicit UpstreamConnection(const boost::asio::any_io_executor& executor)
+        : socket(executor), _timer(executor) { }
+
+    boost::asio::awaitable<void> connect(const std::string& host, const std::string& port, std::chrono::milliseconds timeout) {
+        boost::system::error_code ec;
+
+        TcpResolver resolver(socket.get_executor());
+        auto endpoints = co_await resolver.async_resolve(host, port, boost::asio::redirect_error(boost::asio::use_awaitable, ec));
+        if(ec) throw UpstreamError("cannot resolve " + host + ": " + ec.message());
+
+        arm(timeout);
+        co_await boost::asio::async_connect(socket, endpoints, boost::asio::redirect_error(boost::asio::use_awaitable, ec));
+        disarm();
+
+        if(_timedOut) throw UpstreamError("connect timed out", true);
+        if(ec) throw UpstreamError("connect: " + ec.message());
+
+        socket.set_option(boost::asio::ip::tcp::no_delay(true));
+    }
+
+    // Appends what the upstream sends next to the input; 0 once it has closed
+    boost::asio::awaitable<std::size_t> readSome(std::chrono::milliseconds timeout) {
+        boost::system::error_code ec;
+
+        arm(timeout);
+        auto length = co_await socket.async_read_some(input.prepare(READ_SIZE), boost::asio::redirect_error(boost::asio::use_awaitable, ec));
+        disarm();
+
+        if(_timedOut) throw UpstreamError("upstream timed out", true);
+        if(ec == boost::asio::error::eof) co_return 0;
+        if(ec) throw UpstreamError("read: " + ec.message());
+
+        input.commit(length);
+        co_return length;
+    }
+
+    template<typename Buffers>
+    boost::asio::awaitable<void> write(const Buffers& buffers, std::chrono::milliseconds timeout) {
+        boost::system::error_code ec;
+
+        arm(timeout);
+        co_await boost::asio::async_write(socket, buffers, boost::asio::redirect_error(boost::asio::use_awaitable, ec));
+        disarm();
+
+        if(_timedOut) throw UpstreamError("upstream timed out", true);
+        if(ec) throw UpstreamError("write: " + ec.message());
+    }
+
+    std::string_view pending() const {
+        auto data = input.data();
+        return std::string_view(static_cast<const char*>(data.data()), data.size());
+    }
+
+    void consume(std::size_t length) { input.consume(length); }
+
+    // A parked connection the upstream has closed (or written to unasked)
+    // is readable; one that is still good would block
+    bool alive() {
+        if(!socket.is_open() || input.size() != 0) return false;
+
+        char byte;
+        auto result = ::recv(socket.native_handle(), &byte, 1, MSG_PEEK | MSG_DONTWAIT);
+        return result < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+    }
+
+    TcpSocket socket;
+    boost::asio::streambuf input;
+
+    ReverseProxy::Clock::time_point idleSince;
+    bool reused = false;
+
+private:
+    void arm(std::chrono::milliseconds timeout) {
+        auto generation = ++_generation;
+
+        _timer.expires_after(timeout);
+        _timer.async_wait([self = shared_from_this(), generation](boost::system::error_code ec) {
+            if(ec || self->_generation != generation) return;
+
+            self->_timedOut = true;
+
+            boost::system::error_code ignored;
+            self->socket.close(ignored);
+        });
+    }
+
+    void disarm() {
+        ++_generation;
+        _timer.cancel();
+    }
+
+    boost::asio::steady_timer _timer;
+    std::uint64_t _generation = 0;
+    bool _timedOut = false;
+};
+
+// ============================================================================
+// ReverseProxy Implementation
+// ============================================================================
+
+// One request's claim on a target, and on a connection once it has one.
+// Whoever drops it last (the response's body producer, if it has one) ends
+// the request: the target's count goes down and a connection whose response
+// was read to the end goes back to its loop's pool.
+struct ReverseProxy::Lease {
+    // How the rest of the response body is delimited
+    enum class Framing {
+        LENGTH,
+        CHUNKED,
+        CLOSE
+    };
+
+    Lease(std::shared_ptr<ReverseProxy> proxy, Pool& pool, std::size_t target, bool fresh)
+        : proxy(std::move(proxy)), pool(pool), target(target), fresh(fresh) {
+        auto& state = *this->proxy->_targets[target];
+        state.outstanding.fetch_add(1, std::memory_order_relaxed);
+        state.requests.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    ~Lease() { proxy->release(*this); }
+
+    std::shared_ptr<ReverseProxy> proxy;
+    Pool& pool;
+    std::size_t target;
+    bool fresh;     // skip the pool, after a parked connection turned out dead
+
+    std::shared_ptr<UpstreamConnection> connection;
+
+    Framing framing = Framing::LENGTH;
+    std::uint64_t remaining = 0;
+    ChunkedDecoder decoder;
+
+    bool reusable = false;  // the upstream keeps the connection open after this response
+    bool done = false;      // and all of it has been read
+};
+
+ReverseProxy::ReverseProxy(ProxyOptions options)
+    : _options(std::move(options)), _id(nextProxyId++) {
+    if(_options.targets.empty()) {
+        throw std::invalid_argument("A proxy needs at least one upstream target");
+    }
+
+    for(const auto& target : _options.targets) {
+        auto& state = *_targets.emplace_back(std::make_unique<Target>());
+
+        state.host    = target.host;
+        state.port    = std::to_string(target.port);
+        state.address = target.host + ":" + state.port;
+    }
+}
+
+ReverseProxy::~ReverseProxy() = default;
+
+std::vector<ReverseProxy::TargetStats> ReverseProxy::stats() const {
+    auto now = Clock::now().time_since_epoch().count();
+    std::vector<TargetStats> result;
+
+    for(const auto& target : _targets) {
+        result.push_back({
+            target->address,
+            target->requests.load(std::memory_order_relaxed),
+            target->failures.load(std::memory_order_relaxed),
+            target->outstanding.load(std::memory_order_relaxed),
+            target->ejectedUntil.load(std::memory_order_relaxed) > now
+        });
+    }
+
+    return result;
+}
+
+ReverseProxy::Pool& ReverseProxy::pool(const boost::asio::any_io_executor& executor) {
+    // Each thread remembers the last pool it used, so a loop serving one
+    // proxy only takes the lock for its first request
+    thread_local std::uint64_t lastProxy = 0;
+    thread_local const void* lastContext = nullptr;
+    thread_local Pool* lastPool = nullptr;
+
+    const void* context = &boost::asio::query(executor, boost::asio::execution::context);
+    if(lastProxy == _id && lastContext == context) return *lastPool;
+
+    std::lock_guard<std::mutex> lock(_poolsMutex);
+
+    auto& pool = _pools[context];
+
+    if(!pool) {
+        pool = std::make_unique<Pool>();
+        pool->idle.resize(_targets.size());
+    }
+
+    lastProxy   = _id;
+    lastContext = context;
+    lastPool    = pool.get();
+
+    return *pool;
+}
+
+std::size_t ReverseProxy::pick() {
+    auto now = Clock::now().time_since_epoch().count();
+    auto count = _targets.size();
+
+    // Least outstanding requests, counted over every loop; starting the scan
+    // at a rotating index spreads ties instead of favouring the first target
+    auto start = _next.fetch_add(1, std::memory_order_relaxed);
+    auto best = count;
+    std::int64_t bestLoad = 0;
+
+    for(std::size_t i = 0; i < count; ++i) {
+        auto index = (start + i) % count;
+        auto& target = *_targets[index];
+
+        if(target.ejectedUntil.load(std::memory_order_relaxed) > now) continue;
+
+        auto load = target.outstanding.load(std::memory_order_relaxed);
+
+        if(best == count || load < bestLoad) {
+            best = index;
+            bestLoad = load;
+        }
+    }
+
+    if(best != count) return best;
+
+    // Every target is ejected: rather than failing outright, try the one
+    // that is due back first
+    best = 0;
+
+    for(std::size_t i = 1; i < count; ++i) {
+        if(_targets[i]->ejectedUntil.load(std::memory_order_relaxed) < _targets[best]->ejectedUntil.load(std::memory_order_relaxed)) {
+            best = i;
+        }
+    }
+
+    return best;
+}
+
+void ReverseProxy::report(std::size_t index, bool success) {
+    auto& target = *_targets[index];
+
+    if(success) {
+        target.consecutiveFailures.store(0, std::memory_order_relaxed);
+        return;
+    }
+
+    target.failures.fetch_add(1, std::memory_order_relaxed);
+
+    auto failures = target.consecutiveFailures.fetch_add(1, std::memory_order_relaxed) + 1;
+    if(_options.ejectAfter == 0 || failures < _options.ejectAfter) return;
+
+    target.consecutiveFailures.store(0, std::memory_order_relaxed);
+    target.ejectedUntil.store((Clock::now() + _options.ejectionTime).time_since_epoch().count(), std::memory_order_relaxed);
+
+    std::cerr<<"Ejecting upstream "<<target.address<<" for "<<_options.ejectionTime.count()<<"ms after "<<failures<<" failures"<<std::endl;
+}
+
+void ReverseProxy::release(Lease& lease) {
+    _targets[lease.target]->outstanding.fetch_sub(1, std::memory_order_relaxed);
+
+    auto& connection = lease.connection;
+    if(!connection || !lease.done || !lease.reusable) return;
+    if(!connection->socket.is_open() || connection->input.size() != 0) return;
+
+    auto& idle = lease.pool.idle[lease.target];
+    if(idle.size() >= _options.maxIdlePerTarget) return;
+
+    connection->idleSince = Clock::now();
+    connection->reused = true;
+    idle.push_back(std::move(connection));
+}
+
+boost::asio::awaitable<std::shared_ptr<UpstreamConnection>> ReverseProxy::acquire(Pool& pool, std::size_t index) {
+    auto& idle = pool.idle[index];
+    auto now = Clock::now();
+
+    // Most recently parked first, it is the likeliest to still be open
+    while(!idle.empty()) {
+        auto connection = std::move(idle.back());
+        idle.pop_back();
+
+        if(now - connection->idleSince < _options.idleTimeout && connection->alive()) {
+            co_return connection;
+        }
+    }
+
+    auto& target = *_targets[index];
+
+    auto connection = std::make_shared<UpstreamConnection>(co_await boost::asio::this_coro::executor);
+    co_await connection->connect(target.host, target.port, _options.connectTimeout);
+
+    co_return connection;
+}
+
+boost::asio::awaitable<HttpResponse> ReverseProxy::forward(const HttpRequest& request) {
+    return forward(request, request.uri());
+}
+
+boost::asio::awaitable<HttpResponse> ReverseProxy::forward(const HttpRequest& request, std::string uri) {
+    auto self = shared_from_this();
+    auto& loopPool = pool(co_await boost::asio::this_coro::executor);
+
+    for(int attempt = 0; ; ++attempt) {
+        auto lease = std::make_shared<Lease>(self, loopPool, pick(), attempt > 0);
+
+        try {
+            co_return co_await exchange(lease, request, uri);
+        }
+        catch(const UpstreamError& e) {
+            // A parked connection the upstream had already given up on is
+            // not the target's fault; send the request once more on a new one
+            if(e.retryable && attempt == 0) continue;
+
+            report(lease->target, false);
+            std::cerr<<"Upstream "<<_targets[lease->target]->address<<" failed: "<<e.what()<<std::endl;
+
+            co_return e.timeout ? HttpResponse::gatewayTimeout("Gateway Timeout") : HttpResponse::badGateway("Bad Gateway");
+        }
+    }
+}
+
+boost::asio::awaitable<HttpResponse> ReverseProxy::exchange(std::shared_ptr<Lease> lease, const HttpRequest& request, const std::string& uri) {
+    auto& target = *_targets[lease->target];
+
+    if(lease->fresh) {
+        lease->connection = std::make_shared<UpstreamConnection>(co_await boost::asio::this_coro::executor);
+        co_await lease->connection->connect(target.host, target.port, _options.connectTimeout);
+    }
+    else {
+        lease->connection = co_await acquire(lease->pool, lease->target);
+    }
+
+    auto& connection = *lease->connection;
+
+    // Request head, with the client's connection-level headers replaced by ours
+    auto connectionHeader = request.getHeader(Field::CONNECTION).value_or(std::string_view());
+    auto host = request.getHeader(Field::HOST);
+
+    std::string head;
+    head.reserve(512);
+    head.append(request.methodToString()).append(" ").append(uri).append(" HTTP/1.1\r\n");
+    head.append("Host: ").append(_options.preserveHost && host ? *host : std::string_view(target.address)).append("\r\n");
+
+    for(const auto& [name, value] : request.headers()) {
+        if(isHopByHop(name, connectionHeader)) continue;
+        if(iequals(name, "host") || iequals(name, "content-length") || iequals(name, "expect")) continue;
+
+        head.append(name).append(": ").append(value).append("\r\n");
+    }
+
+    if(host) head.append("X-Forwarded-Host: ").append(*host).append("\r\n");
+    head.append("X-Forwarded-Proto: http\r\n");
+
+    // Streamed bodies keep their length when the client announced one and
+    // are re-chunked otherwise; a request that turns out to have no body
+    // (an HTTP/2 GET, say) is only known as such after a first read
+    auto reader = request.bodyReader();
+    std::string_view piece = reader ? std::string_view() : std::string_view(request.body());
+    bool chunked = false;
+    bool bodyStarted = false;
+
+    if(request.hasContentLength()) {
+        head.append("Content-Length: ").append(std::to_string(request.contentLength())).append("\r\n");
+    }
+    else if(!reader) {
+        if(!piece.empty()) head.append("Content-Length: ").append(std::to_string(piece.size())).append("\r\n");
+    }
+    else if(!reader->finished()) {
+        piece = co_await reader->read();
+        bodyStarted = !piece.empty();
+        chunked = !reader->finished();
+
+        if(chunked) head.append("Transfer-Encoding: chunked\r\n");
+        else if(!piece.empty()) head.append("Content-Length: ").append(std::to_string(piece.size())).append("\r\n");
+    }
+
+    head.append("\r\n");
+
+    bool headSent = false;
+    bool responseStarted = false;
+
+    try {
+        if(reader && piece.empty() && !reader->finished()) {
+            piece = co_await reader->read();
+            bodyStarted = !piece.empty();
+        }
+
+        // The head goes out together with the first piece of the body
+        while(true) {
+            std::array<char, 20> size;
+            std::size_t sizeLength = 0;
+
+            if(chunked && !piece.empty()) {
+                auto result = std::to_chars(size.data(), size.data() + size.size() - 2, piece.size(), 16);
+                *result.ptr++ = '\r';
+                *result.ptr++ = '\n';
+                sizeLength = static_cast<std::size_t>(result.ptr - size.data());
+            }
+
+            std::array<boost::asio::const_buffer, 4> buffers = {
+                boost::asio::buffer(headSent ? std::string_view() : std::string_view(head)),
+                boost::asio::buffer(size.data(), sizeLength),
+                boost::asio::buffer(piece.data(), piece.size()),
+                boost::asio::buffer("\r\n", sizeLength > 0 ? 2 : 0)
+            };
+
+            co_await connection.write(buffers, headSent ? _options.bodyTimeout : _options.responseTimeout);
+            headSent = true;
+
+            if(!reader || reader->finished()) break;
+
+            piece = co_await reader->read();
+            bodyStarted = true;
+        }
+
+        if(chunked) {
+            static constexpr std::string_view LAST_CHUNK = "0\r\n\r\n";
+            co_await connection.write(boost::asio::buffer(LAST_CHUNK.data(), LAST_CHUNK.size()), _options.bodyTimeout);
+        }
+
+        // Response head; interim 1xx responses are passed over
+        while(true) {
+            std::size_t headEnd;
+
+            while((headEnd = scan::findHeadEnd(connection.pending())) == std::string_view::npos) {
+                if(connection.pending().size() > MAX_HEAD) throw UpstreamError("response head is too large");
+
+                if(co_await connection.readSome(_options.responseTimeout) == 0) {
+                    throw UpstreamError("upstream closed the connection");
+                }
+
+                responseStarted = true;
+            }
+
+            responseStarted = true;
+
+            auto responseHead = connection.pending().substr(0, headEnd);
+            auto lineEnd = std::min(responseHead.find("\r\n"), responseHead.size());
+            auto statusLine = responseHead.substr(0, lineEnd);
+
+            int status = 0;
+            if(statusLine.size() < 12 || statusLine.substr(0, 7) != "HTTP/1." ||
+               std::from_chars(statusLine.data() + 9, statusLine.data() + 12, status).ec != std::errc() ||
+               status < 100 || status > 599) {
+                throw UpstreamError("malformed response head");
+            }
+
+            if(status < 200) {
+                connection.consume(headEnd + 4);
+                continue;
+            }
+
+            boost::container::small_vector<std::pair<std::string_view, std::string_view>, 16> fields;
+            std::string_view responseConnection, transferEncoding, contentLength;
+
+            for(auto lines = responseHead.substr(lineEnd); !lines.empty(); ) {
+                lines.remove_prefix(2);
+
+                auto end = std::min(lines.find("\r\n"), lines.size());
+                auto line = lines.substr(0, end);
+                lines.remove_prefix(end);
+
+                auto colon = line.find(':');
+                if(colon == std::string_view::npos || colon == 0) throw UpstreamError("malformed response header");
+
+                auto name  = line.substr(0, colon);
+                auto value = trim(line.substr(colon + 1));
+
+                if(iequals(name, "connection"))             responseConnection = value;
+                else if(iequals(name, "transfer-encoding")) transferEncoding = value;
+                else if(iequals(name, "content-length"))    contentLength = value;
+
+                fields.emplace_back(name, value);
+            }
+
+            HttpResponse response(static_cast<StatusCode>(status));
+
+            // A body's length is measured again when it is sent on; without
+            // one, the upstream's still describes the representation
+            bool bodiless = request.method() == Method::HEAD || status == 204 || status == 304;
+
+            for(const auto& [name, value] : fields) {
+                if(isHopByHop(name, responseConnection)) continue;
+                if(!bodiless && iequals(name, "content-length")) continue;
+
+                response.addHeader(name, value);
+            }
+
+            connection.consume(headEnd + 4);
+
+            report(lease->target, status != 502 && status != 503 && status != 504);
+            lease->reusable = statusLine[7] == '1' && !hasToken(responseConnection, "close");
+
+            if(bodiless) {
+                lease->done = true;
+                co_return response;
+            }
+
+            if(!transferEncoding.empty()) {
+                // Anything but chunked last runs until the upstream closes
+                if(hasToken(transferEncoding, "chunked")) {
+                    lease->framing = Lease::Framing::CHUNKED;
+                }
+                else {
+                    lease->framing = Lease::Framing::CLOSE;
+                    lease->reusable = false;
+                }
+            }
+            else if(!contentLength.empty()) {
+                std::uint64_t length = 0;
+                auto result = std::from_chars(contentLength.data(), contentLength.data() + contentLength.size(), length);
+                if(result.ec != std::errc() || result.ptr != contentLength.data() + contentLength.size()) {
+                    throw UpstreamError("malformed Content-Length");
+                }
+
+                lease->framing = Lease::Framing::LENGTH;
+                lease->remaining = length;
+            }
+            else {
+                lease->framing = Lease::Framing::CLOSE;
+                lease->reusable = false;
+            }
+
+            // Small bodies are answered from memory
+            if(lease->framing == Lease::Framing::LENGTH && lease->remaining <= SMALL_BODY) {
+                while(connection.pending().size() < lease->remaining) {
+                    if(co_await connection.readSome(_options.bodyTimeout) == 0) {
+                        throw UpstreamError("upstream closed the connection mid-body");
+                    }
+                }
+
+                response.body(std::string(connection.pending().substr(0, lease->remaining)));
+                connection.consume(lease->remaining);
+
+                lease->done = true;
+                co_return response;
+            }
+
+            if(lease->framing == Lease::Framing::CHUNKED) {
+                // Already complete in the buffer, likewise
+                ChunkedDecoder probe;
+                std::string body;
+                auto buffered = connection.pending();
+                std::size_t used = 0;
+
+                while(!probe.done() && !probe.failed() && used < buffered.size()) {
+                    std::size_t consumed = 0;
+                    body.append(probe.decode(buffered.substr(used), consumed));
+                    used += consumed;
+                }
+
+                if(probe.done()) {
+                    response.body(std::move(body));
+                    connection.consume(used);
+
+                    lease->done = true;
+                    co_return response;
+                }
+            }
+
+            auto producer = [lease](BodyWriter& writer) { return relay(lease, writer); };
+
+            if(lease->framing == Lease::Framing::LENGTH) response.stream(producer, lease->remaining);
+            else response.stream(producer);
+
+            co_return response;
+        }
+    }
+    catch(UpstreamError& e) {
+        // A timeout means the upstream has the request and is slow with it
+        e.retryable = connection.reused && !e.timeout && !responseStarted && !bodyStarted &&
+                      (isIdempotent(request.method()) || !headSent);
+        throw;
+    }
+}
+
+boost::asio::awaitable<void> ReverseProxy::relay(std::shared_ptr<Lease> lease, BodyWriter& writer) {
+    auto& connection = *lease->connection;
+    auto timeout = lease->proxy->_options.bodyTimeout;
+
+    try {
+        while(true) {
+            auto pending = connection.pending();
+
+            if(lease->framing == Lease::Framing::CHUNKED) {
+                std::size_t consumed = 0;
+                auto payload = lease->decoder.decode(pending, consumed);
+
+                if(lease->decoder.failed()) throw UpstreamError("malformed chunked body");
+
+                // The payload is a view into the input, consumed once written
+                if(!payload.empty()) co_await writer.write(payload);
+                connection.consume(consumed);
+
+                if(lease->decoder.done()) break;
+                if(consumed < pending.size()) continue;
+            }
+            else if(!pending.empty()) {
+                auto length = pending.size();
+                if(lease->framing == Lease::Framing::LENGTH) {
+                    length = static_cast<std::size_t>(std::min<std::uint64_t>(lease->remaining, length));
+                }
+
+                co_await writer.write(pending.substr(0, length));
+                connection.consume(length);
+
+                lease->remaining -= std::min<std::uint64_t>(lease->remaining, length);
+            }
+
+            if(lease->framing == Lease::Framing::LENGTH && lease->remaining == 0) break;
+
+            if(co_await connection.readSome(timeout) == 0) {
+                if(lease->framing == Lease::Framing::CLOSE) break;
+                throw UpstreamError("upstream closed the connection mid-body");
+            }
+        }
+    }
+    catch(const UpstreamError& e) {
+        auto& proxy = *lease->proxy;
+
+        proxy.report(lease->target, false);
+        std::cerr<<"Upstream "<<proxy._targets[lease->target]->address<<" failed mid-body: "<<e.what()<<std::endl;
+        throw;
+    }
+
+    lease->done = true;
+}
@@ -0,0 +1,175 @@
+#include "web/ratelimit.hh"
+
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <cmath>
+#include <functional>
+#include <random>
+
+#include <time.h>
+
+using namespace web::http;
+
+namespace {
+    constexpr std::uint64_t NANOS_PER_SECOND = 1000000000;
+
+    // The coarse clock ticks every few milliseconds, which is precise
+    // enough for request rates and costs a fraction of steady_clock
+    std::uint64_t nowNanos() {
+        timespec time;
+        ::clock_gettime(CLOCK_MONOTONIC_COARSE, &time);
+
+        return static_cast<std::uint64_t>(time.tv_sec) * NANOS_PER_SECOND + static_cast<std::uint64_t>(time.tv_nsec);
+    }
+
+    // splitmix64's finalizer; spreads keys that differ in a few bits
+    std::uint64_t mix(std::uint64_t value) {
+        value ^= value >> 30;
+        value *= 0xbf58476d1ce4e5b9ULL;
+        value ^= value >> 27;
+        value *= 0x94d049bb133111ebULL;
+        return value ^ (value >> 31);
+    }
+
+    std::uint64_t hashAddress(const boost::asio::ip::address& address) {
+        if(address.is_v4()) return address.to_v4().to_uint();
+
+        auto bytes = address.to_v6().to_bytes();
+        std::uint64_t high = 0;
+        std::uint64_t low = 0;
+
+        for(std::size_t i = 0; i < 8; ++i) {
+            high = (high << 8) | bytes[i];
+            low = (low << 8) | bytes[i + 8];
+        }
+
+        return high ^ mix(low);
+    }
+
+    std::uint64_t ceilSeconds(std::uint64_t nanos) {
+        return (nanos + NANOS_PER_SECOND - 1) / NANOS_PER_SECOND;
+    }
+
+    void addNumber(HttpResponse& response, std::string_view name, std::uint64_t value) {
+        char digits[24];
+        auto end = std::to_chars(digits, digits + sizeof(digits), value).ptr;
+
+        response.addHeader(name, std::string_view(digits, static_cast<std::size_t>(end - digits)));
+    }
+}
+
+struct RateLimiter::State {
+    explicit State(RateLimitOptions settings) : options(std::move(settings)) {
+        std::size_t size = 1;
+        while(size < options.slots) size <<= 1;
+
+        mask = size - 1;
+        slots = std::make_unique<std::atomic<std::uint64_t>[]>(size);
+
+        auto rate = std::max(options.rate, 1e-6);
+        burst = std::max<std::uint32_t>(options.burst, 1);
+        interval = std::max<std::uint64_t>(static_cast<std::uint64_t>(std::llround(NANOS_PER_SECOND / rate)), 1);
+        limit = interval * burst;
+
+        // Keeps clients from choosing keys that collide on purpose
+        seed = (static_cast<std::uint64_t>(std::random_device()()) << 32) | std::random_device()();
+    }
+
+    // Null for requests this limiter leaves alone
+    std::atomic<std::uint64_t>* slotOf(const HttpRequest& request) const {
+        if(!options.prefix.empty() && request.path().compare(0, options.prefix.size(), options.prefix) != 0) {
+            return nullptr;
+        }
+
+        std::uint64_t key = 0;
+
+        switch(options.key) {
+            case RateLimitKey::CLIENT_ADDRESS:
+                key = hashAddress(request.remoteAddress());
+                break;
+
+            case RateLimitKey::PATH:
+                key = std::hash<std::string_view>()(request.path());
+                break;
+
+            case RateLimitKey::HEADER:
+                if(auto value = request.getHeader(options.header)) key = std::hash<std::string_view>()(*value);
+                else key = hashAddress(request.remoteAddress());
+                break;
+        }
+
+        return &slots[mix(key ^ seed) & mask];
+    }
+
+    RateLimitOptions options;
+    std::size_t mask;
+
+    // Per slot, the theoretical arrival time: when its bucket will be full
+    // again. Zero, or anything in the past, means full now.
+    std::unique_ptr<std::atomic<std::uint64_t>[]> slots;
+
+    std::uint32_t burst;
+    std::uint64_t interval;     // nanoseconds one request uses up
+    std::uint64_t limit;        // how far ahead of now a slot may be booked
+
+    std::uint64_t seed;
+    std::atomic<std::uint64_t> limited = 0;
+};
+
+RateLimiter::RateLimiter(RateLimitOptions options)
+    : _state(std::make_shared<State>(std::move(options))) {
+}
+
+const RateLimitOptions& RateLimiter::options() const {
+    return _state->options;
+}
+
+std::uint64_t RateLimiter::limited() const {
+    return _state->limited.load(std::memory_order_relaxed);
+}
+
+Next RateLimiter::before(HttpRequest& request, HttpResponse& response) {
+    auto& state = *_state;
+
+    auto slot = state.slotOf(request);
+    if(!slot) return Next::CONTINUE;
+
+    auto now = nowNanos();
+    auto current = slot->load(std::memory_order_relaxed);
+
+    for(;;) {
+        auto booked = std::max(current, now) + state.interval;
+
+        if(booked - now > state.limit) {
+            state.limited.fetch_add(1, std::memory_order_relaxed);
+
+            response = HttpResponse::tooManyRequests("Too Many Requests");
+            addNumber(response, "Retry-After", std::max<std::uint64_t>(ceilSeconds(booked - now - state.limit), 1));
+
+            return Next::STOP;
+        }
+
+        // Relaxed is enough: the slot is the only thing being agreed on
+        if(slot->compare_exchange_weak(current, booked, std::memory_order_relaxed)) return Next::CONTINUE;
+    }
+}
+
+void RateLimiter::after(const HttpRequest& request, HttpResponse& response) {
+    // A response that may be replayed from the cache must not carry one
+    // client's allowance to everyone else
+    auto& state = *_state;
+    if(!state.options.headers || response.shared()) return;
+
+    auto slot = state.slotOf(request);
+    if(!slot) return;
+
+    // The slot as it is now, which other requests may have moved on since
+    auto now = nowNanos();
+    auto ahead = std::max(slot->load(std::memory_order_relaxed), now) - now;
+    auto remaining = ahead >= state.limit ? 0 : (state.limit - ahead) / state.interval;
+
+    addNumber(response, "RateLimit-Limit", state.burst);
+    addNumber(response, "RateLimit-Remaining", remaining);
+    addNumber(response, "RateLimit-Reset", ceilSeconds(ahead));
+}
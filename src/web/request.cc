@@ -1,4 +1,6 @@
 #include "web/request.hh"
+#include "web/scan.hh"
+#include "web/utils.hh"
 
 #include <sstream>
 #include <algorithm>
@@ -6,121 +8,141 @@
 
 using namespace web::http;
 
+boost::asio::awaitable<std::string> BodyReader::readAll() {
+    std::string body;
+
+    for(auto piece = co_await read(); !piece.empty(); piece = co_await read()) {
+        body.append(piece);
+    }
+
+    co_return body;
+}
+
 HttpRequest::HttpRequest(const std::string& rawRequest) { parse(rawRequest); }
 
-bool HttpRequest::parse(const std::string& buffer) {
+bool HttpRequest::parse(std::string_view buffer) {
     reset();
 
-    std::istringstream stream(buffer);
-    std::ostringstream bodyStream;
-    std::string line;
+    // Lines end in CRLF; a bare LF is tolerated as well, but a CR anywhere
+    // else is not (RFC 9112 2.2): a proxy may not have split the line there
+    auto nextLine = [this, &buffer]() {
+        auto end  = scan::findEither(buffer, '\n', '\n');
+        auto line = buffer.substr(0, end);
 
-    bool isFirstLine = true;
-    bool headersDone = false;
+        buffer.remove_prefix(std::min(end + 1, buffer.size()));
 
-    while(std::getline(stream, line)) {
-        if(line.empty() || line == "\r") {
-            line.pop_back();
-        }
+        if(!line.empty() && line.back() == '\r') line.remove_suffix(1);
+        if(line.find('\r') != std::string_view::npos) _malformed = true;
 
-        if(isFirstLine) {
-            parseRequestLine(line);
-            isFirstLine = false;
-        } 
-        else if(!headersDone) {
-            if(line.empty()) { headersDone = true; }
-            else { parseHeaderLine(line); }
-        } 
-        else {
-            if(bodyStream.tellp() > 0) { bodyStream << "\n"; }
-            bodyStream << line;
-        }
+        return line;
+    };
+
+    parseRequestLine(nextLine());
+
+    while(!buffer.empty()) {
+        auto line = nextLine();
+        if(line.empty()) break;
+
+        parseHeaderLine(line);
     }
 
-    _body = bodyStream.str();
-    _isComplete = (_method != Method::UNKNOWN && _version != Version::UNKNOWN);
+    // Whatever follows the head is the body, as is
+    _body = buffer;
+    _json.value.reset();
+    resolveHeaders();
+
+    _isComplete = (_method != Method::UNKNOWN && _version != Version::UNKNOWN && !_malformed);
+
+    return _isComplete;
+}
+
+void HttpRequest::beginHead(std::string_view method, std::string_view uri, Version version) {
+    reset();
+
+    _method  = stringToMethod(std::string(method));
+    _uri     = uri;
+    _version = version;
+
+    parseUri(_uri);
+}
+
+bool HttpRequest::endHead() {
+    resolveHeaders();
 
+    _isComplete = (_method != Method::UNKNOWN && !_malformed);
     return _isComplete;
 }
 
 bool HttpRequest::isComplete() const {
     if (!_isComplete) { return false; }
 
-    auto contentLengthHeader = getHeader("Content-Length");
-
-    if(contentLengthHeader.has_value()) {
-        try {
-            auto expectedLength = std::stoull(contentLengthHeader.value());
-            return _body.size() >= expectedLength;
-        }
-        catch(...) {
-            return false;
-        }
+    if(_contentLength.has_value()) {
+        return _body.size() >= _contentLength.value();
     }
 
     return true;
 }
 
-std::optional<std::string> HttpRequest::getHeader(const std::string& name) const {
-    auto lowerName  = toLowerCase(name);
-    auto it         = _headers.find(lowerName);
+const HttpRequest::QueryParams& HttpRequest::queryParams() const {
+    if(!_parsedQuery.value) parseQuery();
 
-    return (it != _headers.end()) ? std::make_optional(it->second) : std::nullopt;
+    return _parsedQuery.value->params;
 }
 
-bool HttpRequest::hasHeader(const std::string& name) const {
-    auto lowerName = toLowerCase(name);
+std::optional<std::string_view> HttpRequest::queryParam(std::string_view name) const {
+    for(const auto& [key, value] : queryParams()) {
+        if(key == name) return value;
+    }
 
-    return _headers.find(lowerName) != _headers.end();
+    return std::nullopt;
 }
 
-std::size_t HttpRequest::contentLength() const {
-    auto header = getHeader("content-length");
+const ContentType& HttpRequest::contentType() const {
+    if(!_contentType.value) {
+        _contentType.value = parseContentType(_headers.get(Field::CONTENT_TYPE).value_or(std::string_view()));
+    }
 
-    if(header.has_value()) {
-        try {
-            return std::stoull(header.value());
-        }
-        catch(...) {
-            return 0;
-        }
+    return *_contentType.value;
+}
+
+const JsonDocument& HttpRequest::json() const {
+    if(!_json.value) _json.value.emplace(_body);
+    return *_json.value;
+}
+
+std::vector<std::string_view> HttpRequest::queryParamAll(std::string_view name) const {
+    std::vector<std::string_view> values;
+
+    for(const auto& [key, value] : queryParams()) {
+        if(key == name) values.push_back(value);
     }
 
-    return 0;
+    return values;
 }
 
 std::optional<std::string> HttpRequest::getQueryParam(const std::string& name) const {
-    auto params = getQueryParams();
-    auto it     = params.find(name);
+    auto value = queryParam(name);
 
-    return (it != params.end()) ? std::make_optional(it->second) : std::nullopt;
+    return value ? std::make_optional(std::string(*value)) : std::nullopt;
 }
 
 std::unordered_map<std::string, std::string> HttpRequest::getQueryParams() const {
     std::unordered_map<std::string, std::string> params;
-    //parseQuery(_query);
-
-    std::istringstream queryStream(_query);
-    std::string pair;
-
-    while(std::getline(queryStream, pair, '&')) {
-        std::size_t equalPos = pair.find('=');
 
-        if(equalPos != std::string::npos) {
-            auto key = pair.substr(0, equalPos);
-            auto value = pair.substr(equalPos + 1);
-            params[key] = value;
-        }
-        else {
-            params[pair] = "";
-        }
+    // The first value wins, as with queryParam()
+    for(const auto& [key, value] : queryParams()) {
+        params.emplace(key, value);
     }
 
     return params;
 }
 
 std::string HttpRequest::methodToString() const {
-    switch (_method) {
+    return methodToString(_method);
+}
+
+std::string HttpRequest::methodToString(Method method) {
+    switch (method) {
         case Method::GET:       return "GET";
         case Method::POST:      return "POST";
         case Method::PUT:       return "PUT";
@@ -140,8 +162,7 @@ std::string HttpRequest::versionToString() const {
         case Version::HTTP_1_0: return "HTTP/1.0";
         case Version::HTTP_1_1: return "HTTP/1.1";
 
-        //No support for HTTP/2 and HTTP/3 right now
-        //Maybe in the future
+        // HTTP/2 is served over cleartext with prior knowledge (h2c), HTTP/3 not at all
         case Version::HTTP_2_0: return "HTTP/2.0";
         case Version::HTTP_3_0: return "HTTP/3.0";
 
@@ -153,8 +174,8 @@ std::string HttpRequest::toString() const {
     std::ostringstream oss;
     oss << methodToString() << " " << _uri << " " << versionToString() << "\r\n";
 
-    for(const auto& header : _headers) {
-        oss << header.first << ": " << header.second << "\r\n";
+    for(const auto& [name, value] : _headers) {
+        oss << name << ": " << value << "\r\n";
     }
 
     oss << "\r\n" << _body;
@@ -166,9 +187,17 @@ void HttpRequest::reset() {
     _uri.clear();
     _path.clear();
     _query.clear();
+    _parsedQuery.value.reset();
     _version    = Version::UNKNOWN;
     _headers.clear();
+    _contentType.value.reset();
     _body.clear();
+    _json.value.reset();
+    _bodyReader = nullptr;
+    _contentLength.reset();
+    _keepAlive  = false;
+    _chunked    = false;
+    _malformed  = false;
     _isComplete = false;
 }
 
@@ -194,8 +223,8 @@ Version HttpRequest::stringToVersion(const std::string& version) const {
     if (version_ == "HTTP/1.0") return Version::HTTP_1_0;
     if (version_ == "HTTP/1.1") return Version::HTTP_1_1;
 
-    //As I mentioned before, no support for HTTP/2 and HTTP/3 right now
-    //So this is just for future reference
+    // HTTP/2 never arrives as a text request line; its requests are built
+    // from frames by Http2Connection
     if (version_ == "HTTP/2.0") return Version::HTTP_2_0;
     if (version_ == "HTTP/3.0") return Version::HTTP_3_0;
 
@@ -216,35 +245,93 @@ std::string HttpRequest::toUpperCase(const std::string& str) const {
     return result;
 }
 
-void HttpRequest::parseRequestLine(const std::string& line) {
-    std::istringstream iss(line);
-    std::string methodStr, versionStr;
+void HttpRequest::parseRequestLine(std::string_view line) {
+    auto nextToken = [&line]() {
+        auto start = std::min(line.find_first_not_of(' '), line.size());
+        line.remove_prefix(start);
 
-    iss >> methodStr >> _uri >> versionStr;
+        auto token = line.substr(0, line.find(' '));
+        line.remove_prefix(token.size());
 
-    _method  = stringToMethod(methodStr);
-    _version = stringToVersion(versionStr);
+        return token;
+    };
+
+    auto methodStr  = nextToken();
+    _uri            = nextToken();
+    auto versionStr = nextToken();
+
+    _method  = stringToMethod(std::string(methodStr));
+    _version = stringToVersion(std::string(versionStr));
 
     parseUri(_uri);
 }
 
-void HttpRequest::parseHeaderLine(const std::string& line) {
-    auto colonPos = line.find(':');
+void HttpRequest::parseHeaderLine(std::string_view line) {
+    auto colonPos = scan::findEither(line, ':', ':');
+
+    if(colonPos != line.size()) {
+        _headers.add(trim(line.substr(0, colonPos)), trim(line.substr(colonPos + 1)));
+    }
+}
 
-    if(colonPos != std::string::npos) {
-        auto name   = line.substr(0, colonPos);
-        auto value  = line.substr(colonPos + 1);
+void HttpRequest::resolveHeaders() {
+    _contentType.value.reset();
+
+    // Framing is where a proxy and this server could disagree about where a
+    // request ends, so anything ambiguous is malformed (RFC 9112 6.3):
+    // Content-Length must be digits, the same in every field and list item,
+    // and never sent with Transfer-Encoding, whose last coding must be chunked
+    auto hasLength   = _headers.contains(Field::CONTENT_LENGTH);
+    auto hasEncoding = _headers.contains(Field::TRANSFER_ENCODING);
+
+    if(hasLength && hasEncoding) _malformed = true;
+
+    if(hasLength || hasEncoding) {
+        std::size_t codings = 0;
+        bool chunkedLast = false;
+
+        for(auto [name, value] : _headers) {
+            bool length = iequals(name, fieldName(Field::CONTENT_LENGTH));
+            if(!length && !iequals(name, fieldName(Field::TRANSFER_ENCODING))) continue;
+
+            forEachToken(value, [&](std::string_view item) {
+                if(!length) {
+                    ++codings;
+                    if(chunkedLast || item.empty()) _malformed = true;
+                    chunkedLast = iequals(item, "chunked");
+                    return;
+                }
+
+                std::uint64_t number = 0;
+                bool valid = !item.empty() && item.size() <= 19;
+
+                for(auto c : item) {
+                    if(c < '0' || c > '9') { valid = false; break; }
+                    number = number * 10 + static_cast<std::uint64_t>(c - '0');
+                }
+
+                if(!valid || (_contentLength && *_contentLength != number)) _malformed = true;
+                else _contentLength = number;
+            });
+        }
 
-        name.erase(0, name.find_first_not_of(" \t"));
-        name.erase(name.find_last_not_of(" \t") + 1);
-        value.erase(0, value.find_first_not_of(" \t"));
-        value.erase(value.find_last_not_of(" \t\r") + 1);
+        if(hasEncoding && !chunkedLast) _malformed = true;
 
-        _headers[toLowerCase(name)] = value;
+        // Other codings before chunked are well-formed but not supported
+        _chunked = chunkedLast && codings == 1;
     }
+
+    // HTTP/1.1 connections are persistent unless closed, HTTP/1.0 only on request
+    auto connection = _headers.get(Field::CONNECTION).value_or(std::string_view());
+
+    _keepAlive = (_version == Version::HTTP_1_1)
+        ? !hasToken(connection, "close")
+        : hasToken(connection, "keep-alive");
 }
 
 void HttpRequest::parseUri(const std::string& uri) {
+    _parsedQuery.value.reset();
+
     auto queryPos = uri.find('?');
 
     if(queryPos != std::string::npos) {
@@ -257,6 +344,32 @@ void HttpRequest::parseUri(const std::string& uri) {
     }
 }
 
-void HttpRequest::parseQuery(const std::string& query) {
+void HttpRequest::parseQuery() const {
+    auto& cache = _parsedQuery.value.emplace();
+    auto query  = std::string_view(_query);
+
+    // Decoding never grows a component, so views into the arena stay put
+    cache.arena.reserve(query.size());
 
+    auto decode = [&cache](std::string_view component) {
+        if(component.find_first_of("%+") == std::string_view::npos) return component;
+
+        auto offset = cache.arena.size();
+        web::http::utils::urlDecode(component, cache.arena);
+
+        return std::string_view(cache.arena).substr(offset);
+    };
+
+    while(!query.empty()) {
+        auto pair = query.substr(0, query.find('&'));
+        query.remove_prefix(std::min(pair.size() + 1, query.size()));
+
+        if(pair.empty()) continue;
+
+        auto equals = pair.find('=');
+        auto name   = decode(pair.substr(0, equals));
+        auto value  = (equals != std::string_view::npos) ? decode(pair.substr(equals + 1)) : std::string_view();
+
+        cache.params.emplace_back(name, value);
+    }
 }
\ No newline at end of file
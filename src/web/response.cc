@@ -1,31 +1,46 @@
 #include "web/response.hh"
+#include "web/utils.hh"
 
-#include <chrono>
+#include <array>
+#include <charconv>
 
 using namespace web::http;
 
-HttpResponse::HttpResponse(StatusCode code, const std::string& body) 
-    : _statusCode(code), _body(body) {
-    setDefaultHeaders();
-}
+HttpResponse::HttpResponse(StatusCode code, std::string body) 
+    : _statusCode(code), _body(std::move(body)) { }
 
 HttpResponse& HttpResponse::status(StatusCode code) {
     _statusCode = code;
     return *this;
 }
 
-HttpResponse& HttpResponse::body(const std::string& body) {
-    _body = body;
+HttpResponse& HttpResponse::body(std::string body) {
+    _body = std::move(body);
     return *this;
 }
 
 HttpResponse& HttpResponse::header(const std::string& name, const std::string& value) {
-    _headers[name] = value;
+    _headers.set(name, value);
+    return *this;
+}
+
+HttpResponse HttpResponse::json(const std::function<void(JsonWriter&)>& build, StatusCode status) {
+    HttpResponse response(status);
+
+    JsonWriter writer(response._body);
+    build(writer);
+
+    response.contentType("application/json");
+    return response;
+}
+
+HttpResponse& HttpResponse::addHeader(std::string_view name, std::string_view value) {
+    _headers.add(name, value);
     return *this;
 }
 
-HttpResponse& HttpResponse::contentType(const std::string& type) {
-    _headers["Content-Type"] = type;
+HttpResponse& HttpResponse::contentType(std::string_view type) {
+    _headers.set(Field::CONTENT_TYPE, type);
     return *this;
 }
 
@@ -40,43 +55,158 @@ HttpResponse& HttpResponse::cookie(
         oss << "; Max-Age=" << maxAge;
     }
 
-    return header("Set-Cookie", oss.str());
+    // Each cookie needs its own Set-Cookie line
+    _headers.add(fieldName(Field::SET_COOKIE), oss.str());
+    return *this;
 }
 
-std::string HttpResponse::getHeader(const std::string& name) const {
-    auto it = _headers.find(name);
-    return (it != _headers.end()) ? it->second : "";
+HttpResponse& HttpResponse::keepAlive(bool keepAlive) {
+    _keepAlive = keepAlive;
+    return *this;
 }
 
-std::string HttpResponse::toString() const {
-    std::ostringstream oss;
-    oss << "HTTP/1.1 " << static_cast<int>(_statusCode) << " " << statusCodeToString(_statusCode) << "\r\n";
+HttpResponse& HttpResponse::file(std::shared_ptr<File> file) {
+    auto size = file->size();
+    return this->file(std::move(file), { BodySegment{ "", 0, size } });
+}
+
+HttpResponse& HttpResponse::file(std::shared_ptr<File> file, std::vector<BodySegment> segments) {
+    _body.clear();
+    _file = std::move(file);
+    _segments = std::move(segments);
+    return *this;
+}
 
-    auto headers = _headers;
-    headers["Content-Length"] = std::to_string(_body.length());
+HttpResponse& HttpResponse::stream(BodyProducer producer) {
+    _body.clear();
+    _producer = std::move(producer);
+    _streamLength.reset();
+    return *this;
+}
+
+HttpResponse& HttpResponse::stream(BodyProducer producer, std::uint64_t length) {
+    stream(std::move(producer));
+    _streamLength = length;
+    return *this;
+}
+
+HttpResponse& HttpResponse::chunked(bool chunked) {
+    _chunked = chunked;
+    return *this;
+}
 
-    for(const auto& header : headers) {
-        oss << header.first << ": " << header.second << "\r\n";
+HttpResponse& HttpResponse::serialized(std::shared_ptr<const SerializedResponse> serialized) {
+    _statusCode = serialized->status;
+    _serialized = std::move(serialized);
+    return *this;
+}
+
+std::uint64_t HttpResponse::contentLength() const {
+    if(isStreaming()) {
+        return _streamLength.value_or(0);
     }
 
-    oss << "\r\n" << _body;
+    std::uint64_t length = _body.length();
+
+    for(const auto& segment : _segments) {
+        length += segment.data.length() + segment.length;
+    }
 
-    return oss.str();
+    return length;
 }
 
-void HttpResponse::setDefaultHeaders() {
-    _headers["Server"] = "HTTP-Lib/1.0";
-    _headers["Date"] = getCurrentTimestamp();
-    _headers["Connection"] = "close";
+std::string_view HttpResponse::getHeader(std::string_view name) const {
+    return _headers.get(name).value_or(std::string_view());
 }
 
-std::string HttpResponse::getCurrentTimestamp() const {
-    auto now = std::chrono::system_clock::now();
-    auto time_t = std::chrono::system_clock::to_time_t(now);
-    
-    std::ostringstream oss;
-    oss << std::put_time(std::gmtime(&time_t), "%a, %d %b %Y %H:%M:%S GMT");
-    return oss.str();
+void HttpResponse::writeHead(std::string& out, bool connection) const {
+    auto appendHeader = [&out](std::string_view name, std::string_view value) {
+        out.append(name).append(": ").append(value).append("\r\n");
+    };
+
+    out.append(statusLine(_statusCode));
+
+    auto keepLength = keepsContentLength();
+    auto dropLength = !keepLength && _headers.contains(Field::CONTENT_LENGTH);
+
+    for(const auto& [name, value] : _headers) {
+        if(dropLength && iequals(name, "content-length")) continue;
+        appendHeader(name, value);
+    }
+
+    // Defaults are emitted here rather than stored, so a response costs no
+    // header allocations unless the handler overrides them
+    if(!_headers.contains(Field::SERVER)) {
+        appendHeader("Server", SERVER_NAME);
+    }
+
+    if(!_headers.contains(Field::DATE)) {
+        appendHeader("Date", utils::currentHttpDate());
+    }
+
+    if(connection && !_headers.contains(Field::CONNECTION)) {
+        appendHeader("Connection", _keepAlive ? "keep-alive" : "close");
+    }
+
+    if(!allowsBody() || keepLength) {
+        // No body and no measured length: a 304's would be the
+        // representation's, sent above if the response was given it
+    }
+    else if(isStreaming() && !_streamLength.has_value()) {
+        // Length unknown: chunked, or delimited by closing the connection
+        if(_chunked) appendHeader("Transfer-Encoding", "chunked");
+    }
+    else {
+        std::array<char, 24> length;
+        auto result = std::to_chars(length.data(), length.data() + length.size(), contentLength());
+        appendHeader("Content-Length", std::string_view(length.data(), result.ptr - length.data()));
+    }
+
+    out.append("\r\n");
+}
+
+std::string HttpResponse::head() const {
+    std::string out;
+    writeHead(out);
+
+    return out;
+}
+
+std::string HttpResponse::toString() const {
+    std::string out;
+    out.reserve(256 + _body.size());
+
+    writeHead(out);
+    out.append(_body);
+
+    return out;
+}
+
+std::string_view HttpResponse::statusLine(StatusCode code) {
+    static const auto lines = [] {
+        std::array<std::string, 600> table;
+
+        for(std::size_t i = 100; i < table.size(); ++i) {
+            auto status = static_cast<StatusCode>(i);
+            auto reason = HttpResponse().statusCodeToString(status);
+
+            // The reason phrase is optional; the code is what clients act on
+            if(reason == "Unknown") reason.clear();
+
+            table[i] = "HTTP/1.1 " + std::to_string(i) + " " + reason + "\r\n";
+        }
+
+        return table;
+    }();
+
+    auto index = static_cast<std::size_t>(code);
+
+    if(index >= 100 && index < lines.size()) {
+        return lines[index];
+    }
+
+    // Not a three-digit code a client could parse
+    return "HTTP/1.1 500 Internal Server Error\r\n";
 }
 
 std::string HttpResponse::statusCodeToString(StatusCode code) const {
@@ -121,7 +251,9 @@ std::string HttpResponse::statusCodeToString(StatusCode code) const {
         case StatusCode::EXPECTATION_FAILED: return "Expectation Failed";
         case StatusCode::IM_A_TEAPOT: return "I'm a teapot";
         case StatusCode::UNPROCESSABLE_ENTITY: return "Unprocessable Entity";
+        case StatusCode::UPGRADE_REQUIRED: return "Upgrade Required";
         case StatusCode::TOO_MANY_REQUESTS: return "Too Many Requests";
+        case StatusCode::REQUEST_HEADER_FIELDS_TOO_LARGE: return "Request Header Fields Too Large";
         
         // 5xx Server Error
         case StatusCode::INTERNAL_SERVER_ERROR: return "Internal Server Error";
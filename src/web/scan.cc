@@ -0,0 +1,196 @@
+#include "web/scan.hh"
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define MURLY_SCAN_X86 1
+#include <immintrin.h>
+#endif
+
+using namespace web::http;
+
+namespace {
+    using FindEither   = std::size_t (*)(const char*, std::size_t, char, char);
+    using FindReserved = std::size_t (*)(const char*, std::size_t);
+
+    struct Kernels {
+        FindEither findEither;
+        FindReserved findReserved;
+        std::string_view name;
+    };
+
+    bool isUnreserved(unsigned char c) {
+        auto lower = static_cast<unsigned char>(c | 0x20);
+
+        return (c >= '0' && c <= '9') || (lower >= 'a' && lower <= 'z') ||
+               c == '-' || c == '.' || c == '_' || c == '~';
+    }
+
+    std::size_t findEitherScalar(const char* data, std::size_t length, char a, char b) {
+        for(std::size_t i = 0; i < length; ++i) {
+            if(data[i] == a || data[i] == b) return i;
+        }
+
+        return length;
+    }
+
+    std::size_t findReservedScalar(const char* data, std::size_t length) {
+        for(std::size_t i = 0; i < length; ++i) {
+            if(!isUnreserved(static_cast<unsigned char>(data[i]))) return i;
+        }
+
+        return length;
+    }
+
+#if defined(MURLY_SCAN_X86)
+    // Each kernel handles whole blocks and leaves the tail to the next
+    // narrower one. Bit i of a match mask stands for byte i of the block.
+
+    __attribute__((target("sse2")))
+    __m128i inRange128(__m128i bytes, char low, char high) {
+        // Unsigned low <= b <= high as (b - low) <= (high - low)
+        auto shifted = _mm_sub_epi8(bytes, _mm_set1_epi8(low));
+        return _mm_cmpeq_epi8(_mm_min_epu8(shifted, _mm_set1_epi8(static_cast<char>(high - low))), shifted);
+    }
+
+    __attribute__((target("sse2")))
+    unsigned unreserved128(__m128i bytes) {
+        auto lower = _mm_or_si128(bytes, _mm_set1_epi8(0x20));
+
+        auto hits = _mm_or_si128(inRange128(bytes, '0', '9'), inRange128(lower, 'a', 'z'));
+        hits = _mm_or_si128(hits, _mm_cmpeq_epi8(bytes, _mm_set1_epi8('-')));
+        hits = _mm_or_si128(hits, _mm_cmpeq_epi8(bytes, _mm_set1_epi8('.')));
+        hits = _mm_or_si128(hits, _mm_cmpeq_epi8(bytes, _mm_set1_epi8('_')));
+        hits = _mm_or_si128(hits, _mm_cmpeq_epi8(bytes, _mm_set1_epi8('~')));
+
+        return static_cast<unsigned>(_mm_movemask_epi8(hits));
+    }
+
+    __attribute__((target("sse2")))
+    std::size_t findEitherSse2(const char* data, std::size_t length, char a, char b) {
+        auto va = _mm_set1_epi8(a);
+        auto vb = _mm_set1_epi8(b);
+
+        std::size_t i = 0;
+
+        for(; i + 16 <= length; i += 16) {
+            auto block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+            auto hits  = _mm_or_si128(_mm_cmpeq_epi8(block, va), _mm_cmpeq_epi8(block, vb));
+
+            if(auto mask = static_cast<unsigned>(_mm_movemask_epi8(hits))) return i + __builtin_ctz(mask);
+        }
+
+        return i + findEitherScalar(data + i, length - i, a, b);
+    }
+
+    __attribute__((target("sse2")))
+    std::size_t findReservedSse2(const char* data, std::size_t length) {
+        std::size_t i = 0;
+
+        for(; i + 16 <= length; i += 16) {
+            auto block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+
+            if(auto mask = ~unreserved128(block) & 0xffffu) return i + __builtin_ctz(mask);
+        }
+
+        return i + findReservedScalar(data + i, length - i);
+    }
+
+    __attribute__((target("avx2")))
+    __m256i inRange256(__m256i bytes, char low, char high) {
+        auto shifted = _mm256_sub_epi8(bytes, _mm256_set1_epi8(low));
+        return _mm256_cmpeq_epi8(_mm256_min_epu8(shifted, _mm256_set1_epi8(static_cast<char>(high - low))), shifted);
+    }
+
+    __attribute__((target("avx2")))
+    std::size_t findEitherAvx2(const char* data, std::size_t length, char a, char b) {
+        auto va = _mm256_set1_epi8(a);
+        auto vb = _mm256_set1_epi8(b);
+
+        std::size_t i = 0;
+
+        for(; i + 32 <= length; i += 32) {
+            auto block = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+            auto hits  = _mm256_or_si256(_mm256_cmpeq_epi8(block, va), _mm256_cmpeq_epi8(block, vb));
+
+            if(auto mask = static_cast<unsigned>(_mm256_movemask_epi8(hits))) return i + __builtin_ctz(mask);
+        }
+
+        return i + findEitherSse2(data + i, length - i, a, b);
+    }
+
+    __attribute__((target("avx2")))
+    std::size_t findReservedAvx2(const char* data, std::size_t length) {
+        std::size_t i = 0;
+
+        for(; i + 32 <= length; i += 32) {
+            auto block = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+            auto lower = _mm256_or_si256(block, _mm256_set1_epi8(0x20));
+
+            auto hits = _mm256_or_si256(inRange256(block, '0', '9'), inRange256(lower, 'a', 'z'));
+            hits = _mm256_or_si256(hits, _mm256_cmpeq_epi8(block, _mm256_set1_epi8('-')));
+            hits = _mm256_or_si256(hits, _mm256_cmpeq_epi8(block, _mm256_set1_epi8('.')));
+            hits = _mm256_or_si256(hits, _mm256_cmpeq_epi8(block, _mm256_set1_epi8('_')));
+            hits = _mm256_or_si256(hits, _mm256_cmpeq_epi8(block, _mm256_set1_epi8('~')));
+
+            if(auto mask = ~static_cast<unsigned>(_mm256_movemask_epi8(hits))) return i + __builtin_ctz(mask);
+        }
+
+        return i + findReservedSse2(data + i, length - i);
+    }
+#endif
+
+    Kernels select() {
+#if defined(MURLY_SCAN_X86)
+        __builtin_cpu_init();
+
+        if(__builtin_cpu_supports("avx2")) return { findEitherAvx2, findReservedAvx2, "avx2" };
+        if(__builtin_cpu_supports("sse2")) return { findEitherSse2, findReservedSse2, "sse2" };
+#endif
+
+        return { findEitherScalar, findReservedScalar, "scalar" };
+    }
+
+    // Chosen on first use, so other static initializers may already scan
+    const Kernels& kernels() {
+        static const Kernels selected = select();
+        return selected;
+    }
+}
+
+std::size_t scan::findEither(const char* data, std::size_t length, char a, char b) {
+    return kernels().findEither(data, length, a, b);
+}
+
+std::size_t scan::findReserved(const char* data, std::size_t length) {
+    return kernels().findReserved(data, length);
+}
+
+std::size_t scan::findCrlf(std::string_view data) {
+    for(std::size_t offset = 0; offset < data.size(); ) {
+        auto cr = offset + findEither(data.data() + offset, data.size() - offset, '\r', '\r');
+
+        if(cr + 1 >= data.size()) break;
+        if(data[cr + 1] == '\n') return cr;
+
+        offset = cr + 1;
+    }
+
+    return std::string_view::npos;
+}
+
+std::size_t scan::findHeadEnd(std::string_view data) {
+    for(std::size_t offset = 0; offset < data.size(); ) {
+        auto crlf = findCrlf(data.substr(offset));
+        if(crlf == std::string_view::npos) break;
+
+        auto at = offset + crlf;
+        if(data.substr(at + 2, 2) == "\r\n") return at;
+
+        offset = at + 2;
+    }
+
+    return std::string_view::npos;
+}
+
+std::string_view scan::kernel() {
+    return kernels().name;
+}
@@ -1,268 +1,1979 @@
 #include "web/server.hh"
+#include "web/chunked.hh"
+#include "web/http2.hh"
+#include "web/mime.hh"
+#include "web/scan.hh"
 #include "web/utils.hh"
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <charconv>
+#include <cmath>
 #include <iostream>
 #include <filesystem>
+#include <map>
+#include <stdexcept>
 #include <system_error>
 
+#include <pthread.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if defined(__linux__)
+#include <sys/sendfile.h>
+#endif
+
 using namespace web::http;
 
+namespace {
+#if defined(SO_REUSEPORT)
+    using ReusePort = boost::asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT>;
+#endif
+
+    // Granularity of connection deadlines
+    constexpr auto SWEEP_INTERVAL = std::chrono::seconds(1);
+
+    // A keep-alive client hanging up between requests, or our own close(), is not an error
+    bool isQuietClose(const std::error_code& ec) {
+        return ec == std::error_code(boost::asio::error::make_error_code(boost::asio::error::eof)) ||
+               ec == std::error_code(boost::asio::error::make_error_code(boost::asio::error::operation_aborted));
+    }
+
+    // Streams a body over an HTTP/1.x connection, framing it as chunks when
+    // the length is unknown. The head is held back until the first flush so
+    // a short stream leaves in a single write. Each write arms the owner's
+    // deadline; the producer's own pauses are not timed.
+    class Http1BodyWriter : public BodyWriter {
+    public:
+        // Bytes buffered before a flush; bounds memory per streamed response
+        static constexpr std::size_t WINDOW = 16 * 1024;
+
+        Http1BodyWriter(TcpSocket& socket, std::string& head, bool chunked, Connection& owner, EventLoop& loop, std::chrono::seconds timeout)
+            : _socket(socket), _head(head), _chunked(chunked), _owner(owner), _loop(loop), _timeout(timeout) { }
+
+        std::uint64_t written() const { return _written; }
+
+        boost::asio::awaitable<void> write(std::string_view data) override {
+            if(data.empty()) co_return;
+
+            if(_window.size() + data.size() <= WINDOW) {
+                _window.append(data);
+                if(_window.size() == WINDOW) co_await flush();
+                co_return;
+            }
+
+            // Large writes go straight out instead of being copied
+            if(!_window.empty()) co_await flush();
+
+            if(data.size() < WINDOW) {
+                _window.append(data);
+                co_return;
+            }
+
+            co_await send(data);
+        }
+
+        boost::asio::awaitable<void> flush() override {
+            auto data = std::string_view(_window);
+            co_await send(data);
+            _window.clear();
+        }
+
+        boost::asio::awaitable<void> finish() {
+            co_await flush();
+
+            if(_chunked) {
+                _owner.deadline(_loop.now + _timeout);
+                co_await boost::asio::async_write(
+                    _socket, boost::asio::buffer("0\r\n\r\n", 5), boost::asio::use_awaitable
+                );
+                _owner.clearDeadline();
+            }
+        }
+
+    private:
+        boost::asio::awaitable<void> send(std::string_view data) {
+            if(data.empty() && _headSent) co_return;
+
+            std::array<char, 20> sizeLine;
+            std::size_t sizeLength = 0;
+
+            if(_chunked && !data.empty()) {
+                auto result = std::to_chars(sizeLine.data(), sizeLine.data() + 16, data.size(), 16);
+                *result.ptr++ = '\r';
+                *result.ptr++ = '\n';
+                sizeLength = static_cast<std::size_t>(result.ptr - sizeLine.data());
+            }
+
+            std::array<boost::asio::const_buffer, 4> buffers = {
+                boost::asio::buffer(_head.data(), _headSent ? 0 : _head.size()),
+                boost::asio::buffer(sizeLine.data(), sizeLength),
+                boost::asio::buffer(data.data(), data.size()),
+                boost::asio::buffer("\r\n", (_chunked && !data.empty()) ? 2 : 0)
+            };
+
+            _owner.deadline(_loop.now + _timeout);
+            co_await boost::asio::async_write(_socket, buffers, boost::asio::use_awaitable);
+            _owner.clearDeadline();
+
+            _headSent = true;
+            _written += data.size();
+        }
+
+        TcpSocket& _socket;
+        std::string& _head;
+        std::string _window;
+
+        bool _chunked;
+        Connection& _owner;
+        EventLoop& _loop;
+        std::chrono::seconds _timeout;
+        bool _headSent = false;
+        std::uint64_t _written = 0;
+    };
+
+    // In-memory bodies up to this size are compressed in one go and keep
+    // their Content-Length; larger ones are compressed as they are sent
+    constexpr std::size_t COMPRESS_INLINE_LIMIT = 64 * 1024;
+
+    boost::asio::awaitable<void> writeShared(std::shared_ptr<const std::string> data, BodyWriter& out) {
+        co_await out.write(*data);
+    }
+
+    boost::asio::awaitable<void> writeCompressed(BodyProducer producer, ContentCoding coding, int level, BodyWriter& out) {
+        CompressingWriter writer(out, coding, level);
+
+        co_await producer(writer);
+        co_await writer.finish();
+    }
+
+    BodyProducer sharedBody(std::shared_ptr<const std::string> data) {
+        return [data = std::move(data)](BodyWriter& out) { return writeShared(data, out); };
+    }
+
+    BodyProducer compressedBody(BodyProducer producer, ContentCoding coding, int level) {
+        return [producer = std::move(producer), coding, level](BodyWriter& out) {
+            return writeCompressed(producer, coding, level, out);
+        };
+    }
+
+    void addVary(HttpResponse& response, std::string_view field) {
+        auto vary = response.getHeader("Vary");
+
+        if(vary.empty()) {
+            response.header("Vary", std::string(field));
+        }
+        else if(vary.find(field) == std::string_view::npos) {
+            response.header("Vary", std::string(vary) + ", " + std::string(field));
+        }
+    }
+
+    void pinToCore(std::size_t index) {
+#if defined(__linux__)
+        auto cores = std::thread::hardware_concurrency();
+        if(cores == 0) return;
+
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(index % cores, &set);
+
+        pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#else
+        (void)index;
+#endif
+    }
+}
+
 HttpServer::HttpServer(IOContext& ioc, const HttpServerConfig& config)
     :   _ioc(ioc), 
-        _acceptor(ioc, TcpEndpoint(boost::asio::ip::tcp::v4(), config.port)),
-        _config(config) {
+        _mainLoop(ioc),
+        _config(config),
+        _compressionCache(config.compressionCacheSize),
+        _responseCache(config.responseCacheSize) {
 
-    // Enable address reuse
-    //_acceptor.set_option(boost::asio::socket_base::reuse_address(true));
+    if(_config.threads == 0) _config.threads = 1;
+
+    _workerPool = std::make_unique<WorkerPool>(_config.workerThreads, _config.workerQueueCapacity);
+
+    listen(_mainLoop.acceptor);
 
     std::cout<<"Server version: "<<_config.version()<<std::endl;
     std::cout<<"Listening on: "<<_config.host<<":"<<_config.port<<std::endl;
 }
 
+HttpServer::~HttpServer() {
+    stop();
+
+    // Compression queued by process() without start() fills _compressionCache,
+    // which is destroyed before the pool
+    _workerPool->shutdown();
+}
+
+void HttpServer::listen(TcpAcceptor& acceptor) {
+    auto endpoint = TcpEndpoint(boost::asio::ip::tcp::v4(), _config.port);
+
+    acceptor.open(endpoint.protocol());
+
+    // Enable address reuse
+    acceptor.set_option(boost::asio::socket_base::reuse_address(true));
+
+#if defined(SO_REUSEPORT)
+    // Every loop binds its own listening socket and the kernel spreads
+    // incoming connections across them
+    if(_config.threads > 1) {
+        acceptor.set_option(ReusePort(true));
+    }
+#endif
+
+    acceptor.bind(endpoint);
+    acceptor.listen();
+}
+
 void HttpServer::start() {
     if(_isRunning) {
         std::cerr<<"Server is already running!"<<std::endl;
         return;
     }
 
+    // Indexed by route, one past the end for requests no route took
+    if(_metrics) _mainLoop.metrics = std::make_unique<LoopMetrics>(_routes.size() + 1);
+
     _isRunning = true;
-    std::cout<<"Http server started on port "<<_config.port<<std::endl;
-    accept();
+    accept(_mainLoop);
+    sweep(_mainLoop);
+    if(_admission) probe(_mainLoop);
+
+    // Running loops read this (connectionStats(), writeMetrics()), so it must not reallocate
+    _loopThreads.reserve(_config.threads - 1);
+
+    for(std::size_t i = 1; i < _config.threads; ++i) {
+        auto& worker = _loopThreads.emplace_back();
+
+        worker.ioc  = std::make_unique<IOContext>(1);
+        worker.loop = std::make_unique<EventLoop>(*worker.ioc);
+        if(_metrics) worker.loop->metrics = std::make_unique<LoopMetrics>(_routes.size() + 1);
+
+        listen(worker.loop->acceptor);
+        accept(*worker.loop);
+        sweep(*worker.loop);
+        if(_admission) probe(*worker.loop);
+
+        // The pending accept keeps run() going until stop() closes the acceptor
+        worker.thread = std::thread([this, i, &ioc = *worker.ioc]() {
+            if(_config.pinThreads) pinToCore(i);
+            ioc.run();
+        });
+    }
+
+    std::cout<<"Http server started on port "<<_config.port
+             <<" with "<<_config.threads<<" event loop(s)"<<std::endl;
 }
 
 void HttpServer::stop() {
-    if(!_isRunning) return;
+    if(!_isRunning.exchange(false)) return;
+
+    // Offloaded work completes onto the loops, so drain it while they still run
+    _workerPool->shutdown();
+
+    // Queued requests are answered with 503 by their loops
+    if(_admission) _admission->shed();
+
+    auto shutdown = [](EventLoop& loop) {
+        boost::system::error_code ec;
+        loop.acceptor.close(ec);
+        loop.sweeper.cancel();
+        loop.prober.cancel();
+
+        // close() may drop the last reference, so don't iterate the live set
+        auto connections = std::vector<Connection*>(loop.connections.begin(), loop.connections.end());
+
+        for(auto connection : connections) {
+            connection->close();
+        }
+    };
+
+    // Each loop's connections belong to its own thread; stop() may be
+    // called from any thread, so the main loop's are closed on it too
+    boost::asio::dispatch(_mainLoop.ioc, [this, shutdown]() { shutdown(_mainLoop); });
+
+    // Worker loops wind down by themselves once nothing is left to wait on
+    for(auto& worker : _loopThreads) {
+        boost::asio::post(*worker.ioc, [&worker, shutdown]() { shutdown(*worker.loop); });
+    }
+
+    for(auto& worker : _loopThreads) {
+        if(worker.thread.joinable()) worker.thread.join();
+    }
+
+    _loopThreads.clear();
+
+    if(_sessions && !_sessions->options().snapshotPath.empty()) {
+        _sessions->save(_sessions->options().snapshotPath);
+    }
 
-    _isRunning = false;
-    _acceptor.close();
     std::cout<<"Http server stopped."<<std::endl;
 }
 
-void HttpServer::accept() {
-    _acceptor.async_accept(
-        [this](std::error_code ec, TcpSocket socket) {
+void HttpServer::accept(EventLoop& loop) {
+    loop.acceptor.async_accept(
+        [this, &loop](std::error_code ec, TcpSocket socket) {
             if(!ec) {
                 try{
-                    std::cout<<"New connection from: "<<socket.remote_endpoint()<<std::endl;
-                
-                    std::make_shared<HttpConnection>(std::move(socket), *this)->start();
+                    if(_config.accessLog) std::cout<<"New connection from: "<<socket.remote_endpoint()<<std::endl;
+                    increment(loop.counters.accepted);
+
+                    // Responses are written one at a time; with Nagle a
+                    // pipelined client would wait out its delayed ACK between them
+                    socket.set_option(boost::asio::ip::tcp::no_delay(true));
+
+                    std::make_shared<HttpConnection>(std::move(socket), *this, loop)->start();
                 }
                 catch(const std::exception& e) {
                     std::cerr<<"Connection error: "<<e.what()<<std::endl;
                 }
             }
-            else {
+            else if(_isRunning) {
                 std::cerr<<"Accept error: "<<ec.message()<<std::endl;
             }
 
-            if(_isRunning) accept();
+            if(!_isRunning) return;
+
+            // New connections wait in the kernel's backlog until probe() resumes
+            if(_admission && _admission->options().pauseAccepting && _admission->overloaded()) {
+                loop.acceptPaused = true;
+                return;
+            }
+
+            accept(loop);
         }
     );
 }
 
-HttpServer& HttpServer::get(const std::string& path, RouteHandler handler) {
-    return route(Method::GET, path, handler);
-}
+void HttpServer::sweep(EventLoop& loop) {
+    loop.sweeper.expires_after(SWEEP_INTERVAL);
+    loop.sweeper.async_wait([this, &loop](std::error_code ec) {
+        if(ec || !_isRunning) return;
 
-HttpServer& HttpServer::post(const std::string& path, RouteHandler handler) {
-    return route(Method::POST, path, handler);
+        loop.now = Connection::Clock::now();
+
+        // timeout() may close a connection, which changes the set
+        std::vector<Connection*> expired;
+
+        for(auto connection : loop.connections) {
+            if(connection->deadline() <= loop.now) expired.push_back(connection);
+        }
+
+        for(auto connection : expired) {
+            connection->timeout();
+        }
+
+        if(_sessions && &loop == &_mainLoop) _sessions->expire();
+
+        sweep(loop);
+    });
 }
 
-HttpServer& HttpServer::put(const std::string& path, RouteHandler handler) {
-    return route(Method::PUT, path, handler);
+void HttpServer::probe(EventLoop& loop) {
+    auto period = std::max<Connection::Clock::duration>(_admission->options().target, std::chrono::milliseconds(1));
+    auto due = Connection::Clock::now() + period;
+
+    loop.prober.expires_at(due);
+    loop.prober.async_wait([this, &loop, due](std::error_code ec) {
+        if(ec || !_isRunning) return;
+
+        loop.lag = std::max(Connection::Clock::now() - due, Connection::Clock::duration::zero());
+
+        if(&loop == &_mainLoop) _admission->roll();
+
+        if(loop.acceptPaused && !_admission->overloaded()) {
+            loop.acceptPaused = false;
+            accept(loop);
+        }
+
+        probe(loop);
+    });
 }
 
-HttpServer& HttpServer::del(const std::string& path, RouteHandler handler) {
-    return route(Method::DELETE, path, handler);
+ConnectionStats HttpServer::connectionStats() const {
+    ConnectionStats stats{};
+
+    auto add = [&stats](const EventLoop& loop) {
+        const auto& counters = loop.counters;
+
+        stats.accepted        += counters.accepted.load(std::memory_order_relaxed);
+        stats.closedByPeer    += counters.closedByPeer.load(std::memory_order_relaxed);
+        stats.idleTimeouts    += counters.idleTimeouts.load(std::memory_order_relaxed);
+        stats.headerTimeouts  += counters.headerTimeouts.load(std::memory_order_relaxed);
+        stats.bodyTimeouts    += counters.bodyTimeouts.load(std::memory_order_relaxed);
+        stats.writeTimeouts   += counters.writeTimeouts.load(std::memory_order_relaxed);
+        stats.headersTooLarge += counters.headersTooLarge.load(std::memory_order_relaxed);
+        stats.urisTooLong     += counters.urisTooLong.load(std::memory_order_relaxed);
+        stats.bodiesTooLarge  += counters.bodiesTooLarge.load(std::memory_order_relaxed);
+        stats.malformed       += counters.malformed.load(std::memory_order_relaxed);
+    };
+
+    add(_mainLoop);
+
+    for(const auto& worker : _loopThreads) {
+        add(*worker.loop);
+    }
+
+    return stats;
 }
 
-HttpServer& HttpServer::route(Method method, const std::string& path, RouteHandler handler) {
-    _routes.push_back({method, path, handler});
-    std::cout<<"Registered route: "<< static_cast<int>(method) <<" "<<path<<std::endl;
-    return *this;
+std::string HttpServer::routeLabel(std::size_t index) const {
+    if(index >= _routes.size()) return "(unrouted)";
+
+    const auto& route = _routes[index];
+    if(route.prefix) return route.path + "*";
+
+    return HttpRequest::methodToString(route.method) + " " + route.path;
 }
 
-HttpServer& HttpServer::use(Middleware middleware) {
-    _middlewares.push_back(middleware);
-    return *this;
+void HttpServer::record(EventLoop& loop, const HttpRequest& request, const Exchange& exchange, StatusCode status, const RequestTiming& timing) {
+    if(!loop.metrics) return;
+
+    auto now = Ticks::now();
+
+    // A thread that moved cores may see a counter a little behind
+    auto elapsed = [](std::uint64_t from, std::uint64_t to) { return to > from ? Ticks::nanos(to - from) : 0; };
+
+    std::array<std::uint64_t, REQUEST_PHASES> nanos = {
+        elapsed(timing.received, timing.dispatched),
+        elapsed(timing.dispatched, timing.responded),
+        elapsed(timing.responded, now),
+        elapsed(timing.received, now)
+    };
+
+    loop.metrics->record(exchange.route, static_cast<int>(status), nanos);
+
+    auto threshold = static_cast<std::uint64_t>(std::chrono::nanoseconds(_metrics->traceThreshold).count());
+    if(nanos[REQUEST_PHASES - 1] < threshold || !loop.metrics->sample(_metrics->traceSampling)) return;
+
+    RequestTrace trace;
+    trace.finished = std::chrono::system_clock::now();
+    trace.method   = request.methodToString();
+    trace.target   = request.uri().substr(0, 256);
+    trace.route    = routeLabel(exchange.route);
+    trace.client   = request.remoteAddress().to_string();
+    trace.version  = request.versionToString();
+    trace.status   = static_cast<int>(status);
+    trace.nanos    = nanos;
+
+    _traces->push(std::move(trace));
 }
 
-HttpServer& HttpServer::serveStatic(const std::string& path, const std::string& directory) {
-    _staticDirectories[path] = directory;
-    std::cout<<"Serving static files: "<<path<<" -> "<<directory<<std::endl;
-    return *this;
+namespace {
+    constexpr std::array<std::string_view, REQUEST_PHASES> PHASE_NAMES = { "parse", "handler", "write", "total" };
+
+    // To a tenth of a microsecond
+    double micros(double nanos) {
+        return std::round(nanos / 100.0) / 10.0;
+    }
 }
 
-HttpResponse HttpServer::handleRequest(const HttpRequest& request) {
-    // Log the request
-    std::cout << request.methodToString() << " " << request.path() << std::endl;
+void HttpServer::writeMetrics(JsonWriter& json) const {
+    using Snapshots = std::array<LatencyHistogram::Snapshot, REQUEST_PHASES>;
 
-    // Check for matching route
-    for(const auto& route : _routes) {
-        if (route.method == request.method() && route.path == request.path()) {
-            try {
-                return route.handler(request);
-            }
-            catch(const std::exception& e) {
-                std::cerr<<"Handler error: "<<e.what()<<std::endl;
-                return HttpResponse::internalError("Internal Server Error");
-            }
+    json.beginObject();
+
+    if(!_metrics) {
+        json.endObject();
+        return;
+    }
+
+    // Every loop's histograms added up, by route and status
+    std::map<std::pair<std::size_t, int>, std::unique_ptr<Snapshots>> merged;
+
+    auto collect = [&merged](const EventLoop& loop) {
+        if(!loop.metrics) return;
+
+        loop.metrics->visit([&merged](std::size_t route, int status, const LoopMetrics::Phases& phases) {
+            auto& snapshots = merged[{ route, status }];
+            if(!snapshots) snapshots = std::make_unique<Snapshots>();
+
+            for(std::size_t phase = 0; phase < REQUEST_PHASES; ++phase) (*snapshots)[phase].add(phases[phase]);
+        });
+    };
+
+    collect(_mainLoop);
+
+    for(const auto& worker : _loopThreads) {
+        collect(*worker.loop);
+    }
+
+    // Slowest first, so whatever is eating the p99 tops the list
+    std::vector<std::pair<std::uint64_t, decltype(merged)::const_iterator>> order;
+
+    for(auto it = merged.begin(); it != merged.end(); ++it) {
+        order.emplace_back((*it->second)[REQUEST_PHASES - 1].percentile(0.99), it);
+    }
+
+    std::stable_sort(order.begin(), order.end(), [](const auto& a, const auto& b) { return a.first > b.first; });
+
+    json.field("clock", Ticks::source()).field("unit", "us").key("routes").beginArray();
+
+    for(const auto& [p99, it] : order) {
+        const auto& [key, snapshots] = *it;
+
+        json.beginObject()
+            .field("route", routeLabel(key.first))
+            .field("status", key.second)
+            .field("count", (*snapshots)[REQUEST_PHASES - 1].total);
+
+        for(std::size_t phase = 0; phase < REQUEST_PHASES; ++phase) {
+            const auto& snapshot = (*snapshots)[phase];
+
+            json.key(PHASE_NAMES[phase]).beginObject()
+                .field("p50",  micros(static_cast<double>(snapshot.percentile(0.5))))
+                .field("p90",  micros(static_cast<double>(snapshot.percentile(0.9))))
+                .field("p99",  micros(static_cast<double>(snapshot.percentile(0.99))))
+                .field("p999", micros(static_cast<double>(snapshot.percentile(0.999))))
+                .field("max",  micros(static_cast<double>(snapshot.max)))
+                .field("mean", micros(snapshot.mean()))
+                .endObject();
         }
+
+        json.endObject();
     }
 
-    // Check for static file serving
-    for (const auto& [mountPath, directory] : _staticDirectories) {
-        if (request.path().find(mountPath) == 0) {
-            // Extract the file path
-            std::string relativePath = request.path().substr(mountPath.length());
-            if (relativePath.empty() || relativePath[0] != '/') {
-                relativePath = "/" + relativePath;
-            }
+    json.endArray().endObject();
+}
 
-            std::string filePath = directory + relativePath;
+void HttpServer::writeTraces(JsonWriter& json) const {
+    json.beginObject();
 
-            // Security check: prevent directory traversal
-            std::filesystem::path fsPath(filePath);
-            std::filesystem::path dirPath(directory);
-            
-            try {
-                auto canonical = std::filesystem::canonical(fsPath);
-                auto canonicalDir = std::filesystem::canonical(dirPath);
-                
-                // Check if the file is within the allowed directory
-                auto mismatch = std::mismatch(
-                    canonicalDir.begin(), canonicalDir.end(),
-                    canonical.begin(), canonical.end()
-                );
+    if(!_metrics) {
+        json.endObject();
+        return;
+    }
 
-                if (mismatch.first != canonicalDir.end()) {
-                    return HttpResponse::forbidden("Access Denied");
-                }
+    json.field("threshold_ms", _metrics->traceThreshold.count())
+        .field("sampling", _metrics->traceSampling)
+        .field("unit", "us")
+        .key("traces").beginArray();
 
-                // Try to serve the file
-                if (std::filesystem::exists(canonical) && 
-                    std::filesystem::is_regular_file(canonical)) {
-                    
-                    std::ifstream file(canonical, std::ios::binary);
-
-                    if (file) {
-                        std::string content(
-                            (std::istreambuf_iterator<char>(file)),
-                            std::istreambuf_iterator<char>()
-                        );
-                        
-                        auto mimeType = utils::getMimeType(filePath);
-                        return HttpResponse::ok(content).contentType(mimeType);
-                    }
-                }
-            } catch (const std::filesystem::filesystem_error&) {
-                // File doesn't exist or can't be accessed
-            }
+    for(const auto& trace : _traces->snapshot()) {
+        auto finished = std::chrono::duration_cast<std::chrono::milliseconds>(trace.finished.time_since_epoch()).count();
+
+        json.beginObject()
+            .field("finished_ms", finished)
+            .field("method", trace.method)
+            .field("target", trace.target)
+            .field("route", trace.route)
+            .field("status", trace.status)
+            .field("version", trace.version)
+            .field("client", trace.client);
+
+        for(std::size_t phase = 0; phase < REQUEST_PHASES; ++phase) {
+            json.field(PHASE_NAMES[phase], micros(static_cast<double>(trace.nanos[phase])));
         }
+
+        json.endObject();
     }
 
-    // No route found
-    return HttpResponse::notFound("404 Not Found");
+    json.endArray().endObject();
 }
 
-// ============================================================================
-// HttpConnection Implementation
-// ============================================================================
+HttpServer& HttpServer::get(const std::string& path, RouteHandler handler) {
+    return route(Method::GET, path, handler);
+}
 
-HttpConnection::HttpConnection(TcpSocket socket, HttpServer& server)
-    : _socket(std::move(socket)), _server(server) {
+HttpServer& HttpServer::post(const std::string& path, RouteHandler handler) {
+    return route(Method::POST, path, handler);
 }
 
-void HttpConnection::start() {
-    read();
+HttpServer& HttpServer::put(const std::string& path, RouteHandler handler) {
+    return route(Method::PUT, path, handler);
 }
 
-void HttpConnection::read() {
-    auto self(shared_from_this());
+HttpServer& HttpServer::del(const std::string& path, RouteHandler handler) {
+    return route(Method::DELETE, path, handler);
+}
 
-    boost::asio::async_read_until(
-        _socket,
-        _buffer,
-        "\r\n\r\n",
-        [this, self](std::error_code ec, std::size_t bytes) {
-            if (!ec) {
-                // Convert buffer to string
-                std::istream stream(&_buffer);
-                std::string header;
-                std::string line;
-                
-                while (std::getline(stream, line) && line != "\r") {
-                    header += line + "\n";
-                }
+HttpServer& HttpServer::route(Method method, const std::string& path, RouteHandler handler) {
+    return addRoute({method, path, std::move(handler), nullptr});
+}
 
-                // Parse the header
-                _request.parse(header);
-
-                // Check if we need to read the body
-                if (_request.contentLength() > 0) {
-                    std::size_t remaining = _request.contentLength() - _buffer.size();
-                    
-                    if (remaining > 0) {
-                        // Read the remaining body
-                        boost::asio::async_read(
-                            _socket,
-                            _buffer,
-                            boost::asio::transfer_exactly(remaining),
-                            [this, self, &header](std::error_code ec, std::size_t) {
-                                if (!ec) {
-                                    // Now we have the complete request
-                                    std::istream bodyStream(&_buffer);
-                                    std::string body(
-                                        (std::istreambuf_iterator<char>(bodyStream)),
-                                        std::istreambuf_iterator<char>()
-                                    );
-                                    
-                                    // Rebuild request with body
-                                    std::string completeRequest = header + "\r\n" + body;
-                                    _request.parse(completeRequest);
-                                    
-                                    processRequest();
-                                } else {
-                                    std::cerr << "Body read error: " << ec.message() << std::endl;
-                                }
-                            }
-                        );
-                        return;
-                    }
-                }
+HttpServer& HttpServer::get(const std::string& path, AsyncRouteHandler handler) {
+    return route(Method::GET, path, handler);
+}
 
-                processRequest();
-            } else {
-                std::cerr << "Read error: " << ec.message() << std::endl;
-            }
-        }
-    );
+HttpServer& HttpServer::post(const std::string& path, AsyncRouteHandler handler, BodyMode mode) {
+    return route(Method::POST, path, handler, mode);
 }
 
-void HttpConnection::processRequest() {
-    // Handle the request and get response
-    HttpResponse response = _server.handleRequest(_request);
-    
-    // Write the response
-    write(response);
+HttpServer& HttpServer::put(const std::string& path, AsyncRouteHandler handler, BodyMode mode) {
+    return route(Method::PUT, path, handler, mode);
 }
 
-void HttpConnection::write(const HttpResponse& response) {
-    auto self(shared_from_this());
-    auto responseStr = std::make_shared<std::string>(response.toString());
+HttpServer& HttpServer::del(const std::string& path, AsyncRouteHandler handler) {
+    return route(Method::DELETE, path, handler);
+}
 
-    boost::asio::async_write(
-        _socket,
-        boost::asio::buffer(*responseStr),
-        [this, self, responseStr](std::error_code ec, std::size_t) {
-            if (ec) {
-                std::cerr << "Write error: " << ec.message() << std::endl;
-            }
+HttpServer& HttpServer::route(Method method, const std::string& path, AsyncRouteHandler handler, BodyMode mode) {
+    return addRoute({method, path, nullptr, std::move(handler), mode});
+}
 
-            // Close connection after writing (HTTP/1.1 without keep-alive)
-            boost::system::error_code shutdownEc;
-            _socket.shutdown(TcpSocket::shutdown_both, shutdownEc);
-            _socket.close();
-        }
-    );
-}
\ No newline at end of file
+HttpServer& HttpServer::websocket(const std::string& path, WebSocketHandler handler) {
+    return addRoute({Method::GET, path, nullptr, nullptr, BodyMode::BUFFERED, std::move(handler)});
+}
+
+HttpServer& HttpServer::proxy(const std::string& prefix, ProxyOptions options, bool stripPrefix) {
+    return proxy(prefix, std::make_shared<ReverseProxy>(std::move(options)), stripPrefix);
+}
+
+HttpServer& HttpServer::proxy(const std::string& prefix, std::shared_ptr<ReverseProxy> upstream, bool stripPrefix) {
+    if(_isRunning) {
+        throw std::logic_error("Proxy routes must be registered before start()");
+    }
+
+    AsyncRouteHandler handler = [upstream, prefix, stripPrefix](const HttpRequest& request) {
+        if(!stripPrefix) return upstream->forward(request);
+
+        auto uri = request.uri().substr(std::min(prefix.size(), request.uri().size()));
+        if(uri.empty() || uri[0] != '/') uri.insert(0, "/");
+
+        return upstream->forward(request, std::move(uri));
+    };
+
+    Route route{Method::UNKNOWN, prefix, nullptr, std::move(handler), BodyMode::STREAMING};
+    route.prefix = true;
+
+    for(const auto& target : upstream->options().targets) {
+        std::cout<<"Proxying: "<<prefix<<" -> "<<target.host<<":"<<target.port<<std::endl;
+    }
+
+    _routes.push_back(std::move(route));
+    return *this;
+}
+
+HttpServer& HttpServer::addRoute(Route route) {
+    if(_isRunning) {
+        // Every loop reads the route table without locking
+        throw std::logic_error("Routes must be registered before start()");
+    }
+
+    std::cout<<"Registered route: "<< static_cast<int>(route.method) <<" "<<route.path<<std::endl;
+    _routes.push_back(std::move(route));
+    return *this;
+}
+
+HttpServer& HttpServer::cache(const std::string& path, CachePolicy policy) {
+    if(_isRunning) {
+        throw std::logic_error("Cached routes must be registered before start()");
+    }
+
+    for(auto& route : _routes) {
+        if(route.method == Method::GET && route.path == path && !route.socketHandler) {
+            route.cachePolicy = std::make_shared<const CachePolicy>(std::move(policy));
+            std::cout<<"Caching responses: "<<path<<" for "<<route.cachePolicy->ttl.count()<<"ms"<<std::endl;
+            return *this;
+        }
+    }
+
+    throw std::logic_error("No GET route to cache at " + path);
+}
+
+HttpServer& HttpServer::sessions(std::shared_ptr<SessionStore> store) {
+    if(_isRunning) {
+        throw std::logic_error("The session store must be set before start()");
+    }
+
+    _sessions = std::move(store);
+    return *this;
+}
+
+HttpServer& HttpServer::admission(AdmissionOptions options) {
+    if(_isRunning) {
+        throw std::logic_error("Admission control must be set before start()");
+    }
+
+    _admission = std::make_unique<AdmissionController>(std::move(options));
+    return *this;
+}
+
+HttpServer& HttpServer::priority(const std::string& path, Priority priority) {
+    if(_isRunning) {
+        throw std::logic_error("Route priorities must be set before start()");
+    }
+
+    bool found = false;
+
+    for(auto& route : _routes) {
+        if(route.path == path) {
+            route.priority = priority;
+            found = true;
+        }
+    }
+
+    if(!found) throw std::logic_error("No route to prioritize at " + path);
+    return *this;
+}
+
+HttpServer& HttpServer::metrics(MetricsOptions options) {
+    if(_isRunning) {
+        throw std::logic_error("Metrics must be turned on before start()");
+    }
+
+    // Calibrates the clock now rather than on a loop
+    std::cout<<"Request metrics: timed by "<<Ticks::source()<<std::endl;
+
+    _traces = std::make_unique<TraceRing>(options.traceCapacity);
+    _metrics = std::move(options);
+
+    if(!_metrics->debugPath.empty()) {
+        get(_metrics->debugPath, [this](const HttpRequest&) {
+            return HttpResponse::json([this](JsonWriter& json) { writeMetrics(json); }, StatusCode::OK);
+        });
+
+        get(_metrics->debugPath + "/traces", [this](const HttpRequest&) {
+            return HttpResponse::json([this](JsonWriter& json) { writeTraces(json); }, StatusCode::OK);
+        });
+    }
+
+    return *this;
+}
+
+HttpServer& HttpServer::serveStatic(const std::string& path, const std::string& directory) {
+    if(_isRunning) {
+        throw std::logic_error("Static directories must be registered before start()");
+    }
+
+    _staticDirectories[path] = directory;
+    std::cout<<"Serving static files: "<<path<<" -> "<<directory<<std::endl;
+    return *this;
+}
+
+const HttpServer::Route* HttpServer::begin(HttpRequest& request, HttpResponse& response, Exchange& exchange) {
+    if(_config.accessLog) std::cout << request.methodToString() << " " << request.path() << std::endl;
+
+    // admit() may have taken a slot for it already
+    auto admitted = exchange.admitted;
+    exchange = Exchange();
+    exchange.admitted = admitted;
+
+    auto [count, next] = _pipeline.before(request, response);
+    exchange.entered = count;
+
+    // Looked up after the middleware, which may have rewritten the path
+    auto route = findRoute(request);
+    exchange.route = routeIndex(route);
+
+    if(next == Next::STOP) return nullptr;
+
+    if(route != nullptr && route->socketHandler) {
+        // The connection hands its socket over once the 101 has been written
+        if(WebSocket::isUpgrade(request)) {
+            response = HttpResponse(StatusCode::SWITCHING_PROTOCOLS);
+            response.header("Upgrade", "websocket")
+                    .header("Connection", "Upgrade")
+                    .header("Sec-WebSocket-Accept", WebSocket::acceptKey(*request.getHeader("sec-websocket-key")));
+        }
+        else {
+            response = HttpResponse(StatusCode::UPGRADE_REQUIRED, "Upgrade Required");
+            response.header("Upgrade", "websocket").header("Sec-WebSocket-Version", "13");
+        }
+
+        return nullptr;
+    }
+
+    if(route != nullptr && route->cachePolicy && lookupCache(*route, request, response, exchange)) {
+        return nullptr;
+    }
+
+    // Waiting for another request's fill is asynchronous, whatever the handler
+    if(route != nullptr && (route->asyncHandler || exchange.waitForFill)) {
+        return route;
+    }
+
+    response = dispatch(request, route);
+    return nullptr;
+}
+
+bool HttpServer::lookupCache(const Route& route, const HttpRequest& request, HttpResponse& response, Exchange& exchange) {
+    // Stored bytes are HTTP/1.1 framing
+    if(request.version() == Version::HTTP_2_0) return false;
+
+    exchange.cachePolicy = route.cachePolicy.get();
+    exchange.cacheKey = cacheKey(*route.cachePolicy, request);
+
+    auto lookup = _responseCache.lookup(exchange.cacheKey);
+
+    if(lookup.entry) {
+        response.serialized(std::move(lookup.entry));
+        exchange.cached = true;
+        return true;
+    }
+
+    exchange.fill = std::move(lookup.fill);
+    exchange.waitForFill = lookup.pending;
+    return false;
+}
+
+std::string HttpServer::cacheKey(const CachePolicy& policy, const HttpRequest& request) const {
+    // Absent and empty values must not share a key
+    auto append = [](std::string& key, std::optional<std::string_view> value) {
+        key += value ? '\x01' : '\x02';
+        key.append(value.value_or(std::string_view()));
+    };
+
+    auto key = request.path();
+
+    for(const auto& name : policy.queryParams) append(key, request.queryParam(name));
+    for(const auto& name : policy.headers)     append(key, request.getHeader(name));
+
+    // Compressed and identity bodies are different entries
+    if(_config.compression) {
+        auto coding = negotiateCoding(request.getHeader(Field::ACCEPT_ENCODING).value_or(std::string_view()));
+        append(key, codingName(coding));
+    }
+
+    return key;
+}
+
+HttpResponse HttpServer::process(HttpRequest& request) {
+    HttpResponse response;
+    Exchange exchange;
+
+    if(begin(request, response, exchange) != nullptr) {
+        response = HttpResponse::notImplemented("Not Implemented");
+    }
+
+    end(exchange, request, response);
+    return response;
+}
+
+boost::asio::awaitable<void> HttpServer::respond(const Route& route, const HttpRequest& request, HttpResponse& response, Exchange& exchange) {
+    if(exchange.waitForFill) {
+        if(auto entry = co_await _responseCache.wait(exchange.cacheKey)) {
+            response.serialized(std::move(entry));
+            exchange.cached = true;
+            co_return;
+        }
+
+        // Nothing was stored; this request runs the handler on its own
+        if(!route.asyncHandler) {
+            response = dispatch(request, &route);
+            co_return;
+        }
+    }
+
+    try {
+        response = co_await route.asyncHandler(request);
+    }
+    catch(const WorkerPool::Overloaded&) {
+        response = HttpResponse::serviceUnavailable("Service Unavailable");
+    }
+    catch(const BodyTooLarge&) {
+        response = HttpResponse::payloadTooLarge("Payload Too Large");
+    }
+    catch(const MalformedBody&) {
+        response = HttpResponse::badRequest("Bad Request");
+    }
+    catch(const std::exception& e) {
+        std::cerr<<"Handler error: "<<e.what()<<std::endl;
+        response = HttpResponse::internalError("Internal Server Error");
+    }
+}
+
+AdmissionController::Admission HttpServer::admit(const HttpRequest& request, HttpResponse& response, Exchange& exchange, const EventLoop& loop) {
+    exchange = Exchange();
+
+    if(!_admission) return AdmissionController::Admission::ADMITTED;
+
+    auto route = findRoute(request);
+    auto priority = (route != nullptr) ? route->priority : Priority::NORMAL;
+
+    exchange.route = routeIndex(route);
+
+    auto admission = _admission->enter(priority, loop.lag);
+
+    if(admission == AdmissionController::Admission::ADMITTED) exchange.admitted = (priority != Priority::CRITICAL);
+    if(admission == AdmissionController::Admission::SHED) shed(response);
+
+    return admission;
+}
+
+boost::asio::awaitable<AdmissionController::Admission> HttpServer::queue(const HttpRequest& request, HttpResponse& response, Exchange& exchange) {
+    auto route = findRoute(request);
+    auto admission = co_await _admission->wait((route != nullptr) ? route->priority : Priority::NORMAL);
+
+    if(admission == AdmissionController::Admission::ADMITTED) exchange.admitted = true;
+    else shed(response);
+
+    co_return admission;
+}
+
+void HttpServer::shed(HttpResponse& response) const {
+    response = HttpResponse::serviceUnavailable("Service Unavailable");
+    response.header("Retry-After", std::to_string(_admission->options().retryAfter.count()));
+}
+
+void HttpServer::end(Exchange& exchange, const HttpRequest& request, HttpResponse& response) {
+    if(exchange.admitted) {
+        exchange.admitted = false;
+        _admission->leave();
+    }
+
+    // A hit already carries what after() and compression did to it
+    if(exchange.cached) return;
+
+    // Every response of a cached route, so hits and misses look alike
+    if(exchange.cachePolicy) response.shared(true);
+
+    _pipeline.after(exchange.entered, request, response);
+
+    if(_config.compression) compress(request, response);
+
+    if(exchange.fill) {
+        auto entry = ResponseCache::cacheable(response) ? ResponseCache::serialize(response) : nullptr;
+        exchange.fill->complete(entry, exchange.cachePolicy->ttl);
+        exchange.fill.reset();
+
+        if(entry) response.serialized(std::move(entry));
+    }
+}
+
+void HttpServer::compress(const HttpRequest& request, HttpResponse& response) {
+    // File bodies are compressed (and cached) by serveFile()
+    if(response.file() || response.headers().contains(Field::CONTENT_ENCODING)) return;
+
+    auto status = static_cast<int>(response.statusCode());
+    if(status < 200 || status == 204 || status == 206 || status == 304) return;
+
+    auto contentType = response.headers().get(Field::CONTENT_TYPE);
+    if(!contentType.has_value() || !isCompressible(*contentType)) return;
+
+    if(!response.isStreaming() && response.body().size() < _config.compressionMinSize) return;
+
+    addVary(response, "Accept-Encoding");
+
+    auto coding = negotiateCoding(request.getHeader(Field::ACCEPT_ENCODING).value_or(std::string_view()));
+    if(coding == ContentCoding::IDENTITY) return;
+
+    auto level = _config.compressionLevel;
+
+    if(response.isStreaming()) {
+        response.stream(compressedBody(response.producer(), coding, level));
+    }
+    else if(response.body().size() <= COMPRESS_INLINE_LIMIT) {
+        response.body(Deflater::compress(response.body(), coding, level));
+    }
+    else {
+        auto body = std::make_shared<const std::string>(response.takeBody());
+        response.stream(compressedBody(sharedBody(std::move(body)), coding, level));
+    }
+
+    response.header("Content-Encoding", std::string(codingName(coding)));
+}
+
+const HttpServer::Route* HttpServer::findRoute(const HttpRequest& request) const {
+    for(const auto& route : _routes) {
+        if (!route.prefix && route.method == request.method() && route.path == request.path()) {
+            return &route;
+        }
+    }
+
+    // Proxy prefixes, on a segment boundary: /api matches /api/users, not /apiary
+    const auto& path = request.path();
+
+    for(const auto& route : _routes) {
+        if (!route.prefix || path.compare(0, route.path.size(), route.path) != 0) continue;
+
+        if (path.size() == route.path.size() || route.path.back() == '/' || path[route.path.size()] == '/') {
+            return &route;
+        }
+    }
+
+    return nullptr;
+}
+
+HttpResponse HttpServer::dispatch(const HttpRequest& request, const Route* route) {
+    // Matching synchronous route
+    if (route != nullptr) {
+        try {
+            return route->handler(request);
+        }
+        catch(const std::exception& e) {
+            std::cerr<<"Handler error: "<<e.what()<<std::endl;
+            return HttpResponse::internalError("Internal Server Error");
+        }
+    }
+
+    // Check for static file serving
+    for (const auto& [mountPath, directory] : _staticDirectories) {
+        if (request.path().find(mountPath) == 0) {
+            // Files are only read; a HEAD response is written without its body
+            if (request.method() != Method::GET && request.method() != Method::HEAD) {
+                auto response = HttpResponse::methodNotAllowed("Method Not Allowed");
+                response.header("Allow", "GET, HEAD");
+                return response;
+            }
+
+            // Extract the file path
+            std::string relativePath = request.path().substr(mountPath.length());
+            if (relativePath.empty() || relativePath[0] != '/') {
+                relativePath = "/" + relativePath;
+            }
+
+            std::string filePath = directory + relativePath;
+
+            // Security check: prevent directory traversal
+            std::filesystem::path fsPath(filePath);
+            std::filesystem::path dirPath(directory);
+            
+            try {
+                auto canonical = std::filesystem::canonical(fsPath);
+                auto canonicalDir = std::filesystem::canonical(dirPath);
+                
+                // Check if the file is within the allowed directory
+                auto mismatch = std::mismatch(
+                    canonicalDir.begin(), canonicalDir.end(),
+                    canonical.begin(), canonical.end()
+                );
+
+                if (mismatch.first != canonicalDir.end()) {
+                    return HttpResponse::forbidden("Access Denied");
+                }
+
+                // Try to serve the file
+                if (std::filesystem::exists(canonical) && 
+                    std::filesystem::is_regular_file(canonical)) {
+                    return serveFile(request, canonical.string());
+                }
+            } catch (const std::filesystem::filesystem_error&) {
+                // File doesn't exist or can't be accessed
+            }
+        }
+    }
+
+    // No route found
+    return HttpResponse::notFound("404 Not Found");
+}
+
+HttpResponse HttpServer::serveFile(const HttpRequest& request, const std::string& path) {
+    std::shared_ptr<File> file;
+
+    try {
+        file = std::make_shared<File>(path);
+    }
+    catch(const std::system_error&) {
+        return HttpResponse::forbidden("Access Denied");
+    }
+
+    auto size         = file->size();
+    auto etag         = file->etag();
+    auto lastModified = utils::formatHttpDate(file->lastModified());
+    auto mime         = mimeType(path);
+
+    auto rangeHeader = request.getHeader(Field::RANGE);
+
+    // Ranges always address the identity representation
+    if(_config.compression && !rangeHeader.has_value()) {
+        if(auto compressed = serveCompressedFile(request, path, file)) {
+            return std::move(*compressed);
+        }
+    }
+
+    auto response = HttpResponse(StatusCode::OK);
+    response.header("Accept-Ranges", "bytes")
+            .header("ETag", etag)
+            .header("Last-Modified", lastModified);
+
+    if(_config.compression && isCompressible(mime) && size >= _config.compressionMinSize) {
+        addVary(response, "Accept-Encoding");
+    }
+
+    if(request.method() != Method::GET || !rangeHeader.has_value()) {
+        return response.contentType(mime).file(file);
+    }
+
+    // If-Range: only honour the Range when the client's copy is still current
+    auto ifRange = request.getHeader(Field::IF_RANGE);
+
+    if(ifRange.has_value() && ifRange.value() != etag && ifRange.value() != lastModified) {
+        return response.contentType(mime).file(file);
+    }
+
+    std::vector<utils::ByteRange> ranges;
+
+    switch(utils::parseRange(std::string(rangeHeader.value()), size, ranges)) {
+        case utils::RangeStatus::NONE:
+            return response.contentType(mime).file(file);
+
+        case utils::RangeStatus::UNSATISFIABLE:
+            return HttpResponse::rangeNotSatisfiable(size);
+
+        case utils::RangeStatus::SATISFIABLE:
+            break;
+    }
+
+    response.status(StatusCode::PARTIAL_CONTENT);
+
+    auto contentRange = [size](const utils::ByteRange& range) {
+        return "bytes " + std::to_string(range.offset) + "-" +
+               std::to_string(range.offset + range.length - 1) + "/" + std::to_string(size);
+    };
+
+    if(ranges.size() == 1) {
+        return response
+            .contentType(mime)
+            .header("Content-Range", contentRange(ranges.front()))
+            .file(file, { BodySegment{ "", ranges.front().offset, ranges.front().length } });
+    }
+
+    // multipart/byteranges: part headers live in memory, part bodies stay in the file
+    static std::atomic<std::uint64_t> boundaryCounter{0};
+
+    std::ostringstream boundaryStream;
+    boundaryStream << "murly-" << std::hex << std::time(nullptr) << "-" << boundaryCounter++;
+    auto boundary = boundaryStream.str();
+
+    std::vector<BodySegment> segments;
+    segments.reserve(ranges.size() + 1);
+
+    for(const auto& range : ranges) {
+        auto partHeader = "\r\n--" + boundary + "\r\n" +
+                          "Content-Type: " + std::string(mime) + "\r\n" +
+                          "Content-Range: " + contentRange(range) + "\r\n\r\n";
+
+        segments.push_back({ std::move(partHeader), range.offset, range.length });
+    }
+
+    segments.push_back({ "\r\n--" + boundary + "--\r\n", 0, 0 });
+
+    return response
+        .contentType("multipart/byteranges; boundary=" + boundary)
+        .file(file, std::move(segments));
+}
+
+std::optional<HttpResponse> HttpServer::serveCompressedFile(
+    const HttpRequest& request, const std::string& path, std::shared_ptr<File> file
+) {
+    auto mime = mimeType(path);
+    if(!isCompressible(mime)) return std::nullopt;
+
+    auto coding = negotiateCoding(request.getHeader(Field::ACCEPT_ENCODING).value_or(std::string_view()));
+    if(coding == ContentCoding::IDENTITY) return std::nullopt;
+
+    auto response = HttpResponse(StatusCode::OK);
+    response.contentType(mime)
+            .header("Vary", "Accept-Encoding")
+            .header("Content-Encoding", std::string(codingName(coding)))
+            .header("Last-Modified", utils::formatHttpDate(file->lastModified()));
+
+    // A precompressed sibling goes out with sendfile like any other file,
+    // as long as it is at least as new as the original. Most files have
+    // none, so it is looked up without opening it.
+    struct stat sibling{};
+    auto siblingPath = path + ".gz";
+
+    if(coding == ContentCoding::GZIP && ::stat(siblingPath.c_str(), &sibling) == 0 &&
+       S_ISREG(sibling.st_mode) && sibling.st_mtime >= file->lastModified()) {
+        try {
+            auto precompressed = std::make_shared<File>(siblingPath);
+            return response.header("ETag", precompressed->etag()).file(std::move(precompressed));
+        }
+        catch(const std::system_error&) {
+            // Gone since the stat
+        }
+    }
+
+    // Each cache entry is capped well below the budget so one large file
+    // cannot evict everything else
+    if(file->size() < _config.compressionMinSize || file->size() > _compressionCache.budget() / 8) {
+        return std::nullopt;
+    }
+
+    // The compressed bytes are a different representation, so a different validator
+    auto etag = file->etag();
+    etag.insert(etag.size() - 1, "-" + std::string(codingName(coding)));
+
+    auto key  = path + '\0' + etag;
+    auto data = _compressionCache.get(key);
+
+    if(data != nullptr) {
+        auto length = data->size();
+        return response.header("ETag", etag).stream(sharedBody(std::move(data)), length);
+    }
+
+    // A miss goes out as is, with sendfile, while one worker deflates the
+    // file for the requests after it. Misses for the same key meanwhile
+    // don't queue another; with the pool full, a later miss tries again.
+    if(_compressionCache.claim(key)) {
+        auto level  = _config.compressionLevel;
+        auto queued = _workerPool->submit([this, file, key, coding, level] {
+            std::shared_ptr<const std::string> compressed;
+
+            try {
+                compressed = std::make_shared<const std::string>(Deflater::compress(file->read(), coding, level));
+            }
+            catch(const std::exception&) {
+                // Unreadable now; nothing is cached
+            }
+
+            _compressionCache.fill(key, std::move(compressed));
+        });
+
+        if(!queued) _compressionCache.fill(key, nullptr);
+    }
+
+    return std::nullopt;
+}
+
+// ============================================================================
+// Http1BodyReader Implementation
+// ============================================================================
+
+// Reads a request body off the connection, either Content-Length delimited
+// or chunked. Pieces are handed out as views into the connection buffer, so
+// the body is never copied unless the route asks for it in full. Bytes past
+// the body stay in the buffer for the next pipelined request.
+class web::http::Http1BodyReader : public BodyReader {
+public:
+    static constexpr std::size_t READ_SIZE = 64 * 1024;
+
+    Http1BodyReader(TcpSocket& socket, boost::asio::streambuf& buffer, Connection& owner, EventLoop& loop)
+        : _socket(socket), _buffer(buffer), _owner(owner), _loop(loop) { }
+
+    // With a readTimeout, every wait for more of the body arms the owner's
+    // deadline; a streaming handler's own work is not timed
+    void begin(const HttpRequest& request, std::uint64_t limit, std::optional<std::chrono::seconds> readTimeout = std::nullopt) {
+        _readTimeout = readTimeout;
+
+        _chunked   = request.isChunked();
+        _remaining = _chunked ? 0 : request.contentLength();
+        _received  = 0;
+        _limit     = limit;
+        _finished  = !_chunked && _remaining == 0;
+        _decoder.reset();
+
+        // The client holds the body back until asked for it; asking lazily
+        // means a handler that refuses the request never receives it
+        auto expect = request.getHeader(Field::EXPECT).value_or(std::string_view());
+        _expectContinue = !_finished && request.version() == Version::HTTP_1_1 && iequals(expect, "100-continue");
+    }
+
+    bool finished() const override { return _finished; }
+
+    boost::asio::awaitable<std::string_view> read() override {
+        while(!_finished) {
+            auto data = _buffer.data();
+            auto available = std::string_view(static_cast<const char*>(data.data()), data.size());
+
+            // consume() leaves the bytes in place, so the returned view stays
+            // valid until the next read() pulls more from the socket
+            if(_chunked) {
+                std::size_t consumed = 0;
+                auto payload = _decoder.decode(available, consumed);
+                _buffer.consume(consumed);
+
+                if(_decoder.failed()) throw MalformedBody("malformed chunked body");
+
+                if(_decoder.done()) {
+                    _finished = true;
+                }
+                else if(!payload.empty()) {
+                    _received += payload.size();
+                    if(_received > _limit) throw BodyTooLarge();
+
+                    co_return payload;
+                }
+                else if(consumed < available.size()) {
+                    continue;
+                }
+            }
+            else if(!available.empty()) {
+                auto length = static_cast<std::size_t>(std::min<std::uint64_t>(_remaining, available.size()));
+                auto payload = available.substr(0, length);
+
+                _buffer.consume(length);
+                _remaining -= length;
+                _finished = (_remaining == 0);
+
+                co_return payload;
+            }
+
+            if(!_finished) co_await fill();
+        }
+
+        co_return std::string_view();
+    }
+
+private:
+    boost::asio::awaitable<void> fill() {
+        boost::system::error_code ec;
+
+        if(_expectContinue) {
+            _expectContinue = false;
+
+            static constexpr std::string_view CONTINUE = "HTTP/1.1 100 Continue\r\n\r\n";
+            co_await boost::asio::async_write(
+                _socket, boost::asio::buffer(CONTINUE.data(), CONTINUE.size()),
+                boost::asio::redirect_error(boost::asio::use_awaitable, ec)
+            );
+
+            if(ec) throw MalformedBody("connection lost before the body was sent");
+        }
+
+        auto wanted = _chunked ? READ_SIZE : static_cast<std::size_t>(std::min<std::uint64_t>(_remaining, READ_SIZE));
+        wanted = std::min(wanted, _buffer.max_size() - _buffer.size());
+
+        if(_readTimeout) _owner.deadline(_loop.now + *_readTimeout);
+
+        auto length = co_await _socket.async_read_some(
+            _buffer.prepare(wanted), boost::asio::redirect_error(boost::asio::use_awaitable, ec)
+        );
+
+        if(_readTimeout) _owner.clearDeadline();
+
+        if(ec) throw MalformedBody("connection closed before the body was complete");
+
+        _buffer.commit(length);
+    }
+
+    TcpSocket& _socket;
+    boost::asio::streambuf& _buffer;
+    Connection& _owner;
+    EventLoop& _loop;
+    std::optional<std::chrono::seconds> _readTimeout;
+
+    ChunkedDecoder _decoder;
+    bool _chunked = false;
+    bool _finished = true;
+    bool _expectContinue = false;
+
+    std::uint64_t _remaining = 0;
+    std::uint64_t _received = 0;
+    std::uint64_t _limit = 0;
+};
+
+// ============================================================================
+// HttpConnection Implementation
+// ============================================================================
+
+HttpConnection::HttpConnection(TcpSocket socket, HttpServer& server, EventLoop& loop)
+    : _socket(std::move(socket)), _server(server), _loop(loop),
+      // Room for the largest head allowed plus one read
+      _buffer(server.config().maxHeaderSize + Http1BodyReader::READ_SIZE),
+      _bodyReader(std::make_unique<Http1BodyReader>(_socket, _buffer, *this, loop)) {
+    boost::system::error_code ec;
+    auto remote = _socket.remote_endpoint(ec);
+    if(!ec) _request.remoteAddress(remote.address());
+}
+
+HttpConnection::~HttpConnection() {
+    _loop.connections.erase(this);
+}
+
+void HttpConnection::start() {
+    _loop.connections.insert(this);
+
+    // A new connection has as long to send its first head as any other
+    _phase = Phase::HEAD;
+    deadline(_loop.now + _server.config().headerTimeout);
+
+    read();
+}
+
+void HttpConnection::read() {
+    // A pipelined request may be buffered already
+    auto data = _buffer.data();
+    auto buffered = std::string_view(static_cast<const char*>(data.data()), data.size());
+
+    // A request's time starts with the first of its bytes the loop sees
+    if (_loop.metrics && _timing.received == 0 && !buffered.empty()) _timing.received = Ticks::now();
+
+    auto from = _scanned > 3 ? _scanned - 3 : 0;
+    auto end = scan::findHeadEnd(buffered.substr(from));
+
+    if (end != std::string_view::npos) {
+        readHead(from + end + 4);
+        return;
+    }
+
+    if (!checkHeadLimits(buffered)) return;
+
+    _scanned = buffered.size();
+
+    // The head deadline runs from its first byte
+    if (_phase == Phase::IDLE && !buffered.empty()) {
+        _phase = Phase::HEAD;
+        deadline(_loop.now + _server.config().headerTimeout);
+    }
+
+    // Grow the buffer only as fast as data arrives
+    auto wanted = std::clamp<std::size_t>(_buffer.capacity() - _buffer.size(), 512, Http1BodyReader::READ_SIZE);
+    wanted = std::min(wanted, _buffer.max_size() - _buffer.size());
+
+    auto self(shared_from_this());
+
+    _socket.async_read_some(
+        _buffer.prepare(wanted),
+        [this, self](std::error_code ec, std::size_t length) {
+            if (!ec) {
+                _buffer.commit(length);
+                read();
+            } else if (_timedOut) {
+                reject(HttpResponse::requestTimeout("Request Timeout"));
+            } else if (!isQuietClose(ec)) {
+                std::cerr << "Read error: " << ec.message() << std::endl;
+            } else if (_socket.is_open()) {
+                increment(_loop.counters.closedByPeer);
+            }
+        }
+    );
+}
+
+void HttpConnection::readHead(std::size_t length) {
+    auto begin = static_cast<const char*>(_buffer.data().data());
+    auto head = std::string_view(begin, length);
+
+    _scanned = 0;
+
+    if (!checkHeadLimits(head)) return;
+
+    // An HTTP/2 client with prior knowledge: the rest of the connection
+    // belongs to Http2Connection, along with everything read so far
+    constexpr auto PREFACE_HEAD = HTTP2_PREFACE.substr(0, HTTP2_PREFACE.find("SM"));
+
+    if (_server.config().http2 && head == PREFACE_HEAD) {
+        std::string received(begin, _buffer.size());
+        _buffer.consume(_buffer.size());
+        clearDeadline();
+
+        std::make_shared<Http2Connection>(std::move(_socket), _server, _loop, std::move(received))->start();
+        return;
+    }
+
+    // Parse the head alone; the body is read separately
+    auto parsed = _request.parse(head);
+    _buffer.consume(length);
+
+    if (!parsed) {
+        increment(_loop.counters.malformed);
+
+        if (_request.method() == Method::UNKNOWN && !_request.malformed()) {
+            reject(HttpResponse::notImplemented("Not Implemented"));
+        } else {
+            reject(HttpResponse::badRequest("Bad Request"));
+        }
+        return;
+    }
+
+    readBody();
+}
+
+bool HttpConnection::checkHeadLimits(std::string_view head) {
+    const auto& config = _server.config();
+
+    auto lineEnd = scan::findCrlf(head);
+    auto lineLength = (lineEnd == std::string_view::npos) ? head.size() : lineEnd;
+
+    if (lineLength > config.maxUriLength) {
+        increment(_loop.counters.urisTooLong);
+        reject(HttpResponse(StatusCode::URI_TOO_LONG, "URI Too Long"));
+        return false;
+    }
+
+    if (head.size() > config.maxHeaderSize) {
+        increment(_loop.counters.headersTooLarge);
+        reject(HttpResponse(StatusCode::REQUEST_HEADER_FIELDS_TOO_LARGE, "Request Header Fields Too Large"));
+        return false;
+    }
+
+    return true;
+}
+
+void HttpConnection::readBody() {
+    const auto& config = _server.config();
+
+    if (!_request.isChunked() && _request.hasHeader(Field::TRANSFER_ENCODING)) {
+        increment(_loop.counters.malformed);
+        reject(HttpResponse::notImplemented("Unsupported Transfer-Encoding"));
+        return;
+    }
+
+    // Refuse an oversized body up front instead of reading it first
+    if (!_request.isChunked() && _request.contentLength() > config.maxBodySize) {
+        increment(_loop.counters.bodiesTooLarge);
+        reject(HttpResponse::payloadTooLarge("Payload Too Large"));
+        return;
+    }
+
+    auto route = _server.findRoute(_request);
+
+    if (route != nullptr && route->bodyMode == BodyMode::STREAMING) {
+        _bodyReader->begin(_request, config.maxBodySize, config.bodyTimeout);
+        _request.bodyReader(_bodyReader.get());
+        processRequest();
+        return;
+    }
+
+    _bodyReader->begin(_request, config.maxBodySize);
+
+    if (_bodyReader->finished()) {
+        processRequest();
+        return;
+    }
+
+    _phase = Phase::BODY;
+    deadline(_loop.now + config.bodyTimeout);
+
+    auto self(shared_from_this());
+
+    boost::asio::co_spawn(
+        _socket.get_executor(),
+        [this, self]() -> boost::asio::awaitable<void> {
+            _request.body(co_await _bodyReader->readAll());
+        },
+        [this, self](std::exception_ptr error) {
+            if (!error) {
+                processRequest();
+                return;
+            }
+
+            if (_timedOut) {
+                reject(HttpResponse::requestTimeout("Request Timeout"));
+                return;
+            }
+
+            try { std::rethrow_exception(error); }
+            catch (const BodyTooLarge&) {
+                increment(_loop.counters.bodiesTooLarge);
+                reject(HttpResponse::payloadTooLarge("Payload Too Large"));
+            }
+            catch (const MalformedBody& e) {
+                std::cerr << "Body read error: " << e.what() << std::endl;
+                increment(_loop.counters.malformed);
+                reject(HttpResponse::badRequest("Bad Request"));
+            }
+            catch (const std::exception& e) {
+                std::cerr << "Body read error: " << e.what() << std::endl;
+                close();
+            }
+        }
+    );
+}
+
+void HttpConnection::reject(HttpResponse response) {
+    // The rest of the body is still in flight, so the connection can't be reused
+    response.keepAlive(false);
+    write(std::move(response));
+}
+
+void HttpConnection::processRequest() {
+    _response = HttpResponse();
+
+    if (_loop.metrics) {
+        _timing.dispatched = Ticks::now();
+        if (_timing.received == 0) _timing.received = _timing.dispatched;
+    }
+
+    _phase = Phase::RESPONDING;
+    clearDeadline();
+
+    using Admission = AdmissionController::Admission;
+
+    switch(_server.admit(_request, _response, _exchange, _loop)) {
+        case Admission::ADMITTED:
+            serveRequest();
+            return;
+
+        case Admission::SHED:
+            finishRequest();
+            return;
+
+        case Admission::QUEUE:
+            break;
+    }
+
+    auto self(shared_from_this());
+
+    boost::asio::co_spawn(
+        _socket.get_executor(),
+        [this, self]() { return _server.queue(_request, _response, _exchange); },
+        [this, self](std::exception_ptr error, Admission admission) {
+            if(!error && admission == Admission::ADMITTED) { serveRequest(); }
+            else                                           { finishRequest(); }
+        }
+    );
+}
+
+void HttpConnection::serveRequest() {
+    auto route = _server.begin(_request, _response, _exchange);
+
+    if (route == nullptr) {
+        finishRequest();
+        return;
+    }
+
+    // Async handler: the loop keeps serving other connections meanwhile
+    auto self(shared_from_this());
+
+    boost::asio::co_spawn(
+        _socket.get_executor(),
+        [this, self, route]() { return _server.respond(*route, _request, _response, _exchange); },
+        [this, self](std::exception_ptr) { finishRequest(); }
+    );
+}
+
+void HttpConnection::finishRequest() {
+    // A streamed body that stalled surfaces in the handler as a read error
+    if (_timedOut) {
+        _response = HttpResponse::requestTimeout("Request Timeout");
+    }
+
+    _server.end(_exchange, _request, _response);
+
+    if (_loop.metrics) _timing.responded = Ticks::now();
+
+    // A streaming handler that left part of the body unread forfeits keep-alive
+    _response.keepAlive(_request.keepAlive() && _bodyReader->finished());
+
+    if (_response.isStreaming() && !_response.streamLength().has_value()) {
+        // Chunked framing needs an HTTP/1.1 peer; otherwise the end of the
+        // body is marked by closing the connection
+        if (_request.version() == Version::HTTP_1_1) {
+            _response.chunked(true);
+        } else {
+            _response.keepAlive(false);
+        }
+    }
+
+    // Write the response
+    write(std::move(_response));
+}
+
+void HttpConnection::upgrade() {
+    auto route = _server.findRoute(_request);
+
+    if (route == nullptr || !route->socketHandler) {
+        close();
+        return;
+    }
+
+    // Frames the client sent right behind its request are already buffered
+    std::string received(
+        boost::asio::buffers_begin(_buffer.data()),
+        boost::asio::buffers_end(_buffer.data())
+    );
+    _buffer.consume(_buffer.size());
+
+    // The socket's deadlines are the WebSocket's from here on
+    clearDeadline();
+
+    auto socket = std::make_shared<WebSocket>(std::move(_socket), _loop, std::move(received));
+    socket->timeouts(_server.config().webSocketPingInterval, _server.config().writeTimeout);
+
+    try {
+        route->socketHandler(socket, _request);
+    }
+    catch (const std::exception& e) {
+        std::cerr << "WebSocket handler error: " << e.what() << std::endl;
+        socket->close();
+        return;
+    }
+
+    socket->start();
+}
+
+void HttpConnection::write(HttpResponse response) {
+    auto self(shared_from_this());
+
+    _response = std::move(response);
+
+    // A HEAD response keeps the headers, Content-Length included, of the
+    // GET it stands for; anything after them would be read as the next response
+    bool head = _phase == Phase::RESPONDING && _request.method() == Method::HEAD;
+    bool bodiless = head || !_response.allowsBody();
+
+    // Whatever the connection was waiting for, it now waits on the client
+    // to read; 408s included
+    _phase = Phase::WRITE;
+
+    if (_response.serialized()) {
+        writeSerialized();
+        return;
+    }
+
+    // The head buffer keeps its capacity across requests on this connection
+    _responseData.clear();
+    _response.writeHead(_responseData);
+
+    if (_response.isStreaming() && !bodiless) {
+        boost::asio::co_spawn(
+            _socket.get_executor(),
+            [this, self]() { return streamBody(); },
+            [this, self](std::exception_ptr error) {
+                if (error) {
+                    // Headers are already out, all we can do is cut the stream short
+                    try { std::rethrow_exception(error); }
+                    catch (const std::exception& e) { std::cerr << "Stream error: " << e.what() << std::endl; }
+
+                    close();
+                    return;
+                }
+
+                complete();
+            }
+        );
+        return;
+    }
+
+    std::array<boost::asio::const_buffer, 2> buffers = {
+        boost::asio::buffer(_responseData),
+        boost::asio::buffer(bodiless ? std::string_view() : std::string_view(_response.body()))
+    };
+
+    armWrite();
+
+    boost::asio::async_write(
+        _socket,
+        buffers,
+        [this, self, bodiless](std::error_code ec, std::size_t) {
+            if (ec) {
+                if (!isQuietClose(ec)) std::cerr << "Write error: " << ec.message() << std::endl;
+                close();
+                return;
+            }
+
+            if (_response.file() && !bodiless) {
+                writeSegment(0);
+                return;
+            }
+
+            if (_response.statusCode() == StatusCode::SWITCHING_PROTOCOLS) {
+                upgrade();
+                return;
+            }
+
+            complete();
+        }
+    );
+}
+
+void HttpConnection::writeSerialized() {
+    auto self(shared_from_this());
+
+    auto onWritten = [this, self](std::error_code ec, std::size_t) {
+        if (ec) {
+            if (!isQuietClose(ec)) std::cerr << "Write error: " << ec.message() << std::endl;
+            close();
+            return;
+        }
+
+        complete();
+    };
+
+    const auto& serialized = *_response.serialized();
+    auto bytes = std::string_view(serialized.bytes);
+
+    // Persistence is the HTTP/1.1 default, so the stored bytes go out
+    // untouched; otherwise a Connection header is spliced in before the
+    // blank line that ends the head
+    armWrite();
+
+    if (_response.keepAlive() && _request.version() == Version::HTTP_1_1) {
+        boost::asio::async_write(_socket, boost::asio::buffer(bytes), std::move(onWritten));
+        return;
+    }
+
+    static constexpr std::string_view KEEP_ALIVE = "Connection: keep-alive\r\n\r\n";
+    static constexpr std::string_view CLOSE      = "Connection: close\r\n\r\n";
+
+    auto connection = _response.keepAlive() ? KEEP_ALIVE : CLOSE;
+
+    std::array<boost::asio::const_buffer, 3> buffers = {
+        boost::asio::buffer(bytes.substr(0, serialized.headLength - 2)),
+        boost::asio::buffer(connection),
+        boost::asio::buffer(bytes.substr(serialized.headLength))
+    };
+
+    boost::asio::async_write(_socket, buffers, std::move(onWritten));
+}
+
+boost::asio::awaitable<void> HttpConnection::streamBody() {
+    auto writer = Http1BodyWriter(_socket, _responseData, _response.chunked(), *this, _loop, _server.config().writeTimeout);
+
+    co_await _response.producer()(writer);
+    co_await writer.finish();
+
+    auto expected = _response.streamLength();
+
+    if (expected.has_value() && writer.written() != expected.value()) {
+        throw std::runtime_error("streamed body does not match its Content-Length");
+    }
+}
+
+void HttpConnection::writeSegment(std::size_t index) {
+    const auto& segments = _response.segments();
+
+    if (index == segments.size()) {
+        complete();
+        return;
+    }
+
+    const auto& segment = segments[index];
+
+    if (segment.data.empty()) {
+        sendFile(index, segment.offset, segment.length);
+        return;
+    }
+
+    auto self(shared_from_this());
+    armWrite();
+
+    boost::asio::async_write(
+        _socket,
+        boost::asio::buffer(segment.data),
+        [this, self, index](std::error_code ec, std::size_t) {
+            if (ec) {
+                if (!isQuietClose(ec)) std::cerr << "Write error: " << ec.message() << std::endl;
+                close();
+                return;
+            }
+
+            const auto& segment = _response.segments()[index];
+            sendFile(index, segment.offset, segment.length);
+        }
+    );
+}
+
+void HttpConnection::sendFile(std::size_t index, std::uint64_t offset, std::uint64_t remaining) {
+    // Upper bound for one sendfile(2) call so a huge file can't monopolise the loop
+    constexpr std::uint64_t MAX_CHUNK = 1 << 20;
+
+    auto self(shared_from_this());
+    auto fd = _response.file()->fd();
+
+#if defined(__linux__)
+    if (!_socket.native_non_blocking()) {
+        _socket.native_non_blocking(true);
+    }
+
+    while (remaining > 0) {
+        auto fileOffset = static_cast<off_t>(offset);
+        auto sent = ::sendfile(
+            _socket.native_handle(), fd, &fileOffset,
+            static_cast<std::size_t>(std::min(remaining, MAX_CHUNK))
+        );
+
+        if (sent > 0) {
+            offset    += static_cast<std::uint64_t>(sent);
+            remaining -= static_cast<std::uint64_t>(sent);
+            continue;
+        }
+
+        if (sent < 0 && errno == EINTR) continue;
+
+        if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            // Progress so far counts; the client has a full timeout again
+            armWrite();
+
+            _socket.async_wait(
+                TcpSocket::wait_write,
+                [this, self, index, offset, remaining](std::error_code ec) {
+                    if (ec) {
+                        close();
+                        return;
+                    }
+
+                    sendFile(index, offset, remaining);
+                }
+            );
+            return;
+        }
+
+        // File shrank underneath us or the peer went away
+        std::cerr << "sendfile error: " << std::error_code(errno, std::generic_category()).message() << std::endl;
+        close();
+        return;
+    }
+
+    writeSegment(index + 1);
+#else
+    if (remaining == 0) {
+        writeSegment(index + 1);
+        return;
+    }
+
+    // No kernel file-to-socket path, fall back to bounded pread + write
+    _responseData.resize(static_cast<std::size_t>(std::min(remaining, MAX_CHUNK)));
+    auto got = ::pread(fd, _responseData.data(), _responseData.size(), static_cast<off_t>(offset));
+
+    if (got <= 0) {
+        close();
+        return;
+    }
+
+    armWrite();
+
+    boost::asio::async_write(
+        _socket,
+        boost::asio::buffer(_responseData.data(), static_cast<std::size_t>(got)),
+        [this, self, index, offset, remaining](std::error_code ec, std::size_t written) {
+            if (ec) {
+                close();
+                return;
+            }
+
+            sendFile(index, offset + written, remaining - written);
+        }
+    );
+#endif
+}
+
+void HttpConnection::complete() {
+    // Responses written before a request was dispatched, 4xx from the
+    // parser, are not any route's
+    if (_timing.dispatched != 0) _server.record(_loop, _request, _exchange, _response.statusCode(), _timing);
+    _timing = RequestTiming();
+
+    if (!_response.keepAlive() || !_socket.is_open()) {
+        close();
+        return;
+    }
+
+    // Drop the previous body now instead of holding it until the next response
+    _response = HttpResponse();
+
+    _phase = Phase::IDLE;
+    deadline(_loop.now + _server.config().idleTimeout);
+
+    read();
+}
+
+void HttpConnection::timeout() {
+    clearDeadline();
+
+    // The client stopped reading; nothing more can be said to it
+    if (_phase == Phase::WRITE) {
+        increment(_loop.counters.writeTimeouts);
+        close();
+        return;
+    }
+
+    // Nothing of a request has arrived, so there is no one to answer
+    if (_phase == Phase::IDLE || (_phase == Phase::HEAD && _buffer.size() == 0)) {
+        increment(_loop.counters.idleTimeouts);
+        close();
+        return;
+    }
+
+    increment(_phase == Phase::HEAD ? _loop.counters.headerTimeouts : _loop.counters.bodyTimeouts);
+
+    // Fails the pending read; whoever was waiting on it answers 408
+    _timedOut = true;
+
+    boost::system::error_code ec;
+    _socket.cancel(ec);
+}
+
+void HttpConnection::close() {
+    boost::system::error_code shutdownEc;
+    _socket.shutdown(TcpSocket::shutdown_both, shutdownEc);
+    _socket.close(shutdownEc);
+}
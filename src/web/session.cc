@@ -0,0 +1,515 @@
+#include "web/session.hh"
+#include "web/utils.hh"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <system_error>
+#include <vector>
+
+#include <sys/random.h>
+#include <time.h>
+
+using namespace web::http;
+
+namespace {
+    constexpr char SNAPSHOT_MAGIC[8] = { 'M', 'U', 'R', 'L', 'Y', 'S', 'E', 'S' };
+    constexpr std::uint32_t SNAPSHOT_VERSION = 1;
+
+    // Rough heap cost of a map node and its strings beyond their bytes
+    constexpr std::size_t ENTRY_OVERHEAD = 160;
+    constexpr std::size_t ATTRIBUTE_OVERHEAD = 96;
+
+    int hexValue(char c) {
+        if(c >= '0' && c <= '9') return c - '0';
+        if(c >= 'a' && c <= 'f') return c - 'a' + 10;
+        return -1;
+    }
+
+    void writeNumber(std::ostream& out, std::uint32_t value) {
+        out.write(reinterpret_cast<const char*>(&value), sizeof(value));
+    }
+
+    void writeString(std::ostream& out, const std::string& value) {
+        writeNumber(out, static_cast<std::uint32_t>(value.size()));
+        out.write(value.data(), static_cast<std::streamsize>(value.size()));
+    }
+
+    bool readNumber(std::istream& in, std::uint32_t& value) {
+        return static_cast<bool>(in.read(reinterpret_cast<char*>(&value), sizeof(value)));
+    }
+
+    bool readString(std::istream& in, std::string& value) {
+        std::uint32_t length = 0;
+        if(!readNumber(in, length)) return false;
+
+        value.resize(length);
+        return static_cast<bool>(in.read(value.data(), length));
+    }
+}
+
+// ============================================================================
+// SessionStore Implementation
+// ============================================================================
+
+SessionStore::SessionStore(SessionOptions options)
+    : _options(std::move(options)) {
+
+    timespec time;
+    ::clock_gettime(CLOCK_MONOTONIC_COARSE, &time);
+    _epoch = time.tv_sec;
+
+    _ttl = static_cast<std::uint32_t>(std::max<std::chrono::seconds::rep>(_options.ttl.count(), 1));
+
+    std::size_t shards = 1;
+    while(shards < _options.shards) shards <<= 1;
+
+    _mask = shards - 1;
+    _shardBudget = std::max<std::size_t>(_options.budget / shards, 1);
+    _shards = std::make_unique<Shard[]>(shards);
+
+    if(!_options.snapshotPath.empty() && std::filesystem::exists(_options.snapshotPath)) {
+        auto restored = load(_options.snapshotPath);
+        std::cout<<"Restored "<<restored<<" session(s) from "<<_options.snapshotPath.string()<<std::endl;
+    }
+}
+
+std::uint32_t SessionStore::now() const {
+    // Whole seconds are all the wheel needs, and the coarse clock reads
+    // them for a fraction of what steady_clock costs
+    timespec time;
+    ::clock_gettime(CLOCK_MONOTONIC_COARSE, &time);
+
+    return static_cast<std::uint32_t>(time.tv_sec - _epoch);
+}
+
+bool SessionStore::parseId(std::string_view id, Key& key) {
+    if(id.size() != 32) return false;
+
+    std::uint64_t halves[2] = { 0, 0 };
+
+    for(std::size_t i = 0; i < 32; ++i) {
+        auto digit = hexValue(id[i]);
+        if(digit < 0) return false;
+
+        halves[i / 16] = (halves[i / 16] << 4) | static_cast<std::uint64_t>(digit);
+    }
+
+    key = { halves[0], halves[1] };
+    return true;
+}
+
+std::string SessionStore::formatId(const Key& key) {
+    constexpr char HEX[] = "0123456789abcdef";
+
+    std::string id(32, '0');
+    std::uint64_t halves[2] = { key.high, key.low };
+
+    for(std::size_t i = 0; i < 32; ++i) {
+        id[i] = HEX[(halves[i / 16] >> (60 - 4 * (i % 16))) & 0xf];
+    }
+
+    return id;
+}
+
+SessionStore::Key SessionStore::randomKey() {
+    std::uint64_t halves[2];
+    auto* bytes = reinterpret_cast<char*>(halves);
+    std::size_t filled = 0;
+
+    // The kernel's CSPRNG; ids must not be guessable
+    while(filled < sizeof(halves)) {
+        auto got = ::getrandom(bytes + filled, sizeof(halves) - filled, 0);
+
+        if(got < 0) {
+            if(errno == EINTR) continue;
+            throw std::system_error(errno, std::generic_category(), "getrandom");
+        }
+
+        filled += static_cast<std::size_t>(got);
+    }
+
+    return { halves[0], halves[1] };
+}
+
+std::size_t SessionStore::cost(const SessionData& data) {
+    auto total = ENTRY_OVERHEAD;
+
+    for(const auto& [name, value] : data) {
+        total += ATTRIBUTE_OVERHEAD + name.size() + value.size();
+    }
+
+    return total;
+}
+
+SessionStore::Entry* SessionStore::lookup(Shard& shard, const Key& key, std::uint32_t tick) {
+    auto it = shard.entries.find(key);
+
+    if(it == shard.entries.end()) {
+        ++shard.misses;
+        return nullptr;
+    }
+
+    // The wheel may not have come round to it yet
+    if(it->second.expires <= tick) {
+        shard.bytes -= it->second.cost;
+        shard.entries.erase(it);
+
+        ++shard.expired;
+        ++shard.misses;
+        return nullptr;
+    }
+
+    ++shard.hits;
+    return &it->second;
+}
+
+void SessionStore::touch(Shard& shard, Entry& entry, std::uint32_t tick) {
+    // The wheel slot is left as is; expire() reschedules entries whose
+    // deadline moved when it meets them
+    entry.expires = tick + _ttl;
+    shard.recency.splice(shard.recency.begin(), shard.recency, shard.recency.iterator_to(entry));
+}
+
+void SessionStore::insert(Shard& shard, const Key& key, Session data, std::uint32_t expires) {
+    auto [it, inserted] = shard.entries.try_emplace(key);
+    auto& entry = it->second;
+
+    if(!inserted) shard.bytes -= entry.cost;
+
+    entry.key = key;
+    entry.cost = cost(*data);
+    entry.data = std::move(data);
+    entry.expires = expires;
+
+    entry.recency.unlink();
+    entry.schedule.unlink();
+    shard.recency.push_front(entry);
+    shard.wheel[expires % WHEEL_SLOTS].push_back(entry);
+
+    shard.bytes += entry.cost;
+    evict(shard, entry);
+}
+
+void SessionStore::evict(Shard& shard, const Entry& keep) {
+    while(shard.bytes > _shardBudget && !shard.recency.empty()) {
+        auto& victim = shard.recency.back();
+        if(&victim == &keep) break;
+
+        // The key lives in the node being erased
+        auto key = victim.key;
+        shard.bytes -= victim.cost;
+        shard.entries.erase(key);
+
+        ++shard.evictions;
+    }
+}
+
+std::string SessionStore::create(SessionData data) {
+    auto key = randomKey();
+    auto& shard = shardOf(key);
+    auto session = std::make_shared<const SessionData>(std::move(data));
+
+    std::lock_guard<std::mutex> lock(shard.mutex);
+
+    auto tick = now();
+    insert(shard, key, std::move(session), tick + _ttl);
+
+    return formatId(key);
+}
+
+Session SessionStore::find(std::string_view id) {
+    Key key;
+    if(!parseId(id, key)) return nullptr;
+
+    auto& shard = shardOf(key);
+    auto tick = now();
+
+    std::lock_guard<std::mutex> lock(shard.mutex);
+
+    auto entry = lookup(shard, key, tick);
+    if(!entry) return nullptr;
+
+    touch(shard, *entry, tick);
+    return entry->data;
+}
+
+bool SessionStore::update(std::string_view id, const std::function<void(SessionData&)>& change) {
+    Key key;
+    if(!parseId(id, key)) return false;
+
+    auto& shard = shardOf(key);
+    auto tick = now();
+
+    std::lock_guard<std::mutex> lock(shard.mutex);
+
+    auto entry = lookup(shard, key, tick);
+    if(!entry) return false;
+
+    auto copy = std::make_shared<SessionData>(*entry->data);
+    change(*copy);
+
+    shard.bytes -= entry->cost;
+    entry->cost = cost(*copy);
+    entry->data = std::move(copy);
+    shard.bytes += entry->cost;
+
+    touch(shard, *entry, tick);
+    evict(shard, *entry);
+
+    return true;
+}
+
+bool SessionStore::erase(std::string_view id) {
+    Key key;
+    if(!parseId(id, key)) return false;
+
+    auto& shard = shardOf(key);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+
+    auto it = shard.entries.find(key);
+    if(it == shard.entries.end()) return false;
+
+    shard.bytes -= it->second.cost;
+    shard.entries.erase(it);
+
+    return true;
+}
+
+std::string SessionStore::rotate(std::string_view id) {
+    Key key;
+    if(!parseId(id, key)) return {};
+
+    Session data;
+
+    {
+        auto& shard = shardOf(key);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+
+        auto entry = lookup(shard, key, now());
+        if(!entry) return {};
+
+        data = std::move(entry->data);
+        shard.bytes -= entry->cost;
+        shard.entries.erase(key);
+    }
+
+    // Locked one at a time, never two shards at once
+    auto fresh = randomKey();
+    auto& shard = shardOf(fresh);
+
+    std::lock_guard<std::mutex> lock(shard.mutex);
+
+    auto tick = now();
+    insert(shard, fresh, std::move(data), tick + _ttl);
+
+    return formatId(fresh);
+}
+
+std::optional<std::string_view> SessionStore::sessionId(const HttpRequest& request) const {
+    auto header = request.getHeader(Field::COOKIE);
+    if(!header) return std::nullopt;
+
+    return utils::findCookie(*header, _options.cookieName);
+}
+
+Session SessionStore::find(const HttpRequest& request) {
+    auto id = sessionId(request);
+    return id ? find(*id) : nullptr;
+}
+
+void SessionStore::attach(HttpResponse& response, std::string_view id) const {
+    // No Max-Age: the cookie lasts the browser session, the store decides
+    // how long the session itself does
+    std::string cookie;
+    cookie.reserve(128);
+
+    cookie.append(_options.cookieName).append("=").append(id);
+    cookie.append("; Path=").append(_options.cookiePath);
+    cookie.append("; HttpOnly");
+
+    if(!_options.sameSite.empty()) cookie.append("; SameSite=").append(_options.sameSite);
+    if(_options.secure) cookie.append("; Secure");
+
+    response.addHeader(fieldName(Field::SET_COOKIE), cookie);
+}
+
+void SessionStore::detach(HttpResponse& response) const {
+    response.addHeader(
+        fieldName(Field::SET_COOKIE),
+        _options.cookieName + "=; Path=" + _options.cookiePath + "; Max-Age=0; HttpOnly"
+    );
+}
+
+std::size_t SessionStore::expire() {
+    std::size_t dropped = 0;
+    auto tick = now();
+
+    for(std::size_t i = 0; i <= _mask; ++i) {
+        auto& shard = _shards[i];
+        std::lock_guard<std::mutex> lock(shard.mutex);
+
+        if(shard.swept >= tick) continue;
+
+        // After a long pause one turn of the wheel visits every slot
+        auto from = std::max<std::uint32_t>(shard.swept + 1, tick >= WHEEL_SLOTS ? tick - WHEEL_SLOTS + 1 : 0);
+
+        for(auto t = from; t <= tick; ++t) {
+            List<&Entry::schedule> due;
+            due.swap(shard.wheel[t % WHEEL_SLOTS]);
+
+            while(!due.empty()) {
+                auto& entry = due.front();
+                due.pop_front();
+
+                if(entry.expires <= tick) {
+                    auto key = entry.key;
+                    shard.bytes -= entry.cost;
+                    shard.entries.erase(key);
+
+                    ++shard.expired;
+                    ++dropped;
+                }
+                else {
+                    // Touched since it was scheduled, or due in a later round
+                    shard.wheel[entry.expires % WHEEL_SLOTS].push_back(entry);
+                }
+            }
+        }
+
+        shard.swept = tick;
+    }
+
+    return dropped;
+}
+
+bool SessionStore::save(const std::filesystem::path& path) const {
+    struct Saved {
+        Key key;
+        Session data;
+        std::uint32_t remaining;
+    };
+
+    std::vector<Saved> sessions;
+    auto tick = now();
+
+    // Copy the references out shard by shard, then write without any lock
+    for(std::size_t i = 0; i <= _mask; ++i) {
+        const auto& shard = _shards[i];
+        std::lock_guard<std::mutex> lock(shard.mutex);
+
+        for(const auto& [key, entry] : shard.entries) {
+            if(entry.expires > tick) sessions.push_back({ key, entry.data, entry.expires - tick });
+        }
+    }
+
+    auto temporary = path;
+    temporary += ".tmp";
+
+    {
+        std::ofstream out(temporary, std::ios::binary | std::ios::trunc);
+        if(!out) {
+            std::cerr<<"Session snapshot: cannot write "<<temporary.string()<<std::endl;
+            return false;
+        }
+
+        out.write(SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+        writeNumber(out, SNAPSHOT_VERSION);
+        writeNumber(out, static_cast<std::uint32_t>(sessions.size()));
+
+        for(const auto& session : sessions) {
+            out.write(reinterpret_cast<const char*>(&session.key), sizeof(session.key));
+            writeNumber(out, session.remaining);
+            writeNumber(out, static_cast<std::uint32_t>(session.data->size()));
+
+            for(const auto& [name, value] : *session.data) {
+                writeString(out, name);
+                writeString(out, value);
+            }
+        }
+
+        out.flush();
+        if(!out) {
+            std::cerr<<"Session snapshot: write to "<<temporary.string()<<" failed"<<std::endl;
+            return false;
+        }
+    }
+
+    std::error_code error;
+    std::filesystem::rename(temporary, path, error);
+
+    if(error) {
+        std::cerr<<"Session snapshot: "<<error.message()<<std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+std::size_t SessionStore::load(const std::filesystem::path& path) {
+    std::ifstream in(path, std::ios::binary);
+    if(!in) return 0;
+
+    char magic[sizeof(SNAPSHOT_MAGIC)];
+    std::uint32_t version = 0;
+    std::uint32_t count = 0;
+
+    if(!in.read(magic, sizeof(magic)) || std::memcmp(magic, SNAPSHOT_MAGIC, sizeof(magic)) != 0 ||
+       !readNumber(in, version) || version != SNAPSHOT_VERSION || !readNumber(in, count)) {
+        std::cerr<<"Session snapshot: "<<path.string()<<" is not a snapshot of this version"<<std::endl;
+        return 0;
+    }
+
+    std::size_t restored = 0;
+
+    for(std::uint32_t i = 0; i < count; ++i) {
+        Key key;
+        std::uint32_t remaining = 0;
+        std::uint32_t attributes = 0;
+
+        if(!in.read(reinterpret_cast<char*>(&key), sizeof(key)) || !readNumber(in, remaining) || !readNumber(in, attributes)) break;
+
+        auto data = std::make_shared<SessionData>();
+        std::string name;
+        std::string value;
+
+        for(std::uint32_t a = 0; a < attributes; ++a) {
+            if(!readString(in, name) || !readString(in, value)) {
+                std::cerr<<"Session snapshot: "<<path.string()<<" is truncated"<<std::endl;
+                return restored;
+            }
+
+            data->emplace(std::move(name), std::move(value));
+        }
+
+        // Time already spent idle still counts, but never beyond the current TTL
+        auto& shard = shardOf(key);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+
+        auto tick = now();
+        insert(shard, key, std::move(data), tick + std::min(remaining, _ttl));
+        ++restored;
+    }
+
+    return restored;
+}
+
+SessionStore::Stats SessionStore::stats() const {
+    Stats stats{};
+
+    for(std::size_t i = 0; i <= _mask; ++i) {
+        const auto& shard = _shards[i];
+        std::lock_guard<std::mutex> lock(shard.mutex);
+
+        stats.hits      += shard.hits;
+        stats.misses    += shard.misses;
+        stats.expired   += shard.expired;
+        stats.evictions += shard.evictions;
+        stats.sessions  += shard.entries.size();
+        stats.bytes     += shard.bytes;
+    }
+
+    return stats;
+}
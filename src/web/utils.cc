@@ -1,114 +1,161 @@
 #include "web/utils.hh"
+#include "web/mime.hh"
+#include "web/scan.hh"
+
+#include <cstring>
 
 using namespace web::http::utils;
 
+namespace {
+    int hexValue(char c) {
+        if(c >= '0' && c <= '9') return c - '0';
+        if(c >= 'a' && c <= 'f') return c - 'a' + 10;
+        if(c >= 'A' && c <= 'F') return c - 'A' + 10;
+
+        return -1;
+    }
+
+    bool isUnreserved(char c) {
+        auto lower = static_cast<char>(c | 0x20);
+
+        return (c >= '0' && c <= '9') || (lower >= 'a' && lower <= 'z') ||
+               c == '-' || c == '.' || c == '_' || c == '~';
+    }
+
+    // Runs between escapes are mostly short, so bytes are copied one at a
+    // time until a run proves long; the rest of it goes to the vector kernel
+    constexpr std::size_t PEEK = 16;
+}
+
 std::string web::http::utils::urlEncode(const std::string& url) {
-    std::ostringstream encoded;
-    //What the hex?
-    encoded << std::hex;
-
-    for(auto c : url) {
-        if(std::isalnum(c) || c == '-' || c == '_' || c == '.' || c == '~') {
-            encoded << c;
-        } else {
-            encoded << '%' << std::setw(2) << static_cast<int>(static_cast<unsigned char>(c));
+    static constexpr char HEX[] = "0123456789ABCDEF";
+
+    std::string encoded(url.size() * 3, '\0');
+
+    auto src  = url.data();
+    auto end  = src + url.size();
+    auto dst  = encoded.data();
+    std::size_t plain = 0;
+
+    while(src != end) {
+        auto c = *src++;
+
+        if(isUnreserved(c)) {
+            *dst++ = c;
+
+            if(++plain == PEEK) {
+                auto run = scan::findReserved(src, static_cast<std::size_t>(end - src));
+                std::memcpy(dst, src, run);
+
+                src += run;
+                dst += run;
+                plain = 0;
+            }
+
+            continue;
         }
+
+        auto byte = static_cast<unsigned char>(c);
+        *dst++ = '%';
+        *dst++ = HEX[byte >> 4];
+        *dst++ = HEX[byte & 0x0f];
+
+        plain = 0;
     }
 
-    return encoded.str();
+    encoded.resize(static_cast<std::size_t>(dst - encoded.data()));
+    return encoded;
 }
 
 std::string web::http::utils::urlDecode(const std::string& url) {
     std::string decoded;
-    decoded.reserve(url.length());
-
-    for(size_t i = 0; i < url.length(); ++i) {
-        if(url[i] == '%' && i + 2 < url.length()) {
-            auto hex = url.substr(i + 1, 2);
-            auto c = static_cast<char>(std::stoi(hex, nullptr, 16));
-            decoded += c;
-            i += 2;
-        }
-        else if(url[i] == '+') {
-            decoded += ' ';
-        } else {
-            decoded += url[i];
-        }
-    }
+    urlDecode(url, decoded);
 
     return decoded;
 }
 
-std::string getMimeType(const std::string& filename) {
-    auto dotPos = filename.find_last_of('.');
+void web::http::utils::urlDecode(std::string_view url, std::string& out) {
+    auto start = out.size();
+    out.resize(start + url.size());
+
+    auto src  = url.data();
+    auto end  = src + url.size();
+    auto dst  = out.data() + start;
+    std::size_t plain = 0;
+
+    while(src != end) {
+        auto c = *src++;
+
+        if(c != '%' && c != '+') {
+            *dst++ = c;
 
-    if(dotPos == std::string::npos) {
-        return "application/octet-stream"; // Default binary type
+            if(++plain == PEEK) {
+                auto run = scan::findEither(src, static_cast<std::size_t>(end - src), '%', '+');
+                std::memcpy(dst, src, run);
+
+                src += run;
+                dst += run;
+                plain = 0;
+            }
+
+            continue;
+        }
+
+        plain = 0;
+
+        auto high = (c == '%' && end - src >= 2) ? hexValue(src[0]) : -1;
+        auto low  = (high >= 0) ? hexValue(src[1]) : -1;
+
+        if(low >= 0) {
+            *dst++ = static_cast<char>(high * 16 + low);
+            src += 2;
+        }
+        else if(c == '+') {
+            *dst++ = ' ';
+        }
+        else {
+            // Malformed escapes are kept as they are
+            *dst++ = c;
+        }
     }
 
-    std::string ext = filename.substr(dotPos + 1);
-    std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
-
-    // Common MIME types
-    static const std::unordered_map<std::string, std::string> mimeTypes = {
-        // Text
-        {"txt", "text/plain"},
-        {"html", "text/html"},
-        {"htm", "text/html"},
-        {"css", "text/css"},
-        {"js", "application/javascript"},
-        {"json", "application/json"},
-        {"xml", "application/xml"},
-        {"csv", "text/csv"},
-        
-        // Images
-        {"png", "image/png"},
-        {"jpg", "image/jpeg"},
-        {"jpeg", "image/jpeg"},
-        {"gif", "image/gif"},
-        {"svg", "image/svg+xml"},
-        {"webp", "image/webp"},
-        {"ico", "image/x-icon"},
-        
-        // Audio/Video
-        {"mp3", "audio/mpeg"},
-        {"wav", "audio/wav"},
-        {"mp4", "video/mp4"},
-        {"webm", "video/webm"},
-        {"ogg", "audio/ogg"},
-        
-        // Documents
-        {"pdf", "application/pdf"},
-        {"doc", "application/msword"},
-        {"docx", "application/vnd.openxmlformats-officedocument.wordprocessingml.document"},
-        {"xls", "application/vnd.ms-excel"},
-        {"xlsx", "application/vnd.openxmlformats-officedocument.spreadsheetml.sheet"},
-        
-        // Archives
-        {"zip", "application/zip"},
-        {"tar", "application/x-tar"},
-        {"gz", "application/gzip"},
-        {"rar", "application/x-rar-compressed"},
-        
-        // Fonts
-        {"ttf", "font/ttf"},
-        {"woff", "font/woff"},
-        {"woff2", "font/woff2"}
-    };
+    out.resize(static_cast<std::size_t>(dst - out.data()));
+}
 
-    auto it = mimeTypes.find(ext);
+std::string web::http::utils::getMimeType(const std::string& filename) {
+    return std::string(mimeType(filename));
+}
 
-    return (it != mimeTypes.end()) ? it->second : "application/octet-stream";
+std::string web::http::utils::formatHttpDate(const std::time_t time) {
+    // Every loop formats Last-Modified; gmtime() would share one buffer
+    std::tm tm{};
+    gmtime_r(&time, &tm);
+
+    char date[32];
+    auto length = std::strftime(date, sizeof(date), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+
+    return std::string(date, length);
 }
 
-std::string formatHttpDate(const std::time_t time) {
-    std::ostringstream oss;
-    oss << std::put_time(std::gmtime(&time), "%a, %d %b %Y %H:%M:%S GMT");
+std::string_view web::http::utils::currentHttpDate() {
+    thread_local std::time_t cachedTime = -1;
+    thread_local char cachedDate[32];
+    thread_local std::size_t cachedLength = 0;
+
+    auto now = std::time(nullptr);
+
+    if(now != cachedTime) {
+        std::tm tm{};
+        gmtime_r(&now, &tm);
+
+        cachedLength = std::strftime(cachedDate, sizeof(cachedDate), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+        cachedTime = now;
+    }
 
-    return oss.str();
+    return std::string_view(cachedDate, cachedLength);
 }
 
-std::time_t parseHttpDate(const std::string& dateStr) {
+std::time_t web::http::utils::parseHttpDate(const std::string& dateStr) {
     std::tm tm = {};
     std::istringstream iss(dateStr);
 
@@ -142,7 +189,7 @@ std::time_t parseHttpDate(const std::string& dateStr) {
     return -1; // Indicate failure
 }
 
-std::unordered_map<std::string, std::string> parseQueryString(const std::string& query) {
+std::unordered_map<std::string, std::string> web::http::utils::parseQueryString(const std::string& query) {
     std::unordered_map<std::string, std::string> params;
     
     if (query.empty()) return params;
@@ -167,7 +214,7 @@ std::unordered_map<std::string, std::string> parseQueryString(const std::string&
     return params;
 }
 
-std::unordered_map<std::string, std::string> parseCookies(const std::string& cookieHeader) {
+std::unordered_map<std::string, std::string> web::http::utils::parseCookies(const std::string& cookieHeader) {
     std::unordered_map<std::string, std::string> cookies;
     
     if (cookieHeader.empty()) return cookies;
@@ -192,14 +239,134 @@ std::unordered_map<std::string, std::string> parseCookies(const std::string& coo
     return cookies;
 }
 
-bool isJsonContentType(const std::string& contentType) {
-    return contentType.find("application/json") != std::string::npos;
+std::optional<std::string_view> web::http::utils::findCookie(std::string_view cookieHeader, std::string_view name) {
+    while(!cookieHeader.empty()) {
+        auto semicolon = cookieHeader.find(';');
+        auto pair = cookieHeader.substr(0, semicolon);
+
+        pair.remove_prefix(std::min(pair.find_first_not_of(" \t"), pair.size()));
+
+        if(pair.size() > name.size() && pair[name.size()] == '=' && pair.compare(0, name.size(), name) == 0) {
+            auto value = pair.substr(name.size() + 1);
+            return value.substr(0, value.find_last_not_of(" \t") + 1);
+        }
+
+        if(semicolon == std::string_view::npos) break;
+        cookieHeader.remove_prefix(semicolon + 1);
+    }
+
+    return std::nullopt;
 }
 
-bool isFormContentType(const std::string& contentType) {
-    return contentType.find("application/x-www-form-urlencoded") != std::string::npos;
+RangeStatus web::http::utils::parseRange(
+    const std::string& rangeHeader, std::uint64_t size, std::vector<ByteRange>& ranges
+) {
+    // Guards against clients asking for thousands of tiny overlapping ranges
+    constexpr std::size_t MAX_RANGES = 16;
+
+    ranges.clear();
+
+    auto eqPos = rangeHeader.find('=');
+    if(eqPos == std::string::npos) return RangeStatus::NONE;
+
+    auto unit = rangeHeader.substr(0, eqPos);
+    unit.erase(0, unit.find_first_not_of(" \t"));
+    unit.erase(unit.find_last_not_of(" \t") + 1);
+
+    if(unit != "bytes") return RangeStatus::NONE;
+
+    auto parseNumber = [](const std::string& str, std::uint64_t& out) {
+        if(str.empty() || str.size() > 19) return false;
+
+        out = 0;
+        for(auto c : str) {
+            if(c < '0' || c > '9') return false;
+            out = out * 10 + static_cast<std::uint64_t>(c - '0');
+        }
+
+        return true;
+    };
+
+    std::istringstream specStream(rangeHeader.substr(eqPos + 1));
+    std::string spec;
+    bool anySpec = false;
+
+    while(std::getline(specStream, spec, ',')) {
+        spec.erase(0, spec.find_first_not_of(" \t"));
+        spec.erase(spec.find_last_not_of(" \t") + 1);
+
+        if(spec.empty()) continue;
+
+        auto dashPos = spec.find('-');
+        if(dashPos == std::string::npos) return RangeStatus::NONE;
+
+        auto firstStr = spec.substr(0, dashPos);
+        auto lastStr  = spec.substr(dashPos + 1);
+        std::uint64_t first = 0, last = 0;
+
+        anySpec = true;
+
+        if(firstStr.empty()) {
+            // Suffix range: the final N bytes
+            if(!parseNumber(lastStr, last)) return RangeStatus::NONE;
+            if(last == 0 || size == 0) continue;
+
+            auto length = std::min(last, size);
+            ranges.push_back({ size - length, length });
+        }
+        else {
+            if(!parseNumber(firstStr, first)) return RangeStatus::NONE;
+
+            if(lastStr.empty()) { last = size - 1; }
+            else if(!parseNumber(lastStr, last) || last < first) { return RangeStatus::NONE; }
+
+            if(first >= size) continue;
+
+            last = std::min(last, size - 1);
+            ranges.push_back({ first, last - first + 1 });
+        }
+    }
+
+    if(!anySpec) return RangeStatus::NONE;
+    if(ranges.empty()) return RangeStatus::UNSATISFIABLE;
+
+    // Coalesce overlapping and adjacent ranges so no byte is sent twice
+    std::sort(ranges.begin(), ranges.end(), [](const ByteRange& a, const ByteRange& b) {
+        return a.offset < b.offset;
+    });
+
+    std::vector<ByteRange> merged;
+    merged.reserve(ranges.size());
+
+    for(const auto& range : ranges) {
+        if(!merged.empty() && range.offset <= merged.back().offset + merged.back().length) {
+            auto& back = merged.back();
+            auto end = std::max(back.offset + back.length, range.offset + range.length);
+            back.length = end - back.offset;
+        }
+        else {
+            merged.push_back(range);
+        }
+    }
+
+    if(merged.size() > MAX_RANGES) {
+        // Too fragmented to be worth a multipart response; send one covering range instead
+        auto end = merged.back().offset + merged.back().length;
+        merged = { { merged.front().offset, end - merged.front().offset } };
+    }
+
+    ranges = std::move(merged);
+    return RangeStatus::SATISFIABLE;
 }
 
-bool isMultipartContentType(const std::string& contentType) {
-    return contentType.find("multipart/form-data") != std::string::npos;
-}
\ No newline at end of file
+bool web::http::utils::isJsonContentType(std::string_view contentType) {
+    return parseContentType(contentType).is(MediaType::JSON);
+}
+
+bool web::http::utils::isFormContentType(std::string_view contentType) {
+    return parseContentType(contentType).is(MediaType::FORM);
+}
+
+bool web::http::utils::isMultipartContentType(std::string_view contentType) {
+    return parseContentType(contentType).is(MediaType::MULTIPART_FORM);
+}
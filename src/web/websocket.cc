@@ -0,0 +1,541 @@
+#include "web/websocket.hh"
+#include "web/headers.hh"
+
+#include <boost/uuid/detail/sha1.hpp>
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <iostream>
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+using namespace web::http;
+
+namespace {
+    // Appended to the client's key before hashing (RFC 6455, section 1.3)
+    constexpr std::string_view HANDSHAKE_GUID = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+
+    constexpr std::size_t READ_SIZE = 64 * 1024;
+
+    // Frames gathered into one write
+    constexpr std::size_t MAX_WRITE_BATCH = 64;
+
+    std::string base64Encode(const unsigned char* data, std::size_t length) {
+        static constexpr char ALPHABET[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+        std::string out;
+        out.reserve((length + 2) / 3 * 4);
+
+        for(std::size_t i = 0; i < length; i += 3) {
+            std::uint32_t chunk = static_cast<std::uint32_t>(data[i]) << 16;
+            if(i + 1 < length) chunk |= static_cast<std::uint32_t>(data[i + 1]) << 8;
+            if(i + 2 < length) chunk |= static_cast<std::uint32_t>(data[i + 2]);
+
+            out.push_back(ALPHABET[(chunk >> 18) & 0x3f]);
+            out.push_back(ALPHABET[(chunk >> 12) & 0x3f]);
+            out.push_back(i + 1 < length ? ALPHABET[(chunk >> 6) & 0x3f] : '=');
+            out.push_back(i + 2 < length ? ALPHABET[chunk & 0x3f] : '=');
+        }
+
+        return out;
+    }
+
+    bool isControl(WebSocket::Opcode opcode) {
+        return static_cast<std::uint8_t>(opcode) >= 0x8;
+    }
+
+    // Well-formed UTF-8 (RFC 3629): no overlong forms, surrogates or code
+    // points past U+10FFFF. Runs of ASCII are skipped eight bytes at a time.
+    bool isValidUtf8(std::string_view text) {
+        auto data = reinterpret_cast<const std::uint8_t*>(text.data());
+        std::size_t size = text.size();
+        std::size_t i = 0;
+
+        while(i < size) {
+            if(i + 8 <= size) {
+                std::uint64_t word;
+                std::memcpy(&word, data + i, sizeof(word));
+
+                if((word & 0x8080808080808080ULL) == 0) {
+                    i += 8;
+                    continue;
+                }
+            }
+
+            auto lead = data[i];
+
+            if(lead < 0x80) {
+                ++i;
+                continue;
+            }
+
+            std::size_t extra;
+            std::uint8_t low = 0x80, high = 0xbf;   // allowed range of the second byte
+
+            if(lead >= 0xc2 && lead <= 0xdf)      { extra = 1; }
+            else if(lead == 0xe0)                 { extra = 2; low = 0xa0; }
+            else if(lead == 0xed)                 { extra = 2; high = 0x9f; }
+            else if(lead >= 0xe1 && lead <= 0xef) { extra = 2; }
+            else if(lead == 0xf0)                 { extra = 3; low = 0x90; }
+            else if(lead >= 0xf1 && lead <= 0xf3) { extra = 3; }
+            else if(lead == 0xf4)                 { extra = 3; high = 0x8f; }
+            else return false;
+
+            if(size - i <= extra) return false;
+            if(data[i + 1] < low || data[i + 1] > high) return false;
+
+            for(std::size_t k = 2; k <= extra; ++k) {
+                if((data[i + k] & 0xc0) != 0x80) return false;
+            }
+
+            i += extra + 1;
+        }
+
+        return true;
+    }
+
+    // Codes a peer may send in a close frame (RFC 6455, section 7.4): 1005
+    // and 1006 are only ever reported locally, 1015 likewise
+    bool isValidCloseCode(std::uint16_t code) {
+        return (code >= 1000 && code <= 1003) || (code >= 1007 && code <= 1014) || (code >= 3000 && code <= 4999);
+    }
+}
+
+// ============================================================================
+// WebSocket Implementation
+// ============================================================================
+
+WebSocket::WebSocket(TcpSocket socket, EventLoop& loop, std::string received)
+    : _socket(std::move(socket)), _loop(loop), _input(std::move(received)) {
+}
+
+WebSocket::~WebSocket() {
+    _loop.connections.erase(this);
+}
+
+void WebSocket::start() {
+    _loop.connections.insert(this);
+    armDeadline();
+
+    auto self(shared_from_this());
+
+    boost::asio::co_spawn(
+        _socket.get_executor(),
+        [this, self]() { return readFrames(); },
+        [this, self](std::exception_ptr error) {
+            // A read error means the peer is gone; a clean return leaves the
+            // socket open until our close frame has been written
+            if(error) close();
+        }
+    );
+}
+
+boost::asio::awaitable<void> WebSocket::readFrames() {
+    while(!_closed) {
+        std::size_t offset = 0;
+
+        while(_input.size() - offset >= 2) {
+            auto header = reinterpret_cast<const std::uint8_t*>(_input.data() + offset);
+            auto available = _input.size() - offset;
+
+            bool fin    = (header[0] & 0x80) != 0;
+            auto opcode = static_cast<Opcode>(header[0] & 0x0f);
+
+            if(header[0] & 0x70) {
+                fail(PROTOCOL_ERROR, "reserved bits set");
+                co_return;
+            }
+
+            // Every frame from a client must be masked
+            if(!(header[1] & 0x80)) {
+                fail(PROTOCOL_ERROR, "unmasked frame");
+                co_return;
+            }
+
+            std::uint64_t length = header[1] & 0x7f;
+            std::size_t headerSize = 2;
+
+            if(length == 126) {
+                if(available < 4) break;
+
+                length = (static_cast<std::uint64_t>(header[2]) << 8) | header[3];
+                headerSize = 4;
+            }
+            else if(length == 127) {
+                if(available < 10) break;
+
+                length = 0;
+                for(int i = 2; i < 10; ++i) length = (length << 8) | header[i];
+                headerSize = 10;
+            }
+
+            if(length > _maxMessageSize) {
+                fail(MESSAGE_TOO_BIG, "message too big");
+                co_return;
+            }
+
+            if(available < headerSize + 4 + length) break;
+
+            std::array<std::uint8_t, 4> key = { header[headerSize], header[headerSize + 1], header[headerSize + 2], header[headerSize + 3] };
+            auto payload = _input.data() + offset + headerSize + 4;
+
+            unmask(payload, static_cast<std::size_t>(length), key);
+            offset += headerSize + 4 + static_cast<std::size_t>(length);
+
+            if(!handleFrame(fin, opcode, std::string_view(payload, static_cast<std::size_t>(length)))) co_return;
+        }
+
+        _input.erase(0, offset);
+
+        // Read straight into the tail of the buffer the frames are parsed from
+        auto used = _input.size();
+        _input.resize(used + READ_SIZE);
+
+        std::size_t count = 0;
+
+        try {
+            count = co_await _socket.async_read_some(boost::asio::buffer(_input.data() + used, READ_SIZE), boost::asio::use_awaitable);
+        }
+        catch(...) {
+            _input.resize(used);
+            throw;
+        }
+
+        _input.resize(used + count);
+
+        // Any frame at all shows the peer is there; a write in flight keeps
+        // its own deadline, which reading must not extend
+        _pingSent = false;
+        if(_writing.empty()) armDeadline();
+    }
+}
+
+bool WebSocket::handleFrame(bool fin, Opcode opcode, std::string_view payload) {
+    if(isControl(opcode)) {
+        if(!fin || payload.size() > 125) {
+            fail(PROTOCOL_ERROR, "invalid control frame");
+            return false;
+        }
+
+        switch(opcode) {
+            case Opcode::CLOSE: {
+                // Echo the peer's status code, then close once it is written
+                std::uint16_t code = NORMAL_CLOSURE;
+
+                if(payload.size() == 1) {
+                    fail(PROTOCOL_ERROR, "truncated close code");
+                    return false;
+                }
+
+                if(payload.size() >= 2) {
+                    code = static_cast<std::uint16_t>((static_cast<std::uint8_t>(payload[0]) << 8) | static_cast<std::uint8_t>(payload[1]));
+
+                    if(!isValidCloseCode(code)) {
+                        fail(PROTOCOL_ERROR, "invalid close code");
+                        return false;
+                    }
+
+                    if(!isValidUtf8(payload.substr(2))) {
+                        fail(INVALID_DATA, "invalid UTF-8 in close reason");
+                        return false;
+                    }
+                }
+
+                close(code, "");
+                return false;
+            }
+
+            case Opcode::PING:
+                send(Opcode::PONG, payload);
+                return true;
+
+            case Opcode::PONG:
+                return true;
+
+            default:
+                fail(PROTOCOL_ERROR, "unknown opcode");
+                return false;
+        }
+    }
+
+    switch(opcode) {
+        case Opcode::TEXT:
+        case Opcode::BINARY:
+            if(_messageOpcode != Opcode::CONTINUATION) {
+                fail(PROTOCOL_ERROR, "expected continuation frame");
+                return false;
+            }
+
+            if(fin) {
+                if(opcode == Opcode::TEXT && !isValidUtf8(payload)) {
+                    fail(INVALID_DATA, "invalid UTF-8 in text message");
+                    return false;
+                }
+
+                // The common case: no copy, the handler sees the read buffer
+                if(_onMessage) _onMessage(opcode, payload);
+                return !_closed && !_closeSent;
+            }
+
+            _message.assign(payload);
+            _messageOpcode = opcode;
+            return true;
+
+        case Opcode::CONTINUATION:
+            if(_messageOpcode == Opcode::CONTINUATION) {
+                fail(PROTOCOL_ERROR, "unexpected continuation frame");
+                return false;
+            }
+
+            if(_message.size() + payload.size() > _maxMessageSize) {
+                fail(MESSAGE_TOO_BIG, "message too big");
+                return false;
+            }
+
+            _message.append(payload);
+
+            if(fin) {
+                auto messageOpcode = _messageOpcode;
+                _messageOpcode = Opcode::CONTINUATION;
+
+                // Checked whole, as a fragment may end inside a character
+                if(messageOpcode == Opcode::TEXT && !isValidUtf8(_message)) {
+                    fail(INVALID_DATA, "invalid UTF-8 in text message");
+                    return false;
+                }
+
+                if(_onMessage) _onMessage(messageOpcode, _message);
+                _message.clear();
+
+                return !_closed && !_closeSent;
+            }
+
+            return true;
+
+        default:
+            fail(PROTOCOL_ERROR, "unknown opcode");
+            return false;
+    }
+}
+
+void WebSocket::fail(std::uint16_t code, std::string_view reason) {
+    std::cerr << "WebSocket error: " << reason << std::endl;
+    close(code, reason);
+}
+
+void WebSocket::send(Frame frame) {
+    if(_closed || _closeSent) return;
+
+    if(_pending.size() >= MAX_PENDING_FRAMES) {
+        std::cerr << "WebSocket peer too slow, disconnecting" << std::endl;
+        close();
+        return;
+    }
+
+    _pending.push_back(std::move(frame));
+
+    if(_writing.empty()) write();
+}
+
+void WebSocket::send(Opcode opcode, std::string_view payload) {
+    send(encode(opcode, payload));
+}
+
+void WebSocket::close(std::uint16_t code, std::string_view reason) {
+    if(_closed || _closeSent) return;
+
+    std::string payload;
+    payload.push_back(static_cast<char>(code >> 8));
+    payload.push_back(static_cast<char>(code));
+    payload.append(reason.substr(0, 123));
+
+    _pending.push_back(encode(Opcode::CLOSE, payload));
+    _closeSent = true;
+
+    if(_writing.empty()) write();
+}
+
+void WebSocket::close() {
+    if(_closed) return;
+    _closed = true;
+    clearDeadline();
+
+    boost::system::error_code ec;
+    _socket.shutdown(TcpSocket::shutdown_both, ec);
+    _socket.close(ec);
+
+    _pending.clear();
+
+    if(_onClose) {
+        auto handler = std::move(_onClose);
+        _onClose = nullptr;
+        handler();
+    }
+}
+
+void WebSocket::write() {
+    if(_closed || _pending.empty()) return;
+
+    // Everything queued so far goes out in one gathered write
+    while(!_pending.empty() && _writing.size() < MAX_WRITE_BATCH) {
+        _writing.push_back(std::move(_pending.front()));
+        _pending.pop_front();
+    }
+
+    _buffers.clear();
+
+    for(const auto& frame : _writing) {
+        _buffers.push_back(boost::asio::buffer(*frame));
+    }
+
+    auto self(shared_from_this());
+    armDeadline();
+
+    boost::asio::async_write(_socket, _buffers, [this, self](std::error_code ec, std::size_t) {
+        _writing.clear();
+
+        if(ec) {
+            close();
+            return;
+        }
+
+        if(!_pending.empty()) {
+            write();
+        }
+        else if(_closeSent) {
+            close();
+        }
+        else {
+            armDeadline();
+        }
+    });
+}
+
+void WebSocket::armDeadline() {
+    if(!_writing.empty() && _writeTimeout.count() > 0) {
+        deadline(_loop.now + _writeTimeout);
+    }
+    else if(_writing.empty() && _pingInterval.count() > 0) {
+        deadline(_loop.now + _pingInterval);
+    }
+    else {
+        clearDeadline();
+    }
+}
+
+void WebSocket::timeout() {
+    if(_closed) return;
+
+    // A write the peer did not take in, a ping it did not answer, or a
+    // close it never got to read
+    if(!_writing.empty() || _pingSent || _closeSent) {
+        close();
+        return;
+    }
+
+    _pingSent = true;
+    send(Opcode::PING, "");
+}
+
+WebSocket::Frame WebSocket::encode(Opcode opcode, std::string_view payload) {
+    auto frame = std::make_shared<std::string>();
+    auto length = payload.size();
+
+    frame->reserve(length + 10);
+    frame->push_back(static_cast<char>(0x80 | static_cast<std::uint8_t>(opcode)));
+
+    if(length < 126) {
+        frame->push_back(static_cast<char>(length));
+    }
+    else if(length <= 0xffff) {
+        frame->push_back(static_cast<char>(126));
+        frame->push_back(static_cast<char>(length >> 8));
+        frame->push_back(static_cast<char>(length));
+    }
+    else {
+        frame->push_back(static_cast<char>(127));
+
+        for(int shift = 56; shift >= 0; shift -= 8) {
+            frame->push_back(static_cast<char>(static_cast<std::uint64_t>(length) >> shift));
+        }
+    }
+
+    frame->append(payload);
+    return frame;
+}
+
+std::string WebSocket::acceptKey(std::string_view key) {
+    boost::uuids::detail::sha1 sha1;
+    sha1.process_bytes(key.data(), key.size());
+    sha1.process_bytes(HANDSHAKE_GUID.data(), HANDSHAKE_GUID.size());
+
+    boost::uuids::detail::sha1::digest_type digest;
+    sha1.get_digest(digest);
+
+    std::array<unsigned char, 20> bytes;
+
+    for(std::size_t i = 0; i < 5; ++i) {
+        bytes[i * 4]     = static_cast<unsigned char>(digest[i] >> 24);
+        bytes[i * 4 + 1] = static_cast<unsigned char>(digest[i] >> 16);
+        bytes[i * 4 + 2] = static_cast<unsigned char>(digest[i] >> 8);
+        bytes[i * 4 + 3] = static_cast<unsigned char>(digest[i]);
+    }
+
+    return base64Encode(bytes.data(), bytes.size());
+}
+
+bool WebSocket::isUpgrade(const HttpRequest& request) {
+    if(request.method() != Method::GET || request.version() != Version::HTTP_1_1) return false;
+
+    auto upgrade    = request.getHeader(Field::UPGRADE);
+    auto connection = request.getHeader(Field::CONNECTION);
+    auto key        = request.getHeader("sec-websocket-key");
+    auto version    = request.getHeader("sec-websocket-version");
+
+    return upgrade && hasToken(*upgrade, "websocket") &&
+           connection && hasToken(*connection, "upgrade") &&
+           key && key->size() == 24 &&
+           version && *version == "13";
+}
+
+void WebSocket::unmask(char* data, std::size_t length, std::array<std::uint8_t, 4> key) {
+    // Every step below covers a multiple of 4 bytes, so the key stays in phase
+    std::uint32_t word;
+    std::memcpy(&word, key.data(), sizeof(word));
+
+    std::size_t i = 0;
+
+#if defined(__AVX2__)
+    auto mask256 = _mm256_set1_epi32(static_cast<int>(word));
+
+    for(; i + 32 <= length; i += 32) {
+        auto block = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(data + i), _mm256_xor_si256(block, mask256));
+    }
+#endif
+
+#if defined(__SSE2__)
+    auto mask128 = _mm_set1_epi32(static_cast<int>(word));
+
+    for(; i + 16 <= length; i += 16) {
+        auto block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(data + i), _mm_xor_si128(block, mask128));
+    }
+#endif
+
+    auto mask64 = (static_cast<std::uint64_t>(word) << 32) | word;
+
+    for(; i + 8 <= length; i += 8) {
+        std::uint64_t block;
+        std::memcpy(&block, data + i, sizeof(block));
+        block ^= mask64;
+        std::memcpy(data + i, &block, sizeof(block));
+    }
+
+    for(; i < length; ++i) {
+        data[i] = static_cast<char>(data[i] ^ key[i % 4]);
+    }
+}
@@ -0,0 +1,93 @@
+#include "web/worker.hh"
+
+#include <algorithm>
+
+using namespace web::http;
+
+WorkerPool::WorkerPool(std::size_t threads, std::size_t capacity)
+    : _capacity(std::max<std::size_t>(capacity, 1)) {
+
+    if(threads == 0) {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    _threads.reserve(threads);
+
+    for(std::size_t i = 0; i < threads; ++i) {
+        _threads.emplace_back([this]() { work(); });
+    }
+}
+
+WorkerPool::~WorkerPool() {
+    shutdown();
+}
+
+void WorkerPool::shutdown() {
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stopping = true;
+    }
+
+    _ready.notify_all();
+
+    for(auto& thread : _threads) {
+        if(thread.joinable()) thread.join();
+    }
+}
+
+bool WorkerPool::enqueue(std::unique_ptr<Task>& task) {
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        if(_stopping || _queue.size() >= _capacity) {
+            ++_rejected;
+            return false;
+        }
+
+        _queue.push_back(std::move(task));
+        _maxDepth = std::max(_maxDepth, _queue.size());
+    }
+
+    ++_submitted;
+    _ready.notify_one();
+
+    return true;
+}
+
+void WorkerPool::work() {
+    while(true) {
+        std::unique_ptr<Task> task;
+
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _ready.wait(lock, [this]() { return _stopping || !_queue.empty(); });
+
+            // Drain what was accepted before shutting down
+            if(_queue.empty()) return;
+
+            task = std::move(_queue.front());
+            _queue.pop_front();
+        }
+
+        ++_active;
+        task->run();
+        --_active;
+
+        ++_completed;
+    }
+}
+
+WorkerPool::Stats WorkerPool::stats() const {
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    return Stats{
+        _threads.size(),
+        _capacity,
+        _queue.size(),
+        _maxDepth,
+        _active.load(),
+        _submitted.load(),
+        _completed.load(),
+        _rejected.load()
+    };
+}